@@ -24,7 +24,7 @@ class Blob {
  public:
   Blob()
        : data_(), diff_(), num_(0), channels_(0), height_(0), width_(0),
-       count_(0), capacity_(0) {}
+       count_(0), capacity_(0), channels_last_(false) {}
   explicit Blob(const int num, const int channels, const int height,
     const int width);
   /**
@@ -35,7 +35,8 @@ class Blob {
    * of memory, and to adjust the dimensions of a top blob during Layer::Reshape
    * or Layer::Forward. When changing the size of blob, memory will only be
    * reallocated if sufficient memory does not already exist, and excess memory
-   * will never be freed.
+   * will never be freed. The layout is reset to NCHW; layers producing
+   * channel-last data call set_channels_last afterwards.
    *
    * Note that reshaping an input blob and immediately calling Net::Backward is
    * an error; either Net::Forward or Net::Reshape need to be called to
@@ -59,8 +60,23 @@ class Blob {
     CHECK_LE(h, height_);
     CHECK_GE(width_, 0);
     CHECK_LE(w, width_);
+    if (channels_last_) {
+      return ((n * height_ + h) * width_ + w) * channels_ + c;
+    }
     return ((n * channels_ + c) * height_ + h) * width_ + w;
   }
+  /**
+   * @brief Whether the data is stored channel-last (NHWC) rather than in the
+   *        default NCHW order.
+   *
+   * The shape accessors are unaffected; offset(), and so data_at() and
+   * diff_at(), follow the layout. Only the layers that declare support for it
+   * (see InsertLayouts) produce or consume channel-last blobs.
+   */
+  inline bool channels_last() const { return channels_last_; }
+  inline void set_channels_last(const bool channels_last) {
+    channels_last_ = channels_last;
+  }
   /**
    * @brief Copy from a source Blob.
    *
@@ -106,7 +122,9 @@ class Blob {
   void FromProto(const BlobProto& proto);
   void ToProto(BlobProto* proto, bool write_diff = false) const;
 
-  void FromMat(const char *fname);
+  // With reshape false, the file must hold an array of the blob's shape,
+  // which is read in place, e.g. into a view set with set_cpu_data.
+  void FromMat(const char *fname, bool reshape = true);
   void ToMat(const char *fname, bool write_diff = false);
 
   /// @brief Compute the sum of absolute values (L1 norm) of the data.
@@ -146,6 +164,7 @@ class Blob {
   int width_;
   int count_;
   int capacity_;
+  bool channels_last_;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
@@ -12,6 +12,7 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/quantize.hpp"
 
 namespace caffe {
 
@@ -316,6 +317,36 @@ class InnerProductLayer : public Layer<Dtype> {
   int N_;
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
+  /// int8 inference engine, only set for quantized layers
+  /// (quantization_param.precision INT8, CPU forward only).
+  shared_ptr<Int8Gemm<Dtype> > int8_gemm_;
+};
+
+/**
+ * @brief Converts a blob between the NCHW and the channel-last (NHWC)
+ *        layouts (see Blob::channels_last), transposing the diff back in the
+ *        backward pass. Inserted by InsertLayouts at the boundaries of the
+ *        layers that run channel-last.
+ */
+template <typename Dtype>
+class LayoutLayer : public Layer<Dtype> {
+ public:
+  explicit LayoutLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_LAYOUT;
+  }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 };
 
 /**
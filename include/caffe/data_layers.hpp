@@ -5,6 +5,7 @@
 #include <utility>
 #include <vector>
 
+#include "boost/scoped_array.hpp"
 #include "boost/scoped_ptr.hpp"
 #include "hdf5.h"
 
@@ -16,6 +17,9 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/seg_pack.hpp"
+#include "caffe/util/worker_pool.hpp"
 
 namespace caffe {
 
@@ -52,12 +56,33 @@ class BaseDataLayer : public Layer<Dtype> {
   bool output_labels_;
 };
 
+/**
+ * @brief A batch prefetched by a BasePrefetchingDataLayer. dim_ holds the
+ *    image dimensions of an ImageDimPrefetchingDataLayer and is empty
+ *    otherwise.
+ */
+template <typename Dtype>
+class Batch {
+ public:
+  Blob<Dtype> data_, label_, dim_;
+};
+
+/**
+ * @brief Provides base for data layers that load their batches in a
+ *    background thread.
+ *
+ * A single persistent thread fills prefetch_count preallocated batches in
+ * turn: it takes a batch from the free queue, loads it with LoadBatch and
+ * hands it over through the full queue. Forward_cpu points the tops at the
+ * next full batch instead of copying it, and recycles the batch it handed
+ * out on the previous call.
+ */
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
  public:
-  explicit BasePrefetchingDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param) {}
+  explicit BasePrefetchingDataLayer(const LayerParameter& param,
+      const int prefetch_count = PREFETCH_COUNT);
   virtual ~BasePrefetchingDataLayer() {}
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
@@ -70,14 +95,31 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
+  // Starts the prefetch thread; it keeps running until JoinPrefetchThread.
   virtual void CreatePrefetchThread();
+  // Stops the prefetch thread and waits for it to exit.
   virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+
+  // Default number of batches loaded ahead of the net.
+  static const int PREFETCH_COUNT = 3;
+
+  int prefetch_count() const { return prefetch_count_; }
 
  protected:
-  Blob<Dtype> prefetch_data_;
-  Blob<Dtype> prefetch_label_;
+  // The thread's function: loads batches until the thread is stopped.
+  virtual void InternalThreadEntry();
+  // Loads one batch; implemented by the individual layer types.
+  virtual void LoadBatch(Batch<Dtype>* batch) = 0;
+  // Takes the next full batch, returning the current one to the free queue.
+  Batch<Dtype>* NextBatch();
+
+  const int prefetch_count_;
+  boost::scoped_array<Batch<Dtype> > prefetch_;
+  BlockingQueue<Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // The batch the tops currently point at.
+  Batch<Dtype>* prefetch_current_;
+
   Blob<Dtype> transformed_data_;
 };
 
@@ -98,7 +140,7 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MaxTopBlobs() const { return 2; }
 
  protected:
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
 
   shared_ptr<Dataset<string, Datum> > dataset_;
   Dataset<string, Datum>::const_iterator iter_;
@@ -245,7 +287,7 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
 
   vector<std::pair<std::string, std::vector<int> > > lines_;
   int lines_id_;
@@ -319,7 +361,7 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
@@ -357,11 +399,7 @@ class ImageDimPrefetchingDataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  // The thread's function
-  virtual void InternalThreadEntry() {}
-
  protected:
-  Blob<Dtype> prefetch_data_dim_;
   bool output_data_dim_;
 };
 
@@ -384,7 +422,32 @@ class ImageSegDataLayer : public ImageDimPrefetchingDataLayer<Dtype> {
 
  protected:
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  // Sorts lines_ by the padded size of their images, so that the images of
+  // a batch need about the same padding, and fills lines_index_.
+  virtual void BucketImages();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  // The images of the batch being loaded, shared with the decode workers.
+  struct BatchItems;
+  // Read the item_id-th image of items, and transform it into the batch.
+  // Called concurrently by the decode workers.
+  void ReadItem(BatchItems* items, const int item_id);
+  void TransformItem(BatchItems* items, const int item_id);
+  // Fills (*keys)[i] with ((padded height, padded width), i) for BucketImages.
+  void ReadBucketKey(vector<std::pair<std::pair<int, int>, int> >* keys,
+      const int i);
+  // Fills lines_ from the source: (image, label) file names by default.
+  virtual void ReadSource();
+  // Called in batch order for every line of a batch before any of them is
+  // read, so that a source can start fetching them.
+  virtual void WillRead(const std::pair<std::string, std::string>& line) {}
+  // Reads the image and the label map of a line, and the size of the image
+  // before any resizing. Called concurrently by the decode workers.
+  virtual void ReadImgAndSeg(const std::pair<std::string, std::string>& line,
+      std::vector<cv::Mat>* cv_img_seg, int* img_row, int* img_col);
+  // Reads the size of the image of a line as ReadImgAndSeg returns it,
+  // without decoding it when the source allows. Used by BucketImages.
+  virtual void ReadImgSize(const std::pair<std::string, std::string>& line,
+      int* rows, int* cols);
 
  protected:
   Blob<Dtype> transformed_label_;
@@ -392,7 +455,75 @@ class ImageSegDataLayer : public ImageDimPrefetchingDataLayer<Dtype> {
   shared_ptr<Caffe::RNG> prefetch_rng_;
 
   vector<std::pair<std::string, std::string> > lines_;
+  // The position in the source of every line of lines_ once it is sorted
+  // by BucketImages, and empty otherwise.
+  vector<int> lines_index_;
   int lines_id_;
+  // decode_threads workers.
+  shared_ptr<WorkerPool> decode_pool_;
+};
+
+/**
+ * @brief Reads segmentation samples from a seg pack file (see
+ *    util/seg_pack.hpp) written by tools/convert_segset, with the options
+ *    and transformations of ImageSegDataLayer. The file is memory mapped,
+ *    so no file is opened per sample.
+ */
+template <typename Dtype>
+class SegPackDataLayer : public ImageSegDataLayer<Dtype> {
+ public:
+  explicit SegPackDataLayer(const LayerParameter& param)
+    : ImageSegDataLayer<Dtype>(param) {}
+  virtual ~SegPackDataLayer();
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_SEG_PACK_DATA;
+  }
+
+ protected:
+  // lines_ holds the record indices, as strings.
+  virtual void ReadSource();
+  virtual void WillRead(const std::pair<std::string, std::string>& line);
+  virtual void ReadImgAndSeg(const std::pair<std::string, std::string>& line,
+      std::vector<cv::Mat>* cv_img_seg, int* img_row, int* img_col);
+  virtual void ReadImgSize(const std::pair<std::string, std::string>& line,
+      int* rows, int* cols);
+
+  SegPackReader reader_;
+};
+
+/**
+ * @brief Reads segmentation samples stored as SegDatum records in an LMDB
+ *    or a LevelDB, with the options and transformations of
+ *    ImageSegDataLayer.
+ *
+ * LMDB records are located once (see Dataset::mapped_values) and then
+ * decoded straight from the mapped pages.
+ */
+template <typename Dtype>
+class SegDataLayer : public ImageSegDataLayer<Dtype> {
+ public:
+  explicit SegDataLayer(const LayerParameter& param)
+    : ImageSegDataLayer<Dtype>(param) {}
+  virtual ~SegDataLayer();
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_SEG_DATA;
+  }
+
+ protected:
+  // lines_ holds the record indices, as strings.
+  virtual void ReadSource();
+  virtual void WillRead(const std::pair<std::string, std::string>& line);
+  virtual void ReadImgAndSeg(const std::pair<std::string, std::string>& line,
+      std::vector<cv::Mat>* cv_img_seg, int* img_row, int* img_col);
+  virtual void ReadImgSize(const std::pair<std::string, std::string>& line,
+      int* rows, int* cols);
+
+  shared_ptr<Dataset<string, string> > dataset_;
+  // The mapped records (LMDB), or else the keys to get them by (LevelDB).
+  vector<std::pair<const char*, size_t> > mapped_values_;
+  vector<string> keys_;
 };
 
 
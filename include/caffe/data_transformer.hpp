@@ -71,6 +71,13 @@ class DataTransformer {
   void TransformImgAndSeg(const std::vector<cv::Mat>& cv_img_seg,
     Blob<Dtype>* transformed_data_blob, Blob<Dtype>* transformed_label_blob,
     const int ignore_label);
+  // Same as above, but draws the mirror flag and the crop offsets from rng
+  // rather than from the transformer's own generator. It leaves the
+  // transformer untouched, so several threads may call it concurrently, each
+  // with its own generator (rng may be NULL if no randomness is needed).
+  void TransformImgAndSeg(const std::vector<cv::Mat>& cv_img_seg,
+    Blob<Dtype>* transformed_data_blob, Blob<Dtype>* transformed_label_blob,
+    const int ignore_label, Caffe::RNG* rng);
   //void TransformSegAndPad(const cv::Mat& cv_seg, Blob<Dtype>* transformed_blob);
   //void TransformAndPad(const cv::Mat& cv_img, Blob<Dtype>* transformed_blob);
   // end jay
@@ -89,6 +96,12 @@ class DataTransformer {
    */
   void Transform(Blob<Dtype>* input_blob, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Draws a seed for a per-item generator from the transformer's own
+   *    generator, or returns 0 if the transformation is deterministic.
+   */
+  unsigned int RandSeed();
+
  protected:
    /**
    * @brief Generates a random integer from Uniform({0, 1, ..., n-1}).
@@ -99,6 +112,14 @@ class DataTransformer {
    *    A uniformly random integer value from ({0, 1, ..., n-1}).
    */
   virtual int Rand(int n);
+  int Rand(int n, Caffe::RNG* rng);
+  // Generates a random float from Uniform([a, b]).
+  float RandUniform(const float a, const float b, Caffe::RNG* rng);
+  // Whether TransformImgAndSeg randomly rescales in the TRAIN phase.
+  bool DoesScale() const {
+    return param_.min_scale_factor() != 1 || param_.max_scale_factor() != 1 ||
+        param_.max_aspect_ratio() != 1;
+  }
 
   void Transform(const Datum& datum, Dtype* transformed_data);
   // Tranformation parameters
@@ -142,6 +142,17 @@ class Dataset {
 
   virtual void keys(vector<K>* keys) = 0;
 
+  /**
+   * Points values at the serialized value of every record, without copying
+   * them, if the records are memory mapped. The bytes stay valid, and may be
+   * read from any thread, until the dataset is committed or closed. Returns
+   * false if the backend cannot (LevelDB): read the values with get then.
+   */
+  virtual bool mapped_values(
+      vector<std::pair<const char*, size_t> >* values) const {
+    return false;
+  }
+
   Dataset() { }
   virtual ~Dataset() { }
 
@@ -15,6 +15,7 @@ class Thread {
   Thread(Callable func, A1 a1);
   void join();
   bool joinable();
+  void interrupt();
  private:
   void* thread_;
 };
@@ -35,6 +36,12 @@ class InternalThread {
   /** Will not return until the internal thread has exited. */
   bool WaitForInternalThreadToExit();
 
+  /**
+   * Requests the internal thread to stop, then waits for it to exit. A thread
+   * blocked on a BlockingQueue is woken up by the request.
+   */
+  bool StopInternalThread();
+
   bool is_started() const { return thread_ != NULL && thread_->joinable(); }
 
  protected:
@@ -42,6 +49,10 @@ class InternalThread {
       with the code you want your thread to run. */
   virtual void InternalThreadEntry() {}
 
+  /* Should be tested by long-running loops in InternalThreadEntry, which
+      return once it is true. */
+  bool must_stop();
+
   caffe::Thread* thread_;
 };
 
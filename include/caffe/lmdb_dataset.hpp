@@ -40,6 +40,7 @@ class LmdbDataset : public Dataset<K, V, KCoder, VCoder> {
   void close();
 
   void keys(vector<K>* keys);
+  bool mapped_values(vector<std::pair<const char*, size_t> >* values) const;
 
   const_iterator begin() const;
   const_iterator cbegin() const;
@@ -734,8 +734,7 @@ template <typename Dtype>
 class SoftmaxWithLossLayer : public LossLayer<Dtype> {
  public:
   explicit SoftmaxWithLossLayer(const LayerParameter& param)
-      : LossLayer<Dtype>(param),
-        softmax_layer_(new SoftmaxLayer<Dtype>(param)) {}
+      : LossLayer<Dtype>(param) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -788,7 +787,8 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  /// The internal SoftmaxLayer used to map predictions to a distribution.
+  /// The internal SoftmaxLayer used to map predictions to a distribution
+  /// on the GPU; the CPU pass computes the softmax tile by tile itself.
   shared_ptr<SoftmaxLayer<Dtype> > softmax_layer_;
   /// prob stores the output probability predictions from the SoftmaxLayer.
   Blob<Dtype> prob_;
@@ -802,10 +802,23 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype> {
   // the weight for different object classes when computing loss
   std::vector<Dtype> loss_weights_;
   
-  // set of ignore labels
-  std::set<int> ignore_label_;
+  // non-negative ignore labels as a dense bitmap indexed by label
+  std::vector<bool> ignore_label_;
+  // negative ignore labels, sorted
+  std::vector<int> negative_ignore_labels_;
   // end jay
 
+  /// The class of a label value, or -1 if it is ignored.
+  int LabelOf(const Dtype label_value) const;
+  /// Computes the loss and, if compute_prob, prob_ in one pass over tiles of
+  /// spatial positions.
+  void ForwardTiles(const vector<Blob<Dtype>*>& bottom, bool compute_prob);
+  /// Per-tile partial sums, reduced in order so the loss is deterministic.
+  std::vector<Dtype> tile_loss_;
+  std::vector<Dtype> tile_weight_;
+  Dtype loss_;
+  Dtype batch_weight_;
+
 };
 
 /** Jay add
@@ -876,8 +889,10 @@ class SegAccuracyLayer : public Layer<Dtype> {
       
   ConfusionMatrix confusion_matrix_;
 
-  // set of ignore labels
-  std::set<int> ignore_label_;
+  // non-negative ignore labels as a dense bitmap indexed by label
+  std::vector<bool> ignore_label_;
+  // negative ignore labels, sorted
+  std::vector<int> negative_ignore_labels_;
 };
 
 
@@ -125,8 +125,19 @@ class Net {
   inline const vector<string>& layer_names() { return layer_names_; }
   /// @brief returns the blob names
   inline const vector<string>& blob_names() { return blob_names_; }
-  /// @brief returns the blobs
+  /**
+   * @brief returns the blobs
+   *
+   * With NetParameter.plan_memory, only the inputs and the outputs keep
+   * their values after a forward pass; call UnplanMemory first to read the
+   * others, or get them by blob_by_name.
+   */
   inline const vector<shared_ptr<Blob<Dtype> > >& blobs() { return blobs_; }
+  /**
+   * @brief Gives every blob memory of its own again and stops planning, so
+   *        that all of them keep their values after the next forward pass.
+   */
+  void UnplanMemory();
   /// @brief returns the layers
   inline const vector<shared_ptr<Layer<Dtype> > >& layers() { return layers_; }
   /**
@@ -200,6 +211,16 @@ class Net {
   /// @brief Get misc parameters, e.g. the LR multiplier and weight decay.
   void GetLearningRateAndWeightDecay();
 
+  /// @brief Assigns the top blobs to arenas shared by disjoint lifetimes.
+  void PlanMemory();
+  /// @brief Points the planned blobs written first by the layer at their
+  ///        arenas, once the layer is reshaped.
+  void PlaceTops(const int layer_id);
+  /// @brief Gives the storage memory of its own again.
+  void UnplanStorage(const int storage);
+  /// @brief Gives the storage of the blob memory of its own again.
+  void UnplanBlob(const int blob_id);
+
   /// @brief Individual layers in the net
   vector<shared_ptr<Layer<Dtype> > > layers_;
   vector<string> layer_names_;
@@ -240,6 +261,17 @@ class Net {
   vector<float> params_weight_decay_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// For plan_memory: a blob and the tops aliasing it (in-place, SPLIT and
+  /// FLATTEN) hold one storage, named by the id of that blob.
+  /// blob_storage_ gives the storage of every blob.
+  vector<int> blob_storage_;
+  /// The arena of every planned storage, or -1.
+  vector<int> storage_arena_;
+  /// The planned storages first written by each layer.
+  vector<vector<int> > storage_births_;
+  /// The storages assigned to each arena.
+  vector<vector<int> > arena_storages_;
+  vector<shared_ptr<SyncedMemory> > arenas_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
 
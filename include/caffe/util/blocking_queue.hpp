@@ -0,0 +1,46 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+#define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+
+#include <queue>
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe FIFO queue whose pop waits until an element is
+ *    available. Waiting is an interruption point, so that a thread blocked
+ *    on the queue can be stopped by InternalThread::StopInternalThread.
+ *
+ * The synchronization is kept out of the header, like caffe::Thread, to
+ * force host compilation for boost.
+ */
+template <typename T>
+class BlockingQueue {
+ public:
+  BlockingQueue();
+  ~BlockingQueue();
+
+  void push(const T& t);
+
+  /** Returns false, leaving t untouched, if the queue is empty. */
+  bool try_pop(T* t);
+
+  /** Waits for an element, logging log_on_wait if it has to wait. */
+  T pop(const string& log_on_wait = "");
+
+  size_t size() const;
+
+ protected:
+  class Sync;
+
+  std::queue<T> queue_;
+  Sync* sync_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_HPP_
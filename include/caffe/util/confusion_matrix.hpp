@@ -19,9 +19,15 @@
 #ifndef _CONFUSION_MATRIX_H
 #define _CONFUSION_MATRIX_H
 
-#include <vector>
+#include <iosfwd>
 #include <string>
+#include <vector>
 
+// Counts are kept in one row-major m-by-m array, with row/column sums kept
+// up to date by the functions that change the counts. The const functions
+// only read, so several threads may call them at once. Several threads may
+// also count in parallel, each into its own shard (see shard()); the shards
+// must then be merged with mergeShards() before any read.
 class ConfusionMatrix {
  public:
   //create a m-by-m confusion matrix
@@ -37,6 +43,21 @@ class ConfusionMatrix {
   
   void resize(const int m);
   void clear();
+
+  // n independent m-by-m count arrays for concurrent accumulation: thread t
+  // only increments shard(t)[actual * m + predicted].
+  void resizeShards(const int n);
+  int numShards() const;
+  unsigned long* shard(const int n);
+  // adds the shards into the matrix, clears them and updates the sums
+  void mergeShards();
+
+  // binary serialization, so that the partial matrices of several evaluation
+  // jobs can be loaded and accumulated
+  void write(std::ostream& os) const;
+  void read(std::istream& is);
+  void save(const std::string& filename) const;
+  void load(const std::string& filename);
   
   void printCounts(const char *header = NULL) const;
   void printRowNormalized(const char *header = NULL) const;
@@ -59,12 +80,26 @@ class ConfusionMatrix {
   double recall(int n) const;
   double jaccard(int n) const;
  
+  // The counts are only changed through accumulate(), so that the sums
+  // stay in step with them.
   const unsigned long& operator()(int x, int y) const;
-  unsigned long& operator()(int x, int y);
 
  protected:
+  // recomputes the sums from the counts
+  void updateSums();
+  // fails if the shards hold counts not merged into the matrix yet
+  void checkMerged() const;
+
+  int _size;
   // use unsigned long: be caureful of overflow for large-scale dataset
-  std::vector< std::vector<unsigned long> > _matrix;
+  std::vector<unsigned long> _matrix;
+  std::vector< std::vector<unsigned long> > _shards;
+  bool _shardsDirty;
+  // sums of the counts
+  std::vector<double> _rowSums;
+  std::vector<double> _colSums;
+  double _diagSum;
+  double _totalSum;
   
  public:
   static std::string COL_SEP;   // string for separating columns when printing
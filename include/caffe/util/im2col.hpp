@@ -17,6 +17,49 @@ void col2im_cpu(const Dtype* data_col,
     const int stride_h, const int stride_w, const int hole_h, const int hole_w,
     Dtype* data_im);
 
+// Precomputes the gather table of im2col_cpu for one image of the given
+// geometry: data_col[i] = data_im[index[i]], or zero (padding) where
+// index[i] < 0. Only depends on the shapes, so it can be reused as long as
+// they do not change.
+void im2col_index(const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int hole_h, const int hole_w,
+    int* index);
+
+// im2col_cpu of one image through a table built by im2col_index.
+template <typename Dtype>
+void im2col_gather_cpu(const Dtype* data_im, const int* index,
+    const int size, Dtype* data_col);
+
+// Splits the zero-padded image into hole_h * hole_w dense subimages of size
+// height_sub x width_sub, one per phase (ph, pw) of the holes:
+//   data_sub[ph * hole_w + pw][c][i][j] =
+//       data_im[c][ph + i * hole_h - pad_h][pw + j * hole_w - pad_w],
+// zero outside of the image. A convolution with holes then is a dense
+// convolution of each subimage (space-to-batch).
+template <typename Dtype>
+void space_to_batch_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int hole_h, const int hole_w, const int height_sub,
+    const int width_sub, Dtype* data_sub);
+
+// Inverse of space_to_batch_cpu: interleaves the subimages back into the
+// height x width image, dropping the padding.
+template <typename Dtype>
+void batch_to_space_cpu(const Dtype* data_sub, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int hole_h, const int hole_w, const int height_sub,
+    const int width_sub, Dtype* data_im);
+
+// im2col of one channel-last (NHWC) image: a height_out * width_out by
+// kernel_h * kernel_w * channels matrix, one row per output position with the
+// patch in (kh, kw, c) order, so that the channels are copied contiguously.
+template <typename Dtype>
+void im2col_channels_last_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int hole_h, const int hole_w, Dtype* data_col);
+
 template <typename Dtype>
 void im2col_gpu(const Dtype* data_im,
     const int num, const int channels, const int height, const int width,
@@ -0,0 +1,76 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#ifndef OSX
+#include <opencv2/core/core.hpp>
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe cache of decoded images, evicting the least recently
+ *    used ones once they take more than a memory budget.
+ *
+ * The cached mats share their pixels with the mats handed out, which must
+ * therefore not be written to.
+ */
+class ImageCache {
+ public:
+  explicit ImageCache(const size_t budget_bytes = 0);
+  ~ImageCache();
+
+  /**
+   * @brief The cache shared by all the data layers of the process, e.g. by
+   *    the train and test nets of a Solver.
+   */
+  static ImageCache& Global();
+
+  // Raises the budget to at least budget_bytes.
+  void Reserve(const size_t budget_bytes);
+  // Returns false if key is not cached.
+  bool Lookup(const string& key, cv::Mat* cv_img);
+  // Does nothing if cv_img alone is over budget.
+  void Insert(const string& key, const cv::Mat& cv_img);
+  void Clear();
+
+  size_t budget_bytes() const;
+  size_t size_bytes() const;
+  size_t hits() const;
+  size_t misses() const;
+
+ protected:
+  class Sync;
+  typedef std::list<std::pair<string, cv::Mat> > EntryList;
+
+  void EvictTo(const size_t budget_bytes);
+
+  size_t budget_bytes_;
+  size_t size_bytes_;
+  size_t hits_;
+  size_t misses_;
+  // Most recently used first.
+  EntryList entries_;
+  std::map<string, EntryList::iterator> index_;
+  Sync* sync_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+/**
+ * @brief ReadImageToCVMat through cache: the image is decoded (and resized)
+ *    only if it is not cached yet. Reads directly if cache is NULL.
+ */
+cv::Mat ReadImageToCVMatCached(ImageCache* cache, const string& filename,
+    const int height, const int width, const bool is_color,
+    int* img_height = NULL, int* img_width = NULL);
+
+}  // namespace caffe
+
+#endif  // OSX
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
@@ -0,0 +1,30 @@
+#ifndef _CAFFE_UTIL_INSERT_LAYOUTS_HPP_
+#define _CAFFE_UTIL_INSERT_LAYOUTS_HPP_
+
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters with LayoutLayers added so that the layers able to run
+// channel-last get NHWC bottoms and every other layer NCHW ones. Tops changing
+// layout in place are renamed. Net outputs are converted back to NCHW under
+// their original names, with the channel-last blob renamed.
+void InsertLayouts(const NetParameter& param, NetParameter* param_layout);
+
+// The number of leading bottoms the layer takes channel-last, in which case
+// all its tops are channel-last too; 0 if the layer only supports NCHW.
+int ChannelsLastBottoms(const LayerParameter& layer_param);
+
+// Whether the layer is elementwise and keeps the layout of its bottom.
+bool LayerKeepsLayout(const LayerParameter& layer_param);
+
+void ConfigureLayoutLayer(const string& bottom_name, const string& top_name,
+    const bool channels_last, LayerParameter* layout_layer_param);
+
+string LayoutBlobName(const string& blob_name, const bool channels_last);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_INSERT_LAYOUTS_HPP_
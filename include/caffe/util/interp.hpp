@@ -33,6 +33,22 @@ void caffe_gpu_interp2_backward(const int channels,
 	  Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
     const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2);
 
+// Bi-linear upsampling by an integer zoom factor
+// IN : [channels height1 width1] cropped from a bigger [Height1 Width1] image
+// OUT: [channels (height1 - 1) * zoom + 1 (width1 - 1) * zoom + 1]
+// Same as caffe_cpu_interp2 onto that grid, computed separably with the
+// zoom fixed weight pairs instead of per-pixel index arithmetic.
+template <typename Dtype>
+void caffe_cpu_zoom2(const int channels,
+    const Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
+    const int zoom, Dtype *data2);
+
+// Backward (adjoint) operation of caffe_cpu_zoom2 (accumulates into data1)
+template <typename Dtype>
+void caffe_cpu_zoom2_backward(const int channels,
+    Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
+    const int zoom, const Dtype *data2);
+
 // Create Gaussian pyramid of an image. Assume output space is pre-allocated.
 // IN : [channels height width]
 template <typename Dtype, bool packed>
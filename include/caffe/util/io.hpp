@@ -146,6 +146,10 @@ inline cv::Mat ReadImageToCVMat(const string& filename) {
   return ReadImageToCVMat(filename, 0, 0, true);
 }
 
+// Reads the size of a PNG or JPEG image from its header, without decoding
+// it. Returns false for other formats or a header it cannot parse.
+bool ReadImageSize(const string& filename, int* height, int* width);
+
 cv::Mat DecodeDatumToCVMat(const Datum& datum,
     const int height, const int width, const bool is_color);
 
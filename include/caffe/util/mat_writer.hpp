@@ -0,0 +1,79 @@
+#ifndef CAFFE_UTIL_MAT_WRITER_HPP_
+#define CAFFE_UTIL_MAT_WRITER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief An array to be saved by MatWriter as the 'data' variable of a MAT
+ *    file, with dims width x height x channels x num like Blob::ToMat.
+ */
+struct MatWriteJob {
+  enum ElemType { SINGLE, DOUBLE, HALF, UINT8 };
+
+  static size_t elem_size(const ElemType type);
+
+  // Resizes buffer for the given shape and element type.
+  void Reshape(const ElemType type, const int num, const int channels,
+      const int height, const int width);
+  int count() const { return num * channels * height * width; }
+
+  string filename;
+  ElemType type;
+  int num;
+  int channels;
+  int height;
+  int width;
+  // The elements in blob order. HALF elements are IEEE 754 binary16 bit
+  // patterns, saved as a uint16 array.
+  vector<char> buffer;
+};
+
+/**
+ * @brief Saves MAT files in background threads, so that the forward pass
+ *    does not wait for the disk.
+ *
+ * The jobs come from a fixed pool: Get waits while all of them are queued
+ * or being written, which bounds the memory held by pending files.
+ */
+class MatWriter {
+ public:
+  // With 0 threads, Write saves the file before returning.
+  MatWriter(const int threads, const int max_pending);
+  // Saves the pending files.
+  ~MatWriter();
+
+  // Returns a job to fill, waiting for one to be free.
+  MatWriteJob* Get();
+  // Hands over a job returned by Get.
+  void Write(MatWriteJob* job);
+
+  static void Save(const MatWriteJob& job);
+
+ protected:
+  // The worker threads are kept out of the header, like in BlockingQueue,
+  // to force host compilation for boost.
+  class Workers;
+
+  void WorkerEntry();
+
+  vector<shared_ptr<MatWriteJob> > jobs_;
+  BlockingQueue<MatWriteJob*> free_;
+  BlockingQueue<MatWriteJob*> full_;
+  shared_ptr<Workers> workers_;
+
+  DISABLE_COPY_AND_ASSIGN(MatWriter);
+};
+
+// Converts to an IEEE 754 binary16 bit pattern, rounding to nearest even.
+unsigned short FloatToHalf(const float value);
+float HalfToFloat(const unsigned short half);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MAT_WRITER_HPP_
@@ -125,6 +125,19 @@ void caffe_exp(const int n, const Dtype* a, Dtype* y);
 template <typename Dtype>
 void caffe_abs(const int n, const Dtype* a, Dtype* y);
 
+// Softmax across the channels of a (channels x spatial_dim) plane, for the
+// size consecutive positions starting at x (and y). In-place is allowed.
+template <typename Dtype>
+void caffe_cpu_channel_softmax(const int channels, const int spatial_dim,
+    const int size, const Dtype* x, Dtype* y);
+
+// Index and value of the maximum across the channels of a (channels x
+// spatial_dim) plane, for the size consecutive positions starting at x. Ties
+// go to the higher channel, as with a descending sort of (value, channel).
+template <typename Dtype>
+void caffe_cpu_channel_argmax(const int channels, const int spatial_dim,
+    const int size, const Dtype* x, int* argmax, Dtype* max_val);
+
 template <typename Dtype>
 Dtype caffe_cpu_dot(const int n, const Dtype* x, const Dtype* y);
 
@@ -0,0 +1,97 @@
+#ifndef CAFFE_UTIL_QUANTIZE_H_
+#define CAFFE_UTIL_QUANTIZE_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Symmetric per-row quantization of a rows x cols weight matrix to
+// [-127, 127]: w = scale[r] * q. row_sum[r] receives the sum of the
+// quantized row, which is needed to fold the input zero point into the GEMM.
+template <typename Dtype>
+void caffe_cpu_quantize_weights(const int rows, const int cols,
+    const Dtype* w, int8_t* q, Dtype* scale, int* row_sum);
+
+// Affine quantization parameters covering [min(x, 0), max(x, 0)].
+template <typename Dtype>
+void caffe_cpu_quantize_range(const int n, const Dtype* x,
+    Dtype* scale, int* zero_point);
+
+// Affine quantization to [0, 255]: q = round(x / scale) + zero_point.
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    const int zero_point, uint8_t* q);
+
+// C (M x N) = A (M x K, signed) * op(B) (K x N, unsigned) in int32.
+// Only A in row-major order is supported; TransB selects whether B is
+// stored as K x N (CblasNoTrans) or N x K (CblasTrans).
+void caffe_cpu_gemm_s8u8s32(const CBLAS_TRANSPOSE TransB,
+    const int M, const int N, const int K,
+    const int8_t* A, const uint8_t* B, int32_t* C);
+
+// Stores quantized weights in proto (see BlobProto.int8_data) instead of
+// float data, using one scale per each of rows equal parts of the blob.
+template <typename Dtype>
+void QuantizeBlobToProto(const Blob<Dtype>& blob, const int rows,
+    BlobProto* proto);
+
+/**
+ * @brief The int8 engine shared by ConvolutionLayer and InnerProductLayer:
+ *        holds the quantized weight matrix and computes
+ *        out = W * in + bias with u8 x s8 -> s32 arithmetic.
+ *
+ * The weights are quantized per output channel (row of W); the input is
+ * quantized either with the calibrated QuantizationParameter or with a range
+ * computed from the data, and the int32 result is requantized to Dtype.
+ */
+template <typename Dtype>
+class Int8Gemm {
+ public:
+  explicit Int8Gemm(const QuantizationParameter& param);
+
+  /// Quantizes the rows x cols weight matrix (row-major).
+  void SetWeights(const int rows, const int cols, const Dtype* weight);
+  inline bool initialized() const { return rows_ > 0; }
+  /**
+   * @brief Quantizes weights, as a rows x cols matrix, unless they are
+   *        unchanged since the last call, e.g. by CopyTrainedLayersFrom or a
+   *        solver update.
+   */
+  void UpdateWeights(const int rows, const int cols, const Blob<Dtype>& weights);
+
+  /**
+   * @brief out = W[row_begin : row_begin + M] * in (+ bias).
+   *
+   * in is cols x N, or N x cols if trans_in; out is M x N, or N x M if
+   * trans_out. bias (optional) has one entry per output row.
+   */
+  void Forward(const int row_begin, const int M, const int N,
+      const Dtype* in, const bool trans_in, const Dtype* bias,
+      Dtype* out, const bool trans_out);
+
+ protected:
+  bool has_input_scale_;
+  Dtype input_scale_;
+  int input_zero_point_;
+  int rows_, cols_;
+  // The memory and version the weights were quantized from. Holding the
+  // memory keeps its address from being reused by another one.
+  shared_ptr<SyncedMemory> weight_memory_;
+  unsigned int weight_version_;
+  std::vector<int8_t> weight_;
+  std::vector<Dtype> weight_scale_;
+  std::vector<int> weight_sum_;
+  std::vector<uint8_t> input_;
+  std::vector<int32_t> output_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZE_H_
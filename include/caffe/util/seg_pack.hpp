@@ -0,0 +1,142 @@
+#ifndef CAFFE_UTIL_SEG_PACK_HPP_
+#define CAFFE_UTIL_SEG_PACK_HPP_
+
+#ifndef OSX
+#include <opencv2/core/core.hpp>
+#endif
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+struct SegDatumView;
+
+/**
+ * A segmentation dataset packed into a single file: a header, the
+ * serialized SegDatum records back to back, and an index with the offset of
+ * every record. Reading a sample then costs a lookup in a memory mapping
+ * instead of opening an image and a label file.
+ *
+ * Layout (little-endian):
+ *   char     magic[8]            "SEGPACK1"
+ *   uint64_t num_records
+ *   uint64_t index_offset
+ *   records, then zero padding up to a multiple of 8 bytes
+ *   uint64_t offsets[num_records + 1]  at index_offset; record i spans
+ *                                      [offsets[i], offsets[i + 1]).
+ */
+class SegPackWriter {
+ public:
+  SegPackWriter() : file_(NULL) {}
+  ~SegPackWriter() { Close(); }
+
+  bool Open(const string& filename);
+  bool Add(const SegDatum& datum);
+  // Writes the index and the header. Returns false on any write error.
+  bool Close();
+
+  int size() const { return offsets_.size(); }
+
+ private:
+  FILE* file_;
+  uint64_t pos_;
+  std::vector<uint64_t> offsets_;
+
+  DISABLE_COPY_AND_ASSIGN(SegPackWriter);
+};
+
+class SegPackReader {
+ public:
+  SegPackReader() : data_(NULL), size_(0), num_records_(0), index_(NULL),
+      readahead_(false) {}
+  ~SegPackReader() { Close(); }
+
+  /**
+   * Maps the file. With readahead, the pages of a record are requested from
+   * the kernel by WillNeed; otherwise the mapping is advised as random
+   * access so the kernel does not read around every record. Fails unless
+   * the index offsets are in order and within the records.
+   */
+  bool Open(const string& filename, const bool readahead = false);
+  void Close();
+
+  int size() const { return num_records_; }
+
+  // Asks the kernel to start reading record i in the background. Does
+  // nothing without readahead.
+  void WillNeed(const int i) const;
+
+  // Parses record i into datum, which copies its bytes. May be called
+  // concurrently.
+  bool Read(const int i, SegDatum* datum) const;
+  // Parses record i in place; the view is valid until Close.
+  bool Read(const int i, SegDatumView* view) const;
+
+ private:
+  const char* data_;
+  size_t size_;
+  int num_records_;
+  const uint64_t* index_;
+  bool readahead_;
+
+  DISABLE_COPY_AND_ASSIGN(SegPackReader);
+};
+
+/**
+ * A serialized SegDatum parsed in place: image and label point into the
+ * record, which must outlive the view. Used to decode records straight from
+ * mapped pages (a seg pack, an LMDB) without copying them first.
+ */
+struct SegDatumView {
+  SegDatumView() : channels(0), height(0), width(0), encoded(false),
+      image(NULL), image_size(0), label(NULL), label_size(0) {}
+
+  int channels;
+  int height;
+  int width;
+  bool encoded;
+  const char* image;
+  size_t image_size;
+  // NULL if the record is unlabeled.
+  const char* label;
+  size_t label_size;
+};
+
+bool ParseSegDatumView(const char* data, const size_t size,
+    SegDatumView* view);
+
+#ifndef OSX
+/**
+ * Fills datum with an image and, unless seg_filename is empty, its label
+ * map. If encoded, the file bytes are stored as they are; otherwise the
+ * pixels are stored, resized to height x width if those are not zero.
+ */
+bool ReadImgAndSegToSegDatum(const string& img_filename,
+    const string& seg_filename, const int height, const int width,
+    const bool is_color, const bool encoded, SegDatum* datum);
+
+/**
+ * Decodes the image of datum, and its label map (left empty if there is
+ * none). Both are resized to height x width if those are not zero, the
+ * label map with nearest neighbour interpolation.
+ */
+bool DecodeSegDatumToCVMat(const SegDatum& datum, const int height,
+    const int width, const bool is_color, cv::Mat* cv_img, cv::Mat* cv_seg);
+
+/**
+ * As above, but raw pixels that need no resizing are not copied: the mats
+ * then point into the record of the view.
+ */
+bool DecodeSegDatumToCVMat(const SegDatumView& view, const int height,
+    const int width, const bool is_color, cv::Mat* cv_img, cv::Mat* cv_seg);
+#endif
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SEG_PACK_HPP_
@@ -0,0 +1,44 @@
+#ifndef CAFFE_UTIL_WORKER_POOL_HPP_
+#define CAFFE_UTIL_WORKER_POOL_HPP_
+
+#include <boost/function.hpp>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of threads running the iterations of a loop
+ *    concurrently, e.g. to decode the images of a batch.
+ *
+ * The threads are kept out of the header, like in MatWriter, to force host
+ * compilation for boost.
+ */
+class WorkerPool {
+ public:
+  // Runs the loops on threads - 1 background threads and the calling
+  // thread, so with 1 thread everything runs on the calling thread.
+  explicit WorkerPool(const int threads);
+  ~WorkerPool();
+
+  int threads() const { return threads_; }
+
+  // Calls task(i) for every i in [0, count), in any order and on any of the
+  // threads, and returns once all the calls are done. Not an interruption
+  // point: the tasks may use the stack of the caller.
+  void Run(const int count, const boost::function<void(int)>& task);
+
+ protected:
+  class Workers;
+
+  void WorkerEntry();
+
+  const int threads_;
+  shared_ptr<Workers> workers_;
+
+  DISABLE_COPY_AND_ASSIGN(WorkerPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WORKER_POOL_HPP_
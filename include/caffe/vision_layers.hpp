@@ -15,6 +15,8 @@
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/util/densecrf_pairwise.hpp"
+#include "caffe/util/mat_writer.hpp"
+#include "caffe/util/quantize.hpp"
 
 namespace caffe {
 
@@ -67,9 +69,24 @@ class ConvolutionLayer : public Layer<Dtype> {
    *  - bias_term (\b optional, default true). Whether to have a bias.
    *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
    *    kernels + stream parallelism) engines.
+   *  - hole_mode (\b optional, default IM2COL). With SPACE_TO_BATCH the CPU
+   *    engine rearranges the input into hole_h * hole_w dense subimages and
+   *    convolves each of them without holes, which keeps the unrolled
+   *    subimage in cache. Requires stride 1.
+   *  - im2col_table (\b optional, default false). Unroll the input through
+   *    a table of gather indices, rebuilt only when the input shape changes,
+   *    instead of recomputing the coordinates on every pass. The table is
+   *    skipped if larger than im2col_table_max_size bytes.
+   *  - retain_col_buffer (\b optional, default false). Keep the column
+   *    buffers of the batch from forward for backward while training,
+   *    within retain_col_buffer_max_size bytes, instead of recomputing them.
+   *  - quantization_param (\b optional). With precision INT8 the CPU forward
+   *    pass runs on int8 weights and uint8 inputs (see Int8Gemm); the weights
+   *    are quantized again on the first forward pass after they change.
+   *    Backward uses the float weights.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), weight_channels_last_version_(0) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -92,6 +109,20 @@ class ConvolutionLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // Helpers multiplying an unrolled input of N columns by the filters of
+  // every group, for the forward pass, the weight and the input gradients.
+  void forward_cpu_gemm(const Dtype* col_buff, const Dtype* weight,
+      Dtype* output, const int N);
+  void weight_cpu_gemm(const Dtype* col_buff, const Dtype* output_diff,
+      Dtype* weight_diff, const int N);
+  void backward_cpu_gemm(const Dtype* output_diff, const Dtype* weight,
+      Dtype* col_buff, const int N);
+  // Unrolls one input (or subimage, for space-to-batch) into col_buff.
+  void conv_im2col_cpu(const Dtype* data, Dtype* col_buff);
+  // Forward pass over channel-last bottoms, for inference.
+  void Forward_channels_last_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
   int num_;
@@ -116,6 +147,30 @@ class ConvolutionLayer : public Layer<Dtype> {
   int N_;
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  /// Space-to-batch execution of the holes (see hole_mode): the input
+  /// subimages and the per-subimage outputs, with their diffs.
+  bool space_to_batch_;
+  int height_sub_, width_sub_;
+  int height_sub_out_, width_sub_out_;
+  Blob<Dtype> sub_buffer_;
+  Blob<Dtype> sub_top_buffer_;
+  /// im2col gather indices (see im2col_table) and the input shape they
+  /// were built for.
+  vector<int> im2col_index_;
+  int im2col_index_height_, im2col_index_width_;
+  /// Column buffers of the whole batch retained for backward (see
+  /// retain_col_buffer); valid when the last forward pass filled them.
+  bool retain_col_buffer_;
+  bool col_retained_valid_;
+  Blob<Dtype> col_retained_;
+  /// int8 inference engine, only set for quantized layers.
+  shared_ptr<Int8Gemm<Dtype> > int8_gemm_;
+  /// Filters in (kh, kw, c) order, matching the columns of a channel-last
+  /// input (see im2col_channels_last_cpu), permuted from the weight memory
+  /// at the version below and redone only when the weights change.
+  Blob<Dtype> weight_channels_last_;
+  shared_ptr<SyncedMemory> weight_channels_last_memory_;
+  unsigned int weight_channels_last_version_;
 };
 
 #ifdef USE_CUDNN
@@ -238,6 +293,61 @@ class InterpLayer : public Layer<Dtype> {
   int height_out_, width_out_;
   int pad_beg_, pad_end_;
   int height_in_eff_, width_in_eff_;
+  int zoom_factor_;  // 0 unless the output size is given by zoom_factor
+};
+
+/**
+ * @brief Fused inference head of a segmentation net: bi-linearly upsamples
+ *        the class scores like InterpLayer (configured by interp_param) and
+ *        takes the argmax over the channels, one output row at a time.
+ *
+ * Equivalent to INTERP followed by (SOFTMAX and) ARGMAX, but the upsampled
+ * score volume is never stored: only the N x 1 x H x W label map (top[0])
+ * and, optionally, the N x 1 x H x W map of the winning scores (top[1]) are
+ * written. With seg_head_param.softmax (the default) top[1] holds the
+ * softmax probability of the winning class. Ties go to the higher class
+ * index, like ARGMAX. Inference only: there is no backward pass.
+ */
+template <typename Dtype>
+class SegHeadLayer : public Layer<Dtype> {
+ public:
+  explicit SegHeadLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_SEG_HEAD;
+  }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 2; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  /// @brief Not implemented (non-differentiable function)
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    for (int i = 0; i < propagate_down.size(); ++i) {
+      if (propagate_down[i]) { NOT_IMPLEMENTED; }
+    }
+  }
+
+  int num_, channels_;
+  int height_in_, width_in_;
+  int height_out_, width_out_;
+  int pad_beg_, pad_end_;
+  int height_in_eff_, width_in_eff_;
+  bool softmax_;
+  /// Horizontal interpolation taps of every output column: the left input
+  /// column, the offset to the right one and the weight of the right one.
+  vector<int> w1_, w1p_;
+  vector<Dtype> w1lambda_;
+  /// One output row of upsampled scores for all the channels.
+  Blob<Dtype> row_buffer_;
 };
 
 /**
@@ -533,28 +643,28 @@ class PaddingLayer : public Layer<Dtype> {
   MatReadLayer
 */
 template <typename Dtype>
-class MatReadLayer : public Layer<Dtype> {
+class MatReadLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit MatReadLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
-  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top);
-  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      : BasePrefetchingDataLayer<Dtype>(param,
+          param.mat_read_param().prefetch()) {}
+  virtual ~MatReadLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_MAT_READ;
   }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
-  virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 2; }
 
  protected:
-  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top);
-  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // The file of the given item and top.
+  string FileName(const int id, const int blob_id) const;
+  virtual void LoadBatch(Batch<Dtype>* batch);
 
-  bool reshape_;
   int batch_size_;
+  // The next item to load; only used by the prefetch thread after setup.
   int iter_;
   string prefix_;
   vector<string> fnames_;
@@ -583,10 +693,18 @@ class MatWriteLayer : public Layer<Dtype> {
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // The file of the given image (or batch) and bottom.
+  string FileName(const int id, const int blob_id) const;
+  // Hands over the height x width window of images [n_begin, n_end).
+  void Enqueue(const Blob<Dtype>& blob, const int n_begin, const int n_end,
+      const int height, const int width, const string& filename);
+
   int iter_;
   int period_;
   string prefix_;
   vector<string> fnames_;
+  MatWriteJob::ElemType elem_type_;
+  shared_ptr<MatWriter> writer_;
 };
 
 // Forward declare PoolingLayer and SplitLayer for use in LRNLayer.
@@ -717,6 +835,12 @@ class PoolingLayer : public Layer<Dtype> {
   bool global_pooling_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
+  // argmax as offsets within the window, used instead of max_idx_ by the
+  // CPU forward pass when compact_mask_
+  bool compact_mask_;
+  std::vector<uint8_t> max_idx_compact_;
+  // whether the last forward pass stored the argmax in max_idx_compact_
+  bool mask_compact_;
 };
 
 #ifdef USE_CUDNN
@@ -813,6 +937,7 @@ class DenseCRFLayer : public Layer<Dtype> {
   int num_;
   int pad_height_;   // may have padded rows
   int pad_width_;    // may have padded cols
+  bool channels_last_;  // bottom[0] and top[0] are NHWC, like unary_
 
   int M_;   // number of input feature (channel)
   int W_;   // effective width   (<= pad_width_)
@@ -158,6 +158,8 @@ BOOST_PYTHON_MODULE(_caffe) {
       .def("_forward",              &PyNet::Forward)
       .def("_backward",             &PyNet::Backward)
       .def("reshape",               &PyNet::Reshape)
+      .def("_unplan_blob",          &PyNet::UnplanBlob)
+      .def("unplan_memory",         &PyNet::UnplanMemory)
       .def("set_mode_cpu",          &PyNet::set_mode_cpu)
       .def("set_mode_gpu",          &PyNet::set_mode_gpu)
       .def("set_phase_train",       &PyNet::set_phase_train)
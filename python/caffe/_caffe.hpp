@@ -107,6 +107,9 @@ class PyNet {
   void Forward(int start, int end) { net_->ForwardFromTo(start, end); }
   void Backward(int start, int end) { net_->BackwardFromTo(start, end); }
   void Reshape() { net_->Reshape(); }
+  // See NetParameter.plan_memory.
+  void UnplanBlob(const string& name) { net_->blob_by_name(name); }
+  void UnplanMemory() { net_->UnplanMemory(); }
 
   void set_input_arrays(bp::object data_obj, bp::object labels_obj);
 
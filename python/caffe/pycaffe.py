@@ -77,6 +77,9 @@ def _Net_forward(self, blobs=None, start=None, end=None, **kwargs):
                 raise Exception('Input is not batch sized')
             self.blobs[in_].data[...] = blob
 
+    # The requested blobs keep their values when the net plans its memory.
+    for blob in blobs:
+        self._unplan_blob(blob)
     self._forward(start_ind, end_ind)
 
     # Unpack blobs to extract
@@ -24,6 +24,7 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
   height_ = height;
   width_ = width;
   count_ = num_ * channels_ * height_ * width_;
+  channels_last_ = false;
   if (count_ > capacity_) {
     capacity_ = count_;
     data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
@@ -33,14 +34,17 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
 
 template <typename Dtype>
 void Blob<Dtype>::ReshapeLike(const Blob<Dtype>& other) {
+  // Read first: other may be this blob (in-place layers).
+  const bool channels_last = other.channels_last();
   Reshape(other.num(), other.channels(), other.height(), other.width());
+  channels_last_ = channels_last;
 }
 
 template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
     const int width)
   // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  : capacity_(0), channels_last_(false) {
   Reshape(num, channels, height, width);
 }
 
@@ -222,6 +226,12 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
       LOG(FATAL) << "Trying to copy blobs of different sizes.";
     }
   }
+  if (reshape) {
+    channels_last_ = source.channels_last();
+  } else {
+    CHECK_EQ(channels_last_, source.channels_last())
+        << "Trying to copy blobs of different layouts.";
+  }
   switch (Caffe::mode()) {
   case Caffe::GPU:
     if (copy_diff) {
@@ -251,8 +261,22 @@ void Blob<Dtype>::FromProto(const BlobProto& proto) {
   Reshape(proto.num(), proto.channels(), proto.height(), proto.width());
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    data_vec[i] = proto.data(i);
+  if (proto.data_size() == 0 && proto.has_int8_data()) {
+    // dequantize the weights of an int8-quantized layer
+    const int rows = proto.int8_scale_size();
+    CHECK_GT(rows, 0) << "int8_data given without int8_scale";
+    CHECK_EQ(proto.int8_data().size(), count_);
+    CHECK_EQ(count_ % rows, 0);
+    const int cols = count_ / rows;
+    const signed char* q =
+        reinterpret_cast<const signed char*>(proto.int8_data().data());
+    for (int i = 0; i < count_; ++i) {
+      data_vec[i] = proto.int8_scale(i / cols) * q[i];
+    }
+  } else {
+    for (int i = 0; i < count_; ++i) {
+      data_vec[i] = proto.data(i);
+    }
   }
   if (proto.diff_size() > 0) {
     Dtype* diff_vec = mutable_cpu_diff();
@@ -327,7 +351,7 @@ template <> enum matio_classes matio_class_map<int>() { return MAT_C_INT32; }
 template <> enum matio_classes matio_class_map<unsigned int>() { return MAT_C_UINT32; }
 
 template <typename Dtype>
-void Blob<Dtype>::FromMat(const char *fname) {
+void Blob<Dtype>::FromMat(const char *fname, bool reshape) {
   mat_t *matfp;
   matfp = Mat_Open(fname, MAT_ACC_RDONLY);
   CHECK(matfp) << "Error opening MAT file " << fname;
@@ -339,10 +363,19 @@ void Blob<Dtype>::FromMat(const char *fname) {
     CHECK_EQ(matvar->class_type, matio_class_map<Dtype>())
       << "Field 'data' must be of the right class (single/double) in MAT file " << fname;
     CHECK(matvar->rank < 5) << "Field 'data' cannot have ndims > 4 in MAT file " << fname;
-    Reshape((matvar->rank > 3) ? matvar->dims[3] : 1,
-	    (matvar->rank > 2) ? matvar->dims[2] : 1,
-	    (matvar->rank > 1) ? matvar->dims[1] : 1,
-	    (matvar->rank > 0) ? matvar->dims[0] : 0);
+    const int num      = (matvar->rank > 3) ? matvar->dims[3] : 1;
+    const int channels = (matvar->rank > 2) ? matvar->dims[2] : 1;
+    const int height   = (matvar->rank > 1) ? matvar->dims[1] : 1;
+    const int width    = (matvar->rank > 0) ? matvar->dims[0] : 0;
+    if (reshape) {
+      Reshape(num, channels, height, width);
+    } else {
+      CHECK(num == num_ && channels == channels_ && height == height_
+	    && width == width_) << "Field 'data' in MAT file " << fname
+	<< " is " << num << "x" << channels << "x" << height << "x" << width
+	<< ", expected " << num_ << "x" << channels_ << "x" << height_
+	<< "x" << width_;
+    }
     Dtype* data = mutable_cpu_data();
     int ret = Mat_VarReadDataLinear(matfp, matvar, data, 0, 1, count());	 
     CHECK(ret == 0) << "Error reading array 'data' from MAT file " << fname;
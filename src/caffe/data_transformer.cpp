@@ -3,6 +3,9 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #endif
 
+#include <boost/random.hpp>
+
+#include <cmath>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -305,19 +308,38 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   }
 }
 
+// The source taps of destination coordinate x of a resize from n pixels by
+// 1 / inv_scale, as cv::resize takes them: the two neighbors and the weight
+// of the second for INTER_LINEAR, and the source for INTER_NEAREST.
+static void ResizeTaps(const int x, const float inv_scale, const int n,
+    int* x0, int* x1, float* lambda, int* nearest) {
+  const float fx = std::max(0.f, (x + 0.5f) * inv_scale - 0.5f);
+  *x0 = std::min(static_cast<int>(fx), n - 1);
+  *x1 = std::min(*x0 + 1, n - 1);
+  *lambda = fx - *x0;
+  *nearest = std::min(static_cast<int>(x * inv_scale), n - 1);
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::TransformImgAndSeg(const std::vector<cv::Mat>& cv_img_seg,
   Blob<Dtype>* transformed_data_blob, Blob<Dtype>* transformed_label_blob, const int ignore_label) {
+  TransformImgAndSeg(cv_img_seg, transformed_data_blob, transformed_label_blob,
+      ignore_label, rng_.get());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformImgAndSeg(const std::vector<cv::Mat>& cv_img_seg,
+  Blob<Dtype>* transformed_data_blob, Blob<Dtype>* transformed_label_blob,
+  const int ignore_label, Caffe::RNG* rng) {
   CHECK(cv_img_seg.size() == 2) << "Input must contain image and seg.";
 
   const int img_channels = cv_img_seg[0].channels();
-  // height and width may change due to pad for cropping
-  int img_height   = cv_img_seg[0].rows;
-  int img_width    = cv_img_seg[0].cols;
+  const int img_height   = cv_img_seg[0].rows;
+  const int img_width    = cv_img_seg[0].cols;
 
   const int seg_channels = cv_img_seg[1].channels();
-  int seg_height   = cv_img_seg[1].rows;
-  int seg_width    = cv_img_seg[1].cols;
+  const int seg_height   = cv_img_seg[1].rows;
+  const int seg_width    = cv_img_seg[1].cols;
 
   const int data_channels = transformed_data_blob->channels();
   const int data_height   = transformed_data_blob->height();
@@ -336,132 +358,193 @@ void DataTransformer<Dtype>::TransformImgAndSeg(const std::vector<cv::Mat>& cv_i
   CHECK_EQ(data_height, label_height);
   CHECK_EQ(data_width, label_width);
 
-  CHECK(cv_img_seg[0].depth() == CV_8U) << "Image data type must be unsigned byte";
-  CHECK(cv_img_seg[1].depth() == CV_8U) << "Seg data type must be unsigned byte";
-
   const int crop_size = param_.crop_size();
   const Dtype scale = param_.scale();
-  const bool do_mirror = param_.mirror() && Rand(2);
+  const bool do_mirror = param_.mirror() && Rand(2, rng);
   const bool has_mean_file = param_.has_mean_file();
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(img_channels, 0);
 
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   if (has_mean_file) {
     CHECK_EQ(img_channels, data_mean_.channels());
     CHECK_EQ(img_height, data_mean_.height());
     CHECK_EQ(img_width, data_mean_.width());
-    mean = data_mean_.mutable_cpu_data();
+    mean = data_mean_.cpu_data();
   }
+  // Replicate the mean_value into a local copy, so that concurrent calls do
+  // not modify mean_values_.
+  vector<Dtype> mean_values(mean_values_);
   if (has_mean_values) {
-    CHECK(mean_values_.size() == 1 || mean_values_.size() == img_channels) <<
+    CHECK(mean_values.size() == 1 || mean_values.size() == img_channels) <<
      "Specify either 1 mean_value or as many as channels: " << img_channels;
-    if (img_channels > 1 && mean_values_.size() == 1) {
-      // Replicate the mean_value for simplicity
-      for (int c = 1; c < img_channels; ++c) {
-        mean_values_.push_back(mean_values_[0]);
-      }
+    if (img_channels > 1 && mean_values.size() == 1) {
+      mean_values.resize(img_channels, mean_values[0]);
     }
   }
  
-  int h_off = 0;
-  int w_off = 0;
-  cv::Mat cv_cropped_img = cv_img_seg[0];  
-  cv::Mat cv_cropped_seg = cv_img_seg[1];
-  
-  // transform to double, since we will pad mean pixel values
-  cv_cropped_img.convertTo(cv_cropped_img, CV_64F);
-
-  // Check if we need to pad img to fit for crop_size
-  // copymakeborder
-  int pad_height = std::max(crop_size - img_height, 0);
-  int pad_width  = std::max(crop_size - img_width, 0);
-  if (pad_height > 0 || pad_width > 0) {
-    cv::copyMakeBorder(cv_cropped_img, cv_cropped_img, 0, pad_height, 
-          0, pad_width, cv::BORDER_CONSTANT, 
-          cv::Scalar(mean_values_[0], mean_values_[1], mean_values_[2]));
-    cv::copyMakeBorder(cv_cropped_seg, cv_cropped_seg, 0, pad_height, 
-          0, pad_width, cv::BORDER_CONSTANT, 
-		       cv::Scalar(ignore_label));
-    // update height/width
-    img_height   = cv_cropped_img.rows;
-    img_width    = cv_cropped_img.cols;
-
-    seg_height   = cv_cropped_seg.rows;
-    seg_width    = cv_cropped_seg.cols;
+  CHECK(cv_img_seg[0].data);
+  CHECK(cv_img_seg[1].data);
+  // The window is converted straight from the uint8 pixels below.
+  CHECK_EQ(cv_img_seg[0].depth(), CV_8U) << "Image data type must be unsigned byte";
+  CHECK_EQ(cv_img_seg[1].depth(), CV_8U) << "Seg data type must be unsigned byte";
+
+  // Random scale augmentation: the pair is virtually resized to
+  // scaled_height x scaled_width, and only the pixels of the crop window
+  // picked below are interpolated.
+  int scaled_height = img_height;
+  int scaled_width  = img_width;
+  if (phase_ == Caffe::TRAIN && DoesScale()) {
+    CHECK(!has_mean_file) << "Scale augmentation does not support mean file";
+    CHECK_GT(param_.min_scale_factor(), 0);
+    CHECK_GE(param_.max_aspect_ratio(), 1);
+    const float scale_factor = RandUniform(param_.min_scale_factor(),
+        param_.max_scale_factor(), rng);
+    const float log_aspect = std::log(param_.max_aspect_ratio());
+    const float stretch = std::sqrt(std::exp(
+        RandUniform(-log_aspect, log_aspect, rng)));
+    scaled_height = std::max(1,
+        static_cast<int>(img_height * scale_factor / stretch + 0.5f));
+    scaled_width  = std::max(1,
+        static_cast<int>(img_width * scale_factor * stretch + 0.5f));
   }
+  const bool do_scale =
+      scaled_height != img_height || scaled_width != img_width;
 
-  // crop img/seg
+  // Pick the crop window first. An image smaller than the window is padded
+  // at the bottom and right, as if by copyMakeBorder: with the mean for the
+  // image (i.e. zero after mean subtraction) and with ignore_label for seg.
+  int h_off = 0;
+  int w_off = 0;
   if (crop_size) {
-    CHECK_EQ(crop_size, data_height);
-    CHECK_EQ(crop_size, data_width);    
+    if (phase_ == Caffe::TRAIN) {
+      CHECK_EQ(crop_size, data_height);
+      CHECK_EQ(crop_size, data_width);
+    } else {
+      // The window may be cut short at the bottom and right when the
+      // batch is only padded to the size of its images (bucket_stride).
+      CHECK_GE(crop_size, data_height);
+      CHECK_GE(crop_size, data_width);
+    }
+    const int pad_height = std::max(scaled_height, crop_size);
+    const int pad_width  = std::max(scaled_width, crop_size);
     // We only do random crop when we do training.
     if (phase_ == Caffe::TRAIN) {
-      h_off = Rand(img_height - crop_size + 1);
-      w_off = Rand(img_width - crop_size + 1);
+      h_off = Rand(pad_height - crop_size + 1, rng);
+      w_off = Rand(pad_width - crop_size + 1, rng);
     } else {
       // CHECK: use middle crop
-      h_off = (img_height - crop_size) / 2;
-      w_off = (img_width - crop_size) / 2;
+      h_off = (pad_height - crop_size) / 2;
+      w_off = (pad_width - crop_size) / 2;
     }
-    cv::Rect roi(w_off, h_off, crop_size, crop_size);
-    cv_cropped_img = cv_cropped_img(roi);
-    cv_cropped_seg = cv_cropped_seg(roi);
-  } 
-  
-  CHECK(cv_cropped_img.data);
-  CHECK(cv_cropped_seg.data);
+  }
+  // Rows and columns of the window that fall inside the image.
+  const int valid_height =
+      std::max(0, std::min(data_height, scaled_height - h_off));
+  const int valid_width  =
+      std::max(0, std::min(data_width, scaled_width - w_off));
+
+  // Source taps of the valid columns when rescaling.
+  const float inv_scale_y = static_cast<float>(img_height) / scaled_height;
+  const float inv_scale_x = static_cast<float>(img_width) / scaled_width;
+  vector<int> x0, x1, x_nearest;
+  vector<float> x_lambda;
+  if (do_scale) {
+    x0.resize(valid_width);
+    x1.resize(valid_width);
+    x_nearest.resize(valid_width);
+    x_lambda.resize(valid_width);
+    for (int w = 0; w < valid_width; ++w) {
+      ResizeTaps(w_off + w, inv_scale_x, img_width, &x0[w], &x1[w],
+          &x_lambda[w], &x_nearest[w]);
+      x0[w] *= img_channels;
+      x1[w] *= img_channels;
+    }
+  }
 
   Dtype* transformed_data  = transformed_data_blob->mutable_cpu_data();
   Dtype* transformed_label = transformed_label_blob->mutable_cpu_data();
 
-  int top_index;
-  const double* data_ptr;
-  const uchar* label_ptr;
-
+  // Convert the uint8 pixels of the window straight into the planar output,
+  // fusing the resize, mean subtraction, scaling and mirroring. The pad is
+  // written as zero data and ignore_label.
+  const int data_plane = data_height * data_width;
+  const int mirror_step = do_mirror ? -1 : 1;
   for (int h = 0; h < data_height; ++h) {
-    data_ptr = cv_cropped_img.ptr<double>(h);
-    label_ptr = cv_cropped_seg.ptr<uchar>(h);
-
-    int data_index = 0;
-    int label_index = 0;
-
-    for (int w = 0; w < data_width; ++w) {
-      // for image
-      for (int c = 0; c < img_channels; ++c) {
-	if (do_mirror) {
-          top_index = (c * data_height + h) * data_width + (data_width - 1 - w);
-        } else {
-          top_index = (c * data_height + h) * data_width + w;
+    const int out_begin = do_mirror ? (h + 1) * data_width - 1 : h * data_width;
+    const int out_pad = h * data_width + (do_mirror ? 0 : valid_width);
+    if (h >= valid_height) {
+      caffe_set(data_width, Dtype(0), transformed_data + h * data_width);
+      for (int c = 1; c < img_channels; ++c) {
+        caffe_set(data_width, Dtype(0),
+            transformed_data + c * data_plane + h * data_width);
+      }
+      caffe_set(data_width, Dtype(ignore_label),
+          transformed_label + h * data_width);
+      continue;
+    }
+    const uchar* img_ptr;
+    const uchar* seg_ptr;
+    const uchar* img_ptr1 = NULL;
+    float y_lambda = 0;
+    if (do_scale) {
+      int y0, y1, y_nearest;
+      ResizeTaps(h_off + h, inv_scale_y, img_height, &y0, &y1, &y_lambda,
+          &y_nearest);
+      img_ptr  = cv_img_seg[0].ptr<uchar>(y0);
+      img_ptr1 = cv_img_seg[0].ptr<uchar>(y1);
+      seg_ptr  = cv_img_seg[1].ptr<uchar>(y_nearest);
+    } else {
+      img_ptr = cv_img_seg[0].ptr<uchar>(h_off + h) + w_off * img_channels;
+      seg_ptr = cv_img_seg[1].ptr<uchar>(h_off + h) + w_off;
+    }
+    for (int c = 0; c < img_channels; ++c) {
+      Dtype* out = transformed_data + c * data_plane + out_begin;
+      const Dtype mean_c = has_mean_values ? mean_values[c] : Dtype(0);
+      if (do_scale) {
+        const uchar* in0 = img_ptr + c;
+        const uchar* in1 = img_ptr1 + c;
+        for (int w = 0; w < valid_width; ++w) {
+          const float top =
+              in0[x0[w]] + x_lambda[w] * (in0[x1[w]] - in0[x0[w]]);
+          const float bottom =
+              in1[x0[w]] + x_lambda[w] * (in1[x1[w]] - in1[x0[w]]);
+          out[w * mirror_step] =
+              (static_cast<Dtype>(top + y_lambda * (bottom - top)) - mean_c) *
+              scale;
         }
-        Dtype pixel = static_cast<Dtype>(data_ptr[data_index++]);
-        if (has_mean_file) {
-          int mean_index = (c * img_height + h_off + h) * img_width + w_off + w;
-          transformed_data[top_index] =
-            (pixel - mean[mean_index]) * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] =
-              (pixel - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = pixel * scale;
-          }
+      } else if (has_mean_file) {
+        const uchar* in = img_ptr + c;
+        const Dtype* mean_row =
+            mean + (c * img_height + h_off + h) * img_width + w_off;
+        for (int w = 0; w < valid_width; ++w) {
+          out[w * mirror_step] =
+              (static_cast<Dtype>(in[w * img_channels]) - mean_row[w]) * scale;
         }
-      }
-
-      // for segmentation
-      if (do_mirror) {
-	top_index = h * data_width + data_width - 1 - w;
       } else {
-	top_index = h * data_width + w;
+        const uchar* in = img_ptr + c;
+        for (int w = 0; w < valid_width; ++w) {
+          out[w * mirror_step] =
+              (static_cast<Dtype>(in[w * img_channels]) - mean_c) * scale;
+        }
       }
-      Dtype pixel = static_cast<Dtype>(label_ptr[label_index++]);
-      transformed_label[top_index] = pixel;
+      caffe_set(data_width - valid_width, Dtype(0),
+          transformed_data + c * data_plane + out_pad);
     }
-
+    Dtype* out = transformed_label + out_begin;
+    if (do_scale) {
+      for (int w = 0; w < valid_width; ++w) {
+        out[w * mirror_step] = static_cast<Dtype>(seg_ptr[x_nearest[w]]);
+      }
+    } else {
+      for (int w = 0; w < valid_width; ++w) {
+        out[w * mirror_step] = static_cast<Dtype>(seg_ptr[w]);
+      }
+    }
+    caffe_set(data_width - valid_width, Dtype(ignore_label),
+        transformed_label + out_pad);
   }
-
 }
 
 
@@ -571,7 +654,7 @@ void DataTransformer<Dtype>::Transform(Blob<Dtype>* input_blob,
 template <typename Dtype>
 void DataTransformer<Dtype>::InitRand() {
   const bool needs_rand = param_.mirror() ||
-      (phase_ == Caffe::TRAIN && param_.crop_size());
+      (phase_ == Caffe::TRAIN && (param_.crop_size() || DoesScale()));
   if (needs_rand) {
     const unsigned int rng_seed = caffe_rng_rand();
     rng_.reset(new Caffe::RNG(rng_seed));
@@ -589,6 +672,38 @@ int DataTransformer<Dtype>::Rand(int n) {
   return ((*rng)() % n);
 }
 
+template <typename Dtype>
+int DataTransformer<Dtype>::Rand(int n, Caffe::RNG* rng) {
+  CHECK(rng);
+  CHECK_GT(n, 0);
+  caffe::rng_t* generator = static_cast<caffe::rng_t*>(rng->generator());
+  return ((*generator)() % n);
+}
+
+template <typename Dtype>
+float DataTransformer<Dtype>::RandUniform(const float a, const float b,
+    Caffe::RNG* rng) {
+  CHECK(rng);
+  CHECK_LE(a, b);
+  if (a == b) {
+    return a;
+  }
+  boost::uniform_real<float> random_distribution(a, b);
+  boost::variate_generator<caffe::rng_t*, boost::uniform_real<float> >
+      variate_generator(static_cast<caffe::rng_t*>(rng->generator()),
+      random_distribution);
+  return variate_generator();
+}
+
+template <typename Dtype>
+unsigned int DataTransformer<Dtype>::RandSeed() {
+  if (!rng_) {
+    return 0;
+  }
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(rng_->generator());
+  return (*rng)();
+}
+
 
 
 
@@ -5,7 +5,7 @@
 namespace caffe {
 
 InternalThread::~InternalThread() {
-  WaitForInternalThreadToExit();
+  StopInternalThread();
   if (thread_ != NULL) {
     delete thread_;
   }
@@ -15,6 +15,10 @@ bool InternalThread::StartInternalThread() {
   if (!WaitForInternalThreadToExit()) {
     return false;
   }
+  if (thread_ != NULL) {
+    delete thread_;
+    thread_ = NULL;
+  }
   try {
     thread_ = new caffe::Thread
         (&InternalThread::InternalThreadEntry, this);
@@ -36,4 +40,15 @@ bool InternalThread::WaitForInternalThreadToExit() {
   return true;
 }
 
+bool InternalThread::StopInternalThread() {
+  if (is_started()) {
+    thread_->interrupt();
+  }
+  return WaitForInternalThreadToExit();
+}
+
+bool InternalThread::must_stop() {
+  return boost::this_thread::interruption_requested();
+}
+
 }  // namespace caffe
@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -28,16 +29,73 @@ void ArgMaxLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   // Produces max_ind and max_val if out_max_val_, otherwise only max_ind
   const int channels_out = (out_max_val_) ? 2 * top_k_ : top_k_;
   top[0]->Reshape(num_, channels_out, height_, width_);
+  top[0]->set_channels_last(bottom[0]->channels_last());
 }
 
+// Number of spatial positions handled together by the top_k = 1 path.
+static const int kArgMaxTile = 512;
+
 template <typename Dtype>
 void ArgMaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (top_k_ == 1) {
+    const Dtype* bottom_data = bottom[0]->cpu_data();
+    Dtype* top_data = top[0]->mutable_cpu_data();
+    const int spatial_dim = height_ * width_;
+    if (bottom[0]->channels_last()) {
+      // The channels of a position are contiguous: no tiling needed.
+      const int channels_out = top[0]->channels();
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+      for (int i = 0; i < num_ * spatial_dim; ++i) {
+        const Dtype* x = bottom_data + i * channels_;
+        int argmax = 0;
+        Dtype max_val = x[0];
+        for (int c = 1; c < channels_; ++c) {
+          if (x[c] >= max_val) {
+            max_val = x[c];
+            argmax = c;
+          }
+        }
+        Dtype* top_ind = top_data + i * channels_out;
+        top_ind[0] = argmax;
+        if (out_max_val_) {
+          top_ind[1] = max_val;
+        }
+      }
+      return;
+    }
+    const int num_tiles = (spatial_dim + kArgMaxTile - 1) / kArgMaxTile;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int t = 0; t < num_ * num_tiles; ++t) {
+      const int n = t / num_tiles;
+      const int k0 = (t % num_tiles) * kArgMaxTile;
+      const int size = std::min(kArgMaxTile, spatial_dim - k0);
+      int argmax[kArgMaxTile];
+      Dtype max_val[kArgMaxTile];
+      caffe_cpu_channel_argmax(channels_, spatial_dim, size,
+          bottom_data + bottom[0]->offset(n) + k0, argmax, max_val);
+      Dtype* top_ind = top_data + top[0]->offset(n) + k0;
+      for (int k = 0; k < size; ++k) {
+        top_ind[k] = argmax[k];
+      }
+      if (out_max_val_) {
+        std::copy(max_val, max_val + size, top_ind + spatial_dim);
+      }
+    }
+    return;
+  }
+  // Distance between the channels of a position, in either layout.
+  const int channel_offset = bottom[0]->channels_last() ? 1 : height_ * width_;
+  const int top_channel_offset =
+      top[0]->channels_last() ? 1 : height_ * width_;
   for (int n = 0; n < num_; ++n) {
     for (int h = 0; h < height_; ++h) {
       for (int w = 0; w < width_; ++w) {
 	const Dtype* bottom_data = bottom[0]->cpu_data(n, 0, h, w);
-	const int channel_offset = height_ * width_;
 	std::vector<std::pair<Dtype, int> > bottom_data_vector;
 	for (int c = 0; c < channels_; ++c) {
 	  bottom_data_vector.push_back(
@@ -48,9 +106,10 @@ void ArgMaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 	    bottom_data_vector.end(), std::greater<std::pair<Dtype, int> >());
 	Dtype* top_data = top[0]->mutable_cpu_data(n, 0, h, w);
 	for (int j = 0; j < top_k_; ++j) {
-	  top_data[j * channel_offset] = bottom_data_vector[j].second;
+	  top_data[j * top_channel_offset] = bottom_data_vector[j].second;
 	  if (out_max_val_) {
-	    top_data[(top_k_ + j) * channel_offset] = bottom_data_vector[j].first;
+	    top_data[(top_k_ + j) * top_channel_offset] =
+	        bottom_data_vector[j].first;
 	  }
 	}
       }
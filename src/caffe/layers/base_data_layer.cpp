@@ -1,3 +1,4 @@
+#include <boost/thread.hpp>
 #include <string>
 #include <vector>
 
@@ -26,17 +27,33 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   data_transformer_.InitRand();
 }
 
+template <typename Dtype>
+BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
+    const LayerParameter& param, const int prefetch_count)
+    : BaseDataLayer<Dtype>(param), prefetch_count_(prefetch_count),
+      prefetch_(new Batch<Dtype>[prefetch_count]), prefetch_current_(NULL) {
+  CHECK_GT(prefetch_count_, 0);
+  for (int i = 0; i < prefetch_count_; ++i) {
+    prefetch_free_.push(&prefetch_[i]);
+  }
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
-  // Now, start the prefetch thread. Before calling prefetch, we make two
+  // Now, start the prefetch thread. Before calling prefetch, we make
   // cpu_data calls so that the prefetch thread does not accidentally make
   // simultaneous cudaMalloc calls when the main thread is running. In some
   // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
-  if (this->output_labels_) {
-    this->prefetch_label_.mutable_cpu_data();
+  for (int i = 0; i < prefetch_count_; ++i) {
+    prefetch_[i].data_.mutable_cpu_data();
+    if (this->output_labels_) {
+      prefetch_[i].label_.mutable_cpu_data();
+    }
+    if (prefetch_[i].dim_.count()) {
+      prefetch_[i].dim_.mutable_cpu_data();
+    }
   }
   DLOG(INFO) << "Initializing prefetch";
   this->CreatePrefetchThread();
@@ -52,26 +69,44 @@ void BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread() {
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread() {
-  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  CHECK(StopInternalThread()) << "Thread joining failed";
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      Batch<Dtype>* batch = prefetch_free_.pop();
+      LoadBatch(batch);
+      prefetch_full_.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted while waiting for a free batch: the layer is being stopped.
+  }
+}
+
+template <typename Dtype>
+Batch<Dtype>* BasePrefetchingDataLayer<Dtype>::NextBatch() {
+  if (prefetch_current_) {
+    prefetch_free_.push(prefetch_current_);
+  }
+  prefetch_current_ = prefetch_full_.pop("Data layer prefetch queue empty");
+  return prefetch_current_;
 }
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  DLOG(INFO) << "Thread joined";
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             top[0]->mutable_cpu_data());
-  DLOG(INFO) << "Prefetch copied";
+  Batch<Dtype>* batch = NextBatch();
+  // Point the tops at the batch, which stays out of the free queue until
+  // the next call.
+  top[0]->ReshapeLike(batch->data_);
+  top[0]->set_cpu_data(batch->data_.mutable_cpu_data());
+  DLOG(INFO) << "Prefetch handed over";
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-               top[1]->mutable_cpu_data());
+    top[1]->ReshapeLike(batch->label_);
+    top[1]->set_cpu_data(batch->label_.mutable_cpu_data());
   }
-  // Start a new prefetch thread
-  DLOG(INFO) << "CreatePrefetchThread";
-  CreatePrefetchThread();
 }
 
   /* 
@@ -81,52 +116,24 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
 template <typename Dtype>
 void ImageDimPrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
   if (top.size() == 3) {
     output_data_dim_ = true;
   } else {
     output_data_dim_ = false;
   }
-  // Now, start the prefetch thread. Before calling prefetch, we make two
-  // cpu_data calls so that the prefetch thread does not accidentally make
-  // simultaneous cudaMalloc calls when the main thread is running. In some
-  // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
-  if (this->output_labels_) {
-    this->prefetch_label_.mutable_cpu_data();
-  }
-  if (output_data_dim_) {
-    prefetch_data_dim_.mutable_cpu_data();
-  }
-
-  DLOG(INFO) << "Initializing prefetch";
-  BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread();
-  DLOG(INFO) << "Prefetch initialized.";
+  BasePrefetchingDataLayer<Dtype>::LayerSetUp(bottom, top);
 }
 
 
 template <typename Dtype>
 void ImageDimPrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // First, join the thread
-  BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread();
-  DLOG(INFO) << "Thread joined";
-  // Copy the data
-  caffe_copy(this->prefetch_data_.count(), this->prefetch_data_.cpu_data(),
-             top[0]->mutable_cpu_data());
-  DLOG(INFO) << "Prefetch copied";
-  if (this->output_labels_) {
-    caffe_copy(this->prefetch_label_.count(), this->prefetch_label_.cpu_data(),
-               top[1]->mutable_cpu_data());
-  }
+  BasePrefetchingDataLayer<Dtype>::Forward_cpu(bottom, top);
   if (output_data_dim_) {
-    caffe_copy(prefetch_data_dim_.count(), prefetch_data_dim_.cpu_data(),
-	       top[2]->mutable_cpu_data());
+    Batch<Dtype>* batch = this->prefetch_current_;
+    top[2]->ReshapeLike(batch->dim_);
+    top[2]->set_cpu_data(batch->dim_.mutable_cpu_data());
   }
-
-  // Start a new prefetch thread
-  DLOG(INFO) << "CreatePrefetchThread";
-  BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread();
 }
 
 
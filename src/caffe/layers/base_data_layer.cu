@@ -7,17 +7,16 @@ namespace caffe {
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // First, join the thread
-  JoinPrefetchThread();
+  Batch<Dtype>* batch = NextBatch();
   // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
+  top[0]->ReshapeLike(batch->data_);
+  caffe_copy(batch->data_.count(), batch->data_.cpu_data(),
       top[0]->mutable_gpu_data());
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
+    top[1]->ReshapeLike(batch->label_);
+    caffe_copy(batch->label_.count(), batch->label_.cpu_data(),
         top[1]->mutable_gpu_data());
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
 }
 
   /*
@@ -27,22 +26,13 @@ void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
 template <typename Dtype>
 void ImageDimPrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // First, join the thread
-  BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(this->prefetch_data_.count(), this->prefetch_data_.cpu_data(),
-	     top[0]->mutable_gpu_data());
-  if (this->output_labels_) {
-    caffe_copy(this->prefetch_label_.count(), this->prefetch_label_.cpu_data(),
-	       top[1]->mutable_gpu_data());
-  }
+  BasePrefetchingDataLayer<Dtype>::Forward_gpu(bottom, top);
   if (output_data_dim_) {
-    caffe_copy(prefetch_data_dim_.count(), prefetch_data_dim_.cpu_data(),
+    Batch<Dtype>* batch = this->prefetch_current_;
+    top[2]->ReshapeLike(batch->dim_);
+    caffe_copy(batch->dim_.count(), batch->dim_.cpu_data(),
 	       top[2]->mutable_gpu_data());
   }
-
-  // Start a new prefetch thread
-  BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread();
 }
 
 
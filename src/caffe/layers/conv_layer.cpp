@@ -61,6 +61,15 @@ void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // and no padding or holes, so flag for skipping the buffer and transformation.
   is_1x1_ = kernel_w_ == 1 && kernel_h_ == 1  && stride_h_ == 1 && stride_w_ == 1
     && pad_h_ == 0 && pad_w_ == 0 && hole_h_ == 1 && hole_w_ == 1;
+  // Run the holes as dense convolutions of subimages if asked to.
+  space_to_batch_ = (hole_h_ > 1 || hole_w_ > 1) && conv_param.hole_mode() ==
+      ConvolutionParameter_HoleMode_SPACE_TO_BATCH;
+  if (space_to_batch_) {
+    CHECK(stride_h_ == 1 && stride_w_ == 1)
+        << "SPACE_TO_BATCH hole_mode requires stride 1.";
+  }
+  im2col_index_height_ = im2col_index_width_ = -1;
+  col_retained_valid_ = false;
   // Configure output channels and groups.
   channels_ = bottom[0]->channels();
   num_output_ = this->layer_param_.convolution_param().num_output();
@@ -99,6 +108,13 @@ void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // Set up the int8 engine; the weights are quantized on the first forward
+  // pass after they change, e.g. once the trained weights are copied in.
+  const QuantizationParameter& quant_param =
+      this->layer_param_.quantization_param();
+  if (quant_param.precision() == QuantizationParameter_Precision_INT8) {
+    int8_gemm_.reset(new Int8Gemm<Dtype>(quant_param));
+  }
 }
 
 template <typename Dtype>
@@ -135,10 +151,74 @@ void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   // The im2col result buffer will only hold one image at a time to avoid
   // overly large memory usage. In the special case of 1x1 convolution
   // it goes lazily unused to save memory.
-  col_buffer_.Reshape(
-      1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  if (bottom[0]->channels_last()) {
+    // Channel-last inputs are unrolled whole, one row per output position
+    // (see Forward_channels_last_cpu).
+    CHECK_EQ(group_, 1) << "Channel-last convolution needs group 1.";
+    CHECK(!int8_gemm_) << "Channel-last convolution does not support int8.";
+    col_buffer_.Reshape(
+        1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  } else if (space_to_batch_) {
+    // Every subimage gathers one phase of the holes from the padded input,
+    // which makes the subimages large enough to give all of the outputs of
+    // their phase (and a few unused ones, for the shorter phases).
+    height_sub_ = (height_ + 2 * pad_h_ + hole_h_ - 1) / hole_h_;
+    width_sub_ = (width_ + 2 * pad_w_ + hole_w_ - 1) / hole_w_;
+    height_sub_out_ = height_sub_ - kernel_h_ + 1;
+    width_sub_out_ = width_sub_ - kernel_w_ + 1;
+    sub_buffer_.Reshape(hole_h_ * hole_w_, channels_, height_sub_, width_sub_);
+    sub_top_buffer_.Reshape(hole_h_ * hole_w_, num_output_, height_sub_out_,
+        width_sub_out_);
+    col_buffer_.Reshape(1, channels_ * kernel_h_ * kernel_w_,
+        height_sub_out_, width_sub_out_);
+  } else {
+    col_buffer_.Reshape(
+        1, channels_ * kernel_h_ * kernel_w_, height_out_, width_out_);
+  }
+  // (Re)build the im2col gather table if the input shape has changed.
+  if (this->layer_param_.convolution_param().im2col_table() && !is_1x1_ &&
+      (height_ != im2col_index_height_ || width_ != im2col_index_width_)) {
+    im2col_index_height_ = height_;
+    im2col_index_width_ = width_;
+    const size_t table_size = col_buffer_.count() * sizeof(int);
+    if (table_size > this->layer_param_.convolution_param()
+        .im2col_table_max_size()) {
+      LOG(INFO) << "Skipping the im2col table of " << table_size
+          << " bytes; unrolling with coordinate arithmetic.";
+      vector<int>().swap(im2col_index_);
+    } else if (space_to_batch_) {
+      im2col_index_.resize(col_buffer_.count());
+      im2col_index(channels_, height_sub_, width_sub_, kernel_h_, kernel_w_,
+          0, 0, 1, 1, 1, 1, &im2col_index_[0]);
+    } else {
+      im2col_index_.resize(col_buffer_.count());
+      im2col_index(channels_, height_, width_, kernel_h_, kernel_w_,
+          pad_h_, pad_w_, stride_h_, stride_w_, hole_h_, hole_w_,
+          &im2col_index_[0]);
+    }
+  }
+  // Keep the column buffers of the whole batch for the backward pass if
+  // they fit in the budget; they are only allocated on first use.
+  const int num_col = bottom.size() * num_ *
+      (space_to_batch_ ? hole_h_ * hole_w_ : 1);
+  const size_t retained_size =
+      static_cast<size_t>(num_col) * col_buffer_.count() * sizeof(Dtype);
+  retain_col_buffer_ = this->layer_param_.convolution_param()
+      .retain_col_buffer() && !is_1x1_;
+  if (retain_col_buffer_ && retained_size > this->layer_param_
+      .convolution_param().retain_col_buffer_max_size()) {
+    LOG(INFO) << "Not retaining " << retained_size << " bytes of column "
+        << "buffers; backward will recompute them.";
+    retain_col_buffer_ = false;
+  }
+  if (retain_col_buffer_) {
+    col_retained_.Reshape(num_col, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  col_retained_valid_ = false;
   for (int top_id = 0; top_id < top.size(); ++top_id) {
     top[top_id]->Reshape(num_, num_output_, height_out_, width_out_);
+    top[top_id]->set_channels_last(bottom[top_id]->channels_last());
   }
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   if (bias_term_) {
@@ -147,9 +227,135 @@ void ConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::conv_im2col_cpu(const Dtype* data,
+    Dtype* col_buff) {
+  if (!im2col_index_.empty()) {
+    im2col_gather_cpu(data, &im2col_index_[0], col_buffer_.count(), col_buff);
+  } else if (space_to_batch_) {
+    im2col_cpu(data, 1, channels_, height_sub_, width_sub_,
+        kernel_h_, kernel_w_, 0, 0, 1, 1, 1, 1, col_buff);
+  } else {
+    im2col_cpu(data, 1, channels_, height_, width_,
+        kernel_h_, kernel_w_, pad_h_, pad_w_,
+        stride_h_, stride_w_, hole_h_, hole_w_, col_buff);
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* col_buff,
+    const Dtype* weight, Dtype* output, const int N) {
+  const int weight_offset = M_ * K_;
+  const int col_offset = K_ * N;
+  const int output_offset = M_ * N;
+  if (int8_gemm_) {
+    // Quantized inner products for groups, with the bias folded in.
+    const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+    for (int g = 0; g < group_; ++g) {
+      int8_gemm_->Forward(M_ * g, M_, N, col_buff + col_offset * g, false,
+          bias ? bias + M_ * g : NULL, output + output_offset * g, false);
+    }
+    return;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N, K_,
+        (Dtype)1., weight + weight_offset * g, col_buff + col_offset * g,
+        (Dtype)0., output + output_offset * g);
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* col_buff,
+    const Dtype* output_diff, Dtype* weight_diff, const int N) {
+  const int weight_offset = M_ * K_;
+  const int col_offset = K_ * N;
+  const int output_offset = M_ * N;
+  // Note that we will accumulate diffs.
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N,
+        (Dtype)1., output_diff + output_offset * g,
+        col_buff + col_offset * g, (Dtype)1.,
+        weight_diff + weight_offset * g);
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output_diff,
+    const Dtype* weight, Dtype* col_buff, const int N) {
+  const int weight_offset = M_ * K_;
+  const int col_offset = K_ * N;
+  const int output_offset = M_ * N;
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N, M_,
+        (Dtype)1., weight + weight_offset * g,
+        output_diff + output_offset * g,
+        (Dtype)0., col_buff + col_offset * g);
+  }
+}
+
+// A channel-last image of H x W positions by C channels is a HW x C matrix:
+// the output is the unrolled input times the transposed (kh, kw, c) filters,
+// directly in channel-last order.
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Forward_channels_last_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int kernel_dim = kernel_h_ * kernel_w_;
+  const shared_ptr<SyncedMemory>& weight_memory = this->blobs_[0]->data();
+  if (weight_memory != weight_channels_last_memory_ ||
+      weight_memory->version() != weight_channels_last_version_ ||
+      weight_channels_last_.count() != this->blobs_[0]->count()) {
+    const Dtype* weight = this->blobs_[0]->cpu_data();
+    weight_channels_last_.Reshape(num_output_, kernel_h_, kernel_w_,
+        channels_);
+    Dtype* weight_cl = weight_channels_last_.mutable_cpu_data();
+    for (int m = 0; m < num_output_; ++m) {
+      for (int c = 0; c < channels_; ++c) {
+        for (int k = 0; k < kernel_dim; ++k) {
+          weight_cl[(m * kernel_dim + k) * channels_ + c] =
+              weight[(m * channels_ + c) * kernel_dim + k];
+        }
+      }
+    }
+    // Read after cpu_data(), which may sync but does not count as a change.
+    weight_channels_last_memory_ = weight_memory;
+    weight_channels_last_version_ = weight_memory->version();
+  }
+  const Dtype* weight_cl = weight_channels_last_.cpu_data();
+  const bool identity = kernel_dim == 1 && stride_h_ == 1 && stride_w_ == 1 &&
+      pad_h_ == 0 && pad_w_ == 0;
+  for (int i = 0; i < bottom.size(); ++i) {
+    CHECK(bottom[i]->channels_last())
+        << "Inputs must all have the same layout.";
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < num_; ++n) {
+      const Dtype* col_buff = bottom_data + bottom[i]->offset(n);
+      if (!identity) {
+        im2col_channels_last_cpu(col_buff, channels_, height_, width_,
+            kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+            hole_h_, hole_w_, col_buffer_.mutable_cpu_data());
+        col_buff = col_buffer_.cpu_data();
+      }
+      Dtype* output = top_data + top[i]->offset(n);
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, N_, num_output_, K_,
+          (Dtype)1., col_buff, weight_cl, (Dtype)0., output);
+      if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, N_, num_output_, 1,
+            (Dtype)1., bias_multiplier_.cpu_data(),
+            this->blobs_[1]->cpu_data(), (Dtype)1., output);
+      }
+    }
+  }
+  col_retained_valid_ = false;
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (bottom[0]->channels_last()) {
+    Forward_channels_last_cpu(bottom, top);
+    return;
+  }
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
@@ -157,42 +363,65 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     if (!is_1x1_) {
       col_buff = col_buffer_.mutable_cpu_data();
     }
+    // Only retain the columns when there is a backward pass to use them.
+    const bool retain = retain_col_buffer_ && Caffe::phase() == Caffe::TRAIN;
+    const int num_sub = hole_h_ * hole_w_;
     const Dtype* weight = this->blobs_[0]->cpu_data();
-    int weight_offset = M_ * K_;  // number of filter parameters in a group
-    int col_offset = K_ * N_;  // number of values in an input region / column
-    int top_offset = M_ * N_;  // number of values in an output region / column
+    if (int8_gemm_) {
+      int8_gemm_->UpdateWeights(num_output_, K_, *this->blobs_[0]);
+    }
     for (int n = 0; n < num_; ++n) {
-      // im2col transformation: unroll input regions for filtering
-      // into column matrix for multplication.
-      if (!is_1x1_) {
-        im2col_cpu(bottom_data + bottom[i]->offset(n),
-            1, channels_, height_, width_,
-            kernel_h_, kernel_w_, pad_h_, pad_w_,
-	    stride_h_, stride_w_, hole_h_, hole_w_,
-            col_buff);
-      } else {  // special case for 1x1 convolution
-        col_buff = bottom[i]->mutable_cpu_data() + bottom[i]->offset(n);
+      if (retain) {
+        col_buff = col_retained_.mutable_cpu_data() +
+            col_retained_.offset((i * num_ + n) * num_sub);
       }
-      // Take inner products for groups.
-      for (int g = 0; g < group_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-          (Dtype)1., weight + weight_offset * g, col_buff + col_offset * g,
-          (Dtype)0., top_data + top[i]->offset(n) + top_offset * g);
+      if (space_to_batch_) {
+        // Convolve the dense subimages one at a time and interleave the
+        // results back into the output.
+        Dtype* sub_data = sub_buffer_.mutable_cpu_data();
+        Dtype* sub_top_data = sub_top_buffer_.mutable_cpu_data();
+        space_to_batch_cpu(bottom_data + bottom[i]->offset(n),
+            channels_, height_, width_, pad_h_, pad_w_, hole_h_, hole_w_,
+            height_sub_, width_sub_, sub_data);
+        const int N_sub = height_sub_out_ * width_sub_out_;
+        for (int s = 0; s < num_sub; ++s) {
+          Dtype* sub_col_buff = retain ?
+              col_buff + col_buffer_.count() * s : col_buff;
+          conv_im2col_cpu(sub_data + sub_buffer_.offset(s), sub_col_buff);
+          forward_cpu_gemm(sub_col_buff, weight,
+              sub_top_data + sub_top_buffer_.offset(s), N_sub);
+        }
+        batch_to_space_cpu(sub_top_data, num_output_, height_out_,
+            width_out_, 0, 0, hole_h_, hole_w_, height_sub_out_,
+            width_sub_out_, top_data + top[i]->offset(n));
+      } else {
+        // im2col transformation: unroll input regions for filtering
+        // into column matrix for multplication.
+        if (!is_1x1_) {
+          conv_im2col_cpu(bottom_data + bottom[i]->offset(n), col_buff);
+        } else {  // special case for 1x1 convolution
+          col_buff = bottom[i]->mutable_cpu_data() + bottom[i]->offset(n);
+        }
+        // Take inner products for groups.
+        forward_cpu_gemm(col_buff, weight, top_data + top[i]->offset(n), N_);
       }
-      // Add bias.
-      if (bias_term_) {
+      // Add bias (the int8 path has folded it in already).
+      if (bias_term_ && !int8_gemm_) {
         caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
             N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
             bias_multiplier_.cpu_data(),
             (Dtype)1., top_data + top[i]->offset(n));
       }
     }
+    col_retained_valid_ = retain;
   }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!bottom[0]->channels_last())
+      << "Channel-last convolution is for inference only; no backward pass.";
   const Dtype* weight = NULL;
   Dtype* weight_diff = NULL;
   if (this->param_propagate_down_[0]) {
@@ -205,9 +434,6 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     bias_diff = this->blobs_[1]->mutable_cpu_diff();
     caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
   }
-  const int weight_offset = M_ * K_;
-  const int col_offset = K_ * N_;
-  const int top_offset = M_ * N_;
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = NULL;
     // Bias gradient, if necessary.
@@ -224,54 +450,92 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       if (!top_diff) {
         top_diff = top[i]->cpu_diff();
       }
+      if (weight == NULL) {
+        weight = this->blobs_[0]->cpu_data();
+      }
+      // The column data comes from the buffers retained by the forward pass
+      // if there are any; col_buff is the scratch for recomputing them and
+      // for the column gradients.
       Dtype* col_buff = NULL;
       if (!is_1x1_) {
         col_buff = col_buffer_.mutable_cpu_data();
       }
+      const int num_sub = hole_h_ * hole_w_;
+      const Dtype* col_data = col_buff;
       const Dtype* bottom_data = bottom[i]->cpu_data();
       Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
       for (int n = 0; n < num_; ++n) {
-        // Since we saved memory in the forward pass by not storing all col
-        // data, we will need to recompute them.
-        if (!is_1x1_) {
-          im2col_cpu(bottom_data + bottom[i]->offset(n),
-		     1, channels_, height_, width_,
-		     kernel_h_, kernel_w_, pad_h_, pad_w_,
-		     stride_h_, stride_w_, hole_h_, hole_w_,
-		     col_buff);
-        } else {
-          col_buff = bottom[i]->mutable_cpu_data() + bottom[i]->offset(n);
+        if (col_retained_valid_) {
+          col_data = col_retained_.cpu_data() +
+              col_retained_.offset((i * num_ + n) * num_sub);
+        }
+        if (space_to_batch_) {
+          // Gather the subimages and their output gradients, and
+          // backpropagate through the dense convolution of each subimage.
+          Dtype* sub_data = sub_buffer_.mutable_cpu_data();
+          Dtype* sub_diff = sub_buffer_.mutable_cpu_diff();
+          Dtype* sub_top_diff = sub_top_buffer_.mutable_cpu_diff();
+          if (!col_retained_valid_ && this->param_propagate_down_[0]) {
+            space_to_batch_cpu(bottom_data + bottom[i]->offset(n),
+                channels_, height_, width_, pad_h_, pad_w_, hole_h_, hole_w_,
+                height_sub_, width_sub_, sub_data);
+          }
+          space_to_batch_cpu(top_diff + top[i]->offset(n),
+              num_output_, height_out_, width_out_, 0, 0, hole_h_, hole_w_,
+              height_sub_out_, width_sub_out_, sub_top_diff);
+          const int N_sub = height_sub_out_ * width_sub_out_;
+          for (int s = 0; s < num_sub; ++s) {
+            if (this->param_propagate_down_[0]) {
+              const Dtype* sub_col_data = col_data + col_buffer_.count() * s;
+              if (!col_retained_valid_) {
+                conv_im2col_cpu(sub_data + sub_buffer_.offset(s), col_buff);
+                sub_col_data = col_buff;
+              }
+              weight_cpu_gemm(sub_col_data,
+                  sub_top_diff + sub_top_buffer_.offset(s), weight_diff, N_sub);
+            }
+            if (propagate_down[i]) {
+              backward_cpu_gemm(sub_top_diff + sub_top_buffer_.offset(s),
+                  weight, col_buff, N_sub);
+              col2im_cpu(col_buff, 1, channels_, height_sub_, width_sub_,
+                  kernel_h_, kernel_w_, 0, 0, 1, 1, 1, 1,
+                  sub_diff + sub_buffer_.offset(s));
+            }
+          }
+          // Every input pixel lies in exactly one subimage.
+          if (propagate_down[i]) {
+            batch_to_space_cpu(sub_diff, channels_, height_, width_,
+                pad_h_, pad_w_, hole_h_, hole_w_, height_sub_, width_sub_,
+                bottom_diff + bottom[i]->offset(n));
+          }
+          continue;
+        }
+        // Unless the forward pass retained the col data, we will need to
+        // recompute them.
+        if (is_1x1_) {
+          col_data = bottom_data + bottom[i]->offset(n);
+        } else if (!col_retained_valid_ && this->param_propagate_down_[0]) {
+          conv_im2col_cpu(bottom_data + bottom[i]->offset(n), col_buff);
         }
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                (Dtype)1., top_diff + top[i]->offset(n) + top_offset * g,
-                col_buff + col_offset * g, (Dtype)1.,
-                weight_diff + weight_offset * g);
-          }
+          weight_cpu_gemm(col_data, top_diff + top[i]->offset(n),
+              weight_diff, N_);
         }
         // gradient w.r.t. bottom data, if necessary.
         if (propagate_down[i]) {
-          if (weight == NULL) {
-            weight = this->blobs_[0]->cpu_data();
-          }
           if (is_1x1_) {
             col_buff = bottom[i]->mutable_cpu_diff() + bottom[i]->offset(n);
           }
-          for (int g = 0; g < group_; ++g) {
-            caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                (Dtype)1., weight + weight_offset * g,
-                top_diff + top[i]->offset(n) + top_offset * g,
-                (Dtype)0., col_buff + col_offset * g);
-          }
+          backward_cpu_gemm(top_diff + top[i]->offset(n), weight, col_buff,
+              N_);
           // col2im back to the data
           if (!is_1x1_) {
             col2im_cpu(col_buff,
-		1, channels_, height_, width_,
+                1, channels_, height_, width_,
                 kernel_h_, kernel_w_, pad_h_, pad_w_,
-		stride_h_, stride_w_, hole_h_, hole_w_, 
-		bottom_diff + bottom[i]->offset(n));
+                stride_h_, stride_w_, hole_h_, hole_w_,
+                bottom_diff + bottom[i]->offset(n));
           }
         }
       }
@@ -100,8 +100,11 @@ void DenseCRFLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     AllocateAllData();
   }
 
+  // channel-last scores are already in the pixel-major order of unary_
+  channels_last_ = bottom[0]->channels_last();
   // allocate largest possible size for top
   top[0]->Reshape(num_, M_, pad_height_, pad_width_);
+  top[0]->set_channels_last(channels_last_);
 
   sum_multiplier_.Reshape(1, M_, 1, 1);
   Dtype* multiplier_data = sum_multiplier_.mutable_cpu_data();
@@ -284,6 +287,18 @@ void DenseCRFLayer<Dtype>::ComputeMap(Dtype* top_inf) {
   int in_index;
   int out_index;
 
+  if (channels_last_) {
+    // same order as current_, row by row
+    for (int h = 0; h < H_; ++h) {
+      const float* in_row = current_ + h * W_ * M_;
+      Dtype* out_row = top_inf + h * pad_width_ * M_;
+      for (int i = 0; i < W_ * M_; ++i) {
+	out_row[i] = static_cast<Dtype>(in_row[i]);
+      }
+    }
+    return;
+  }
+
   // copy current_ to top
   for (int h = 0; h < H_; ++h) {
     for (int w = 0; w < W_; ++w) {      
@@ -345,6 +360,30 @@ void DenseCRFLayer<Dtype>::SetupPairwiseFunctions(const vector<Blob<Dtype>*>& bo
 
 template <typename Dtype>
 void DenseCRFLayer<Dtype>::SetupUnaryEnergy(const Dtype* bottom_data) {
+  if (channels_last_) {
+    // the scores of a pixel are contiguous: -log(softmax) straight into
+    // unary_, as log(sum_c exp(x_c - max)) - (x - max)
+    for (int h = 0; h < H_; ++h) {
+      for (int w = 0; w < W_; ++w) {
+	const Dtype* in = bottom_data + (h * pad_width_ + w) * M_;
+	float* out = unary_ + (h * W_ + w) * M_;
+	Dtype max_val = in[0];
+	for (int c = 1; c < M_; ++c) {
+	  max_val = std::max(max_val, in[c]);
+	}
+	Dtype sum = 0;
+	for (int c = 0; c < M_; ++c) {
+	  sum += exp(in[c] - max_val);
+	}
+	const Dtype log_sum = log(sum);
+	for (int c = 0; c < M_; ++c) {
+	  out[c] = log_sum - (in[c] - max_val);
+	}
+      }
+    }
+    return;
+  }
+
   // take exp and then -log
   Dtype* scale_data = scale_.mutable_cpu_data();
   Dtype* norm_data  = norm_data_.mutable_cpu_data();
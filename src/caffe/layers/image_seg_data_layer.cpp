@@ -5,6 +5,7 @@
 #include <vector>
 #include <algorithm>
 
+#include <boost/bind.hpp>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/highgui/highgui_c.h>
@@ -13,6 +14,7 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -29,9 +31,6 @@ void ImageSegDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom
       const vector<Blob<Dtype>*>& top) {
   const int new_height = this->layer_param_.image_data_param().new_height();
   const int new_width  = this->layer_param_.image_data_param().new_width();
-  const bool is_color  = this->layer_param_.image_data_param().is_color();
-  const int label_type = this->layer_param_.image_data_param().label_type();
-  string root_folder = this->layer_param_.image_data_param().root_folder();
 
   TransformationParameter transform_param = this->layer_param_.transform_param();
   CHECK(transform_param.has_mean_file() == false) << 
@@ -40,22 +39,9 @@ void ImageSegDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom
       (new_height > 0 && new_width > 0)) << "Current implementation requires "
       "new_height and new_width to be set at the same time.";
 
-  // Read the file with filenames and labels
-  const string& source = this->layer_param_.image_data_param().source();
-  LOG(INFO) << "Opening file " << source;
-  std::ifstream infile(source.c_str());
-
-  string linestr;
-  while (std::getline(infile, linestr)) {
-    std::istringstream iss(linestr);
-    string imgfn;
-    iss >> imgfn;
-    string segfn = "";
-    if (label_type != ImageDataParameter_LabelType_NONE) {
-      iss >> segfn;
-    }
-    lines_.push_back(std::make_pair(imgfn, segfn));
-  }
+  ReadSource();
+  CHECK(!lines_.empty()) << "No images in " <<
+      this->layer_param_.image_data_param().source();
 
   if (this->layer_param_.image_data_param().shuffle()) {
     // randomly shuffle data
@@ -65,6 +51,21 @@ void ImageSegDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom
     ShuffleImages();
   }
   LOG(INFO) << "A total of " << lines_.size() << " images.";
+  const int cache_mb = this->layer_param_.image_data_param().cache_mb();
+  if (cache_mb > 0) {
+    ImageCache::Global().Reserve(static_cast<size_t>(cache_mb) << 20);
+    LOG(INFO) << "Caching decoded images, up to "
+        << (ImageCache::Global().budget_bytes() >> 20) << " MB.";
+  }
+  const int decode_threads =
+      this->layer_param_.image_data_param().decode_threads();
+  CHECK_GT(decode_threads, 0);
+  decode_pool_.reset(new WorkerPool(decode_threads));
+  if (this->layer_param_.image_data_param().bucket_stride() > 0 &&
+      Caffe::phase() == Caffe::TEST &&
+      !this->layer_param_.image_data_param().shuffle()) {
+    BucketImages();
+  }
 
   lines_id_ = 0;
   // Check if we would need to randomly skip a few data points
@@ -77,38 +78,58 @@ void ImageSegDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom
   }
 
   // Read an image, and use it to initialize the top blob.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-                                    new_height, new_width, is_color);
-  const int channels = cv_img.channels();
-  const int height = cv_img.rows;
-  const int width = cv_img.cols;
+  std::vector<cv::Mat> cv_img_seg;
+  int img_row, img_col;
+  ReadImgAndSeg(lines_[lines_id_], &cv_img_seg, &img_row, &img_col);
+  CHECK(cv_img_seg[0].data) << "Could not read " << lines_[lines_id_].first;
+  const int channels = cv_img_seg[0].channels();
+  const int height = cv_img_seg[0].rows;
+  const int width = cv_img_seg[0].cols;
   // image
   const int crop_size = this->layer_param_.transform_param().crop_size();
   const int batch_size = this->layer_param_.image_data_param().batch_size();
+  if (this->layer_param_.image_data_param().bucket_stride() > 0) {
+    // Random crops always fill the whole crop_size window.
+    CHECK(crop_size == 0 || Caffe::phase() == Caffe::TEST)
+        << "bucket_stride with crop_size is only allowed in the TEST phase";
+  }
   if (crop_size > 0) {
     top[0]->Reshape(batch_size, channels, crop_size, crop_size);
-    this->prefetch_data_.Reshape(batch_size, channels, crop_size, crop_size);
+    for (int i = 0; i < this->prefetch_count_; ++i) {
+      this->prefetch_[i].data_.Reshape(batch_size, channels, crop_size,
+          crop_size);
+    }
     this->transformed_data_.Reshape(1, channels, crop_size, crop_size);
 
     //label
     top[1]->Reshape(batch_size, 1, crop_size, crop_size);
-    this->prefetch_label_.Reshape(batch_size, 1, crop_size, crop_size);
+    for (int i = 0; i < this->prefetch_count_; ++i) {
+      this->prefetch_[i].label_.Reshape(batch_size, 1, crop_size, crop_size);
+    }
     this->transformed_label_.Reshape(1, 1, crop_size, crop_size);
      
   } else {
     top[0]->Reshape(batch_size, channels, height, width);
-    this->prefetch_data_.Reshape(batch_size, channels, height, width);
+    for (int i = 0; i < this->prefetch_count_; ++i) {
+      this->prefetch_[i].data_.Reshape(batch_size, channels, height, width);
+    }
     this->transformed_data_.Reshape(1, channels, height, width);
 
     //label
     top[1]->Reshape(batch_size, 1, height, width);
-    this->prefetch_label_.Reshape(batch_size, 1, height, width);
+    for (int i = 0; i < this->prefetch_count_; ++i) {
+      this->prefetch_[i].label_.Reshape(batch_size, 1, height, width);
+    }
     this->transformed_label_.Reshape(1, 1, height, width);     
   }
 
-  // image dimensions, for each image, stores (img_height, img_width)
-  top[2]->Reshape(batch_size, 1, 1, 2);
-  this->prefetch_data_dim_.Reshape(batch_size, 1, 1, 2);
+  // image dimensions, for each image, stores (img_height, img_width), and
+  // its position in the source when the lines are sorted into buckets
+  const int dim_width = lines_index_.empty() ? 2 : 3;
+  top[2]->Reshape(batch_size, 1, 1, dim_width);
+  for (int i = 0; i < this->prefetch_count_; ++i) {
+    this->prefetch_[i].dim_.Reshape(batch_size, 1, 1, dim_width);
+  }
 
   LOG(INFO) << "output data size: " << top[0]->num() << ","
 	    << top[0]->channels() << "," << top[0]->height() << ","
@@ -124,96 +145,232 @@ void ImageSegDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom
 }
 
 template <typename Dtype>
-void ImageSegDataLayer<Dtype>::ShuffleImages() {
-  caffe::rng_t* prefetch_rng =
-      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
-  shuffle(lines_.begin(), lines_.end(), prefetch_rng);
+void ImageSegDataLayer<Dtype>::ReadSource() {
+  const int label_type = this->layer_param_.image_data_param().label_type();
+  // Read the file with filenames and labels
+  const string& source = this->layer_param_.image_data_param().source();
+  LOG(INFO) << "Opening file " << source;
+  std::ifstream infile(source.c_str());
+
+  string linestr;
+  while (std::getline(infile, linestr)) {
+    std::istringstream iss(linestr);
+    string imgfn;
+    iss >> imgfn;
+    string segfn = "";
+    if (label_type != ImageDataParameter_LabelType_NONE) {
+      iss >> segfn;
+    }
+    lines_.push_back(std::make_pair(imgfn, segfn));
+  }
 }
 
-// This function is used to create a thread that prefetches the data.
 template <typename Dtype>
-void ImageSegDataLayer<Dtype>::InternalThreadEntry() {
-  CPUTimer batch_timer;
-  batch_timer.Start();
-  double read_time = 0;
-  double trans_time = 0;
-  CPUTimer timer;
-  CHECK(this->prefetch_data_.count());
-  CHECK(this->transformed_data_.count());
-
-  Dtype* top_data     = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label    = this->prefetch_label_.mutable_cpu_data(); 
-  Dtype* top_data_dim = this->prefetch_data_dim_.mutable_cpu_data();
-
-  const int max_height = this->prefetch_data_.height();
-  const int max_width  = this->prefetch_data_.width();
-
-  ImageDataParameter image_data_param    = this->layer_param_.image_data_param();
-  const int batch_size = image_data_param.batch_size();
+void ImageSegDataLayer<Dtype>::ReadImgAndSeg(
+    const std::pair<std::string, std::string>& line,
+    std::vector<cv::Mat>* cv_img_seg, int* img_row, int* img_col) {
+  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
   const int new_height = image_data_param.new_height();
   const int new_width  = image_data_param.new_width();
-  const int label_type = this->layer_param_.image_data_param().label_type();
+  const int label_type = image_data_param.label_type();
   const int ignore_label = image_data_param.ignore_label();
   const bool is_color  = image_data_param.is_color();
-  string root_folder   = image_data_param.root_folder();
-
-  const int lines_size = lines_.size();
-  int top_data_dim_offset;
+  const string& root_folder = image_data_param.root_folder();
+  ImageCache* cache =
+      image_data_param.cache_mb() > 0 ? &ImageCache::Global() : NULL;
 
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    top_data_dim_offset = this->prefetch_data_dim_.offset(item_id);
+  cv_img_seg->clear();
+  cv_img_seg->push_back(ReadImageToCVMatCached(cache,
+	  root_folder + line.first, new_height, new_width, is_color,
+	  img_row, img_col));
 
-    std::vector<cv::Mat> cv_img_seg;
+  if (!(*cv_img_seg)[0].data) {
+    DLOG(INFO) << "Fail to load img: " << root_folder + line.first;
+  }
+  if (label_type == ImageDataParameter_LabelType_PIXEL) {
+    cv_img_seg->push_back(ReadImageToCVMatCached(cache,
+	root_folder + line.second, new_height, new_width, false));
+    if (!(*cv_img_seg)[1].data) {
+      DLOG(INFO) << "Fail to load seg: " << root_folder + line.second;
+    }
+  }
+  else if (label_type == ImageDataParameter_LabelType_IMAGE) {
+    const int label = atoi(line.second.c_str());
+    cv::Mat seg((*cv_img_seg)[0].rows, (*cv_img_seg)[0].cols, 
+		CV_8UC1, cv::Scalar(label));
+    cv_img_seg->push_back(seg);      
+  }
+  else {
+    cv::Mat seg((*cv_img_seg)[0].rows, (*cv_img_seg)[0].cols, 
+		CV_8UC1, cv::Scalar(ignore_label));
+    cv_img_seg->push_back(seg);
+  }
+}
 
-    // get a blob
-    timer.Start();
-    CHECK_GT(lines_size, lines_id_);
+template <typename Dtype>
+void ImageSegDataLayer<Dtype>::ReadImgSize(
+    const std::pair<std::string, std::string>& line, int* rows, int* cols) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  if (image_data_param.new_height() > 0) {
+    *rows = image_data_param.new_height();
+    *cols = image_data_param.new_width();
+    return;
+  }
+  if (ReadImageSize(image_data_param.root_folder() + line.first, rows, cols)) {
+    return;
+  }
+  // Not a PNG or a JPEG: decode it (into the image cache, if any).
+  std::vector<cv::Mat> cv_img_seg;
+  ReadImgAndSeg(line, &cv_img_seg, rows, cols);
+  CHECK(cv_img_seg[0].data) << "Could not read " << line.first;
+  *rows = cv_img_seg[0].rows;
+  *cols = cv_img_seg[0].cols;
+}
 
-    int img_row, img_col;
-    cv_img_seg.push_back(ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-	  new_height, new_width, is_color, &img_row, &img_col));
+template <typename Dtype>
+void ImageSegDataLayer<Dtype>::ShuffleImages() {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(lines_.begin(), lines_.end(), prefetch_rng);
+}
 
-    top_data_dim[top_data_dim_offset]     = static_cast<Dtype>(std::min(max_height, img_row));
-    top_data_dim[top_data_dim_offset + 1] = static_cast<Dtype>(std::min(max_width, img_col));
+template <typename Dtype>
+void ImageSegDataLayer<Dtype>::ReadBucketKey(
+    vector<std::pair<std::pair<int, int>, int> >* keys, const int i) {
+  const int bucket_stride = this->layer_param_.image_data_param().bucket_stride();
+  const int crop_size = this->layer_param_.transform_param().crop_size();
+  int height, width;
+  ReadImgSize(lines_[i], &height, &width);
+  height = (height + bucket_stride - 1) / bucket_stride * bucket_stride;
+  width  = (width + bucket_stride - 1) / bucket_stride * bucket_stride;
+  if (crop_size) {
+    height = std::min(height, crop_size);
+    width  = std::min(width, crop_size);
+  }
+  (*keys)[i] = std::make_pair(std::make_pair(height, width), i);
+}
 
-    if (!cv_img_seg[0].data) {
-      DLOG(INFO) << "Fail to load img: " << root_folder + lines_[lines_id_].first;
-    }
-    if (label_type == ImageDataParameter_LabelType_PIXEL) {
-      cv_img_seg.push_back(ReadImageToCVMat(root_folder + lines_[lines_id_].second,
-					    new_height, new_width, false));
-      if (!cv_img_seg[1].data) {
-	DLOG(INFO) << "Fail to load seg: " << root_folder + lines_[lines_id_].second;
-      }
-    }
-    else if (label_type == ImageDataParameter_LabelType_IMAGE) {
-      const int label = atoi(lines_[lines_id_].second.c_str());
-      cv::Mat seg(cv_img_seg[0].rows, cv_img_seg[0].cols, 
-		  CV_8UC1, cv::Scalar(label));
-      cv_img_seg.push_back(seg);      
-    }
-    else {
-      cv::Mat seg(cv_img_seg[0].rows, cv_img_seg[0].cols, 
-		  CV_8UC1, cv::Scalar(ignore_label));
-      cv_img_seg.push_back(seg);
+template <typename Dtype>
+void ImageSegDataLayer<Dtype>::BucketImages() {
+  // ((padded height, padded width), position in the source) of every line.
+  const int lines_size = lines_.size();
+  vector<std::pair<std::pair<int, int>, int> > keys(lines_size);
+  decode_pool_->Run(lines_size,
+      boost::bind(&ImageSegDataLayer<Dtype>::ReadBucketKey, this, &keys, _1));
+  // The position breaks the ties, so a bucket keeps the order of the source.
+  std::sort(keys.begin(), keys.end());
+  vector<std::pair<std::string, std::string> > lines(lines_size);
+  lines_index_.resize(lines_size);
+  int buckets = 0;
+  for (int i = 0; i < lines_size; ++i) {
+    lines[i] = lines_[keys[i].second];
+    lines_index_[i] = keys[i].second;
+    if (i == 0 || keys[i].first != keys[i - 1].first) {
+      ++buckets;
     }
+  }
+  lines_.swap(lines);
+  LOG(INFO) << "Sorted the images into " << buckets << " buckets.";
+}
 
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset;
+template <typename Dtype>
+struct ImageSegDataLayer<Dtype>::BatchItems {
+  explicit BatchItems(const int batch_size)
+      : lines(batch_size), indices(batch_size), seeds(batch_size),
+        cv_img_segs(batch_size), img_rows(batch_size), img_cols(batch_size),
+        read_times(batch_size), trans_times(batch_size), batch(NULL),
+        top_data(NULL), top_label(NULL), top_data_dim(NULL) {}
+
+  vector<std::pair<std::string, std::string> > lines;
+  // The positions of the lines in the source.
+  vector<int> indices;
+  vector<unsigned int> seeds;
+  vector<std::vector<cv::Mat> > cv_img_segs;
+  vector<int> img_rows;
+  vector<int> img_cols;
+  // In microseconds.
+  vector<double> read_times;
+  vector<double> trans_times;
+  Batch<Dtype>* batch;
+  // Taken on the prefetch thread, before the workers write to the blobs.
+  Dtype* top_data;
+  Dtype* top_label;
+  Dtype* top_data_dim;
+};
 
-    offset = this->prefetch_data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
+template <typename Dtype>
+void ImageSegDataLayer<Dtype>::ReadItem(BatchItems* items,
+    const int item_id) {
+  CPUTimer timer;
+  timer.Start();
+  ReadImgAndSeg(items->lines[item_id], &items->cv_img_segs[item_id],
+      &items->img_rows[item_id], &items->img_cols[item_id]);
+  items->read_times[item_id] = timer.MicroSeconds();
+}
 
-    offset = this->prefetch_label_.offset(item_id);
-    this->transformed_label_.set_cpu_data(top_label + offset);
+template <typename Dtype>
+void ImageSegDataLayer<Dtype>::TransformItem(BatchItems* items,
+    const int item_id) {
+  CPUTimer timer;
+  Batch<Dtype>* batch = items->batch;
+  const int channels   = batch->data_.channels();
+  const int max_height = batch->data_.height();
+  const int max_width  = batch->data_.width();
+  Dtype* top_data_dim = items->top_data_dim;
+  const int top_data_dim_offset = batch->dim_.offset(item_id);
+  top_data_dim[top_data_dim_offset] =
+      static_cast<Dtype>(std::min(max_height, items->img_rows[item_id]));
+  top_data_dim[top_data_dim_offset + 1] =
+      static_cast<Dtype>(std::min(max_width, items->img_cols[item_id]));
+  if (!lines_index_.empty()) {
+    top_data_dim[top_data_dim_offset + 2] =
+        static_cast<Dtype>(items->indices[item_id]);
+  }
 
-    this->data_transformer_.TransformImgAndSeg(cv_img_seg, 
-	 &(this->transformed_data_), &(this->transformed_label_),
-	 ignore_label);
-    trans_time += timer.MicroSeconds();
+  timer.Start();
+  // Apply transformations (mirror, crop...) to the image, writing straight
+  // into this slot of the prefetch blobs through per-slot views.
+  Blob<Dtype> transformed_data(1, channels, max_height, max_width);
+  Blob<Dtype> transformed_label(1, 1, max_height, max_width);
+  transformed_data.set_cpu_data(
+      items->top_data + batch->data_.offset(item_id));
+  transformed_label.set_cpu_data(
+      items->top_label + batch->label_.offset(item_id));
+
+  Caffe::RNG rng(items->seeds[item_id]);
+  this->data_transformer_.TransformImgAndSeg(items->cv_img_segs[item_id],
+      &transformed_data, &transformed_label,
+      this->layer_param_.image_data_param().ignore_label(), &rng);
+  // Release the decoded images as soon as they are written.
+  items->cv_img_segs[item_id].clear();
+  items->trans_times[item_id] = timer.MicroSeconds();
+}
 
+// This function is called on the prefetch thread to load a batch.
+template <typename Dtype>
+void ImageSegDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CPUTimer batch_timer;
+  batch_timer.Start();
+  CHECK(batch->data_.count());
+  CHECK(this->transformed_data_.count());
+
+  ImageDataParameter image_data_param    = this->layer_param_.image_data_param();
+  const int batch_size = image_data_param.batch_size();
+  const int bucket_stride = image_data_param.bucket_stride();
+
+  // Assign the lines and the generator seeds to the batch slots in order, so
+  // that the batch is the same however the slots are spread over the workers.
+  const int lines_size = lines_.size();
+  BatchItems items(batch_size);
+  items.batch = batch;
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    CHECK_GT(lines_size, lines_id_);
+    items.lines[item_id] = lines_[lines_id_];
+    items.indices[item_id] =
+        lines_index_.empty() ? lines_id_ : lines_index_[lines_id_];
+    items.seeds[item_id] = this->data_transformer_.RandSeed();
+    WillRead(items.lines[item_id]);
     // go to the next std::vector<int>::iterator iter;
     lines_id_++;
     if (lines_id_ >= lines_size) {
@@ -225,6 +382,43 @@ void ImageSegDataLayer<Dtype>::InternalThreadEntry() {
       }
     }
   }
+
+  // Read the whole batch first: its shape may depend on the images.
+  decode_pool_->Run(batch_size,
+      boost::bind(&ImageSegDataLayer<Dtype>::ReadItem, this, &items, _1));
+
+  if (bucket_stride > 0) {
+    // Pad the batch only up to the next multiple of bucket_stride that holds
+    // the largest of its images (or of their crop windows).
+    const int crop_size = this->layer_param_.transform_param().crop_size();
+    int height = 0;
+    int width = 0;
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      height = std::max(height, items.cv_img_segs[item_id][0].rows);
+      width  = std::max(width, items.cv_img_segs[item_id][0].cols);
+    }
+    height = (height + bucket_stride - 1) / bucket_stride * bucket_stride;
+    width  = (width + bucket_stride - 1) / bucket_stride * bucket_stride;
+    if (crop_size) {
+      height = std::min(height, crop_size);
+      width  = std::min(width, crop_size);
+    }
+    batch->data_.Reshape(batch_size, batch->data_.channels(), height, width);
+    batch->label_.Reshape(batch_size, 1, height, width);
+  }
+  items.top_data     = batch->data_.mutable_cpu_data();
+  items.top_label    = batch->label_.mutable_cpu_data();
+  items.top_data_dim = batch->dim_.mutable_cpu_data();
+
+  decode_pool_->Run(batch_size,
+      boost::bind(&ImageSegDataLayer<Dtype>::TransformItem, this, &items,
+          _1));
+  double read_time = 0;
+  double trans_time = 0;
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    read_time += items.read_times[item_id];
+    trans_time += items.trans_times[item_id];
+  }
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
@@ -40,6 +40,13 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // Set up the int8 engine; the weights are quantized on the first forward
+  // pass after they change, e.g. once the trained weights are copied in.
+  const QuantizationParameter& quant_param =
+      this->layer_param_.quantization_param();
+  if (quant_param.precision() == QuantizationParameter_Precision_INT8) {
+    int8_gemm_.reset(new Int8Gemm<Dtype>(quant_param));
+  }
 }
 
 template <typename Dtype>
@@ -63,6 +70,13 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  if (int8_gemm_) {
+    // top^T = W * bottom^T, computed in int8 with the bias folded in.
+    int8_gemm_->UpdateWeights(N_, K_, *this->blobs_[0]);
+    int8_gemm_->Forward(0, N_, M_, bottom_data, true,
+        bias_term_ ? this->blobs_[1]->cpu_data() : NULL, top_data, true);
+    return;
+  }
   caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
       bottom_data, weight, (Dtype)0., top_data);
   if (bias_term_) {
@@ -21,6 +21,8 @@ void InterpLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   pad_end_ = interp_param.pad_end();
   CHECK_LE(pad_beg_, 0) << "Only supports non-pos padding (cropping) for now";
   CHECK_LE(pad_end_, 0) << "Only supports non-pos padding (cropping) for now";
+  // Upsampling by an integer factor has a separable CPU fast path.
+  zoom_factor_ = interp_param.has_zoom_factor() ? interp_param.zoom_factor() : 0;
 }
 
 template <typename Dtype>
@@ -57,11 +59,27 @@ void InterpLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   CHECK_GT(height_out_, 0) << "height should be positive";
   CHECK_GT(width_out_, 0) << "width should be positive";
   top[0]->Reshape(num_, channels_, height_out_, width_out_);
+  top[0]->set_channels_last(bottom[0]->channels_last());
 }
 
 template <typename Dtype>
 void InterpLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (bottom[0]->channels_last()) {
+    // Channel-last images go through the packed kernel one at a time.
+    for (int n = 0; n < num_; ++n) {
+      caffe_cpu_interp2<Dtype,true>(channels_,
+        bottom[0]->cpu_data() + bottom[0]->offset(n), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
+        top[0]->mutable_cpu_data() + top[0]->offset(n), 0, 0, height_out_, width_out_, height_out_, width_out_);
+    }
+    return;
+  }
+  if (zoom_factor_ > 1) {
+    caffe_cpu_zoom2(num_ * channels_,
+      bottom[0]->cpu_data(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
+      zoom_factor_, top[0]->mutable_cpu_data());
+    return;
+  }
   caffe_cpu_interp2<Dtype,false>(num_ * channels_,
     bottom[0]->cpu_data(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
     top[0]->mutable_cpu_data(), 0, 0, height_out_, width_out_, height_out_, width_out_);
@@ -72,6 +90,24 @@ void InterpLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   if (!propagate_down[0]) { return; }
   caffe_set(bottom[0]->count(), Dtype(0), bottom[0]->mutable_cpu_diff());
+  if (bottom[0]->channels_last()) {
+    // The packed backward runs serially: split the images across threads.
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int n = 0; n < num_; ++n) {
+      caffe_cpu_interp2_backward<Dtype,true>(channels_,
+        bottom[0]->mutable_cpu_diff() + bottom[0]->offset(n), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
+        top[0]->cpu_diff() + top[0]->offset(n), 0, 0, height_out_, width_out_, height_out_, width_out_);
+    }
+    return;
+  }
+  if (zoom_factor_ > 1) {
+    caffe_cpu_zoom2_backward(num_ * channels_,
+      bottom[0]->mutable_cpu_diff(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
+      zoom_factor_, top[0]->cpu_diff());
+    return;
+  }
   caffe_cpu_interp2_backward<Dtype,false>(num_ * channels_,
     bottom[0]->mutable_cpu_diff(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
     top[0]->cpu_diff(), 0, 0, height_out_, width_out_, height_out_, width_out_);
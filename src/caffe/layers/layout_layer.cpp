@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// Transposes a rows x cols matrix in square blocks, so that both the reads
+// and the writes stay within a few cache lines.
+template <typename Dtype>
+static void transpose_plane(const int rows, const int cols, const Dtype* in,
+    Dtype* out) {
+  const int kBlock = 32;
+  for (int r0 = 0; r0 < rows; r0 += kBlock) {
+    const int r1 = std::min(r0 + kBlock, rows);
+    for (int c0 = 0; c0 < cols; c0 += kBlock) {
+      const int c1 = std::min(c0 + kBlock, cols);
+      for (int r = r0; r < r1; ++r) {
+        for (int c = c0; c < c1; ++c) {
+          out[c * rows + r] = in[r * cols + c];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_NE(top[0], bottom[0]) << this->type_name() << " Layer does not "
+      "allow in-place computation.";
+  const bool channels_last = this->layer_param_.layout_param().channels_last();
+  CHECK_NE(bottom[0]->channels_last(), channels_last)
+      << "The bottom of a " << this->type_name() << " layer must be in the "
+      << "other layout.";
+  top[0]->Reshape(bottom[0]->num(), bottom[0]->channels(),
+      bottom[0]->height(), bottom[0]->width());
+  top[0]->set_channels_last(channels_last);
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const int num = bottom[0]->num();
+  const int channels = bottom[0]->channels();
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  const int dim = channels * spatial_dim;
+  // An NCHW image is a C x HW matrix, an NHWC one its HW x C transpose.
+  const int rows = top[0]->channels_last() ? channels : spatial_dim;
+  const int cols = dim / std::max(rows, 1);
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+#ifdef WITH_OPENMP
+  #pragma omp parallel for
+#endif
+  for (int n = 0; n < num; ++n) {
+    transpose_plane(rows, cols, bottom_data + n * dim, top_data + n * dim);
+  }
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  const int num = bottom[0]->num();
+  const int channels = bottom[0]->channels();
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  const int dim = channels * spatial_dim;
+  const int rows = top[0]->channels_last() ? spatial_dim : channels;
+  const int cols = dim / std::max(rows, 1);
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+#ifdef WITH_OPENMP
+  #pragma omp parallel for
+#endif
+  for (int n = 0; n < num; ++n) {
+    transpose_plane(rows, cols, top_diff + n * dim, bottom_diff + n * dim);
+  }
+}
+
+INSTANTIATE_CLASS(LayoutLayer);
+REGISTER_LAYER_CLASS(LAYOUT, LayoutLayer);
+
+}  // namespace caffe
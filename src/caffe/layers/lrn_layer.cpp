@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -103,51 +105,70 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+// Number of spatial positions handled together. The running window sums of
+// a tile stay in L1 while the window slides across the channels, so every
+// input is read once and no padded copy of the blob is needed.
+static const int kLRNTile = 512;
+
+// x^-beta, with the usual beta = 0.75 as two square roots.
+template <typename Dtype>
+static inline Dtype lrn_pow(const Dtype x, const Dtype beta) {
+  if (beta == Dtype(0.75)) {
+    const Dtype root = sqrt(x);
+    return Dtype(1) / (root * sqrt(root));
+  }
+  return pow(x, -beta);
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelForward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
+  const Dtype alpha_over_size = alpha_ / size_;
+  const int spatial_dim = height_ * width_;
+  const int num_tiles = (spatial_dim + kLRNTile - 1) / kLRNTile;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for (int t = 0; t < num_ * num_tiles; ++t) {
+    const int offset = (t / num_tiles) * channels_ * spatial_dim +
+        (t % num_tiles) * kLRNTile;
+    const int size = std::min(kLRNTile,
+        spatial_dim - (t % num_tiles) * kLRNTile);
+    const Dtype* x = bottom_data + offset;
+    // sum of the squares over the channels [c - pre_pad, c + pre_pad]
+    Dtype window[kLRNTile];
+    std::fill(window, window + size, Dtype(0));
+    for (int c = 0; c < std::min(pre_pad_, channels_); ++c) {
+      const Dtype* head = x + c * spatial_dim;
+      for (int k = 0; k < size; ++k) {
+        window[k] += head[k] * head[k];
+      }
     }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+    for (int c = 0; c < channels_; ++c) {
+      if (c + pre_pad_ < channels_) {
+        const Dtype* head = x + (c + pre_pad_) * spatial_dim;
+        for (int k = 0; k < size; ++k) {
+          window[k] += head[k] * head[k];
+        }
+      }
+      const Dtype* x_c = x + c * spatial_dim;
+      Dtype* scale = scale_data + offset + c * spatial_dim;
+      Dtype* y = top_data + offset + c * spatial_dim;
+      for (int k = 0; k < size; ++k) {
+        scale[k] = k_ + alpha_over_size * window[k];
+        y[k] = x_c[k] * lrn_pow(scale[k], beta_);
+      }
+      if (c >= pre_pad_) {
+        const Dtype* tail = x + (c - pre_pad_) * spatial_dim;
+        for (int k = 0; k < size; ++k) {
+          window[k] -= tail[k] * tail[k];
+        }
+      }
     }
   }
-
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
 }
 
 template <typename Dtype>
@@ -175,6 +196,9 @@ void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+// bottom_diff_c = top_diff_c * scale_c^-beta - 2 alpha beta / size * x_c *
+// sum over the window of c of top_diff * top_data / scale, with the window
+// sum slid across the channels of a tile as in the forward pass.
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelBackward_cpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
@@ -184,48 +208,48 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+  const int spatial_dim = height_ * width_;
+  const int num_tiles = (spatial_dim + kLRNTile - 1) / kLRNTile;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for (int t = 0; t < num_ * num_tiles; ++t) {
+    const int offset = (t / num_tiles) * channels_ * spatial_dim +
+        (t % num_tiles) * kLRNTile;
+    const int size = std::min(kLRNTile,
+        spatial_dim - (t % num_tiles) * kLRNTile);
+    const Dtype* dy = top_diff + offset;
+    const Dtype* y = top_data + offset;
+    const Dtype* scale = scale_data + offset;
+    Dtype accum_ratio[kLRNTile];
+    std::fill(accum_ratio, accum_ratio + size, Dtype(0));
+    for (int c = 0; c < std::min(pre_pad_, channels_); ++c) {
+      const int head = c * spatial_dim;
+      for (int k = 0; k < size; ++k) {
+        accum_ratio[k] += dy[head + k] * y[head + k] / scale[head + k];
+      }
     }
     for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+      if (c + pre_pad_ < channels_) {
+        const int head = (c + pre_pad_) * spatial_dim;
+        for (int k = 0; k < size; ++k) {
+          accum_ratio[k] += dy[head + k] * y[head + k] / scale[head + k];
+        }
+      }
+      const int cur = c * spatial_dim;
+      const Dtype* x_c = bottom_data + offset + cur;
+      Dtype* dx = bottom_diff + offset + cur;
+      for (int k = 0; k < size; ++k) {
+        dx[k] = dy[cur + k] * lrn_pow(scale[cur + k], beta_) -
+            cache_ratio_value * x_c[k] * accum_ratio[k];
+      }
+      if (c >= pre_pad_) {
+        const int tail = (c - pre_pad_) * spatial_dim;
+        for (int k = 0; k < size; ++k) {
+          accum_ratio[k] -= dy[tail + k] * y[tail + k] / scale[tail + k];
+        }
+      }
     }
   }
 }
@@ -1,20 +1,28 @@
+#include <boost/thread.hpp>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
 #include <vector>
 
 #include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/vision_layers.hpp"
-#include "caffe/syncedmem.hpp"
 #include <sstream>
 
 namespace caffe {
 
 template <typename Dtype>
-void MatReadLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+MatReadLayer<Dtype>::~MatReadLayer<Dtype>() {
+  this->JoinPrefetchThread();
+}
+
+template <typename Dtype>
+void MatReadLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 				      const vector<Blob<Dtype>*>& top) {
   prefix_ = this->layer_param_.mat_read_param().prefix();
   batch_size_ = this->layer_param_.mat_read_param().batch_size();
   CHECK_GT(batch_size_, 0) << "batch_size must be positive";
-  reshape_ = false;
   iter_ = 0;
   if (this->layer_param_.mat_read_param().has_source()) {
     std::ifstream infile(this->layer_param_.mat_read_param().source().c_str());
@@ -33,54 +41,109 @@ void MatReadLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(INFO) << "MatRead will load from a set of " << fnames_.size() << " files.";
     CHECK_GT(fnames_.size(), 0);
   }
+  CHECK_GT(this->layer_param_.mat_read_param().read_threads(), 0);
+#ifndef WITH_OPENMP
+  LOG_IF(WARNING, this->layer_param_.mat_read_param().read_threads() > 1)
+      << "read_threads needs a build with OpenMP; reading serially.";
+#endif
+
+  // The first item gives the shape of the tops; all the files of a top
+  // must have the same.
+  for (int i = 0; i < top.size(); ++i) {
+    Blob<Dtype> blob;
+    blob.FromMat(FileName(0, i).c_str());
+    CHECK_EQ(blob.num(), 1);
+    top[i]->Reshape(batch_size_, blob.channels(), blob.height(), blob.width());
+    for (int j = 0; j < this->prefetch_count_; ++j) {
+      Blob<Dtype>& prefetch_blob = i == 0 ?
+          this->prefetch_[j].data_ : this->prefetch_[j].label_;
+      prefetch_blob.ReshapeLike(*top[i]);
+    }
+    LOG(INFO) << "output blob " << i << " size: " << top[i]->num() << ","
+	      << top[i]->channels() << "," << top[i]->height() << ","
+	      << top[i]->width();
+  }
 }
 
 template <typename Dtype>
-void MatReadLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
-  reshape_ = true;   iter_ = 0;
-  Forward_cpu(bottom, top);
-  reshape_ = false;  iter_ = 0;
+string MatReadLayer<Dtype>::FileName(const int id, const int blob_id) const {
+  std::ostringstream oss;
+  oss << prefix_;
+  if (this->layer_param_.mat_read_param().has_source()) {
+    oss << fnames_[id];
+  }
+  else {
+    oss << "iter_" << id;
+  }
+  oss << "_blob_" << blob_id << ".mat";
+  return oss.str();
 }
 
+// Reads the files of the next batch into it, on the prefetch thread.
 template <typename Dtype>
-void MatReadLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-    const vector<Blob<Dtype>*>& top) {
+void MatReadLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CPUTimer batch_timer;
+  batch_timer.Start();
+  vector<Blob<Dtype>*> outputs;
+  outputs.push_back(&batch->data_);
+  if (this->output_labels_) {
+    outputs.push_back(&batch->label_);
+  }
+  // Take the pointers before the workers write through them.
+  vector<Dtype*> output_data;
+  for (int i = 0; i < outputs.size(); ++i) {
+    output_data.push_back(outputs[i]->mutable_cpu_data());
+  }
+  vector<int> ids(batch_size_);
   for (int n = 0; n < batch_size_; ++n) {
-    for (int i = 0; i < top.size(); ++i) {
-      std::ostringstream oss;
-      oss << prefix_;
-      if (this->layer_param_.mat_read_param().has_source()) {
-	if (iter_ >= fnames_.size()) {
-	  iter_ = 0;
-	}
-	oss << fnames_[iter_];
-      }
-      else {
-	oss << "iter_" << iter_;
-      }
-      oss << "_blob_" << i << ".mat";
-      Blob<Dtype> blob;
-      blob.FromMat(oss.str().c_str());
-      CHECK_EQ(blob.num(), 1);
-      if (reshape_) {
-	top[i]->Reshape(batch_size_, blob.channels(), blob.height(), blob.width());
-      }
-      else {
-	CHECK(blob.channels()  == top[i]->channels()
-	      && blob.height() == top[i]->height() 
-	      && blob.width()  == top[i]->width());
+    if (this->layer_param_.mat_read_param().has_source() &&
+        iter_ >= fnames_.size()) {
+      iter_ = 0;
+    }
+    ids[n] = iter_++;
+  }
+  // The iter_N files never wrap around, and may still be being written
+  // (e.g. by the MAT_WRITE layer of another net, which renames each file
+  // into place once saved): wait for the files of the batch, up to
+  // wait_timeout seconds each.
+  if (!this->layer_param_.mat_read_param().has_source()) {
+    const float wait_timeout =
+        this->layer_param_.mat_read_param().wait_timeout();
+    for (int n = 0; n < batch_size_; ++n) {
+      for (int i = 0; i < outputs.size(); ++i) {
+        const string filename = FileName(ids[n], i);
+        if (!std::ifstream(filename.c_str()).good()) {
+          LOG(INFO) << "Waiting for " << filename;
+          const boost::posix_time::ptime deadline =
+              boost::posix_time::microsec_clock::universal_time() +
+              boost::posix_time::milliseconds(
+                  static_cast<int>(1000 * wait_timeout));
+          do {
+            CHECK(boost::posix_time::microsec_clock::universal_time() <
+                deadline) << "Missing " << filename << " after waiting "
+                << wait_timeout << " s";
+            boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+          } while (!std::ifstream(filename.c_str()).good());
+        }
       }
     }
-    ++iter_;
   }
-}
 
-template <typename Dtype>
-void MatReadLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-    const vector<bool>& propagate_down,
-    const vector<Blob<Dtype>*>& bottom) {
-  return;
+#ifdef WITH_OPENMP
+  const int read_threads = this->layer_param_.mat_read_param().read_threads();
+#pragma omp parallel for num_threads(read_threads) schedule(dynamic)
+#endif
+  for (int n = 0; n < batch_size_; ++n) {
+    for (int i = 0; i < outputs.size(); ++i) {
+      // Read the file straight into its slot of the batch.
+      Blob<Dtype> item(1, outputs[i]->channels(), outputs[i]->height(),
+          outputs[i]->width());
+      item.set_cpu_data(output_data[i] + outputs[i]->offset(n));
+      item.FromMat(FileName(ids[n], i).c_str(), false);
+    }
+  }
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
 }
 
 INSTANTIATE_CLASS(MatReadLayer);
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
 #include <vector>
 
 #include "caffe/common.hpp"
@@ -31,29 +34,123 @@ void MatWriteLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
     LOG(INFO) << "MatWrite will save a maximum of " << fnames_.size() << " files.";
   }
+  switch (this->layer_param_.mat_write_param().output_type()) {
+  case MatWriteParameter_OutputType_FLOAT:
+    elem_type_ = sizeof(Dtype) == sizeof(float) ?
+        MatWriteJob::SINGLE : MatWriteJob::DOUBLE;
+    break;
+  case MatWriteParameter_OutputType_HALF:
+    elem_type_ = MatWriteJob::HALF;
+    break;
+  case MatWriteParameter_OutputType_UINT8:
+    elem_type_ = MatWriteJob::UINT8;
+    break;
+  default:
+    LOG(FATAL) << "Unknown output type";
+  }
+  writer_.reset(new MatWriter(this->layer_param_.mat_write_param().threads(),
+      this->layer_param_.mat_write_param().max_pending()));
 }
 
 template <typename Dtype>
 void MatWriteLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (this->layer_param_.mat_write_param().crop_to_dims()) {
+    CHECK_GE(bottom.size(), 2) << "crop_to_dims needs the data_dims bottom";
+    const Blob<Dtype>* data_dims = bottom.back();
+    CHECK(data_dims->count() == data_dims->num() * 2 ||
+        data_dims->count() == data_dims->num() * 3)
+        << "data_dims must be num x 1 x 1 x 2 or num x 1 x 1 x 3";
+    for (int i = 0; i < bottom.size() - 1; ++i) {
+      CHECK_EQ(bottom[i]->num(), data_dims->num());
+    }
+  }
+}
+
+template <typename Dtype>
+string MatWriteLayer<Dtype>::FileName(const int id, const int blob_id) const {
+  std::ostringstream oss;
+  oss << prefix_;
+  if (this->layer_param_.mat_write_param().has_source()) {
+    CHECK_LT(id, fnames_.size()) << "Test has run for more iterations than it was supposed to";
+    oss << fnames_[id];
+  }
+  else {
+    oss << "iter_" << id;
+  }
+  oss << "_blob_" << blob_id << ".mat";
+  return oss.str();
+}
+
+template <typename Dtype>
+void MatWriteLayer<Dtype>::Enqueue(const Blob<Dtype>& blob, const int n_begin,
+    const int n_end, const int height, const int width,
+    const string& filename) {
+  // The bottom is converted while it is copied out of the window, so that
+  // the workers only have the disk to wait for.
+  MatWriteJob* job = writer_->Get();
+  job->filename = filename;
+  job->Reshape(elem_type_, n_end - n_begin, blob.channels(), height, width);
+  char* out = &job->buffer[0];
+  for (int n = n_begin; n < n_end; ++n) {
+    for (int c = 0; c < blob.channels(); ++c) {
+      for (int h = 0; h < height; ++h) {
+        const Dtype* in = blob.cpu_data(n, c, h);
+        switch (elem_type_) {
+        case MatWriteJob::SINGLE:
+        case MatWriteJob::DOUBLE:
+          memcpy(out, in, width * sizeof(Dtype));
+          out += width * sizeof(Dtype);
+          break;
+        case MatWriteJob::HALF:
+          for (int w = 0; w < width; ++w) {
+            const unsigned short half = FloatToHalf(in[w]);
+            memcpy(out, &half, sizeof(half));
+            out += sizeof(half);
+          }
+          break;
+        case MatWriteJob::UINT8:
+          for (int w = 0; w < width; ++w) {
+            const Dtype value = std::min(std::max(in[w], Dtype(0)), Dtype(1));
+            *out++ = static_cast<unsigned char>(value * 255 + Dtype(0.5));
+          }
+          break;
+        }
+      }
+    }
+  }
+  writer_->Write(job);
 }
 
 template <typename Dtype>
 void MatWriteLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   if (iter_ % period_ == 0) {
-    for (int i = 0; i < bottom.size(); ++i) {
-      std::ostringstream oss;
-      oss << prefix_;
-      if (this->layer_param_.mat_write_param().has_source()) {
-	CHECK_LT(iter_, fnames_.size()) << "Test has run for more iterations than it was supposed to";
-	oss << fnames_[iter_];
+    if (this->layer_param_.mat_write_param().crop_to_dims()) {
+      // One file per image, of its valid window only.
+      const Blob<Dtype>* data_dims = bottom.back();
+      const int num = data_dims->num();
+      // A third value is the position of the image in the source, when the
+      // data layer has sorted its images into buckets.
+      const bool has_index = data_dims->count() == num * 3;
+      for (int i = 0; i < bottom.size() - 1; ++i) {
+	for (int n = 0; n < num; ++n) {
+	  const int id = has_index ?
+	      static_cast<int>(data_dims->data_at(n, 0, 0, 2)) : iter_ * num + n;
+	  const int height = std::min(bottom[i]->height(),
+	      static_cast<int>(data_dims->data_at(n, 0, 0, 0)));
+	  const int width = std::min(bottom[i]->width(),
+	      static_cast<int>(data_dims->data_at(n, 0, 0, 1)));
+	  Enqueue(*bottom[i], n, n + 1, height, width,
+	      FileName(id, i));
+	}
       }
-      else {
-	oss << "iter_" << iter_;
+    }
+    else {
+      for (int i = 0; i < bottom.size(); ++i) {
+	Enqueue(*bottom[i], 0, bottom[i]->num(), bottom[i]->height(),
+	    bottom[i]->width(), FileName(iter_, i));
       }
-      oss << "_blob_" << i << ".mat";
-      bottom[i]->ToMat(oss.str().c_str(), false);
     }
   }
   ++iter_;
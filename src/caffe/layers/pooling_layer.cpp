@@ -76,6 +76,11 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_LT(pad_h_, kernel_h_);
     CHECK_LT(pad_w_, kernel_w_);
   }
+  if (pool_param.compact_mask()) {
+    CHECK(pool_param.pool() == PoolingParameter_PoolMethod_MAX)
+        << "compact_mask applies to max pooling only.";
+  }
+  mask_compact_ = false;
 }
 
 template <typename Dtype>
@@ -106,12 +111,24 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
   top[0]->Reshape(bottom[0]->num(), channels_, pooled_height_,
       pooled_width_);
+  top[0]->set_channels_last(bottom[0]->channels_last());
   if (top.size() > 1) {
+    CHECK(!bottom[0]->channels_last())
+        << "The mask top is not supported with a channel-last bottom.";
     top[1]->ReshapeLike(*top[0]);
   }
-  // If max pooling, we will initialize the vector index part.
+  // If max pooling, we will initialize the vector index part. The offsets
+  // of the compact mask must fit in a uint8, which e.g. global pooling over
+  // a large map does not; such windows fall back to max_idx_.
+  compact_mask_ = this->layer_param_.pooling_param().compact_mask() &&
+      top.size() == 1 && !bottom[0]->channels_last() &&
+      kernel_h_ * kernel_w_ <= 256;
+  if (compact_mask_) {
+    max_idx_compact_.resize(top[0]->count());
+  }
   if (this->layer_param_.pooling_param().pool() ==
       PoolingParameter_PoolMethod_MAX && top.size() == 1) {
+    // Only allocated once used, i.e. on GPU if compact_mask_.
     max_idx_.Reshape(bottom[0]->num(), channels_, pooled_height_,
         pooled_width_);
   }
@@ -123,99 +140,303 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
-// TODO(Yangqing): Is there a faster way to do pooling in the channel-first
-// case?
+// Max pooling of one plane. Every window starts from its first element and
+// only a strictly greater value replaces the maximum, so the argmax is the
+// first maximum in row-major order.
+template <typename Dtype>
+static void max_pool_plane(const Dtype* bottom_data, const int height,
+    const int width, const int kernel_h, const int kernel_w,
+    const int stride_h, const int stride_w, const int pad_h, const int pad_w,
+    const int pooled_height, const int pooled_width,
+    Dtype* top_data, int* mask) {
+  for (int ph = 0; ph < pooled_height; ++ph) {
+    const int hstart = max(ph * stride_h - pad_h, 0);
+    const int hend = min(ph * stride_h - pad_h + kernel_h, height);
+    for (int pw = 0; pw < pooled_width; ++pw) {
+      const int wstart = max(pw * stride_w - pad_w, 0);
+      const int wend = min(pw * stride_w - pad_w + kernel_w, width);
+      int max_index = hstart * width + wstart;
+      Dtype max_value = bottom_data[max_index];
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = wstart; w < wend; ++w) {
+          const int index = h * width + w;
+          if (bottom_data[index] > max_value) {
+            max_value = bottom_data[index];
+            max_index = index;
+          }
+        }
+      }
+      top_data[ph * pooled_width + pw] = max_value;
+      mask[ph * pooled_width + pw] = max_index;
+    }
+  }
+}
+
+// Stride 1 max pooling of one plane, separably: the max over the window
+// width of every input row, then the max of kernel_h of those row maxima.
+// Gives the same values and argmax as max_pool_plane. row_max and row_arg
+// hold height x pooled_width elements.
+template <typename Dtype>
+static void max_pool_plane_stride1(const Dtype* bottom_data, const int height,
+    const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int pooled_height, const int pooled_width,
+    Dtype* row_max, int* row_arg, Dtype* top_data, int* mask) {
+  for (int h = 0; h < height; ++h) {
+    const Dtype* bottom_row = bottom_data + h * width;
+    Dtype* max_row = row_max + h * pooled_width;
+    int* arg_row = row_arg + h * pooled_width;
+    for (int pw = 0; pw < pooled_width; ++pw) {
+      const int wstart = max(pw - pad_w, 0);
+      const int wend = min(pw - pad_w + kernel_w, width);
+      Dtype max_value = bottom_row[wstart];
+      int max_w = wstart;
+      for (int w = wstart + 1; w < wend; ++w) {
+        if (bottom_row[w] > max_value) {
+          max_value = bottom_row[w];
+          max_w = w;
+        }
+      }
+      max_row[pw] = max_value;
+      arg_row[pw] = h * width + max_w;
+    }
+  }
+  for (int ph = 0; ph < pooled_height; ++ph) {
+    const int hstart = max(ph - pad_h, 0);
+    const int hend = min(ph - pad_h + kernel_h, height);
+    Dtype* top_row = top_data + ph * pooled_width;
+    int* mask_row = mask + ph * pooled_width;
+    std::copy(row_max + hstart * pooled_width,
+        row_max + (hstart + 1) * pooled_width, top_row);
+    std::copy(row_arg + hstart * pooled_width,
+        row_arg + (hstart + 1) * pooled_width, mask_row);
+    for (int h = hstart + 1; h < hend; ++h) {
+      const Dtype* max_row = row_max + h * pooled_width;
+      const int* arg_row = row_arg + h * pooled_width;
+      for (int pw = 0; pw < pooled_width; ++pw) {
+        const bool greater = max_row[pw] > top_row[pw];
+        top_row[pw] = greater ? max_row[pw] : top_row[pw];
+        mask_row[pw] = greater ? arg_row[pw] : mask_row[pw];
+      }
+    }
+  }
+}
+
+// Pooling of one channel-last image: each window is reduced for all the
+// channels at once, along the contiguous channel dimension. For max pooling,
+// mask gets the spatial index h * width + w of the first maximum of every
+// output element, as in max_pool_plane.
+template <typename Dtype>
+static void pool_image_channels_last(const bool max_pool,
+    const Dtype* bottom_data, const int channels, const int height,
+    const int width, const int kernel_h, const int kernel_w,
+    const int stride_h, const int stride_w, const int pad_h, const int pad_w,
+    const int pooled_height, const int pooled_width,
+    Dtype* top_data, int* mask) {
+  for (int ph = 0; ph < pooled_height; ++ph) {
+    for (int pw = 0; pw < pooled_width; ++pw) {
+      int hstart = ph * stride_h - pad_h;
+      int wstart = pw * stride_w - pad_w;
+      int hend = min(hstart + kernel_h, height + pad_h);
+      int wend = min(wstart + kernel_w, width + pad_w);
+      const int pool_size = (hend - hstart) * (wend - wstart);
+      hstart = max(hstart, 0);
+      wstart = max(wstart, 0);
+      hend = min(hend, height);
+      wend = min(wend, width);
+      const int top_index = (ph * pooled_width + pw) * channels;
+      Dtype* top = top_data + top_index;
+      if (max_pool) {
+        int* top_mask = mask + top_index;
+        const int first = hstart * width + wstart;
+        std::copy(bottom_data + first * channels,
+            bottom_data + (first + 1) * channels, top);
+        std::fill(top_mask, top_mask + channels, first);
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = (h == hstart) ? wstart + 1 : wstart; w < wend; ++w) {
+            const int index = h * width + w;
+            const Dtype* bottom = bottom_data + index * channels;
+            for (int c = 0; c < channels; ++c) {
+              if (bottom[c] > top[c]) {
+                top[c] = bottom[c];
+                top_mask[c] = index;
+              }
+            }
+          }
+        }
+      } else {
+        std::fill(top, top + channels, Dtype(0));
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const Dtype* bottom = bottom_data + (h * width + w) * channels;
+            for (int c = 0; c < channels; ++c) {
+              top[c] += bottom[c];
+            }
+          }
+        }
+        const Dtype scale = Dtype(1) / pool_size;
+        for (int c = 0; c < channels; ++c) {
+          top[c] *= scale;
+        }
+      }
+    }
+  }
+}
+
+// Backward of pool_image_channels_last.
+template <typename Dtype>
+static void pool_backward_image_channels_last(const bool max_pool,
+    const Dtype* top_diff, const int* mask, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int stride_h, const int stride_w, const int pad_h, const int pad_w,
+    const int pooled_height, const int pooled_width, Dtype* bottom_diff) {
+  caffe_set(height * width * channels, Dtype(0), bottom_diff);
+  for (int ph = 0; ph < pooled_height; ++ph) {
+    for (int pw = 0; pw < pooled_width; ++pw) {
+      const int top_index = (ph * pooled_width + pw) * channels;
+      const Dtype* top = top_diff + top_index;
+      if (max_pool) {
+        const int* top_mask = mask + top_index;
+        for (int c = 0; c < channels; ++c) {
+          bottom_diff[top_mask[c] * channels + c] += top[c];
+        }
+        continue;
+      }
+      int hstart = ph * stride_h - pad_h;
+      int wstart = pw * stride_w - pad_w;
+      int hend = min(hstart + kernel_h, height + pad_h);
+      int wend = min(wstart + kernel_w, width + pad_w);
+      const Dtype scale = Dtype(1) / ((hend - hstart) * (wend - wstart));
+      hstart = max(hstart, 0);
+      wstart = max(wstart, 0);
+      hend = min(hend, height);
+      wend = min(wend, width);
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = wstart; w < wend; ++w) {
+          Dtype* bottom = bottom_diff + (h * width + w) * channels;
+          for (int c = 0; c < channels; ++c) {
+            bottom[c] += top[c] * scale;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Every (n, c) plane is pooled independently, in parallel with OpenMP.
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int top_count = top[0]->count();
+  const int num_planes = bottom[0]->num() * channels_;
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
   int* mask = NULL;  // suppress warnings about uninitalized variables
   Dtype* top_mask = NULL;
+  const bool separable = stride_h_ == 1 && stride_w_ == 1;
+  const PoolingParameter_PoolMethod pool =
+      this->layer_param_.pooling_param().pool();
+  mask_compact_ = false;
+  if (bottom[0]->channels_last() &&
+      pool != PoolingParameter_PoolMethod_STOCHASTIC) {
+    const bool max_pool = pool == PoolingParameter_PoolMethod_MAX;
+    mask = max_pool ? max_idx_.mutable_cpu_data() : NULL;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int n = 0; n < bottom[0]->num(); ++n) {
+      pool_image_channels_last(max_pool,
+          bottom_data + n * channels_ * bottom_dim, channels_, height_, width_,
+          kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_,
+          pooled_height_, pooled_width_, top_data + n * channels_ * top_dim,
+          max_pool ? mask + n * channels_ * top_dim : NULL);
+    }
+    return;
+  }
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
-  switch (this->layer_param_.pooling_param().pool()) {
+  switch (pool) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
+    mask_compact_ = compact_mask_;
     if (use_top_mask) {
       top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
-    } else {
+    } else if (!mask_compact_) {
       mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
     }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
-          }
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+    {
+      // int indices of the planes whose mask is not an int blob, and the
+      // row maxima of the separable path
+      std::vector<int> plane_mask(mask ? 0 : top_dim);
+      std::vector<Dtype> row_max(separable ? height_ * pooled_width_ : 0);
+      std::vector<int> row_arg(row_max.size());
+#ifdef WITH_OPENMP
+#pragma omp for
+#endif
+      for (int i = 0; i < num_planes; ++i) {
+        int* index = mask ? mask + i * top_dim : &plane_mask[0];
+        if (separable) {
+          max_pool_plane_stride1(bottom_data + i * bottom_dim, height_, width_,
+              kernel_h_, kernel_w_, pad_h_, pad_w_,
+              pooled_height_, pooled_width_, &row_max[0], &row_arg[0],
+              top_data + i * top_dim, index);
+        } else {
+          max_pool_plane(bottom_data + i * bottom_dim, height_, width_,
+              kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_,
+              pooled_height_, pooled_width_, top_data + i * top_dim, index);
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
         if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
+          Dtype* plane_top_mask = top_mask + i * top_dim;
+          for (int j = 0; j < top_dim; ++j) {
+            plane_top_mask[j] = index[j];
+          }
+        } else if (mask_compact_) {
+          // offset of the argmax from the (unclipped) window start
+          uint8_t* compact = &max_idx_compact_[i * top_dim];
+          for (int ph = 0; ph < pooled_height_; ++ph) {
+            for (int pw = 0; pw < pooled_width_; ++pw) {
+              const int j = ph * pooled_width_ + pw;
+              const int h = index[j] / width_ - (ph * stride_h_ - pad_h_);
+              const int w = index[j] % width_ - (pw * stride_w_ - pad_w_);
+              compact[j] = static_cast<uint8_t>(h * kernel_w_ + w);
+            }
+          }
         }
       }
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
-    }
     // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < num_planes; ++i) {
+      const Dtype* plane_bottom = bottom_data + i * bottom_dim;
+      Dtype* plane_top = top_data + i * top_dim;
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = ph * stride_h_ - pad_h_;
+          int wstart = pw * stride_w_ - pad_w_;
+          int hend = min(hstart + kernel_h_, height_ + pad_h_);
+          int wend = min(wstart + kernel_w_, width_ + pad_w_);
+          int pool_size = (hend - hstart) * (wend - wstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          Dtype sum = 0;
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              sum += plane_bottom[h * width_ + w];
             }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
           }
+          plane_top[ph * pooled_width_ + pw] = sum / pool_size;
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
       }
     }
     break;
@@ -235,67 +456,96 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
-  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  const int num_planes = top[0]->num() * channels_;
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
   const int* mask = NULL;  // suppress warnings about uninitialized variables
   const Dtype* top_mask = NULL;
-  switch (this->layer_param_.pooling_param().pool()) {
+  const PoolingParameter_PoolMethod pool =
+      this->layer_param_.pooling_param().pool();
+  if (bottom[0]->channels_last() &&
+      pool != PoolingParameter_PoolMethod_STOCHASTIC) {
+    const bool max_pool = pool == PoolingParameter_PoolMethod_MAX;
+    mask = max_pool ? max_idx_.cpu_data() : NULL;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int n = 0; n < bottom[0]->num(); ++n) {
+      pool_backward_image_channels_last(max_pool,
+          top_diff + n * channels_ * top_dim,
+          max_pool ? mask + n * channels_ * top_dim : NULL, channels_,
+          height_, width_, kernel_h_, kernel_w_, stride_h_, stride_w_,
+          pad_h_, pad_w_, pooled_height_, pooled_width_,
+          bottom_diff + n * channels_ * bottom_dim);
+    }
+    return;
+  }
+  // Different pooling methods. We explicitly do the switch outside the for
+  // loop to save time, although this results in more codes.
+  switch (pool) {
   case PoolingParameter_PoolMethod_MAX:
     // The main loop
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
-    } else {
+    } else if (!mask_compact_) {
       mask = max_idx_.cpu_data();
     }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < num_planes; ++i) {
+      Dtype* plane_bottom_diff = bottom_diff + i * bottom_dim;
+      const Dtype* plane_top_diff = top_diff + i * top_dim;
+      caffe_set(bottom_dim, Dtype(0), plane_bottom_diff);
+      if (mask_compact_) {
+        const uint8_t* compact = &max_idx_compact_[i * top_dim];
         for (int ph = 0; ph < pooled_height_; ++ph) {
           for (int pw = 0; pw < pooled_width_; ++pw) {
             const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
+            const int h = ph * stride_h_ - pad_h_ + compact[index] / kernel_w_;
+            const int w = pw * stride_w_ - pad_w_ + compact[index] % kernel_w_;
+            plane_bottom_diff[h * width_ + w] += plane_top_diff[index];
           }
         }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
+        continue;
+      }
+      for (int index = 0; index < top_dim; ++index) {
+        const int bottom_index = use_top_mask ?
+            static_cast<int>(top_mask[i * top_dim + index]) :
+            mask[i * top_dim + index];
+        plane_bottom_diff[bottom_index] += plane_top_diff[index];
       }
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
     // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < num_planes; ++i) {
+      Dtype* plane_bottom_diff = bottom_diff + i * bottom_dim;
+      const Dtype* plane_top_diff = top_diff + i * top_dim;
+      caffe_set(bottom_dim, Dtype(0), plane_bottom_diff);
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = ph * stride_h_ - pad_h_;
+          int wstart = pw * stride_w_ - pad_w_;
+          int hend = min(hstart + kernel_h_, height_ + pad_h_);
+          int wend = min(wstart + kernel_w_, width_ + pad_w_);
+          int pool_size = (hend - hstart) * (wend - wstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          const Dtype diff = plane_top_diff[ph * pooled_width_ + pw] / pool_size;
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              plane_bottom_diff[h * width_ + w] += diff;
             }
           }
         }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
       }
     }
     break;
@@ -1,8 +1,10 @@
 #include <algorithm>
-#include <functional>
-#include <utility>
 #include <vector>
 
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -20,8 +22,17 @@ void SegAccuracyLayer<Dtype>::LayerSetUp(
   confusion_matrix_.resize(bottom[0]->channels());
   SegAccuracyParameter seg_accuracy_param = this->layer_param_.seg_accuracy_param();
   for (int c = 0; c < seg_accuracy_param.ignore_label_size(); ++c){
-    ignore_label_.insert(seg_accuracy_param.ignore_label(c));
+    const int label = seg_accuracy_param.ignore_label(c);
+    if (label < 0) {
+      negative_ignore_labels_.push_back(label);
+      continue;
+    }
+    if (label >= static_cast<int>(ignore_label_.size())) {
+      ignore_label_.resize(label + 1, false);
+    }
+    ignore_label_[label] = true;
   }
+  std::sort(negative_ignore_labels_.begin(), negative_ignore_labels_.end());
 }
 
 template <typename Dtype>
@@ -41,58 +52,74 @@ void SegAccuracyLayer<Dtype>::Reshape(
   top[0]->Reshape(1, 1, 1, 3);
 }
 
+// Number of spatial positions handled together.
+static const int kSegAccuracyTile = 512;
+
 template <typename Dtype>
 void SegAccuracyLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* bottom_label = bottom[1]->cpu_data();
-  int num = bottom[0]->num();
-  //int dim = bottom[0]->count() / bottom[0]->num();
-  int channels = bottom[0]->channels();
-  int height = bottom[0]->height();
-  int width = bottom[0]->width();
+  const int num = bottom[0]->num();
+  const int channels = bottom[0]->channels();
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  const int num_tiles = (spatial_dim + kSegAccuracyTile - 1) / kSegAccuracyTile;
+  const int num_ignore = ignore_label_.size();
 
-  int data_index, label_index;
-
-  int top_k = 1;  // only support for top_k = 1
+  // only support for top_k = 1, i.e. the running maximum over the channels
 
   // remove old predictions if exists
-  confusion_matrix_.clear();  
-
-  for (int i = 0; i < num; ++i) {
-    for (int h = 0; h < height; ++h) {
-      for (int w = 0; w < width; ++w) {
-	// Top-k accuracy
-	std::vector<std::pair<Dtype, int> > bottom_data_vector;
-
-	for (int c = 0; c < channels; ++c) {
-	  data_index = (c * height + h) * width + w;
-	  bottom_data_vector.push_back(std::make_pair(bottom_data[data_index], c));
-	}
-
-	std::partial_sort(
-	  bottom_data_vector.begin(), bottom_data_vector.begin() + top_k,
-	  bottom_data_vector.end(), std::greater<std::pair<Dtype, int> >());
-
-	// check if true label is in top k predictions
-	label_index = h * width + w;
-	const int gt_label = static_cast<int>(bottom_label[label_index]);
+  confusion_matrix_.clear();
 
-	if (ignore_label_.count(gt_label) != 0) {
+  // Every thread counts (actual, predicted) pairs into its own shard of the
+  // confusion matrix, merged into it once all are done.
+#ifdef WITH_OPENMP
+  if (confusion_matrix_.numShards() != omp_get_max_threads()) {
+    confusion_matrix_.resizeShards(omp_get_max_threads());
+  }
+#endif
+  std::vector<unsigned long*> shards(confusion_matrix_.numShards());
+  for (int j = 0; j < confusion_matrix_.numShards(); ++j) {
+    shards[j] = confusion_matrix_.shard(j);
+  }
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+#ifdef WITH_OPENMP
+    unsigned long* counts = shards[omp_get_thread_num()];
+#pragma omp for
+#else
+    unsigned long* counts = shards[0];
+#endif
+    for (int t = 0; t < num * num_tiles; ++t) {
+      const int i = t / num_tiles;
+      const int k0 = (t % num_tiles) * kSegAccuracyTile;
+      const int size = std::min(kSegAccuracyTile, spatial_dim - k0);
+      int predicted[kSegAccuracyTile];
+      Dtype max_val[kSegAccuracyTile];
+      caffe_cpu_channel_argmax(channels, spatial_dim, size,
+          bottom_data + bottom[0]->offset(i) + k0, predicted, max_val);
+      const Dtype* label = bottom_label + bottom[1]->offset(i) + k0;
+      for (int k = 0; k < size; ++k) {
+	const int gt_label = static_cast<int>(label[k]);
+	if (gt_label >= 0 ? gt_label < num_ignore && ignore_label_[gt_label] :
+	    std::binary_search(negative_ignore_labels_.begin(),
+		negative_ignore_labels_.end(), gt_label)) {
 	  // ignore the pixel with this gt_label
 	  continue;
 	} else if (gt_label >= 0 && gt_label < channels) {
 	  // current position is not "255", indicating ambiguous position
-	  confusion_matrix_.accumulate(gt_label, bottom_data_vector[0].second);
+	  ++counts[gt_label * channels + predicted[k]];
 	} else {
 	  LOG(FATAL) << "Unexpected label " << gt_label;
 	}
       }
     }
-    bottom_data  += bottom[0]->offset(1);
-    bottom_label += bottom[1]->offset(1);
   }
 
+  confusion_matrix_.mergeShards();
+
   // we report all the resuls
   top[0]->mutable_cpu_data()[0] = (Dtype)confusion_matrix_.accuracy();
   top[0]->mutable_cpu_data()[1] = (Dtype)confusion_matrix_.avgRecall(false);
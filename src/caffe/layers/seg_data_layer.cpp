@@ -0,0 +1,142 @@
+#include <opencv2/core/core.hpp>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/data_layers.hpp"
+#include "caffe/dataset_factory.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/seg_pack.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+SegDataLayer<Dtype>::~SegDataLayer<Dtype>() {
+  // Stop the workers before the records go away.
+  this->JoinPrefetchThread();
+  if (dataset_) {
+    dataset_->close();
+  }
+}
+
+template <typename Dtype>
+void SegDataLayer<Dtype>::ReadSource() {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const string& source = image_data_param.source();
+  dataset_ = DatasetFactory<string, string>(image_data_param.backend());
+  LOG(INFO) << "Opening dataset " << source;
+  CHECK(dataset_->open(source, Dataset<string, string>::ReadOnly))
+      << "Failed to open dataset " << source;
+  // The workers read the records concurrently: in place if they are mapped,
+  // else by key.
+  int num_records;
+  if (dataset_->mapped_values(&mapped_values_)) {
+    num_records = mapped_values_.size();
+  } else {
+    dataset_->keys(&keys_);
+    num_records = keys_.size();
+  }
+  for (int i = 0; i < num_records; ++i) {
+    std::ostringstream index;
+    index << i;
+    this->lines_.push_back(std::make_pair(index.str(), string()));
+  }
+}
+
+template <typename Dtype>
+void SegDataLayer<Dtype>::WillRead(
+    const std::pair<std::string, std::string>& line) {
+  if (mapped_values_.empty() ||
+      !this->layer_param_.image_data_param().readahead()) {
+    return;
+  }
+  const std::pair<const char*, size_t>& value =
+      mapped_values_[atoi(line.first.c_str())];
+  // madvise wants a page-aligned address.
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t address = reinterpret_cast<size_t>(value.first);
+  const size_t begin = address / page_size * page_size;
+  madvise(reinterpret_cast<void*>(begin), address + value.second - begin,
+      MADV_WILLNEED);
+}
+
+template <typename Dtype>
+void SegDataLayer<Dtype>::ReadImgAndSeg(
+    const std::pair<std::string, std::string>& line,
+    std::vector<cv::Mat>* cv_img_seg, int* img_row, int* img_col) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const int index = atoi(line.first.c_str());
+  cv::Mat cv_img, cv_seg;
+  bool decoded;
+  if (mapped_values_.empty()) {
+    string value;
+    CHECK(dataset_->get(keys_[index], &value))
+        << "Could not read record " << index;
+    SegDatum datum;
+    CHECK(datum.ParseFromString(value)) << "Could not parse record " << index;
+    decoded = DecodeSegDatumToCVMat(datum, image_data_param.new_height(),
+        image_data_param.new_width(), image_data_param.is_color(),
+        &cv_img, &cv_seg);
+  } else {
+    // The record is decoded where it is mapped; raw pixels are not copied
+    // before the transformation.
+    const std::pair<const char*, size_t>& value = mapped_values_[index];
+    SegDatumView view;
+    CHECK(ParseSegDatumView(value.first, value.second, &view))
+        << "Could not parse record " << index;
+    decoded = DecodeSegDatumToCVMat(view, image_data_param.new_height(),
+        image_data_param.new_width(), image_data_param.is_color(),
+        &cv_img, &cv_seg);
+  }
+  CHECK(decoded) << "Could not decode record " << index;
+  if (!cv_seg.data) {
+    // An unlabeled record.
+    cv_seg = cv::Mat(cv_img.rows, cv_img.cols, CV_8UC1,
+        cv::Scalar(image_data_param.ignore_label()));
+  }
+  cv_img_seg->clear();
+  cv_img_seg->push_back(cv_img);
+  cv_img_seg->push_back(cv_seg);
+  *img_row = cv_img.rows;
+  *img_col = cv_img.cols;
+}
+
+template <typename Dtype>
+void SegDataLayer<Dtype>::ReadImgSize(
+    const std::pair<std::string, std::string>& line, int* rows, int* cols) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const int index = atoi(line.first.c_str());
+  int height, width;
+  if (mapped_values_.empty()) {
+    string value;
+    CHECK(dataset_->get(keys_[index], &value))
+        << "Could not read record " << index;
+    SegDatum datum;
+    CHECK(datum.ParseFromString(value)) << "Could not parse record " << index;
+    height = datum.height();
+    width = datum.width();
+  } else {
+    const std::pair<const char*, size_t>& value = mapped_values_[index];
+    SegDatumView view;
+    CHECK(ParseSegDatumView(value.first, value.second, &view))
+        << "Could not parse record " << index;
+    height = view.height;
+    width = view.width;
+  }
+  // The record keeps the size of encoded images as well.
+  const bool resize = image_data_param.new_height() > 0;
+  *rows = resize ? image_data_param.new_height() : height;
+  *cols = resize ? image_data_param.new_width() : width;
+}
+
+INSTANTIATE_CLASS(SegDataLayer);
+REGISTER_LAYER_CLASS(SEG_DATA, SegDataLayer);
+}  // namespace caffe
@@ -0,0 +1,146 @@
+#include <cmath>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void SegHeadLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  InterpParameter interp_param = this->layer_param_.interp_param();
+  int num_specs = 0;
+  num_specs += interp_param.has_zoom_factor();
+  num_specs += interp_param.has_shrink_factor();
+  num_specs += interp_param.has_height() && interp_param.has_width();
+  CHECK_EQ(num_specs, 1) << "Output dimension specified either by "
+                         << "zoom factor or shrink factor or explicitly";
+  pad_beg_ = interp_param.pad_beg();
+  pad_end_ = interp_param.pad_end();
+  CHECK_LE(pad_beg_, 0) << "Only supports non-pos padding (cropping) for now";
+  CHECK_LE(pad_end_, 0) << "Only supports non-pos padding (cropping) for now";
+  softmax_ = this->layer_param_.seg_head_param().softmax();
+}
+
+template <typename Dtype>
+void SegHeadLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  num_ = bottom[0]->num();
+  channels_ = bottom[0]->channels();
+  height_in_ = bottom[0]->height();
+  width_in_ = bottom[0]->width();
+  height_in_eff_ = height_in_ + pad_beg_ + pad_end_;
+  width_in_eff_ = width_in_ + pad_beg_ + pad_end_;
+  InterpParameter interp_param = this->layer_param_.interp_param();
+  if (interp_param.has_zoom_factor()) {
+    const int zoom_factor = interp_param.zoom_factor();
+    CHECK_GE(zoom_factor, 1) << "Zoom factor must be positive";
+    height_out_ = height_in_eff_ + (height_in_eff_ - 1) * (zoom_factor - 1);
+    width_out_ = width_in_eff_ + (width_in_eff_ - 1) * (zoom_factor - 1);
+  } else if (interp_param.has_shrink_factor()) {
+    const int shrink_factor = interp_param.shrink_factor();
+    CHECK_GE(shrink_factor, 1) << "Shrink factor must be positive";
+    height_out_ = (height_in_eff_ - 1) / shrink_factor + 1;
+    width_out_ = (width_in_eff_ - 1) / shrink_factor + 1;
+  } else {
+    height_out_ = interp_param.height();
+    width_out_ = interp_param.width();
+  }
+  CHECK_GT(height_in_eff_, 0) << "height should be positive";
+  CHECK_GT(width_in_eff_, 0) << "width should be positive";
+  CHECK_GT(height_out_, 0) << "height should be positive";
+  CHECK_GT(width_out_, 0) << "width should be positive";
+  for (int top_id = 0; top_id < top.size(); ++top_id) {
+    top[top_id]->Reshape(num_, 1, height_out_, width_out_);
+  }
+  // Horizontal taps, computed exactly as in caffe_cpu_interp2.
+  const float rwidth = (width_out_ > 1) ?
+      static_cast<float>(width_in_eff_ - 1) / (width_out_ - 1) : 0.f;
+  w1_.resize(width_out_);
+  w1p_.resize(width_out_);
+  w1lambda_.resize(width_out_);
+  for (int w2 = 0; w2 < width_out_; ++w2) {
+    const float w1r = rwidth * w2;
+    w1_[w2] = w1r;
+    w1p_[w2] = (w1_[w2] < width_in_eff_ - 1) ? 1 : 0;
+    w1lambda_[w2] = w1r - w1_[w2];
+  }
+  // The scores of all the channels plus the running maximum.
+  row_buffer_.Reshape(1, channels_ + 1, 1, width_out_);
+}
+
+template <typename Dtype>
+void SegHeadLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* label_data = top[0]->mutable_cpu_data();
+  Dtype* score_data = (top.size() > 1) ? top[1]->mutable_cpu_data() : NULL;
+  Dtype* row = row_buffer_.mutable_cpu_data();
+  Dtype* max_row = row + channels_ * width_out_;
+  const float rheight = (height_out_ > 1) ?
+      static_cast<float>(height_in_eff_ - 1) / (height_out_ - 1) : 0.f;
+  for (int n = 0; n < num_; ++n) {
+    for (int h2 = 0; h2 < height_out_; ++h2) {
+      const float h1r = rheight * h2;
+      const int h1 = h1r;
+      const int h1p = (h1 < height_in_eff_ - 1) ? 1 : 0;
+      const Dtype h1lambda = h1r - h1;
+      const Dtype h0lambda = Dtype(1.) - h1lambda;
+      // Upsample this row of every channel.
+      for (int c = 0; c < channels_; ++c) {
+        const Dtype* pos0 = bottom_data +
+            bottom[0]->offset(n, c, h1 - pad_beg_, -pad_beg_);
+        const Dtype* pos1 = pos0 + h1p * width_in_;
+        Dtype* row_c = row + c * width_out_;
+        for (int w2 = 0; w2 < width_out_; ++w2) {
+          const int w1 = w1_[w2];
+          const int w1p = w1p_[w2];
+          const Dtype w1lambda = w1lambda_[w2];
+          const Dtype w0lambda = Dtype(1.) - w1lambda;
+          row_c[w2] =
+              h0lambda * (w0lambda * pos0[w1] + w1lambda * pos0[w1 + w1p]) +
+              h1lambda * (w0lambda * pos1[w1] + w1lambda * pos1[w1 + w1p]);
+        }
+      }
+      // Running argmax over the channels.
+      Dtype* label_row = label_data + top[0]->offset(n, 0, h2);
+      caffe_copy(width_out_, row, max_row);
+      caffe_set(width_out_, Dtype(0), label_row);
+      for (int c = 1; c < channels_; ++c) {
+        const Dtype* row_c = row + c * width_out_;
+        for (int w2 = 0; w2 < width_out_; ++w2) {
+          if (row_c[w2] >= max_row[w2]) {
+            max_row[w2] = row_c[w2];
+            label_row[w2] = c;
+          }
+        }
+      }
+      if (!score_data) {
+        continue;
+      }
+      Dtype* score_row = score_data + top[1]->offset(n, 0, h2);
+      if (!softmax_) {
+        caffe_copy(width_out_, max_row, score_row);
+        continue;
+      }
+      // The softmax probability of the maximum is 1 / sum_c exp(x_c - max).
+      caffe_set(width_out_, Dtype(0), score_row);
+      for (int c = 0; c < channels_; ++c) {
+        const Dtype* row_c = row + c * width_out_;
+        for (int w2 = 0; w2 < width_out_; ++w2) {
+          score_row[w2] += exp(row_c[w2] - max_row[w2]);
+        }
+      }
+      for (int w2 = 0; w2 < width_out_; ++w2) {
+        score_row[w2] = Dtype(1) / score_row[w2];
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(SegHeadLayer);
+REGISTER_LAYER_CLASS(SEG_HEAD, SegHeadLayer);
+
+}  // namespace caffe
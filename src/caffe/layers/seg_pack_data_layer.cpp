@@ -0,0 +1,85 @@
+#include <opencv2/core/core.hpp>
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/data_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/seg_pack.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+SegPackDataLayer<Dtype>::~SegPackDataLayer<Dtype>() {
+  // Stop the workers before the mapping goes away.
+  this->JoinPrefetchThread();
+}
+
+template <typename Dtype>
+void SegPackDataLayer<Dtype>::ReadSource() {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const string& source = image_data_param.source();
+  LOG(INFO) << "Opening seg pack " << source;
+  CHECK(reader_.Open(source, image_data_param.readahead()))
+      << "Could not open seg pack " << source;
+  for (int i = 0; i < reader_.size(); ++i) {
+    std::ostringstream index;
+    index << i;
+    this->lines_.push_back(std::make_pair(index.str(), string()));
+  }
+}
+
+template <typename Dtype>
+void SegPackDataLayer<Dtype>::WillRead(
+    const std::pair<std::string, std::string>& line) {
+  reader_.WillNeed(atoi(line.first.c_str()));
+}
+
+template <typename Dtype>
+void SegPackDataLayer<Dtype>::ReadImgAndSeg(
+    const std::pair<std::string, std::string>& line,
+    std::vector<cv::Mat>* cv_img_seg, int* img_row, int* img_col) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const int index = atoi(line.first.c_str());
+  // The record is decoded where it is mapped; raw pixels are not copied
+  // before the transformation.
+  SegDatumView view;
+  CHECK(reader_.Read(index, &view)) << "Could not parse record " << index;
+  cv::Mat cv_img, cv_seg;
+  CHECK(DecodeSegDatumToCVMat(view, image_data_param.new_height(),
+      image_data_param.new_width(), image_data_param.is_color(),
+      &cv_img, &cv_seg)) << "Could not decode record " << index;
+  if (!cv_seg.data) {
+    // An unlabeled record.
+    cv_seg = cv::Mat(cv_img.rows, cv_img.cols, CV_8UC1,
+        cv::Scalar(image_data_param.ignore_label()));
+  }
+  cv_img_seg->clear();
+  cv_img_seg->push_back(cv_img);
+  cv_img_seg->push_back(cv_seg);
+  *img_row = cv_img.rows;
+  *img_col = cv_img.cols;
+}
+
+template <typename Dtype>
+void SegPackDataLayer<Dtype>::ReadImgSize(
+    const std::pair<std::string, std::string>& line, int* rows, int* cols) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const int index = atoi(line.first.c_str());
+  SegDatumView view;
+  CHECK(reader_.Read(index, &view)) << "Could not parse record " << index;
+  // The record keeps the size of encoded images as well.
+  const bool resize = image_data_param.new_height() > 0;
+  *rows = resize ? image_data_param.new_height() : view.height;
+  *cols = resize ? image_data_param.new_width() : view.width;
+}
+
+INSTANTIATE_CLASS(SegPackDataLayer);
+REGISTER_LAYER_CLASS(SEG_PACK_DATA, SegPackDataLayer);
+}  // namespace caffe
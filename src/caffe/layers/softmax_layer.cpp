@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -10,8 +11,11 @@ namespace caffe {
 template <typename Dtype>
 void SoftmaxLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  // Read before reshaping, which resets the layout of an in-place top.
+  const bool channels_last = bottom[0]->channels_last();
   top[0]->Reshape(bottom[0]->num(), bottom[0]->channels(),
       bottom[0]->height(), bottom[0]->width());
+  top[0]->set_channels_last(channels_last);
   sum_multiplier_.Reshape(1, bottom[0]->channels(), 1, 1);
   Dtype* multiplier_data = sum_multiplier_.mutable_cpu_data();
   for (int i = 0; i < sum_multiplier_.count(); ++i) {
@@ -20,41 +24,56 @@ void SoftmaxLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   scale_.Reshape(bottom[0]->num(), 1, bottom[0]->height(), bottom[0]->width());
 }
 
+// Number of spatial positions handled together. A tile of all the channels
+// stays in cache through the max, exp-sum and normalization passes, so the
+// blob is read and written once from memory.
+static const int kSoftmaxTile = 512;
+
 template <typename Dtype>
 void SoftmaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* scale_data = scale_.mutable_cpu_data();
   int num = bottom[0]->num();
   int channels = bottom[0]->channels();
   int dim = bottom[0]->count() / bottom[0]->num();
   int spatial_dim = bottom[0]->height() * bottom[0]->width();
-  caffe_copy(bottom[0]->count(), bottom_data, top_data);
-  // We need to subtract the max to avoid numerical issues, compute the exp,
-  // and then normalize.
-  for (int i = 0; i < num; ++i) {
-    // initialize scale_data to the first plane
-    caffe_copy(spatial_dim, bottom_data + i * dim, scale_data);
-    for (int j = 0; j < channels; j++) {
-      for (int k = 0; k < spatial_dim; k++) {
-        scale_data[k] = std::max(scale_data[k],
-            bottom_data[i * dim + j * spatial_dim + k]);
+  if (bottom[0]->channels_last()) {
+    // The channels of a position are contiguous: no tiling needed.
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < num * spatial_dim; ++i) {
+      const Dtype* x = bottom_data + i * channels;
+      Dtype* y = top_data + i * channels;
+      Dtype max_val = x[0];
+      for (int j = 1; j < channels; ++j) {
+        max_val = std::max(max_val, x[j]);
+      }
+      Dtype sum = 0;
+      for (int j = 0; j < channels; ++j) {
+        y[j] = exp(x[j] - max_val);
+        sum += y[j];
+      }
+      const Dtype scale = Dtype(1) / sum;
+      for (int j = 0; j < channels; ++j) {
+        y[j] *= scale;
       }
     }
-    // subtraction
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-        1, -1., sum_multiplier_.cpu_data(), scale_data, 1., top_data + i * dim);
-    // exponentiation
-    caffe_exp<Dtype>(dim, top_data + i * dim, top_data + i * dim);
-    // sum after exp
-    caffe_cpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, 1.,
-        top_data + i * dim, sum_multiplier_.cpu_data(), 0., scale_data);
-    // division
-    for (int j = 0; j < channels; j++) {
-      caffe_div(spatial_dim, top_data + top[0]->offset(i, j), scale_data,
-          top_data + top[0]->offset(i, j));
-    }
+    return;
+  }
+  int num_tiles = (spatial_dim + kSoftmaxTile - 1) / kSoftmaxTile;
+  // Within a tile we subtract the max to avoid numerical issues, compute the
+  // exp, and then normalize.
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for (int t = 0; t < num * num_tiles; ++t) {
+    const int offset = (t / num_tiles) * dim + (t % num_tiles) * kSoftmaxTile;
+    const int size = std::min(kSoftmaxTile,
+        spatial_dim - (t % num_tiles) * kSoftmaxTile);
+    caffe_cpu_channel_softmax(channels, spatial_dim, size,
+        bottom_data + offset, top_data + offset);
   }
 }
 
@@ -65,25 +84,56 @@ void SoftmaxLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* top_data = top[0]->cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Dtype* scale_data = scale_.mutable_cpu_data();
   int num = top[0]->num();
   int channels = top[0]->channels();
   int dim = top[0]->count() / top[0]->num();
   int spatial_dim = top[0]->height() * top[0]->width();
-  caffe_copy(top[0]->count(), top_diff, bottom_diff);
-  for (int i = 0; i < num; ++i) {
-    // compute dot(top_diff, top_data) and subtract them from the bottom diff
-    for (int k = 0; k < spatial_dim; ++k) {
-      scale_data[k] = caffe_cpu_strided_dot<Dtype>(channels,
-          bottom_diff + i * dim + k, spatial_dim,
-          top_data + i * dim + k, spatial_dim);
+  if (top[0]->channels_last()) {
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < num * spatial_dim; ++i) {
+      const Dtype* diff = top_diff + i * channels;
+      const Dtype* data = top_data + i * channels;
+      Dtype* out = bottom_diff + i * channels;
+      Dtype dot = 0;
+      for (int j = 0; j < channels; ++j) {
+        dot += diff[j] * data[j];
+      }
+      for (int j = 0; j < channels; ++j) {
+        out[j] = (diff[j] - dot) * data[j];
+      }
+    }
+    return;
+  }
+  int num_tiles = (spatial_dim + kSoftmaxTile - 1) / kSoftmaxTile;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for (int t = 0; t < num * num_tiles; ++t) {
+    const int offset = (t / num_tiles) * dim + (t % num_tiles) * kSoftmaxTile;
+    const int size = std::min(kSoftmaxTile,
+        spatial_dim - (t % num_tiles) * kSoftmaxTile);
+    Dtype dot_data[kSoftmaxTile];
+    // compute dot(top_diff, top_data) over the channels
+    std::fill(dot_data, dot_data + size, Dtype(0));
+    for (int j = 0; j < channels; ++j) {
+      const Dtype* diff = top_diff + offset + j * spatial_dim;
+      const Dtype* data = top_data + offset + j * spatial_dim;
+      for (int k = 0; k < size; ++k) {
+        dot_data[k] += diff[k] * data[k];
+      }
+    }
+    // subtract it from the top diff and multiply by the top data
+    for (int j = 0; j < channels; ++j) {
+      const Dtype* diff = top_diff + offset + j * spatial_dim;
+      const Dtype* data = top_data + offset + j * spatial_dim;
+      Dtype* out = bottom_diff + offset + j * spatial_dim;
+      for (int k = 0; k < size; ++k) {
+        out[k] = (diff[k] - dot_data[k]) * data[k];
+      }
     }
-    // subtraction
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim, 1,
-        -1., sum_multiplier_.cpu_data(), scale_data, 1., bottom_diff + i * dim);
   }
-  // elementwise multiplication
-  caffe_mul(top[0]->count(), bottom_diff, top_data, bottom_diff);
 }
 
 
@@ -13,6 +13,10 @@ template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::LayerSetUp(bottom, top);
+  // The loss weights are per top of this layer, not of the softmax.
+  LayerParameter softmax_param(this->layer_param_);
+  softmax_param.clear_loss_weight();
+  softmax_layer_.reset(new SoftmaxLayer<Dtype>(softmax_param));
   softmax_bottom_vec_.clear();
   softmax_bottom_vec_.push_back(bottom[0]);
   softmax_top_vec_.clear();
@@ -41,8 +45,17 @@ void SoftmaxWithLossLayer<Dtype>::LayerSetUp(
     loss_weights_.assign(prob_.channels(), 1.0);
   }
   for (int c = 0; c < softmaxloss_param.ignore_label_size(); ++c){
-    ignore_label_.insert(softmaxloss_param.ignore_label(c));
+    const int label = softmaxloss_param.ignore_label(c);
+    if (label < 0) {
+      negative_ignore_labels_.push_back(label);
+      continue;
+    }
+    if (label >= static_cast<int>(ignore_label_.size())) {
+      ignore_label_.resize(label + 1, false);
+    }
+    ignore_label_[label] = true;
   }
+  std::sort(negative_ignore_labels_.begin(), negative_ignore_labels_.end());
 }
 
 template <typename Dtype>
@@ -57,36 +70,82 @@ void SoftmaxWithLossLayer<Dtype>::Reshape(
 }
 
 template <typename Dtype>
-void SoftmaxWithLossLayer<Dtype>::Forward_cpu(
-    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // The forward pass computes the softmax prob values.
-  softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
-  const Dtype* prob_data = prob_.cpu_data();
+int SoftmaxWithLossLayer<Dtype>::LabelOf(const Dtype label_value) const {
+  const int gt_label = static_cast<int>(label_value);
+  if (gt_label >= 0 ?
+      gt_label < static_cast<int>(ignore_label_.size()) &&
+      ignore_label_[gt_label] :
+      std::binary_search(negative_ignore_labels_.begin(),
+          negative_ignore_labels_.end(), gt_label)) {
+    return -1;
+  }
+  if (gt_label < 0 || gt_label >= prob_.channels()) {
+    LOG(FATAL) << "Unexpected label " << gt_label;
+  }
+  return gt_label;
+}
+
+// Number of spatial positions handled together; see SoftmaxLayer.
+static const int kSoftmaxLossTile = 512;
+
+template <typename Dtype>
+void SoftmaxWithLossLayer<Dtype>::ForwardTiles(
+    const vector<Blob<Dtype>*>& bottom, bool compute_prob) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* prob_data = compute_prob ? prob_.mutable_cpu_data() :
+      const_cast<Dtype*>(prob_.cpu_data());
   const Dtype* label = bottom[1]->cpu_data();
-  int num = prob_.num();
-  int dim = prob_.count() / num;
-  int channels = prob_.channels();
-  Dtype batch_weight = 0;
-  int spatial_dim = prob_.height() * prob_.width();
-  Dtype loss = 0;
-  for (int i = 0; i < num; ++i) {
-    for (int j = 0; j < spatial_dim; j++) {
-      const int gt_label = static_cast<int>(label[i * spatial_dim + j]);
-
-      if (ignore_label_.count(gt_label) != 0) {
+  const int num = prob_.num();
+  const int dim = prob_.count() / num;
+  const int channels = prob_.channels();
+  const int spatial_dim = prob_.height() * prob_.width();
+  const int num_tiles = (spatial_dim + kSoftmaxLossTile - 1) / kSoftmaxLossTile;
+  tile_loss_.resize(num * num_tiles);
+  tile_weight_.resize(num * num_tiles);
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+  for (int t = 0; t < num * num_tiles; ++t) {
+    const int i = t / num_tiles;
+    const int j0 = (t % num_tiles) * kSoftmaxLossTile;
+    const int size = std::min(kSoftmaxLossTile, spatial_dim - j0);
+    const Dtype* tile_label = label + i * spatial_dim + j0;
+    Dtype* tile_prob = prob_data + i * dim + j0;
+    if (compute_prob) {
+      // The softmax of this tile stays in cache for the loss.
+      caffe_cpu_channel_softmax(channels, spatial_dim, size,
+          bottom_data + i * dim + j0, tile_prob);
+    }
+    Dtype loss = 0;
+    Dtype batch_weight = 0;
+    for (int j = 0; j < size; ++j) {
+      const int gt_label = LabelOf(tile_label[j]);
+      if (gt_label < 0) {
 	// ignore the pixel with this gt_label
 	continue;
-      } else if (gt_label >= 0 && gt_label < channels) {
-	batch_weight += loss_weights_[gt_label];
-	// weighted loss
-	loss -= loss_weights_[gt_label] * log(std::max(prob_data[i * dim +
-           gt_label * spatial_dim + j], Dtype(FLT_MIN)));
-      } else {
-	LOG(FATAL) << "Unexpected label " << gt_label;
       }
+      batch_weight += loss_weights_[gt_label];
+      // weighted loss
+      loss -= loss_weights_[gt_label] * log(std::max(
+          tile_prob[gt_label * spatial_dim + j], Dtype(FLT_MIN)));
     }
+    tile_loss_[t] = loss;
+    tile_weight_[t] = batch_weight;
+  }
+  loss_ = 0;
+  batch_weight_ = 0;
+  for (int t = 0; t < num * num_tiles; ++t) {
+    loss_ += tile_loss_[t];
+    batch_weight_ += tile_weight_[t];
   }
-  top[0]->mutable_cpu_data()[0] = loss / batch_weight;
+}
+
+template <typename Dtype>
+void SoftmaxWithLossLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // The forward pass computes the softmax prob values and the loss.
+  ForwardTiles(bottom, true);
+  top[0]->mutable_cpu_data()[0] = loss_ / batch_weight_;
   if (top.size() == 2) {
     top[1]->ShareData(prob_);
   }
@@ -106,37 +165,47 @@ void SoftmaxWithLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (propagate_down[0]) {
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const Dtype* prob_data = prob_.cpu_data();
-    // We need to do *weighted* copy, so we defer that for the loop
-    //caffe_copy(prob_.count(), prob_data, bottom_diff);
     const Dtype* label = bottom[1]->cpu_data();
-    int num = prob_.num();
-    int dim = prob_.count() / num;
-    int channels = prob_.channels();
-    Dtype batch_weight = 0;
-    int spatial_dim = prob_.height() * prob_.width();
-    for (int i = 0; i < num; ++i) {
-      for (int j = 0; j < spatial_dim; ++j) {
-	const int gt_label = static_cast<int>(label[i * spatial_dim + j]);
-
-	if (ignore_label_.count(gt_label) != 0) {
-	  // ignore the pixel with this gt_label
-	  continue;
-	} else if (gt_label >= 0 && gt_label < channels) {
-	  batch_weight += loss_weights_[gt_label];
-	  for (int c = 0; c < channels; ++c) {
-	    bottom_diff[i * dim + c * spatial_dim + j] = 
-	      loss_weights_[gt_label] * prob_data[i * dim + c * spatial_dim + j];
-	  }
-	  bottom_diff[i * dim + gt_label * spatial_dim + j] -= 
-	    loss_weights_[gt_label];
-	} else {
-	  LOG(ERROR) << "Unexpected label.";
-	}
+    const int num = prob_.num();
+    const int dim = prob_.count() / num;
+    const int channels = prob_.channels();
+    const int spatial_dim = prob_.height() * prob_.width();
+    const int num_tiles =
+        (spatial_dim + kSoftmaxLossTile - 1) / kSoftmaxLossTile;
+    // The weighted gradient, scaled by the loss weight and normalized by the
+    // batch weight of the forward pass in the same pass.
+    const Dtype scale = top[0]->cpu_diff()[0] / batch_weight_;
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int t = 0; t < num * num_tiles; ++t) {
+      const int i = t / num_tiles;
+      const int j0 = (t % num_tiles) * kSoftmaxLossTile;
+      const int size = std::min(kSoftmaxLossTile, spatial_dim - j0);
+      const Dtype* tile_label = label + i * spatial_dim + j0;
+      const Dtype* tile_prob = prob_data + i * dim + j0;
+      Dtype* tile_diff = bottom_diff + i * dim + j0;
+      // Label and scaled weight of every position, 0 for ignored ones.
+      int gt_labels[kSoftmaxLossTile];
+      Dtype weights[kSoftmaxLossTile];
+      for (int j = 0; j < size; ++j) {
+        gt_labels[j] = LabelOf(tile_label[j]);
+        weights[j] = gt_labels[j] < 0 ? Dtype(0) :
+            scale * loss_weights_[gt_labels[j]];
+      }
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* prob_c = tile_prob + c * spatial_dim;
+        Dtype* diff_c = tile_diff + c * spatial_dim;
+        for (int j = 0; j < size; ++j) {
+          diff_c[j] = weights[j] * prob_c[j];
+        }
+      }
+      for (int j = 0; j < size; ++j) {
+        if (gt_labels[j] >= 0) {
+          tile_diff[gt_labels[j] * spatial_dim + j] -= weights[j];
+        }
       }
     }
-    // Scale gradient
-    const Dtype loss_weight = top[0]->cpu_diff()[0];
-    caffe_scal(prob_.count(), loss_weight / batch_weight, bottom_diff);
   }
 }
 
@@ -11,7 +11,13 @@ namespace caffe {
 template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  Forward_cpu(bottom, top);
+  // The softmax runs on the GPU; the loss is summed on the CPU.
+  softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
+  ForwardTiles(bottom, false);
+  top[0]->mutable_cpu_data()[0] = loss_ / batch_weight_;
+  if (top.size() == 2) {
+    top[1]->ShareData(prob_);
+  }
 }
 
 template <typename Dtype>
@@ -258,6 +258,31 @@ void LmdbDataset<K, V, KCoder, VCoder>::keys(vector<K>* keys) {
   }
 }
 
+template <typename K, typename V, typename KCoder, typename VCoder>
+bool LmdbDataset<K, V, KCoder, VCoder>::mapped_values(
+    vector<std::pair<const char*, size_t> >* values) const {
+  DLOG(INFO) << "LMDB: Mapped values";
+
+  // The values returned in the read transaction point into the mapping and
+  // remain valid until it ends.
+  values->clear();
+  MDB_cursor* cursor;
+  int retval = mdb_cursor_open(read_txn_, dbi_, &cursor);
+  CHECK_EQ(retval, MDB_SUCCESS) << mdb_strerror(retval);
+  MDB_val key;
+  MDB_val val;
+  retval = mdb_cursor_get(cursor, &key, &val, MDB_FIRST);
+  while (MDB_SUCCESS == retval) {
+    values->push_back(std::make_pair(static_cast<const char*>(val.mv_data),
+        val.mv_size));
+    retval = mdb_cursor_get(cursor, &key, &val, MDB_NEXT);
+  }
+  CHECK_EQ(MDB_NOTFOUND, retval) << mdb_strerror(retval);
+  mdb_cursor_close(cursor);
+
+  return true;
+}
+
 template <typename K, typename V, typename KCoder, typename VCoder>
 typename LmdbDataset<K, V, KCoder, VCoder>::const_iterator
     LmdbDataset<K, V, KCoder, VCoder>::begin() const {
@@ -9,6 +9,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/insert_layouts.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -38,6 +39,19 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   FilterNet(in_param, &filtered_param);
   LOG(INFO) << "Initializing net from parameters: " << std::endl
             << filtered_param.DebugString();
+  // Run the supporting layers channel-last, converting at the boundaries.
+  if (filtered_param.channels_last()) {
+    if (Caffe::mode() != Caffe::CPU) {
+      LOG(WARNING) << "channels_last is only supported in CPU mode; ignored.";
+    } else if (Caffe::phase() != Caffe::TEST) {
+      LOG(WARNING) << "channels_last is only supported in the TEST phase, "
+          "as the converted convolutions have no backward pass; ignored.";
+    } else {
+      NetParameter layout_param;
+      InsertLayouts(filtered_param, &layout_param);
+      filtered_param.CopyFrom(layout_param);
+    }
+  }
   // Create a copy of filtered_param with splits added where necessary.
   NetParameter param;
   InsertSplits(filtered_param, &param);
@@ -215,7 +229,37 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
+  // A data layer that sorts its images into buckets gives the position of
+  // every image in the source as a third data_dims value. MAT_WRITE has to
+  // name its files by it, or they would silently get other images' names.
+  set<int> indexed_dims;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    if (layers_[layer_id]->layer_param().image_data_param().bucket_stride()
+        && top_ids.size() == 3 && blobs_[top_ids[2]]->width() == 3) {
+      indexed_dims.insert(top_ids[2]);
+    } else if (layers_[layer_id]->type() == LayerParameter_LayerType_SPLIT &&
+        indexed_dims.count(bottom_id_vecs_[layer_id][0])) {
+      indexed_dims.insert(top_ids.begin(), top_ids.end());
+    } else if (layers_[layer_id]->type() ==
+        LayerParameter_LayerType_MAT_WRITE && !indexed_dims.empty()) {
+      CHECK(layers_[layer_id]->layer_param().mat_write_param().crop_to_dims()
+          && indexed_dims.count(bottom_id_vecs_[layer_id].back()))
+          << "Layer " << layer_names_[layer_id] << " must take the data_dims "
+          << "of the bucketed data layer as its last bottom, with crop_to_dims.";
+    }
+  }
   GetLearningRateAndWeightDecay();
+  if (param.plan_memory()) {
+    if (Caffe::mode() != Caffe::CPU) {
+      LOG(WARNING) << "plan_memory is only supported in CPU mode; ignored.";
+    } else if (Caffe::phase() != Caffe::TEST) {
+      LOG(WARNING) << "plan_memory is only supported in the TEST phase, "
+          "as backward needs all the activations; ignored.";
+    } else {
+      PlanMemory();
+    }
+  }
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
   // Don't display debug info by default.
@@ -497,6 +541,204 @@ void Net<Dtype>::GetLearningRateAndWeightDecay() {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  const int num_blobs = blobs_.size();
+  blob_storage_.assign(num_blobs, -1);
+  storage_arena_.assign(num_blobs, -1);
+  storage_births_.assign(layers_.size(), vector<int>());
+  arena_storages_.clear();
+  // A storage lives from the first layer writing it to the last layer using
+  // it. Layer -1 writes the inputs of the net.
+  vector<int> birth(num_blobs, -1);
+  vector<int> death(num_blobs, -1);
+  vector<bool> pinned(num_blobs, false);
+  for (int layer_id = -1; layer_id < static_cast<int>(layers_.size());
+       ++layer_id) {
+    const vector<int>& top_ids = layer_id < 0 ?
+        net_input_blob_indices_ : top_id_vecs_[layer_id];
+    // SPLIT and FLATTEN point their tops at the memory of their bottom in
+    // the forward pass, so the tops hold the storage of the bottom.
+    bool aliases_bottom = false;
+    bool owns_top1 = false;
+    if (layer_id >= 0) {
+      for (int bottom_id = 0; bottom_id < bottom_id_vecs_[layer_id].size();
+           ++bottom_id) {
+        const int storage = blob_storage_[bottom_id_vecs_[layer_id][bottom_id]];
+        if (storage >= 0) {
+          death[storage] = layer_id;
+        }
+      }
+      const LayerParameter_LayerType type = layers_[layer_id]->type();
+      aliases_bottom = type == LayerParameter_LayerType_SPLIT ||
+          type == LayerParameter_LayerType_FLATTEN;
+      owns_top1 = type == LayerParameter_LayerType_SOFTMAX_LOSS;
+    }
+    for (int top_id = 0; top_id < top_ids.size(); ++top_id) {
+      const int blob_id = top_ids[top_id];
+      // An in-place top already holds the storage of its bottom.
+      if (blob_storage_[blob_id] < 0) {
+        const int storage = aliases_bottom ?
+            blob_storage_[bottom_id_vecs_[layer_id][0]] : blob_id;
+        blob_storage_[blob_id] = storage;
+        if (storage == blob_id) {
+          birth[storage] = layer_id;
+        }
+      }
+      const int storage = blob_storage_[blob_id];
+      death[storage] = layer_id;
+      // The data layers point their tops at batches of their own, and
+      // SOFTMAX_LOSS its second top at its probabilities, in the forward
+      // pass. Placing those tops would move that memory into an arena.
+      if (layer_id < 0 || bottom_vecs_[layer_id].empty() ||
+          (owns_top1 && top_id == 1)) {
+        pinned[storage] = true;
+      }
+    }
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[blob_storage_[net_output_blob_indices_[i]]] = true;
+  }
+  // Memory a layer shares with a top at setup has holders outside the net.
+  map<const SyncedMemory*, int> memory_holders;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    ++memory_holders[blobs_[blob_id]->data().get()];
+  }
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    const shared_ptr<SyncedMemory>& memory = blobs_[blob_id]->data();
+    if (blob_storage_[blob_id] >= 0 &&
+        memory.use_count() > memory_holders[memory.get()]) {
+      pinned[blob_storage_[blob_id]] = true;
+    }
+  }
+  // Assign the storages in the order they are written to the arena whose
+  // size fits best among those free by then.
+  vector<size_t> arena_bytes;
+  vector<int> arena_free_after;
+  size_t naive_bytes = 0;
+  size_t planned_bytes = 0;
+  int num_planned = 0;
+  for (int storage = 0; storage < num_blobs; ++storage) {
+    if (blob_storage_[storage] != storage) {
+      continue;
+    }
+    const size_t bytes = blobs_[storage]->count() * sizeof(Dtype);
+    naive_bytes += bytes;
+    if (pinned[storage]) {
+      planned_bytes += bytes;
+      continue;
+    }
+    int best = -1;
+    for (int arena = 0; arena < arena_bytes.size(); ++arena) {
+      if (arena_free_after[arena] >= birth[storage]) {
+        continue;
+      }
+      // Prefer the smallest arena holding the storage, else the largest.
+      if (best < 0 ||
+          (arena_bytes[best] >= bytes ? (arena_bytes[arena] >= bytes &&
+              arena_bytes[arena] < arena_bytes[best]) :
+              arena_bytes[arena] > arena_bytes[best])) {
+        best = arena;
+      }
+    }
+    if (best < 0) {
+      best = arena_bytes.size();
+      arena_bytes.push_back(0);
+      arena_free_after.push_back(-1);
+      arena_storages_.push_back(vector<int>());
+    }
+    arena_bytes[best] = std::max(arena_bytes[best], bytes);
+    arena_free_after[best] = death[storage];
+    arena_storages_[best].push_back(storage);
+    storage_arena_[storage] = best;
+    storage_births_[birth[storage]].push_back(storage);
+    ++num_planned;
+  }
+  arenas_.clear();
+  for (int arena = 0; arena < arena_bytes.size(); ++arena) {
+    arenas_.push_back(shared_ptr<SyncedMemory>(
+        new SyncedMemory(arena_bytes[arena])));
+    planned_bytes += arena_bytes[arena];
+  }
+  LOG(INFO) << "Memory planned for data: " << planned_bytes << " instead of "
+      << naive_bytes << " bytes, with " << num_planned << " blobs sharing "
+      << arenas_.size() << " arenas.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlaceTops(const int layer_id) {
+  const vector<int>& storages = storage_births_[layer_id];
+  for (int i = 0; i < storages.size(); ++i) {
+    const int arena = storage_arena_[storages[i]];
+    Blob<Dtype>* blob = blobs_[storages[i]].get();
+    if (arena < 0 || blob->count() == 0) {
+      continue;
+    }
+    // The previous users of the arena are dead, so it can grow, e.g. for a
+    // larger batch. They move along to the new arena, which fits them all,
+    // so that no blob is left pointing at freed memory.
+    if (arenas_[arena]->size() < blob->count() * sizeof(Dtype)) {
+      const vector<int>& users = arena_storages_[arena];
+      size_t bytes = 0;
+      for (int j = 0; j < users.size(); ++j) {
+        bytes = std::max(bytes, blobs_[users[j]]->count() * sizeof(Dtype));
+      }
+      arenas_[arena].reset(new SyncedMemory(bytes));
+      Dtype* data = static_cast<Dtype*>(arenas_[arena]->mutable_cpu_data());
+      for (int j = 0; j < users.size(); ++j) {
+        if (storage_arena_[users[j]] == arena) {
+          blobs_[users[j]]->set_cpu_data(data);
+        }
+      }
+    }
+    blob->set_cpu_data(static_cast<Dtype*>(arenas_[arena]->mutable_cpu_data()));
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::UnplanStorage(const int storage) {
+  storage_arena_[storage] = -1;
+  // The blobs holding the storage share the new memory at once, as the
+  // SPLIT and FLATTEN tops would only do so in their next forward pass.
+  Blob<Dtype>* blob = blobs_[storage].get();
+  Blob<Dtype> own(blob->num(), blob->channels(), blob->height(), blob->width());
+  blob->ShareData(own);
+  for (int i = 0; i < blobs_.size(); ++i) {
+    if (i != storage && blob_storage_[i] == storage) {
+      blobs_[i]->ShareData(*blob);
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::UnplanBlob(const int blob_id) {
+  if (storage_births_.empty()) {
+    return;
+  }
+  const int storage = blob_storage_[blob_id];
+  if (storage < 0 || storage_arena_[storage] < 0) {
+    return;
+  }
+  UnplanStorage(storage);
+  LOG(INFO) << "Blob " << blob_names_[blob_id] << " no longer shares memory.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::UnplanMemory() {
+  if (storage_births_.empty()) {
+    return;
+  }
+  for (int storage = 0; storage < blobs_.size(); ++storage) {
+    if (blob_storage_[storage] == storage && storage_arena_[storage] >= 0) {
+      UnplanStorage(storage);
+    }
+  }
+  storage_births_.clear();
+  arena_storages_.clear();
+  arenas_.clear();
+  LOG(INFO) << "Memory planning stopped; no blob shares memory.";
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
@@ -505,6 +747,7 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   for (int i = start; i <= end; ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    if (!storage_births_.empty()) { PlaceTops(i); }
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
@@ -684,6 +927,7 @@ template <typename Dtype>
 void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    if (!storage_births_.empty()) { PlaceTops(i); }
   }
 }
 
@@ -819,6 +1063,8 @@ const shared_ptr<Blob<Dtype> > Net<Dtype>::blob_by_name(
   shared_ptr<Blob<Dtype> > blob_ptr;
   if (has_blob(blob_name)) {
     blob_ptr = blobs_[blob_names_index_[blob_name]];
+    // The caller may read the blob after any layer, so it may not share.
+    UnplanBlob(blob_names_index_[blob_name]);
   } else {
     blob_ptr.reset((Blob<Dtype>*)(NULL));
     LOG(WARNING) << "Unknown blob name " << blob_name;
@@ -127,4 +127,35 @@ TYPED_TEST(ArgMaxLayerTest, TestCPUMaxValTopK) {
   test_fun<TypeParam>(this, true, this->top_k_);
 }
 
+TYPED_TEST(ArgMaxLayerTest, TestCPUTiesTiled) {
+  // More positions than one tile and many ties, which go to the higher
+  // channel as with the sorting path.
+  this->blob_bottom_->Reshape(2, 4, 25, 23);
+  TypeParam* bottom_data = this->blob_bottom_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    bottom_data[i] = caffe_rng_rand() % 3;
+  }
+  LayerParameter layer_param;
+  layer_param.mutable_argmax_param()->set_out_max_val(true);
+  ArgMaxLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int n = 0; n < this->blob_bottom_->num(); ++n) {
+    for (int h = 0; h < this->blob_bottom_->height(); ++h) {
+      for (int w = 0; w < this->blob_bottom_->width(); ++w) {
+        int max_ind = 0;
+        for (int c = 1; c < this->blob_bottom_->channels(); ++c) {
+          if (this->blob_bottom_->data_at(n, c, h, w) >=
+              this->blob_bottom_->data_at(n, max_ind, h, w)) {
+            max_ind = c;
+          }
+        }
+        EXPECT_EQ(this->blob_top_->data_at(n, 0, h, w), max_ind);
+        EXPECT_EQ(this->blob_top_->data_at(n, 1, h, w),
+            this->blob_bottom_->data_at(n, max_ind, h, w));
+      }
+    }
+  }
+}
+
 }  // namespace caffe
@@ -5,6 +5,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/quantize.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -54,4 +55,42 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestChannelsLastOffset) {
+  EXPECT_FALSE(this->blob_preshaped_->channels_last());
+  EXPECT_EQ(this->blob_preshaped_->offset(1, 2, 3, 4), 119);
+  EXPECT_EQ(this->blob_preshaped_->offset(0, 1, 0, 0), 20);
+  this->blob_preshaped_->set_channels_last(true);
+  EXPECT_EQ(this->blob_preshaped_->offset(1, 2, 3, 4), 119);
+  EXPECT_EQ(this->blob_preshaped_->offset(0, 1, 0, 0), 1);
+  EXPECT_EQ(this->blob_preshaped_->offset(0, 0, 1, 0), 15);
+  EXPECT_EQ(this->blob_preshaped_->offset(1), 60);
+  this->blob_->ReshapeLike(*this->blob_preshaped_);
+  EXPECT_TRUE(this->blob_->channels_last());
+  // in place, as NeuronLayer does
+  this->blob_->ReshapeLike(*this->blob_);
+  EXPECT_TRUE(this->blob_->channels_last());
+  this->blob_->Reshape(2, 3, 4, 5);
+  EXPECT_FALSE(this->blob_->channels_last());
+}
+
+TYPED_TEST(BlobSimpleTest, TestInt8ProtoRoundTrip) {
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_preshaped_);
+  BlobProto proto;
+  QuantizeBlobToProto(*this->blob_preshaped_, 2, &proto);
+  EXPECT_EQ(proto.data_size(), 0);
+  EXPECT_EQ(proto.int8_scale_size(), 2);
+  EXPECT_EQ(proto.int8_data().size(), 120);
+  this->blob_->FromProto(proto);
+  EXPECT_EQ(this->blob_->count(), 120);
+  // The error of symmetric int8 quantization is at most half a step.
+  for (int r = 0; r < 2; ++r) {
+    for (int i = r * 60; i < (r + 1) * 60; ++i) {
+      EXPECT_NEAR(this->blob_->cpu_data()[i],
+          this->blob_preshaped_->cpu_data()[i], proto.int8_scale(r) / 2 + 1e-6);
+    }
+  }
+}
+
 }  // namespace caffe
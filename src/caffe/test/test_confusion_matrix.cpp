@@ -0,0 +1,82 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/confusion_matrix.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ConfusionMatrixTest : public ::testing::Test {
+ protected:
+  ConfusionMatrixTest() : confusion_(3) {
+    // (actual, predicted): 0 -> 0 twice, 0 -> 1, 1 -> 1, 2 -> 0
+    confusion_.accumulate(0, 0);
+    confusion_.accumulate(0, 0);
+    confusion_.accumulate(0, 1);
+    confusion_.accumulate(1, 1);
+    confusion_.accumulate(2, 0);
+  }
+  void ExpectSameCounts(const ConfusionMatrix& other) {
+    ASSERT_EQ(other.numRows(), confusion_.numRows());
+    for (int i = 0; i < confusion_.numRows(); ++i) {
+      for (int j = 0; j < confusion_.numCols(); ++j) {
+        EXPECT_EQ(other(i, j), confusion_(i, j));
+      }
+    }
+  }
+  ConfusionMatrix confusion_;
+};
+
+TEST_F(ConfusionMatrixTest, TestMetrics) {
+  EXPECT_EQ(confusion_.totalSum(), 5);
+  EXPECT_EQ(confusion_.diagSum(), 3);
+  EXPECT_EQ(confusion_.rowSum(0), 3);
+  EXPECT_EQ(confusion_.colSum(0), 3);
+  EXPECT_NEAR(confusion_.accuracy(), 0.6, 1e-12);
+  // recall 2/3, 1, 0 over the 3 present classes
+  EXPECT_NEAR(confusion_.avgRecall(false), 5. / 9, 1e-12);
+  // jaccard 2/4, 1/2, 0
+  EXPECT_NEAR(confusion_.avgJaccard(), 1. / 3, 1e-12);
+  // the cached sums follow later counts
+  for (int i = 0; i < 3; ++i) {
+    confusion_.accumulate(2, 2);
+  }
+  EXPECT_EQ(confusion_.totalSum(), 8);
+  EXPECT_NEAR(confusion_.jaccard(2), 0.75, 1e-12);
+}
+
+TEST_F(ConfusionMatrixTest, TestShards) {
+  ConfusionMatrix sharded(3);
+  sharded.resizeShards(2);
+  ASSERT_EQ(sharded.numShards(), 2);
+  unsigned long* shard0 = sharded.shard(0);
+  unsigned long* shard1 = sharded.shard(1);
+  shard0[0 * 3 + 0] += 2;
+  shard1[0 * 3 + 1] += 1;
+  shard0[1 * 3 + 1] += 1;
+  shard1[2 * 3 + 0] += 1;
+  sharded.mergeShards();
+  EXPECT_NEAR(sharded.accuracy(), 0.6, 1e-12);
+  ExpectSameCounts(sharded);
+  // merged shards are cleared, so merging again does not count twice
+  sharded.mergeShards();
+  EXPECT_EQ(sharded.totalSum(), 5);
+}
+
+TEST_F(ConfusionMatrixTest, TestSaveLoadAccumulate) {
+  string filename;
+  MakeTempFilename(&filename);
+  confusion_.save(filename);
+  ConfusionMatrix loaded;
+  loaded.load(filename);
+  ExpectSameCounts(loaded);
+  loaded.accumulate(confusion_);
+  EXPECT_EQ(loaded.totalSum(), 10);
+  EXPECT_EQ(loaded(0, 0), 4);
+}
+
+}  // namespace caffe
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <vector>
 
@@ -41,6 +43,13 @@ void caffe_conv(const Blob<Dtype>* in, ConvolutionParameter* conv_param,
     stride_h = conv_param->stride_h();
     stride_w = conv_param->stride_w();
   }
+  int hole_h, hole_w;
+  if (!conv_param->has_hole_h()) {
+    hole_h = hole_w = conv_param->hole();
+  } else {
+    hole_h = conv_param->hole_h();
+    hole_w = conv_param->hole_w();
+  }
   // Groups
   int groups = conv_param->group();
   int o_g = out->channels() / groups;
@@ -60,8 +69,8 @@ void caffe_conv(const Blob<Dtype>* in, ConvolutionParameter* conv_param,
             for (int x = 0; x < out->width(); x++) {
               for (int p = 0; p < kernel_h; p++) {
                 for (int q = 0; q < kernel_w; q++) {
-                  int in_y = y * stride_h - pad_h + p;
-                  int in_x = x * stride_w - pad_w + q;
+                  int in_y = y * stride_h - pad_h + p * hole_h;
+                  int in_x = x * stride_w - pad_w + q * hole_w;
                   if (in_y >= 0 && in_y < in->height()
                     && in_x >= 0 && in_x < in->width()) {
                     out_data[out->offset(n, o + o_head, y, x)] +=
@@ -272,6 +281,169 @@ TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionGroup) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestInt8ConvolutionGroup) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    // Fixed data, so that the test does not depend on the draw.
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_stride(2);
+    convolution_param->set_num_output(3);
+    convolution_param->set_group(3);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("constant");
+    convolution_param->mutable_bias_filler()->set_value(0.1);
+    layer_param.mutable_quantization_param()->set_precision(
+        QuantizationParameter_Precision_INT8);
+    shared_ptr<Layer<Dtype> > layer(
+        new ConvolutionLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+        this->MakeReferenceTop(this->blob_top_));
+    // Check against reference convolution, up to the quantization error.
+    // The weights are rounded to w_step = max |w| / 127 per output channel,
+    // the inputs to x_step = range / 255 per image and group, so each output
+    // is off by at most the sum over its taps of
+    // w_step / 2 * |x| + x_step / 2 * (|w| + w_step / 2).
+    const Blob<Dtype>& weights = *layer->blobs()[0];
+    const int channels = weights.num();
+    const int taps = weights.count() / channels;
+    vector<Dtype> w_step(channels, 0);
+    vector<shared_ptr<Blob<Dtype> > > abs_weights(1,
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    abs_weights[0]->ReshapeLike(weights);
+    for (int o = 0; o < channels; ++o) {
+      for (int k = 0; k < taps; ++k) {
+        w_step[o] = std::max(w_step[o],
+            std::abs(weights.cpu_data()[o * taps + k]) / 127);
+      }
+      for (int k = 0; k < taps; ++k) {
+        abs_weights[0]->mutable_cpu_data()[o * taps + k] =
+            std::abs(weights.cpu_data()[o * taps + k]) + w_step[o] / 2;
+      }
+    }
+    vector<shared_ptr<Blob<Dtype> > > ones_weights(1,
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    ones_weights[0]->ReshapeLike(weights);
+    caffe_set(weights.count(), Dtype(1), ones_weights[0]->mutable_cpu_data());
+    Blob<Dtype> abs_bottom;
+    abs_bottom.ReshapeLike(*this->blob_bottom_);
+    caffe_abs(abs_bottom.count(), this->blob_bottom_->cpu_data(),
+        abs_bottom.mutable_cpu_data());
+    Blob<Dtype> ones_bottom;
+    ones_bottom.ReshapeLike(*this->blob_bottom_);
+    caffe_set(ones_bottom.count(), Dtype(1), ones_bottom.mutable_cpu_data());
+    ConvolutionParameter sum_param(*convolution_param);
+    sum_param.set_bias_term(false);
+    Blob<Dtype> sum_x, sum_w;
+    sum_x.ReshapeLike(*this->blob_top_);
+    sum_w.ReshapeLike(*this->blob_top_);
+    caffe_conv(&abs_bottom, &sum_param, ones_weights, &sum_x);
+    caffe_conv(&ones_bottom, &sum_param, abs_weights, &sum_w);
+    const int dim = this->blob_bottom_->height() * this->blob_bottom_->width();
+    for (int n = 0; n < this->blob_top_->num(); ++n) {
+      for (int o = 0; o < channels; ++o) {
+        // One input channel per group, whose range includes 0.
+        const Dtype* x = this->blob_bottom_->cpu_data() +
+            this->blob_bottom_->offset(n, o);
+        const Dtype x_step = (std::max(Dtype(0), *std::max_element(x, x + dim))
+            - std::min(Dtype(0), *std::min_element(x, x + dim))) / 255;
+        for (int i = 0; i < sum_x.height() * sum_x.width(); ++i) {
+          const int offset = this->blob_top_->offset(n, o) + i;
+          const Dtype bound = w_step[o] / 2 * sum_x.cpu_data()[offset] +
+              x_step / 2 * sum_w.cpu_data()[offset];
+          EXPECT_NEAR(this->blob_top_->cpu_data()[offset],
+              this->ref_blob_top_->cpu_data()[offset], bound + 1e-5);
+        }
+      }
+    }
+  } else {
+    LOG(ERROR) << "Skipping test: int8 convolution is CPU only.";
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestHoleConvolutionGroup) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(2);
+  convolution_param->set_hole_h(2);
+  convolution_param->set_hole_w(3);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  for (int mode = 0; mode < 2; ++mode) {
+    convolution_param->set_hole_mode(mode == 0 ?
+        ConvolutionParameter_HoleMode_IM2COL :
+        ConvolutionParameter_HoleMode_SPACE_TO_BATCH);
+    shared_ptr<Layer<Dtype> > layer(
+        new ConvolutionLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_EQ(this->blob_top_->height(), 6);
+    EXPECT_EQ(this->blob_top_->width(), 2);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Check against reference convolution.
+    const Dtype* top_data;
+    const Dtype* ref_top_data;
+    caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+        this->MakeReferenceTop(this->blob_top_));
+    top_data = this->blob_top_->cpu_data();
+    ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestIm2colTableReshape) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_stride(2);
+  convolution_param->set_hole(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_im2col_table(true);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The table is rebuilt for the new shape on the second pass.
+  for (int pass = 0; pass < 2; ++pass) {
+    if (pass == 1) {
+      this->blob_bottom_->Reshape(2, 3, 5, 7);
+      FillerParameter filler_param;
+      GaussianFiller<Dtype> filler(filler_param);
+      filler.Fill(this->blob_bottom_);
+      layer->Reshape(this->blob_bottom_vec_, this->blob_top_vec_);
+    }
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* top_data;
+    const Dtype* ref_top_data;
+    caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+        this->MakeReferenceTop(this->blob_top_));
+    top_data = this->blob_top_->cpu_data();
+    ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestSobelConvolution) {
   // Test separable convolution by computing the Sobel operator
   // as a single filter then comparing the result
@@ -421,6 +593,57 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestGradientSpaceToBatch) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_hole(2);
+  convolution_param->set_hole_mode(
+      ConvolutionParameter_HoleMode_SPACE_TO_BATCH);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestGradientRetainColBuffer) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->set_kernel_size(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_retain_col_buffer(true);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  // Both with im2col and with space-to-batch execution of the holes.
+  for (int mode = 0; mode < 2; ++mode) {
+    if (mode == 0) {
+      convolution_param->set_stride(2);
+    } else {
+      convolution_param->set_stride(1);
+      convolution_param->set_hole(2);
+      convolution_param->set_hole_mode(
+          ConvolutionParameter_HoleMode_SPACE_TO_BATCH);
+    }
+    ConvolutionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
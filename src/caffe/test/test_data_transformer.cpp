@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -10,6 +11,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/rng.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -78,6 +80,58 @@ class DataTransformTest : public ::testing::Test {
   int num_iter_;
 };
 
+#ifndef OSX
+// Fills a height x width color image with unique pixels and its seg with
+// unique labels.
+void FillImgAndSeg(const int height, const int width,
+    std::vector<cv::Mat>* cv_img_seg) {
+  const int channels = 3;
+  cv::Mat img(height, width, CV_8UC3, cv::Scalar(0));
+  cv::Mat seg(height, width, CV_8UC1, cv::Scalar(0));
+  for (int h = 0; h < height; ++h) {
+    uchar* img_ptr = img.ptr<uchar>(h);
+    uchar* seg_ptr = seg.ptr<uchar>(h);
+    for (int w = 0; w < width; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        img_ptr[w * channels + c] = ((h * width + w) * channels + c) % 256;
+      }
+      seg_ptr[w] = (h * width + w) % 256;
+    }
+  }
+  cv_img_seg->clear();
+  cv_img_seg->push_back(img);
+  cv_img_seg->push_back(seg);
+}
+
+// Checks one transformed image and seg against the definition: crop the
+// window at (h_off, w_off) from the image padded with the mean and with
+// ignore_label, subtract the mean, scale and mirror.
+template <typename Dtype>
+void CheckImgAndSeg(const std::vector<cv::Mat>& cv_img_seg,
+    const Blob<Dtype>& data, const Blob<Dtype>& label, const int h_off,
+    const int w_off, const bool mirror, const vector<Dtype>& mean_values,
+    const Dtype scale, const int ignore_label) {
+  const int channels = data.channels();
+  for (int h = 0; h < data.height(); ++h) {
+    for (int w = 0; w < data.width(); ++w) {
+      const int y = h_off + h;
+      const int x = w_off + (mirror ? data.width() - 1 - w : w);
+      const bool inside = y < cv_img_seg[0].rows && x < cv_img_seg[0].cols;
+      for (int c = 0; c < channels; ++c) {
+        const Dtype expected = inside ? (static_cast<Dtype>(
+            cv_img_seg[0].ptr<uchar>(y)[x * channels + c]) - mean_values[c])
+            * scale : Dtype(0);
+        EXPECT_EQ(expected, data.data_at(0, c, h, w));
+      }
+      const Dtype expected_label = inside ?
+          static_cast<Dtype>(cv_img_seg[1].ptr<uchar>(y)[x]) :
+          static_cast<Dtype>(ignore_label);
+      EXPECT_EQ(expected_label, label.data_at(0, 0, h, w));
+    }
+  }
+}
+#endif
+
 TYPED_TEST_CASE(DataTransformTest, TestDtypes);
 
 TYPED_TEST(DataTransformTest, TestEmptyTransform) {
@@ -357,4 +411,182 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+#ifndef OSX
+TYPED_TEST(DataTransformTest, TestImgAndSegCropTest) {
+  TransformationParameter transform_param;
+  const int channels = 3;
+  const int crop_size = 4;
+  const int ignore_label = 255;
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_scale(0.5);
+  transform_param.add_mean_value(1);
+  transform_param.add_mean_value(2);
+  transform_param.add_mean_value(3);
+  std::vector<cv::Mat> cv_img_seg;
+  FillImgAndSeg(5, 7, &cv_img_seg);
+  Blob<TypeParam> data(1, channels, crop_size, crop_size);
+  Blob<TypeParam> label(1, 1, crop_size, crop_size);
+  Caffe::set_phase(Caffe::TEST);
+  DataTransformer<TypeParam> transformer(transform_param);
+  transformer.InitRand();
+  transformer.TransformImgAndSeg(cv_img_seg, &data, &label, ignore_label);
+  vector<TypeParam> mean_values;
+  mean_values.push_back(1);
+  mean_values.push_back(2);
+  mean_values.push_back(3);
+  // Middle crop.
+  CheckImgAndSeg(cv_img_seg, data, label, 0, 1, false, mean_values,
+      TypeParam(0.5), ignore_label);
+}
+
+TYPED_TEST(DataTransformTest, TestImgAndSegPadTest) {
+  TransformationParameter transform_param;
+  const int channels = 3;
+  const int crop_size = 6;
+  const int ignore_label = 254;
+  transform_param.set_crop_size(crop_size);
+  transform_param.add_mean_value(10);
+  std::vector<cv::Mat> cv_img_seg;
+  FillImgAndSeg(3, 7, &cv_img_seg);
+  Blob<TypeParam> data(1, channels, crop_size, crop_size);
+  Blob<TypeParam> label(1, 1, crop_size, crop_size);
+  Caffe::set_phase(Caffe::TEST);
+  DataTransformer<TypeParam> transformer(transform_param);
+  transformer.InitRand();
+  transformer.TransformImgAndSeg(cv_img_seg, &data, &label, ignore_label);
+  // The missing rows are padded at the bottom.
+  vector<TypeParam> mean_values(channels, 10);
+  CheckImgAndSeg(cv_img_seg, data, label, 0, 0, false, mean_values,
+      TypeParam(1), ignore_label);
+}
+
+TYPED_TEST(DataTransformTest, TestImgAndSegCropMirrorTrain) {
+  TransformationParameter transform_param;
+  const int channels = 3;
+  const int crop_size = 5;
+  const int ignore_label = 255;
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  const int height = 4;
+  const int width = 9;
+  std::vector<cv::Mat> cv_img_seg;
+  FillImgAndSeg(height, width, &cv_img_seg);
+  Blob<TypeParam> data(1, channels, crop_size, crop_size);
+  Blob<TypeParam> label(1, 1, crop_size, crop_size);
+  Caffe::set_phase(Caffe::TRAIN);
+  DataTransformer<TypeParam> transformer(transform_param);
+  vector<TypeParam> mean_values(channels, 0);
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    // The mirror flag and the offsets into the padded image are drawn from
+    // the given generator in this order.
+    Caffe::RNG rng(this->seed_ + iter);
+    Caffe::RNG expected_rng(this->seed_ + iter);
+    caffe::rng_t* generator =
+        static_cast<caffe::rng_t*>(expected_rng.generator());
+    const bool mirror = (*generator)() % 2;
+    const int h_off =
+        (*generator)() % (std::max(height, crop_size) - crop_size + 1);
+    const int w_off =
+        (*generator)() % (std::max(width, crop_size) - crop_size + 1);
+    transformer.TransformImgAndSeg(cv_img_seg, &data, &label, ignore_label,
+        &rng);
+    CheckImgAndSeg(cv_img_seg, data, label, h_off, w_off, mirror,
+        mean_values, TypeParam(1), ignore_label);
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestImgAndSegScaleTrain) {
+  TransformationParameter transform_param;
+  const int channels = 3;
+  const int ignore_label = 255;
+  transform_param.set_min_scale_factor(2);
+  transform_param.set_max_scale_factor(2);
+  const int height = 4;
+  const int width = 5;
+  // The pixels of FillImgAndSeg grow linearly along rows and columns, so
+  // their bilinear interpolation is exact.
+  std::vector<cv::Mat> cv_img_seg;
+  FillImgAndSeg(height, width, &cv_img_seg);
+  Blob<TypeParam> data(1, channels, 2 * height, 2 * width);
+  Blob<TypeParam> label(1, 1, 2 * height, 2 * width);
+  Caffe::set_phase(Caffe::TRAIN);
+  DataTransformer<TypeParam> transformer(transform_param);
+  transformer.InitRand();
+  transformer.TransformImgAndSeg(cv_img_seg, &data, &label, ignore_label);
+  for (int h = 0; h < 2 * height; ++h) {
+    const float y = std::min(std::max(0.f, (h + 0.5f) / 2 - 0.5f),
+        static_cast<float>(height - 1));
+    for (int w = 0; w < 2 * width; ++w) {
+      const float x = std::min(std::max(0.f, (w + 0.5f) / 2 - 0.5f),
+          static_cast<float>(width - 1));
+      for (int c = 0; c < channels; ++c) {
+        EXPECT_NEAR(data.data_at(0, c, h, w),
+            (y * width + x) * channels + c, 1e-4);
+      }
+      EXPECT_EQ(label.data_at(0, 0, h, w), (h / 2) * width + w / 2);
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestImgAndSegScaleCropTrain) {
+  TransformationParameter transform_param;
+  const int channels = 3;
+  const int crop_size = 4;
+  const int ignore_label = 255;
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_min_scale_factor(0.5);
+  transform_param.set_max_scale_factor(1.5);
+  transform_param.set_max_aspect_ratio(1.5);
+  const int height = 6;
+  const int width = 8;
+  std::vector<cv::Mat> cv_img_seg;
+  FillImgAndSeg(height, width, &cv_img_seg);
+  Blob<TypeParam> data(1, channels, crop_size, crop_size);
+  Blob<TypeParam> label(1, 1, crop_size, crop_size);
+  Caffe::set_phase(Caffe::TRAIN);
+  DataTransformer<TypeParam> transformer(transform_param);
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    Caffe::RNG rng(this->seed_ + iter);
+    transformer.TransformImgAndSeg(cv_img_seg, &data, &label, ignore_label,
+        &rng);
+    // Every label is a label of the image or the pad, and the pad is the
+    // same in the data and the label.
+    for (int h = 0; h < crop_size; ++h) {
+      for (int w = 0; w < crop_size; ++w) {
+        const TypeParam seg = label.data_at(0, 0, h, w);
+        if (seg == ignore_label) {
+          EXPECT_EQ(data.data_at(0, 0, h, w), 0);
+          EXPECT_EQ(data.data_at(0, 2, h, w), 0);
+        } else {
+          EXPECT_GE(seg, 0);
+          EXPECT_LT(seg, height * width);
+          EXPECT_NEAR(data.data_at(0, 2, h, w) - data.data_at(0, 0, h, w),
+              2, 1e-4);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestImgAndSegScaleTest) {
+  TransformationParameter transform_param;
+  const int channels = 3;
+  const int ignore_label = 255;
+  transform_param.set_min_scale_factor(0.5);
+  transform_param.set_max_scale_factor(2);
+  std::vector<cv::Mat> cv_img_seg;
+  FillImgAndSeg(4, 5, &cv_img_seg);
+  Blob<TypeParam> data(1, channels, 4, 5);
+  Blob<TypeParam> label(1, 1, 4, 5);
+  // There is no scale augmentation in the TEST phase.
+  Caffe::set_phase(Caffe::TEST);
+  DataTransformer<TypeParam> transformer(transform_param);
+  transformer.InitRand();
+  transformer.TransformImgAndSeg(cv_img_seg, &data, &label, ignore_label);
+  vector<TypeParam> mean_values(channels, 0);
+  CheckImgAndSeg(cv_img_seg, data, label, 0, 0, false, mean_values,
+      TypeParam(1), ignore_label);
+}
+#endif
+
 }  // namespace caffe
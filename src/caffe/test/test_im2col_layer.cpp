@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/im2col.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -115,4 +116,54 @@ TYPED_TEST(Im2colLayerTest, TestRectGradient) {
       this->blob_top_vec_);
 }
 
+TEST(Col2imTest, TestOverwrite) {
+  // kernel_h, kernel_w, pad, stride, hole: with a stride larger than the
+  // kernel, some pixels get no tap at all.
+  const int geometries[][5] = {
+    {3, 3, 1, 1, 1}, {2, 2, 0, 3, 1}, {3, 3, 2, 2, 2}, {5, 3, 0, 2, 1},
+  };
+  const int channels = 2;
+  const int height = 7;
+  const int width = 6;
+  for (int g = 0; g < sizeof(geometries) / sizeof(geometries[0]); ++g) {
+    const int kernel_h = geometries[g][0];
+    const int kernel_w = geometries[g][1];
+    const int pad = geometries[g][2];
+    const int stride = geometries[g][3];
+    const int hole = geometries[g][4];
+    const int height_col =
+        (height + 2 * pad - (kernel_h - 1) * hole - 1) / stride + 1;
+    const int width_col =
+        (width + 2 * pad - (kernel_w - 1) * hole - 1) / stride + 1;
+    Blob<float> col(1, channels * kernel_h * kernel_w, height_col, width_col);
+    FillerParameter filler_param;
+    GaussianFiller<float> filler(filler_param);
+    filler.Fill(&col);
+    // The reference: clear, then add every tap.
+    vector<float> expected(channels * height * width, 0);
+    for (int c = 0; c < col.channels(); ++c) {
+      const int i = (c / kernel_w) % kernel_h;
+      const int j = c % kernel_w;
+      const int c_im = c / kernel_w / kernel_h;
+      for (int h = 0; h < height_col; ++h) {
+        for (int w = 0; w < width_col; ++w) {
+          const int h_im = h * stride + i * hole - pad;
+          const int w_im = w * stride + j * hole - pad;
+          if (h_im >= 0 && h_im < height && w_im >= 0 && w_im < width) {
+            expected[(c_im * height + h_im) * width + w_im] +=
+                col.data_at(0, c, h, w);
+          }
+        }
+      }
+    }
+    // Whatever the image held before is overwritten.
+    vector<float> im(channels * height * width, 1e30f);
+    col2im_cpu(col.cpu_data(), 1, channels, height, width, kernel_h,
+        kernel_w, pad, pad, stride, stride, hole, hole, &im[0]);
+    for (int k = 0; k < im.size(); ++k) {
+      EXPECT_EQ(im[k], expected[k]) << "geometry " << g << ", pixel " << k;
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,76 @@
+#ifndef OSX
+#include <opencv2/core/core.hpp>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {
+ protected:
+  // A 10 x 10 color image of 300 bytes, filled with value.
+  static cv::Mat MakeImage(const int value) {
+    return cv::Mat(10, 10, CV_8UC3, cv::Scalar(value, value, value));
+  }
+};
+
+TEST_F(ImageCacheTest, TestLookupInsert) {
+  ImageCache cache(1000);
+  cv::Mat cv_img;
+  EXPECT_FALSE(cache.Lookup("a", &cv_img));
+  cache.Insert("a", MakeImage(1));
+  ASSERT_TRUE(cache.Lookup("a", &cv_img));
+  EXPECT_EQ(cv_img.rows, 10);
+  EXPECT_EQ(cv_img.cols, 10);
+  EXPECT_EQ(cv_img.channels(), 3);
+  EXPECT_EQ(cv_img.ptr<uchar>(9)[29], 1);
+  EXPECT_EQ(cache.size_bytes(), 300);
+  EXPECT_EQ(cache.hits(), 1);
+  EXPECT_EQ(cache.misses(), 1);
+}
+
+TEST_F(ImageCacheTest, TestEvictLeastRecentlyUsed) {
+  ImageCache cache(1000);
+  cache.Insert("a", MakeImage(1));
+  cache.Insert("b", MakeImage(2));
+  cache.Insert("c", MakeImage(3));
+  cv::Mat cv_img;
+  // a is now used more recently than b.
+  EXPECT_TRUE(cache.Lookup("a", &cv_img));
+  cache.Insert("d", MakeImage(4));
+  EXPECT_EQ(cache.size_bytes(), 900);
+  EXPECT_FALSE(cache.Lookup("b", &cv_img));
+  EXPECT_TRUE(cache.Lookup("a", &cv_img));
+  EXPECT_EQ(cv_img.ptr<uchar>(0)[0], 1);
+  EXPECT_TRUE(cache.Lookup("c", &cv_img));
+  EXPECT_TRUE(cache.Lookup("d", &cv_img));
+  EXPECT_EQ(cv_img.ptr<uchar>(0)[0], 4);
+}
+
+TEST_F(ImageCacheTest, TestOverBudget) {
+  ImageCache cache(200);
+  cache.Insert("a", MakeImage(1));
+  cv::Mat cv_img;
+  EXPECT_FALSE(cache.Lookup("a", &cv_img));
+  EXPECT_EQ(cache.size_bytes(), 0);
+  // The budget only grows.
+  cache.Reserve(600);
+  cache.Reserve(100);
+  EXPECT_EQ(cache.budget_bytes(), 600);
+  cache.Insert("a", MakeImage(1));
+  cache.Insert("b", MakeImage(2));
+  EXPECT_TRUE(cache.Lookup("a", &cv_img));
+  EXPECT_TRUE(cache.Lookup("b", &cv_img));
+  cache.Clear();
+  EXPECT_EQ(cache.size_bytes(), 0);
+  EXPECT_FALSE(cache.Lookup("a", &cv_img));
+}
+
+}  // namespace caffe
+#endif  // OSX
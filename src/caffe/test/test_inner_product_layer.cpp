@@ -85,6 +85,84 @@ TYPED_TEST(InnerProductLayerTest, TestForward) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardInt8) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_min(1);
+    inner_product_param->mutable_bias_filler()->set_max(2);
+    shared_ptr<InnerProductLayer<Dtype> > layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> ref_top;
+    ref_top.CopyFrom(*this->blob_top_, false, true);
+    // Same weights, calibrated int8 inference.
+    QuantizationParameter* quantization_param =
+        layer_param.mutable_quantization_param();
+    quantization_param->set_precision(QuantizationParameter_Precision_INT8);
+    quantization_param->set_input_scale(1. / 255);
+    shared_ptr<InnerProductLayer<Dtype> > int8_layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    int8_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < layer->blobs().size(); ++i) {
+      int8_layer->blobs()[i]->CopyFrom(*layer->blobs()[i]);
+    }
+    int8_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* data = this->blob_top_->cpu_data();
+    const Dtype* ref_data = ref_top.cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(data[i], ref_data[i], 0.1);
+    }
+  } else {
+    LOG(ERROR) << "Skipping test: int8 inner product is CPU only.";
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardInt8WeightsChanged) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() == Caffe::CPU) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    shared_ptr<InnerProductLayer<Dtype> > layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> ref_top;
+    ref_top.CopyFrom(*this->blob_top_, false, true);
+    layer_param.mutable_quantization_param()->set_precision(
+        QuantizationParameter_Precision_INT8);
+    inner_product_param->mutable_weight_filler()->set_type("constant");
+    inner_product_param->mutable_weight_filler()->set_value(-1);
+    shared_ptr<InnerProductLayer<Dtype> > int8_layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    int8_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Quantize the filled weights, then copy the trained ones in: the next
+    // forward pass must not use the stale int8 weights.
+    int8_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < layer->blobs().size(); ++i) {
+      int8_layer->blobs()[i]->CopyFrom(*layer->blobs()[i]);
+    }
+    int8_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* data = this->blob_top_->cpu_data();
+    const Dtype* ref_data = ref_top.cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(data[i], ref_data[i], 0.1);
+    }
+  } else {
+    LOG(ERROR) << "Skipping test: int8 inner product is CPU only.";
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   bool IS_VALID_CUDA = false;
@@ -10,6 +10,17 @@ namespace caffe {
 
 class InternalThreadTest : public ::testing::Test {};
 
+// Loops until it is asked to stop.
+class LoopingThread : public InternalThread {
+ public:
+  virtual ~LoopingThread() { StopInternalThread(); }
+
+ protected:
+  virtual void InternalThreadEntry() {
+    while (!must_stop()) {}
+  }
+};
+
 TEST_F(InternalThreadTest, TestStartAndExit) {
   InternalThread thread;
   EXPECT_FALSE(thread.is_started());
@@ -19,5 +30,16 @@ TEST_F(InternalThreadTest, TestStartAndExit) {
   EXPECT_FALSE(thread.is_started());
 }
 
+TEST_F(InternalThreadTest, TestStartAndStop) {
+  LoopingThread thread;
+  EXPECT_TRUE(thread.StartInternalThread());
+  EXPECT_TRUE(thread.is_started());
+  EXPECT_TRUE(thread.StopInternalThread());
+  EXPECT_FALSE(thread.is_started());
+  // The thread can be started again.
+  EXPECT_TRUE(thread.StartInternalThread());
+  EXPECT_TRUE(thread.StopInternalThread());
+}
+
 }  // namespace caffe
 
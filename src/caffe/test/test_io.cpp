@@ -3,6 +3,7 @@
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 
 #include "gtest/gtest.h"
@@ -194,6 +195,26 @@ TEST_F(IOTest, TestReadImageToCVMat) {
   EXPECT_EQ(cv_img.cols, 480);
 }
 
+TEST_F(IOTest, TestReadImageSize) {
+  int height, width;
+  EXPECT_TRUE(ReadImageSize(EXAMPLES_SOURCE_DIR "images/cat.jpg", &height,
+      &width));
+  EXPECT_EQ(height, 360);
+  EXPECT_EQ(width, 480);
+  // A PNG, and a file that is not an image.
+  string dirname;
+  MakeTempDir(&dirname);
+  const string png = dirname + "/image.png";
+  CHECK(cv::imwrite(png, cv::Mat(7, 5, CV_8UC3, cv::Scalar(1, 2, 3))));
+  EXPECT_TRUE(ReadImageSize(png, &height, &width));
+  EXPECT_EQ(height, 7);
+  EXPECT_EQ(width, 5);
+  const string text = dirname + "/image.txt";
+  std::ofstream(text.c_str()) << "not an image";
+  EXPECT_FALSE(ReadImageSize(text, &height, &width));
+  EXPECT_FALSE(ReadImageSize(dirname + "/missing.jpg", &height, &width));
+}
+
 TEST_F(IOTest, TestReadImageToCVMatResized) {
   string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
   cv::Mat cv_img = ReadImageToCVMat(filename, 100, 200);
@@ -0,0 +1,354 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/insert_layouts.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class LayoutLayerTest : public ::testing::Test {
+ protected:
+  LayoutLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 5, 7, 6)),
+        blob_bottom_cl_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_cl_(new Blob<Dtype>()) {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_bottom_cl_vec_.push_back(blob_bottom_cl_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_cl_vec_.push_back(blob_top_cl_);
+    // The channel-last copy of the bottom.
+    LayerParameter layer_param;
+    LayoutLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_bottom_cl_vec_);
+    layer.Forward(blob_bottom_vec_, blob_bottom_cl_vec_);
+  }
+  virtual ~LayoutLayerTest() {
+    delete blob_bottom_;
+    delete blob_bottom_cl_;
+    delete blob_top_;
+    delete blob_top_cl_;
+  }
+
+  // Runs the layer on the NCHW bottom and on its channel-last copy, and
+  // checks that the tops and, if backward, the bottom diffs agree.
+  template <typename LayerType>
+  void CheckChannelsLast(const LayerParameter& layer_param,
+      const bool backward) {
+    shared_ptr<Layer<Dtype> > layer(new LayerType(layer_param));
+    shared_ptr<Layer<Dtype> > layer_cl(new LayerType(layer_param));
+    layer->SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer_cl->SetUp(blob_bottom_cl_vec_, blob_top_cl_vec_);
+    for (int i = 0; i < layer->blobs().size(); ++i) {
+      layer_cl->blobs()[i]->CopyFrom(*layer->blobs()[i]);
+    }
+    layer->Forward(blob_bottom_vec_, blob_top_vec_);
+    layer_cl->Forward(blob_bottom_cl_vec_, blob_top_cl_vec_);
+    ASSERT_TRUE(blob_top_cl_->channels_last());
+    ASSERT_EQ(blob_top_->num(), blob_top_cl_->num());
+    ASSERT_EQ(blob_top_->channels(), blob_top_cl_->channels());
+    ASSERT_EQ(blob_top_->height(), blob_top_cl_->height());
+    ASSERT_EQ(blob_top_->width(), blob_top_cl_->width());
+    for (int n = 0; n < blob_top_->num(); ++n) {
+      for (int c = 0; c < blob_top_->channels(); ++c) {
+        for (int h = 0; h < blob_top_->height(); ++h) {
+          for (int w = 0; w < blob_top_->width(); ++w) {
+            EXPECT_NEAR(blob_top_->data_at(n, c, h, w),
+                blob_top_cl_->data_at(n, c, h, w), 1e-4);
+          }
+        }
+      }
+    }
+    if (!backward) {
+      return;
+    }
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    Blob<Dtype> top_diff;
+    top_diff.ReshapeLike(*blob_top_);
+    filler.Fill(&top_diff);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        blob_top_->mutable_cpu_diff());
+    Dtype* top_diff_cl = blob_top_cl_->mutable_cpu_diff();
+    for (int n = 0; n < blob_top_->num(); ++n) {
+      for (int c = 0; c < blob_top_->channels(); ++c) {
+        for (int h = 0; h < blob_top_->height(); ++h) {
+          for (int w = 0; w < blob_top_->width(); ++w) {
+            top_diff_cl[blob_top_cl_->offset(n, c, h, w)] =
+                top_diff.data_at(n, c, h, w);
+          }
+        }
+      }
+    }
+    vector<bool> propagate_down(1, true);
+    layer->Backward(blob_top_vec_, propagate_down, blob_bottom_vec_);
+    layer_cl->Backward(blob_top_cl_vec_, propagate_down, blob_bottom_cl_vec_);
+    for (int n = 0; n < blob_bottom_->num(); ++n) {
+      for (int c = 0; c < blob_bottom_->channels(); ++c) {
+        for (int h = 0; h < blob_bottom_->height(); ++h) {
+          for (int w = 0; w < blob_bottom_->width(); ++w) {
+            EXPECT_NEAR(blob_bottom_->diff_at(n, c, h, w),
+                blob_bottom_cl_->diff_at(n, c, h, w), 1e-4);
+          }
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_cl_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_cl_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_bottom_cl_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_top_cl_vec_;
+};
+
+TYPED_TEST_CASE(LayoutLayerTest, TestDtypes);
+
+TYPED_TEST(LayoutLayerTest, TestForward) {
+  EXPECT_TRUE(this->blob_bottom_cl_->channels_last());
+  const int channels = this->blob_bottom_->channels();
+  for (int n = 0; n < this->blob_bottom_->num(); ++n) {
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < this->blob_bottom_->height(); ++h) {
+        for (int w = 0; w < this->blob_bottom_->width(); ++w) {
+          const int index = ((n * 7 + h) * 6 + w) * channels + c;
+          EXPECT_EQ(this->blob_bottom_->data_at(n, c, h, w),
+              this->blob_bottom_cl_->cpu_data()[index]);
+        }
+      }
+    }
+  }
+  // And back.
+  LayerParameter layer_param;
+  layer_param.mutable_layout_param()->set_channels_last(false);
+  LayoutLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_cl_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_cl_vec_, this->blob_top_vec_);
+  EXPECT_FALSE(this->blob_top_->channels_last());
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_->cpu_data()[i],
+        this->blob_top_->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(LayoutLayerTest, TestGradient) {
+  LayerParameter layer_param;
+  LayoutLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(LayoutLayerTest, TestSoftmaxChannelsLast) {
+  LayerParameter layer_param;
+  this->template CheckChannelsLast<SoftmaxLayer<TypeParam> >(
+      layer_param, true);
+}
+
+TYPED_TEST(LayoutLayerTest, TestArgMaxChannelsLast) {
+  LayerParameter layer_param;
+  layer_param.mutable_argmax_param()->set_out_max_val(true);
+  this->template CheckChannelsLast<ArgMaxLayer<TypeParam> >(
+      layer_param, false);
+  layer_param.mutable_argmax_param()->set_top_k(2);
+  this->template CheckChannelsLast<ArgMaxLayer<TypeParam> >(
+      layer_param, false);
+}
+
+TYPED_TEST(LayoutLayerTest, TestPoolingChannelsLast) {
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pad(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  this->template CheckChannelsLast<PoolingLayer<TypeParam> >(
+      layer_param, true);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_AVE);
+  this->template CheckChannelsLast<PoolingLayer<TypeParam> >(
+      layer_param, true);
+}
+
+TYPED_TEST(LayoutLayerTest, TestInterpChannelsLast) {
+  LayerParameter layer_param;
+  InterpParameter* interp_param = layer_param.mutable_interp_param();
+  interp_param->set_height(11);
+  interp_param->set_width(13);
+  interp_param->set_pad_beg(-1);
+  this->template CheckChannelsLast<InterpLayer<TypeParam> >(
+      layer_param, true);
+}
+
+TYPED_TEST(LayoutLayerTest, TestConvolutionChannelsLast) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(2);
+  convolution_param->set_hole(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->template CheckChannelsLast<ConvolutionLayer<TypeParam> >(
+      layer_param, false);
+  // 1x1, which multiplies the channel-last input in place
+  convolution_param->set_kernel_size(1);
+  convolution_param->set_pad(0);
+  convolution_param->set_hole(1);
+  this->template CheckChannelsLast<ConvolutionLayer<TypeParam> >(
+      layer_param, false);
+}
+
+TYPED_TEST(LayoutLayerTest, TestSoftmaxChannelsLastInPlace) {
+  LayerParameter layer_param;
+  SoftmaxLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_cl_vec_, this->blob_bottom_cl_vec_);
+  EXPECT_TRUE(this->blob_bottom_cl_->channels_last());
+  layer.Forward(this->blob_bottom_cl_vec_, this->blob_bottom_cl_vec_);
+  EXPECT_TRUE(this->blob_bottom_cl_->channels_last());
+}
+
+TYPED_TEST(LayoutLayerTest, TestConvolutionChannelsLastWeightsChanged) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_num_output(4);
+  convolution_param->set_bias_term(false);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_cl_vec_, this->blob_top_cl_vec_);
+  layer.Forward(this->blob_bottom_cl_vec_, this->blob_top_cl_vec_);
+  Blob<TypeParam> first;
+  first.CopyFrom(*this->blob_top_cl_, false, true);
+  // The cached channel-last filters must follow the new weights.
+  caffe_scal<TypeParam>(layer.blobs()[0]->count(), TypeParam(2),
+      layer.blobs()[0]->mutable_cpu_data());
+  layer.Forward(this->blob_bottom_cl_vec_, this->blob_top_cl_vec_);
+  for (int i = 0; i < first.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_cl_->cpu_data()[i], 2 * first.cpu_data()[i],
+        1e-4);
+  }
+}
+
+class InsertLayoutsTest : public ::testing::Test {
+ protected:
+  void RunInsertionTest(
+      const string& input_param_string, const string& output_param_string) {
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    InsertLayouts(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+  }
+};
+
+TEST_F(InsertLayoutsTest, TestBoundaries) {
+  const string& input_proto =
+      "input: 'data' "
+      "layers: { name: 'conv' type: CONVOLUTION "
+      "  bottom: 'data' top: 'conv' } "
+      "layers: { name: 'relu' type: RELU bottom: 'conv' top: 'conv' } "
+      "layers: { name: 'pool' type: POOLING bottom: 'conv' top: 'pool' } "
+      "layers: { name: 'ip' type: INNER_PRODUCT bottom: 'pool' top: 'ip' } "
+      "layers: { name: 'prob' type: SOFTMAX bottom: 'ip' top: 'prob' } ";
+  const string& expected_output_proto =
+      "input: 'data' "
+      "layers: { name: 'data_nhwc' type: LAYOUT bottom: 'data' "
+      "  top: 'data_nhwc' layout_param { channels_last: true } } "
+      "layers: { name: 'conv' type: CONVOLUTION "
+      "  bottom: 'data_nhwc' top: 'conv' } "
+      "layers: { name: 'relu' type: RELU bottom: 'conv' top: 'conv' } "
+      "layers: { name: 'pool' type: POOLING bottom: 'conv' top: 'pool' } "
+      "layers: { name: 'pool_nchw' type: LAYOUT bottom: 'pool' "
+      "  top: 'pool_nchw' layout_param { channels_last: false } } "
+      "layers: { name: 'ip' type: INNER_PRODUCT "
+      "  bottom: 'pool_nchw' top: 'ip' } "
+      "layers: { name: 'ip_nhwc' type: LAYOUT bottom: 'ip' "
+      "  top: 'ip_nhwc' layout_param { channels_last: true } } "
+      "layers: { name: 'prob' type: SOFTMAX "
+      "  bottom: 'ip_nhwc' top: 'prob_nhwc' } "
+      "layers: { name: 'prob_nchw' type: LAYOUT bottom: 'prob_nhwc' "
+      "  top: 'prob' layout_param { channels_last: false } } ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(InsertLayoutsTest, TestInPlace) {
+  const string& input_proto =
+      "input: 'data' "
+      "layers: { name: 'prob' type: SOFTMAX bottom: 'data' top: 'data' } "
+      "layers: { name: 'label' type: ARGMAX bottom: 'data' top: 'label' } "
+      "layers: { name: 'loss' type: EUCLIDEAN_LOSS "
+      "  bottom: 'data' bottom: 'label' } ";
+  const string& expected_output_proto =
+      "input: 'data' "
+      "layers: { name: 'data_nhwc' type: LAYOUT bottom: 'data' "
+      "  top: 'data_nhwc' layout_param { channels_last: true } } "
+      "layers: { name: 'prob' type: SOFTMAX "
+      "  bottom: 'data_nhwc' top: 'data_nhwc' } "
+      "layers: { name: 'label' type: ARGMAX "
+      "  bottom: 'data_nhwc' top: 'label' } "
+      "layers: { name: 'data_nhwc_nchw' type: LAYOUT bottom: 'data_nhwc' "
+      "  top: 'data_nhwc_nchw' layout_param { channels_last: false } } "
+      "layers: { name: 'label_nchw' type: LAYOUT bottom: 'label' "
+      "  top: 'label_nchw' layout_param { channels_last: false } } "
+      "layers: { name: 'loss' type: EUCLIDEAN_LOSS "
+      "  bottom: 'data_nhwc_nchw' bottom: 'label_nchw' } ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(InsertLayoutsTest, TestOutputs) {
+  const string& input_proto =
+      "input: 'data' "
+      "layers: { name: 'conv' type: CONVOLUTION "
+      "  bottom: 'data' top: 'conv' } "
+      "layers: { name: 'relu' type: RELU bottom: 'conv' top: 'conv' } "
+      "layers: { name: 'ip' type: INNER_PRODUCT bottom: 'data' top: 'ip' } "
+      "layers: { name: 'prob' type: SOFTMAX bottom: 'ip' top: 'ip' } ";
+  const string& expected_output_proto =
+      "input: 'data' "
+      "layers: { name: 'data_nhwc' type: LAYOUT bottom: 'data' "
+      "  top: 'data_nhwc' layout_param { channels_last: true } } "
+      "layers: { name: 'conv' type: CONVOLUTION "
+      "  bottom: 'data_nhwc' top: 'conv_nhwc' } "
+      "layers: { name: 'relu' type: RELU "
+      "  bottom: 'conv_nhwc' top: 'conv_nhwc' } "
+      "layers: { name: 'ip' type: INNER_PRODUCT "
+      "  bottom: 'data' top: 'ip_nchw' } "
+      "layers: { name: 'ip_nhwc' type: LAYOUT bottom: 'ip_nchw' "
+      "  top: 'ip_nhwc' layout_param { channels_last: true } } "
+      "layers: { name: 'prob' type: SOFTMAX "
+      "  bottom: 'ip_nhwc' top: 'ip_nhwc' } "
+      "layers: { name: 'conv_nchw' type: LAYOUT bottom: 'conv_nhwc' "
+      "  top: 'conv' layout_param { channels_last: false } } "
+      "layers: { name: 'ip_nchw_1' type: LAYOUT bottom: 'ip_nhwc' "
+      "  top: 'ip' layout_param { channels_last: false } } ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
+}  // namespace caffe
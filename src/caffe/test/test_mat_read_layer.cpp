@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class MatReadLayerTest : public ::testing::Test {
+ protected:
+  MatReadLayerTest()
+      : blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    MakeTempDir(&prefix_);
+    prefix_ += "/";
+    // Items 0, 1 and 2 of 2 x 3 x 4 features and 1 x 3 x 4 maps, both
+    // filled with values from 100 * item.
+    for (int id = 0; id < 3; ++id) {
+      std::ostringstream name;
+      name << "item" << id;
+      names_.push_back(name.str());
+      const int channels[] = {2, 1};
+      for (int i = 0; i < 2; ++i) {
+        Blob<Dtype> blob(1, channels[i], 3, 4);
+        for (int j = 0; j < blob.count(); ++j) {
+          blob.mutable_cpu_data()[j] = 100 * id + j;
+        }
+        std::ostringstream filename;
+        filename << prefix_ << names_[id] << "_blob_" << i << ".mat";
+        blob.ToMat(filename.str().c_str());
+        std::ostringstream iter_filename;
+        iter_filename << prefix_ << "iter_" << id << "_blob_" << i << ".mat";
+        blob.ToMat(iter_filename.str().c_str());
+      }
+    }
+    MakeTempFilename(&source_);
+    std::ofstream outfile(source_.c_str(), std::ofstream::out);
+    for (int id = 0; id < 3; ++id) {
+      outfile << names_[id] << ".jpg\n";
+    }
+    outfile.close();
+    blob_top_vec_.push_back(blob_top_data_);
+  }
+  virtual ~MatReadLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  void CheckItem(const Blob<Dtype>& blob, const int n, const int id) {
+    const int dim = blob.count() / blob.num();
+    for (int j = 0; j < dim; ++j) {
+      EXPECT_EQ(blob.cpu_data()[n * dim + j], 100 * id + j);
+    }
+  }
+
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<string> names_;
+  string prefix_;
+  string source_;
+};
+
+TYPED_TEST_CASE(MatReadLayerTest, TestDtypes);
+
+TYPED_TEST(MatReadLayerTest, TestReadSource) {
+  LayerParameter param;
+  MatReadParameter* mat_read_param = param.mutable_mat_read_param();
+  mat_read_param->set_prefix(this->prefix_);
+  mat_read_param->set_source(this->source_);
+  mat_read_param->set_strip(4);
+  mat_read_param->set_batch_size(2);
+  mat_read_param->set_prefetch(2);
+  mat_read_param->set_read_threads(2);
+  this->blob_top_vec_.push_back(this->blob_top_label_);
+  MatReadLayer<TypeParam> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 2);
+  EXPECT_EQ(this->blob_top_data_->channels(), 2);
+  EXPECT_EQ(this->blob_top_data_->height(), 3);
+  EXPECT_EQ(this->blob_top_data_->width(), 4);
+  EXPECT_EQ(this->blob_top_label_->num(), 2);
+  EXPECT_EQ(this->blob_top_label_->channels(), 1);
+  // Go through the list twice, wrapping around the end.
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int n = 0; n < 2; ++n) {
+      const int id = (iter * 2 + n) % 3;
+      this->CheckItem(*this->blob_top_data_, n, id);
+      this->CheckItem(*this->blob_top_label_, n, id);
+    }
+  }
+}
+
+TYPED_TEST(MatReadLayerTest, TestReadIter) {
+  LayerParameter param;
+  MatReadParameter* mat_read_param = param.mutable_mat_read_param();
+  mat_read_param->set_prefix(this->prefix_);
+  MatReadLayer<TypeParam> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 1);
+  EXPECT_EQ(this->blob_top_data_->channels(), 2);
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckItem(*this->blob_top_data_, 0, iter);
+  }
+  // The prefetch thread waits for the next file instead of failing.
+  Blob<TypeParam> blob(1, 2, 3, 4);
+  for (int j = 0; j < blob.count(); ++j) {
+    blob.mutable_cpu_data()[j] = 300 + j;
+  }
+  // Written aside and renamed, so that the file appears complete.
+  blob.ToMat((this->prefix_ + "next.mat").c_str());
+  ASSERT_EQ(std::rename((this->prefix_ + "next.mat").c_str(),
+      (this->prefix_ + "iter_3_blob_0.mat").c_str()), 0);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckItem(*this->blob_top_data_, 0, 3);
+}
+
+}  // namespace caffe
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/mat_writer.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+#include "matio.h"
+
+namespace caffe {
+
+template <typename Dtype>
+class MatWriteLayerTest : public ::testing::Test {
+ protected:
+  MatWriteLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_bottom_dims_(new Blob<Dtype>(2, 1, 1, 2)) {}
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    FillerParameter filler_param;
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    Dtype* dims = blob_bottom_dims_->mutable_cpu_data();
+    dims[0] = 3;
+    dims[1] = 5;
+    dims[2] = 4;
+    dims[3] = 2;
+    blob_bottom_vec_.push_back(blob_bottom_);
+    MakeTempDir(&prefix_);
+    prefix_ += "/";
+  }
+  virtual ~MatWriteLayerTest() {
+    delete blob_bottom_;
+    delete blob_bottom_dims_;
+  }
+
+  // Reads the 'data' variable of a MAT file, checking its class and dims.
+  template <typename T>
+  void Read(const string& filename, const matio_classes class_type,
+      const size_t* dims, vector<T>* data) {
+    mat_t* matfp = Mat_Open(filename.c_str(), MAT_ACC_RDONLY);
+    ASSERT_TRUE(matfp) << "Could not open " << filename;
+    matvar_t* matvar = Mat_VarReadInfo(matfp, "data");
+    ASSERT_TRUE(matvar);
+    EXPECT_EQ(matvar->class_type, class_type);
+    ASSERT_EQ(matvar->rank, 4);
+    int count = 1;
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(matvar->dims[i], dims[i]);
+      count *= dims[i];
+    }
+    data->resize(count);
+    EXPECT_EQ(Mat_VarReadDataLinear(matfp, matvar, &(*data)[0], 0, 1, count),
+        0);
+    Mat_VarFree(matvar);
+    Mat_Close(matfp);
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_dims_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  string prefix_;
+};
+
+TYPED_TEST_CASE(MatWriteLayerTest, TestDtypes);
+
+TYPED_TEST(MatWriteLayerTest, TestWrite) {
+  LayerParameter param;
+  MatWriteParameter* mat_write_param = param.mutable_mat_write_param();
+  mat_write_param->set_prefix(this->prefix_);
+  mat_write_param->set_threads(2);
+  mat_write_param->set_max_pending(2);
+  {
+    MatWriteLayer<TypeParam> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int iter = 0; iter < 3; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    }
+    // The layer saves the pending files when it goes away.
+  }
+  for (int iter = 0; iter < 3; ++iter) {
+    std::ostringstream filename;
+    filename << this->prefix_ << "iter_" << iter << "_blob_0.mat";
+    Blob<TypeParam> blob;
+    blob.FromMat(filename.str().c_str());
+    ASSERT_EQ(blob.num(), 2);
+    ASSERT_EQ(blob.channels(), 3);
+    ASSERT_EQ(blob.height(), 4);
+    ASSERT_EQ(blob.width(), 5);
+    for (int i = 0; i < blob.count(); ++i) {
+      EXPECT_EQ(blob.cpu_data()[i], this->blob_bottom_->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(MatWriteLayerTest, TestWriteCropUint8) {
+  LayerParameter param;
+  MatWriteParameter* mat_write_param = param.mutable_mat_write_param();
+  mat_write_param->set_prefix(this->prefix_);
+  mat_write_param->set_crop_to_dims(true);
+  mat_write_param->set_output_type(MatWriteParameter_OutputType_UINT8);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_dims_);
+  {
+    MatWriteLayer<TypeParam> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  }
+  // One file per image, of its 3 x 5 and 4 x 2 windows.
+  const size_t heights[] = {3, 4};
+  const size_t widths[] = {5, 2};
+  for (int n = 0; n < 2; ++n) {
+    std::ostringstream filename;
+    filename << this->prefix_ << "iter_" << n << "_blob_0.mat";
+    const size_t dims[] = {widths[n], heights[n], 3, 1};
+    vector<unsigned char> data;
+    this->Read(filename.str(), MAT_C_UINT8, dims, &data);
+    int i = 0;
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < heights[n]; ++h) {
+        for (int w = 0; w < widths[n]; ++w, ++i) {
+          EXPECT_EQ(data[i], static_cast<int>(
+              this->blob_bottom_->data_at(n, c, h, w) * 255 + 0.5));
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(MatWriteLayerTest, TestWriteCropIndex) {
+  // With bucketed images, data_dims also holds their position in the source.
+  Blob<TypeParam> dims(2, 1, 1, 3);
+  const TypeParam dims_data[] = {3, 5, 7, 4, 2, 1};
+  std::copy(dims_data, dims_data + 6, dims.mutable_cpu_data());
+  LayerParameter param;
+  MatWriteParameter* mat_write_param = param.mutable_mat_write_param();
+  mat_write_param->set_prefix(this->prefix_);
+  mat_write_param->set_crop_to_dims(true);
+  this->blob_bottom_vec_.push_back(&dims);
+  {
+    MatWriteLayer<TypeParam> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  }
+  const int ids[] = {7, 1};
+  const int heights[] = {3, 4};
+  const int widths[] = {5, 2};
+  for (int n = 0; n < 2; ++n) {
+    std::ostringstream filename;
+    filename << this->prefix_ << "iter_" << ids[n] << "_blob_0.mat";
+    Blob<TypeParam> blob;
+    blob.FromMat(filename.str().c_str());
+    ASSERT_EQ(blob.num(), 1);
+    ASSERT_EQ(blob.channels(), 3);
+    ASSERT_EQ(blob.height(), heights[n]);
+    ASSERT_EQ(blob.width(), widths[n]);
+    for (int c = 0; c < 3; ++c) {
+      for (int h = 0; h < heights[n]; ++h) {
+        for (int w = 0; w < widths[n]; ++w) {
+          EXPECT_EQ(blob.data_at(0, c, h, w),
+              this->blob_bottom_->data_at(n, c, h, w));
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(MatWriteLayerTest, TestWriteHalfSync) {
+  LayerParameter param;
+  MatWriteParameter* mat_write_param = param.mutable_mat_write_param();
+  mat_write_param->set_prefix(this->prefix_);
+  mat_write_param->set_threads(0);
+  mat_write_param->set_output_type(MatWriteParameter_OutputType_HALF);
+  MatWriteLayer<TypeParam> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Saved during Forward.
+  const size_t dims[] = {5, 4, 3, 2};
+  vector<unsigned short> data;
+  this->Read(this->prefix_ + "iter_0_blob_0.mat", MAT_C_UINT16, dims, &data);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(HalfToFloat(data[i]), this->blob_bottom_->cpu_data()[i],
+        1. / 2048);
+  }
+}
+
+TEST(MatWriterTest, TestSaveRenames) {
+  string dir;
+  MakeTempDir(&dir);
+  MatWriteJob job;
+  job.filename = dir + "/item.mat";
+  job.Reshape(MatWriteJob::SINGLE, 1, 1, 2, 3);
+  const float values[] = {1, 2, 3, 4, 5, 6};
+  memcpy(&job.buffer[0], values, sizeof(values));
+  MatWriter::Save(job);
+  // Saved aside, then renamed: nothing is left under the temporary name.
+  EXPECT_FALSE(std::ifstream((job.filename + ".part").c_str()).good());
+  Blob<float> blob;
+  blob.FromMat(job.filename.c_str());
+  ASSERT_EQ(blob.count(), 6);
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(blob.cpu_data()[i], values[i]);
+  }
+}
+
+TEST(MatWriterTest, TestFloatToHalf) {
+  EXPECT_EQ(FloatToHalf(0.f), 0x0000);
+  EXPECT_EQ(FloatToHalf(-0.f), 0x8000);
+  EXPECT_EQ(FloatToHalf(1.f), 0x3c00);
+  EXPECT_EQ(FloatToHalf(-2.f), 0xc000);
+  EXPECT_EQ(FloatToHalf(1.f / 3), 0x3555);
+  EXPECT_EQ(FloatToHalf(65504.f), 0x7bff);
+  EXPECT_EQ(FloatToHalf(65520.f), 0x7c00);
+  EXPECT_EQ(FloatToHalf(std::ldexp(1.f, -24)), 0x0001);
+  EXPECT_EQ(FloatToHalf(std::ldexp(1.f, -25)), 0x0000);
+  EXPECT_EQ(FloatToHalf(std::ldexp(3.f, -25)), 0x0002);
+  // Ties round to even.
+  EXPECT_EQ(FloatToHalf(1.f + std::ldexp(1.f, -11)), 0x3c00);
+  EXPECT_EQ(FloatToHalf(1.f + std::ldexp(3.f, -11)), 0x3c02);
+  // Every half but NaN survives the round trip.
+  for (int half = 0; half < 0x10000; ++half) {
+    if ((half & 0x7c00) == 0x7c00 && (half & 0x3ff)) {
+      continue;
+    }
+    EXPECT_EQ(FloatToHalf(HalfToFloat(half)), half);
+  }
+}
+
+}  // namespace caffe
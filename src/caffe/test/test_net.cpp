@@ -596,6 +596,79 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitChannelsLastNet(const bool channels_last) {
+    std::ostringstream proto;
+    proto <<
+        "name: 'ChannelsLastNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 6 "
+        "input_dim: 5 "
+        "layers: { "
+        "  name: 'conv' "
+        "  type: CONVOLUTION "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "      std: 0.1 "
+        "    } "
+        "  } "
+        "} "
+        "layers: { "
+        "  name: 'prob' "
+        "  type: SOFTMAX "
+        "  bottom: 'conv' "
+        "  top: 'prob' "
+        "} "
+        "channels_last: " << (channels_last ? "true" : "false");
+    InitNetFromProtoString(proto.str());
+  }
+
+  // data -> a -> b -> c -> d, and with eltwise, e = d + a, which splits a.
+  virtual void InitPowerChainNet(const bool plan_memory,
+      const bool eltwise = false) {
+    std::ostringstream proto;
+    proto <<
+        "name: 'PowerChainNetwork' "
+        "input: 'data' "
+        "input_dim: 2 "
+        "input_dim: 3 "
+        "input_dim: 4 "
+        "input_dim: 5 ";
+    const char* names[] = {"a", "b", "c", "d"};
+    for (int i = 0; i < 4; ++i) {
+      proto <<
+        "layers: { "
+        "  name: '" << names[i] << "' "
+        "  type: POWER "
+        "  power_param { "
+        "    scale: 2 "
+        "    shift: " << i << " "
+        "  } "
+        "  bottom: '" << (i == 0 ? "data" : names[i - 1]) << "' "
+        "  top: '" << names[i] << "' "
+        "} ";
+    }
+    if (eltwise) {
+      proto <<
+        "layers: { "
+        "  name: 'e' "
+        "  type: ELTWISE "
+        "  bottom: 'd' "
+        "  bottom: 'a' "
+        "  top: 'e' "
+        "} ";
+    }
+    proto << "plan_memory: " << (plan_memory ? "true" : "false");
+    InitNetFromProtoString(proto.str());
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -2197,4 +2270,291 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+
+TYPED_TEST(NetTest, TestPlanMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(2, 3, 4, 5);
+  filler.Fill(&input);
+  vector<Blob<Dtype>*> input_vec(1, &input);
+
+  this->InitPowerChainNet(false);
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->net_->Forward(input_vec)[0], false, true);
+
+  this->InitPowerChainNet(true);
+  // Run twice, so that the second pass reads memory left by the first.
+  for (int iter = 0; iter < 2; ++iter) {
+    const Blob<Dtype>* output = this->net_->Forward(input_vec)[0];
+    ASSERT_EQ(output->count(), expected.count());
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_EQ(output->cpu_data()[i], expected.cpu_data()[i]);
+    }
+  }
+  // The blobs are data, a, b, c, d. a is dead by the time c is written, so
+  // they share; the input and output keep their own memory.
+  vector<Blob<Dtype>*> blobs(1, this->net_->input_blobs()[0]);
+  for (int i = 0; i < 4; ++i) {
+    blobs.push_back(this->net_->top_vecs()[i][0]);
+  }
+  EXPECT_EQ(blobs[1]->cpu_data(), blobs[3]->cpu_data());
+  EXPECT_NE(blobs[1]->cpu_data(), blobs[2]->cpu_data());
+  for (int i = 1; i < 4; ++i) {
+    EXPECT_NE(blobs[0]->cpu_data(), blobs[i]->cpu_data());
+    EXPECT_NE(blobs[4]->cpu_data(), blobs[i]->cpu_data());
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestPlanMemoryBlobByName) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(2, 3, 4, 5);
+  filler.Fill(&input);
+  vector<Blob<Dtype>*> input_vec(1, &input);
+
+  this->InitPowerChainNet(true);
+  // Requested before the forward pass, a keeps its values.
+  const shared_ptr<Blob<Dtype> > blob_a = this->net_->blob_by_name("a");
+  this->net_->Forward(input_vec);
+  EXPECT_NE(blob_a->cpu_data(), this->net_->top_vecs()[2][0]->cpu_data());
+  for (int i = 0; i < input.count(); ++i) {
+    EXPECT_NEAR(blob_a->cpu_data()[i], 2 * input.cpu_data()[i], 1e-5);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestPlanMemorySplit) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(2, 3, 4, 5);
+  filler.Fill(&input);
+  vector<Blob<Dtype>*> input_vec(1, &input);
+
+  this->InitPowerChainNet(false, true);
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->net_->Forward(input_vec)[0], false, true);
+
+  // The layers are a, the SPLIT of a, b, c, d and e: a must live until e
+  // reads it through the split.
+  this->InitPowerChainNet(true, true);
+  ASSERT_EQ(this->net_->layers().size(), 6);
+  ASSERT_EQ(this->net_->layers()[1]->type(), LayerParameter_LayerType_SPLIT);
+  for (int iter = 0; iter < 2; ++iter) {
+    const Blob<Dtype>* output = this->net_->Forward(input_vec)[0];
+    ASSERT_EQ(output->count(), expected.count());
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_EQ(output->cpu_data()[i], expected.cpu_data()[i]);
+    }
+  }
+  const vector<vector<Blob<Dtype>*> >& top_vecs = this->net_->top_vecs();
+  const Blob<Dtype>* a = top_vecs[0][0];
+  EXPECT_EQ(a->cpu_data(), top_vecs[1][0]->cpu_data());
+  EXPECT_EQ(a->cpu_data(), top_vecs[1][1]->cpu_data());
+  for (int i = 2; i < 5; ++i) {
+    EXPECT_NE(a->cpu_data(), top_vecs[i][0]->cpu_data());
+  }
+  // b is dead by the time d is written.
+  EXPECT_EQ(top_vecs[2][0]->cpu_data(), top_vecs[4][0]->cpu_data());
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestPlanMemoryGrow) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(4, 3, 4, 5);
+  filler.Fill(&input);
+  vector<Blob<Dtype>*> input_vec(1, &input);
+
+  this->InitPowerChainNet(false);
+  this->net_->input_blobs()[0]->Reshape(4, 3, 4, 5);
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->net_->Forward(input_vec)[0], false, true);
+
+  this->InitPowerChainNet(true);
+  this->net_->ForwardPrefilled();
+  // The larger batch grows the arena of a and c when a is written. c, not
+  // written yet, moves along instead of pointing at the freed arena.
+  this->net_->input_blobs()[0]->Reshape(4, 3, 4, 5);
+  this->net_->input_blobs()[0]->CopyFrom(input);
+  this->net_->ForwardFromTo(0, 0);
+  const vector<vector<Blob<Dtype>*> >& top_vecs = this->net_->top_vecs();
+  EXPECT_EQ(top_vecs[0][0]->cpu_data(), top_vecs[2][0]->cpu_data());
+  this->net_->ForwardFromTo(1, 3);
+  const Blob<Dtype>* output = this->net_->output_blobs()[0];
+  ASSERT_EQ(output->count(), expected.count());
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(output->cpu_data()[i], expected.cpu_data()[i]);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestPlanMemoryUnplan) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(2, 3, 4, 5);
+  filler.Fill(&input);
+  vector<Blob<Dtype>*> input_vec(1, &input);
+
+  this->InitPowerChainNet(true);
+  // blobs() is a plain accessor: a and c still share.
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = this->net_->blobs();
+  this->net_->Forward(input_vec);
+  const Blob<Dtype>* a = this->net_->top_vecs()[0][0];
+  EXPECT_EQ(a->cpu_data(), this->net_->top_vecs()[2][0]->cpu_data());
+  // Once unplanned, no blob shares memory.
+  this->net_->UnplanMemory();
+  this->net_->Forward(input_vec);
+  for (int i = 0; i < blobs.size(); ++i) {
+    for (int j = 0; j < i; ++j) {
+      EXPECT_NE(blobs[i]->cpu_data(), blobs[j]->cpu_data());
+    }
+  }
+  for (int i = 0; i < input.count(); ++i) {
+    EXPECT_NEAR(a->cpu_data()[i], 2 * input.cpu_data()[i], 1e-5);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestPlanMemorySoftmaxLoss) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 5, 1, 1);
+  filler.Fill(&data);
+  Blob<Dtype> label(2, 1, 1, 1);
+  label.mutable_cpu_data()[0] = 1;
+  label.mutable_cpu_data()[1] = 3;
+  vector<Blob<Dtype>*> input_vec;
+  input_vec.push_back(&data);
+  input_vec.push_back(&label);
+
+  // The probabilities of the loss are read by c, so they are no output; they
+  // live after a dies, and must not take its arena.
+  const string proto =
+      "name: 'SoftmaxLossNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 5 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "input: 'label' "
+      "input_dim: 2 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "plan_memory: true "
+      "layers: { "
+      "  name: 'a' "
+      "  type: POWER "
+      "  power_param { scale: 2 } "
+      "  bottom: 'data' "
+      "  top: 'a' "
+      "} "
+      "layers: { "
+      "  name: 'b' "
+      "  type: POWER "
+      "  power_param { shift: 1 } "
+      "  bottom: 'a' "
+      "  top: 'b' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: SOFTMAX_LOSS "
+      "  bottom: 'b' "
+      "  bottom: 'label' "
+      "  top: 'loss' "
+      "  top: 'prob' "
+      "  loss_weight: 1 "
+      "  loss_weight: 0 "
+      "} "
+      "layers: { "
+      "  name: 'c' "
+      "  type: POWER "
+      "  bottom: 'prob' "
+      "  top: 'c' "
+      "} ";
+  this->InitNetFromProtoString(proto);
+  for (int iter = 0; iter < 2; ++iter) {
+    this->net_->Forward(input_vec);
+  }
+  const vector<vector<Blob<Dtype>*> >& top_vecs = this->net_->top_vecs();
+  const Blob<Dtype>* prob = top_vecs[2][1];
+  EXPECT_NE(prob->cpu_data(), top_vecs[0][0]->cpu_data());
+  EXPECT_NE(prob->cpu_data(), top_vecs[1][0]->cpu_data());
+  for (int n = 0; n < 2; ++n) {
+    Dtype sum = 0;
+    for (int c = 0; c < 5; ++c) {
+      sum += std::exp(2 * data.data_at(n, c, 0, 0));
+    }
+    for (int c = 0; c < 5; ++c) {
+      const Dtype expected = std::exp(2 * data.data_at(n, c, 0, 0)) / sum;
+      EXPECT_NEAR(prob->data_at(n, c, 0, 0), expected, 1e-5);
+      EXPECT_NEAR(top_vecs[3][0]->data_at(n, c, 0, 0), expected, 1e-5);
+    }
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestChannelsLast) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> input(2, 3, 6, 5);
+  filler.Fill(&input);
+  vector<Blob<Dtype>*> input_vec(1, &input);
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitChannelsLastNet(false);
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->net_->Forward(input_vec)[0], false, true);
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitChannelsLastNet(true);
+  EXPECT_TRUE(this->net_->has_layer("prob_nchw"));
+  // The output is converted back to NCHW under its own name.
+  const Blob<Dtype>* output = this->net_->Forward(input_vec)[0];
+  EXPECT_EQ(output, this->net_->blob_by_name("prob").get());
+  EXPECT_FALSE(output->channels_last());
+  ASSERT_EQ(output->count(), expected.count());
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(output->cpu_data()[i], expected.cpu_data()[i], 1e-5);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestChannelsLastTrainIgnored) {
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TRAIN);
+  this->InitChannelsLastNet(true);
+  EXPECT_FALSE(this->net_->has_layer("data_nhwc"));
+  EXPECT_FALSE(this->net_->has_layer("prob_nchw"));
+}
+
 }  // namespace caffe
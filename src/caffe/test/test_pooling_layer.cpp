@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 #include <vector>
 
@@ -537,6 +538,103 @@ TYPED_TEST(PoolingLayerTest, TestGradientMaxTopMask) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestForwardMaxStride1TopMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_h(3);
+  pooling_param->set_kernel_w(2);
+  pooling_param->set_stride(1);
+  pooling_param->set_pad(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  // Small integers, so that many windows have ties.
+  Dtype* bottom_data = this->blob_bottom_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    bottom_data[i] = caffe_rng_rand() % 4;
+  }
+  this->blob_top_vec_.push_back(this->blob_top_mask_);
+  PoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int height = this->blob_bottom_->height();
+  const int width = this->blob_bottom_->width();
+  for (int n = 0; n < this->blob_top_->num(); ++n) {
+    for (int c = 0; c < this->blob_top_->channels(); ++c) {
+      for (int ph = 0; ph < this->blob_top_->height(); ++ph) {
+        for (int pw = 0; pw < this->blob_top_->width(); ++pw) {
+          // the first maximum of the window in row-major order
+          int max_index = -1;
+          Dtype max_value = 0;
+          for (int h = std::max(ph - 1, 0); h < std::min(ph + 2, height); ++h) {
+            for (int w = std::max(pw - 1, 0); w < std::min(pw + 1, width);
+                ++w) {
+              const Dtype value = this->blob_bottom_->data_at(n, c, h, w);
+              if (max_index < 0 || value > max_value) {
+                max_value = value;
+                max_index = h * width + w;
+              }
+            }
+          }
+          EXPECT_EQ(this->blob_top_->data_at(n, c, ph, pw), max_value);
+          EXPECT_EQ(this->blob_top_mask_->data_at(n, c, ph, pw), max_index);
+        }
+      }
+    }
+  }
+  this->blob_top_vec_.pop_back();
+}
+
+TYPED_TEST(PoolingLayerTest, TestGradientMaxCompactMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  for (int stride = 1; stride <= 2; stride++) {
+    LayerParameter layer_param;
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->set_kernel_h(3);
+    pooling_param->set_kernel_w(4);
+    pooling_param->set_stride(stride);
+    pooling_param->set_pad(1);
+    pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+    pooling_param->set_compact_mask(true);
+    PoolingLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-4, 1e-2);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestMaxCompactMaskGlobal) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A 20 x 20 window is too large for the compact mask, which falls back
+  // to int indices.
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_global_pooling(true);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  pooling_param->set_compact_mask(true);
+  this->blob_bottom_->Reshape(2, 3, 20, 20);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  PoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_set(this->blob_top_->count(), Dtype(1),
+      this->blob_top_->mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  const int plane = 20 * 20;
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    const Dtype* bottom_data = this->blob_bottom_->cpu_data() + i * plane;
+    const Dtype* bottom_diff = this->blob_bottom_->cpu_diff() + i * plane;
+    const int argmax = std::max_element(bottom_data, bottom_data + plane) -
+        bottom_data;
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], bottom_data[argmax]);
+    for (int j = 0; j < plane; ++j) {
+      EXPECT_EQ(bottom_diff[j], j == argmax ? 1 : 0);
+    }
+  }
+}
+
 TYPED_TEST(PoolingLayerTest, TestForwardAve) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
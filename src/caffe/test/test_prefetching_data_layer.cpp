@@ -0,0 +1,109 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Fills the i-th batch it loads with the value i, and its label with -i.
+template <typename Dtype>
+class CountingDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit CountingDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param), count_(0) {}
+  virtual ~CountingDataLayer() { this->JoinPrefetchThread(); }
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+    top[0]->Reshape(2, 3, 4, 5);
+    top[1]->Reshape(2, 1, 1, 1);
+    for (int i = 0; i < this->PREFETCH_COUNT; ++i) {
+      this->prefetch_[i].data_.Reshape(2, 3, 4, 5);
+      this->prefetch_[i].label_.Reshape(2, 1, 1, 1);
+    }
+  }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int ExactNumTopBlobs() const { return 2; }
+
+  // Waits until the prefetch thread has filled all the free batches.
+  void WaitForFullQueue() {
+    const size_t expected =
+        this->PREFETCH_COUNT - (this->prefetch_current_ ? 1 : 0);
+    while (this->prefetch_full_.size() < expected) {}
+  }
+
+ protected:
+  virtual void LoadBatch(Batch<Dtype>* batch) {
+    caffe_set(batch->data_.count(), Dtype(count_),
+        batch->data_.mutable_cpu_data());
+    caffe_set(batch->label_.count(), Dtype(-count_),
+        batch->label_.mutable_cpu_data());
+    ++count_;
+  }
+
+  int count_;
+};
+
+template <typename Dtype>
+class PrefetchingDataLayerTest : public ::testing::Test {
+ protected:
+  PrefetchingDataLayerTest()
+      : blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {
+    Caffe::set_mode(Caffe::CPU);
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+  }
+  virtual ~PrefetchingDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(PrefetchingDataLayerTest, TestDtypes);
+
+TYPED_TEST(PrefetchingDataLayerTest, TestBatchesInOrder) {
+  LayerParameter param;
+  CountingDataLayer<TypeParam> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int iter = 0; iter < 3 * layer.PREFETCH_COUNT + 1; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(this->blob_top_data_->count(), 2 * 3 * 4 * 5);
+    ASSERT_EQ(this->blob_top_label_->count(), 2);
+    for (int i = 0; i < this->blob_top_data_->count(); ++i) {
+      EXPECT_EQ(iter, this->blob_top_data_->cpu_data()[i]);
+    }
+    for (int i = 0; i < this->blob_top_label_->count(); ++i) {
+      EXPECT_EQ(-iter, this->blob_top_label_->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(PrefetchingDataLayerTest, TestTopsNotOverwritten) {
+  LayerParameter param;
+  CountingDataLayer<TypeParam> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int iter = 0; iter < 2 * layer.PREFETCH_COUNT; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const TypeParam* data = this->blob_top_data_->cpu_data();
+    // The batch handed out stays valid while the thread runs ahead.
+    layer.WaitForFullQueue();
+    EXPECT_EQ(data, this->blob_top_data_->cpu_data());
+    for (int i = 0; i < this->blob_top_data_->count(); ++i) {
+      EXPECT_EQ(iter, data[i]);
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,115 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class SegAccuracyLayerTest : public ::testing::Test {
+ protected:
+  SegAccuracyLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(2, 5, 25, 23)),
+        blob_bottom_label_(new Blob<Dtype>(2, 1, 25, 23)),
+        blob_top_(new Blob<Dtype>()) {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_random_seed(1701);
+    // fill the values
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    Dtype* label = blob_bottom_label_->mutable_cpu_data();
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      label[i] = (i % 9) ? caffe_rng_rand() % 5 : 255;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~SegAccuracyLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_;
+  }
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SegAccuracyLayerTest, TestDtypes);
+
+TYPED_TEST(SegAccuracyLayerTest, TestForwardIgnoreLabel) {
+  LayerParameter layer_param;
+  layer_param.mutable_seg_accuracy_param()->add_ignore_label(255);
+  SegAccuracyLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Per-class counts of the labels and of the correct predictions.
+  const Blob<TypeParam>* data = this->blob_bottom_data_;
+  vector<int> total(data->channels(), 0);
+  vector<int> correct(data->channels(), 0);
+  for (int n = 0; n < data->num(); ++n) {
+    for (int h = 0; h < data->height(); ++h) {
+      for (int w = 0; w < data->width(); ++w) {
+        const int gt_label = this->blob_bottom_label_->data_at(n, 0, h, w);
+        if (gt_label == 255) {
+          continue;
+        }
+        int max_ind = 0;
+        for (int c = 1; c < data->channels(); ++c) {
+          if (data->data_at(n, c, h, w) > data->data_at(n, max_ind, h, w)) {
+            max_ind = c;
+          }
+        }
+        ++total[gt_label];
+        correct[gt_label] += (max_ind == gt_label);
+      }
+    }
+  }
+  int num_total = 0, num_correct = 0;
+  TypeParam recall = 0;
+  for (int c = 0; c < data->channels(); ++c) {
+    num_total += total[c];
+    num_correct += correct[c];
+    recall += TypeParam(correct[c]) / total[c];
+  }
+  EXPECT_NEAR(this->blob_top_->cpu_data()[0],
+      TypeParam(num_correct) / num_total, 1e-5);
+  EXPECT_NEAR(this->blob_top_->cpu_data()[1],
+      recall / data->channels(), 1e-5);
+}
+
+TYPED_TEST(SegAccuracyLayerTest, TestForwardNegativeIgnoreLabel) {
+  LayerParameter layer_param;
+  layer_param.mutable_seg_accuracy_param()->add_ignore_label(255);
+  SegAccuracyLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<TypeParam> expected;
+  expected.CopyFrom(*this->blob_top_, false, true);
+  // The same pixels, ignored as -1 instead.
+  TypeParam* label = this->blob_bottom_label_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_label_->count(); ++i) {
+    if (label[i] == 255) {
+      label[i] = -1;
+    }
+  }
+  LayerParameter negative_param;
+  negative_param.mutable_seg_accuracy_param()->add_ignore_label(-1);
+  SegAccuracyLayer<TypeParam> negative_layer(negative_param);
+  negative_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  negative_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], expected.cpu_data()[i]);
+  }
+}
+
+}  // namespace caffe
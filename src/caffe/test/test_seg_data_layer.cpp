@@ -0,0 +1,332 @@
+#ifndef OSX
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/dataset_factory.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class SegDataLayerTest : public ::testing::Test {
+ protected:
+  SegDataLayerTest()
+      : blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()),
+        blob_top_dim_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    MakeTempDir(&filename_);
+    filename_ += "/db";
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    blob_top_vec_.push_back(blob_top_dim_);
+  }
+  virtual ~SegDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+    delete blob_top_dim_;
+  }
+
+  // Fills the db with 3 x 5 color images whose pixels are
+  // (i + h * 5 + w + c) % 256, and label maps of i except for record 1,
+  // which is unlabeled.
+  void Fill(DataParameter_DB backend) {
+    const int heights[] = {3, 3, 3};
+    const int widths[] = {5, 5, 5};
+    Fill(backend, heights, widths);
+  }
+
+  // The same with images of heights[i] x widths[i], whose pixels are
+  // (i + h * widths[i] + w + c) % 256.
+  void Fill(DataParameter_DB backend, const int* heights, const int* widths) {
+    LOG(INFO) << "Using temporary dataset " << filename_;
+    shared_ptr<Dataset<string, string> > dataset =
+        DatasetFactory<string, string>(backend);
+    CHECK(dataset->open(filename_, Dataset<string, string>::New));
+    for (int i = 0; i < 3; ++i) {
+      const int size = heights[i] * widths[i];
+      SegDatum datum;
+      datum.set_channels(3);
+      datum.set_height(heights[i]);
+      datum.set_width(widths[i]);
+      string* image = datum.mutable_image();
+      for (int j = 0; j < size; ++j) {
+        for (int c = 0; c < 3; ++c) {
+          image->push_back(static_cast<char>((i + j + c) % 256));
+        }
+      }
+      if (i != 1) {
+        datum.mutable_label()->assign(size, static_cast<char>(i));
+      }
+      std::stringstream ss;
+      ss << i;
+      CHECK(dataset->put(ss.str(), datum.SerializeAsString()));
+    }
+    CHECK(dataset->commit());
+    dataset->close();
+  }
+
+  void TestRead(DataParameter_DB backend, const bool readahead) {
+    Fill(backend);
+    LayerParameter param;
+    ImageDataParameter* image_data_param = param.mutable_image_data_param();
+    image_data_param->set_batch_size(2);
+    image_data_param->set_source(filename_.c_str());
+    image_data_param->set_backend(backend);
+    image_data_param->set_readahead(readahead);
+    image_data_param->set_ignore_label(255);
+    SegDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 2);
+    EXPECT_EQ(blob_top_data_->channels(), 3);
+    EXPECT_EQ(blob_top_data_->height(), 3);
+    EXPECT_EQ(blob_top_data_->width(), 5);
+    EXPECT_EQ(blob_top_label_->channels(), 1);
+    EXPECT_EQ(blob_top_label_->height(), 3);
+    EXPECT_EQ(blob_top_label_->width(), 5);
+    // Go through the records twice, wrapping around the end.
+    for (int iter = 0; iter < 3; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int n = 0; n < 2; ++n) {
+        const int id = (iter * 2 + n) % 3;
+        EXPECT_EQ(blob_top_dim_->data_at(n, 0, 0, 0), 3);
+        EXPECT_EQ(blob_top_dim_->data_at(n, 0, 0, 1), 5);
+        for (int h = 0; h < 3; ++h) {
+          for (int w = 0; w < 5; ++w) {
+            for (int c = 0; c < 3; ++c) {
+              EXPECT_EQ(blob_top_data_->data_at(n, c, h, w),
+                  (id + h * 5 + w + c) % 256);
+            }
+            EXPECT_EQ(blob_top_label_->data_at(n, 0, h, w),
+                id == 1 ? 255 : id);
+          }
+        }
+      }
+    }
+  }
+
+  // Checks that the images are sorted by their padded size, and that every
+  // batch is only padded to the multiple of 4 (at most crop_size) holding
+  // its images, with the pad filled with zero data and the ignore label.
+  void TestBucketStride(const int crop_size) {
+    const int heights[] = {3, 7, 2};
+    const int widths[] = {5, 4, 2};
+    Fill(DataParameter_DB_LMDB, heights, widths);
+    Caffe::set_phase(Caffe::TEST);
+    LayerParameter param;
+    param.mutable_transform_param()->set_crop_size(crop_size);
+    ImageDataParameter* image_data_param = param.mutable_image_data_param();
+    image_data_param->set_batch_size(2);
+    image_data_param->set_source(filename_.c_str());
+    image_data_param->set_ignore_label(255);
+    image_data_param->set_bucket_stride(4);
+    SegDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    // Padded to 4 x 8, 8 x 4 and 4 x 4 (4 x 6, 6 x 4 and 4 x 4 with a crop
+    // of 6), the images are sorted into 2, 0, 1: batches {2, 0}, {1, 2} and
+    // {0, 1}.
+    const int order[] = {2, 0, 1};
+    const int batch_heights[] = {4, 8, 8};
+    const int batch_widths[] = {8, 4, 8};
+    for (int iter = 0; iter < 3; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      int batch_height = batch_heights[iter];
+      int batch_width = batch_widths[iter];
+      if (crop_size) {
+        batch_height = std::min(batch_height, crop_size);
+        batch_width = std::min(batch_width, crop_size);
+      }
+      EXPECT_EQ(blob_top_data_->num(), 2);
+      EXPECT_EQ(blob_top_data_->channels(), 3);
+      EXPECT_EQ(blob_top_data_->height(), batch_height);
+      EXPECT_EQ(blob_top_data_->width(), batch_width);
+      EXPECT_EQ(blob_top_label_->height(), batch_height);
+      EXPECT_EQ(blob_top_label_->width(), batch_width);
+      EXPECT_EQ(blob_top_dim_->width(), 3);
+      for (int n = 0; n < 2; ++n) {
+        const int id = order[(iter * 2 + n) % 3];
+        const int height = std::min(heights[id], batch_height);
+        const int width = std::min(widths[id], batch_width);
+        // The crop window is centered on the images larger than it.
+        const int h_off = (heights[id] - height) / 2;
+        const int w_off = (widths[id] - width) / 2;
+        EXPECT_EQ(blob_top_dim_->data_at(n, 0, 0, 0), height);
+        EXPECT_EQ(blob_top_dim_->data_at(n, 0, 0, 1), width);
+        EXPECT_EQ(blob_top_dim_->data_at(n, 0, 0, 2), id);
+        for (int h = 0; h < batch_height; ++h) {
+          for (int w = 0; w < batch_width; ++w) {
+            const bool valid = h < height && w < width;
+            for (int c = 0; c < 3; ++c) {
+              EXPECT_EQ(blob_top_data_->data_at(n, c, h, w), !valid ? 0 :
+                  (id + (h + h_off) * widths[id] + w + w_off + c) % 256);
+            }
+            EXPECT_EQ(blob_top_label_->data_at(n, 0, h, w),
+                !valid || id == 1 ? 255 : id);
+          }
+        }
+      }
+    }
+    Caffe::set_phase(Caffe::TRAIN);
+  }
+
+  // Checks that MAT_WRITE names the files of bucketed images after the
+  // lines of its source in the order of the records.
+  void TestBucketStrideMatWrite() {
+    const int heights[] = {3, 7, 2};
+    const int widths[] = {5, 4, 2};
+    Fill(DataParameter_DB_LMDB, heights, widths);
+    string prefix;
+    MakeTempDir(&prefix);
+    prefix += "/";
+    const string names[] = {"a", "b", "c"};
+    const string list = prefix + "list.txt";
+    {
+      std::ofstream out(list.c_str());
+      for (int i = 0; i < 3; ++i) {
+        out << names[i] << std::endl;
+      }
+    }
+    Caffe::set_phase(Caffe::TEST);
+    NetParameter param;
+    LayerParameter* data_param = param.add_layers();
+    data_param->set_name("data");
+    data_param->set_type(LayerParameter_LayerType_SEG_DATA);
+    data_param->add_top("data");
+    data_param->add_top("label");
+    data_param->add_top("data_dims");
+    ImageDataParameter* image_data_param =
+        data_param->mutable_image_data_param();
+    image_data_param->set_batch_size(2);
+    image_data_param->set_source(filename_.c_str());
+    image_data_param->set_bucket_stride(4);
+    LayerParameter* write_param = param.add_layers();
+    write_param->set_name("write");
+    write_param->set_type(LayerParameter_LayerType_MAT_WRITE);
+    write_param->add_bottom("data");
+    write_param->add_bottom("data_dims");
+    MatWriteParameter* mat_write_param = write_param->mutable_mat_write_param();
+    mat_write_param->set_prefix(prefix);
+    mat_write_param->set_source(list);
+    mat_write_param->set_crop_to_dims(true);
+    {
+      Net<Dtype> net(param);
+      // Batches {2, 0} and {1, 2}.
+      for (int iter = 0; iter < 2; ++iter) {
+        net.ForwardPrefilled();
+      }
+      // The net saves the pending files when it goes away.
+    }
+    for (int id = 0; id < 3; ++id) {
+      Blob<Dtype> blob;
+      blob.FromMat((prefix + names[id] + "_blob_0.mat").c_str());
+      ASSERT_EQ(blob.num(), 1);
+      ASSERT_EQ(blob.channels(), 3);
+      ASSERT_EQ(blob.height(), heights[id]);
+      ASSERT_EQ(blob.width(), widths[id]);
+      for (int c = 0; c < 3; ++c) {
+        for (int h = 0; h < heights[id]; ++h) {
+          for (int w = 0; w < widths[id]; ++w) {
+            EXPECT_EQ(blob.data_at(0, c, h, w),
+                (id + h * widths[id] + w + c) % 256);
+          }
+        }
+      }
+    }
+    Caffe::set_phase(Caffe::TRAIN);
+  }
+
+  // Checks that the batches are the same with 1 and 4 decode threads, with
+  // random crops, mirroring and scaling.
+  void TestDecodeThreads() {
+    const int heights[] = {6, 5, 7};
+    const int widths[] = {6, 8, 4};
+    Fill(DataParameter_DB_LMDB, heights, widths);
+    LayerParameter param;
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_crop_size(4);
+    transform_param->set_mirror(true);
+    transform_param->set_min_scale_factor(0.7);
+    transform_param->set_max_scale_factor(1.5);
+    ImageDataParameter* image_data_param = param.mutable_image_data_param();
+    image_data_param->set_batch_size(3);
+    image_data_param->set_source(filename_.c_str());
+    image_data_param->set_ignore_label(255);
+    const int iters = 4;
+    vector<vector<Dtype> > batches[2];
+    for (int run = 0; run < 2; ++run) {
+      image_data_param->set_decode_threads(run == 0 ? 1 : 4);
+      Caffe::set_random_seed(1701);
+      SegDataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      for (int iter = 0; iter < iters; ++iter) {
+        layer.Forward(blob_bottom_vec_, blob_top_vec_);
+        for (int i = 0; i < blob_top_vec_.size(); ++i) {
+          const Dtype* data = blob_top_vec_[i]->cpu_data();
+          batches[run].push_back(
+              vector<Dtype>(data, data + blob_top_vec_[i]->count()));
+        }
+      }
+    }
+    ASSERT_EQ(batches[0].size(), batches[1].size());
+    for (int i = 0; i < batches[0].size(); ++i) {
+      ASSERT_EQ(batches[0][i].size(), batches[1][i].size());
+      for (int j = 0; j < batches[0][i].size(); ++j) {
+        EXPECT_EQ(batches[0][i][j], batches[1][i][j]);
+      }
+    }
+  }
+
+  string filename_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  Blob<Dtype>* const blob_top_dim_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SegDataLayerTest, TestDtypes);
+
+TYPED_TEST(SegDataLayerTest, TestReadLevelDB) {
+  this->TestRead(DataParameter_DB_LEVELDB, false);
+}
+
+TYPED_TEST(SegDataLayerTest, TestReadLMDB) {
+  this->TestRead(DataParameter_DB_LMDB, false);
+}
+
+TYPED_TEST(SegDataLayerTest, TestReadLMDBReadahead) {
+  this->TestRead(DataParameter_DB_LMDB, true);
+}
+
+TYPED_TEST(SegDataLayerTest, TestDecodeThreads) {
+  this->TestDecodeThreads();
+}
+
+TYPED_TEST(SegDataLayerTest, TestBucketStride) {
+  this->TestBucketStride(0);
+}
+
+TYPED_TEST(SegDataLayerTest, TestBucketStrideCrop) {
+  this->TestBucketStride(6);
+}
+
+TYPED_TEST(SegDataLayerTest, TestBucketStrideMatWrite) {
+  this->TestBucketStrideMatWrite();
+}
+
+}  // namespace caffe
+#endif  // OSX
@@ -0,0 +1,116 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class SegHeadLayerTest : public ::testing::Test {
+ protected:
+  SegHeadLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 5, 6, 7)),
+        blob_top_label_(new Blob<Dtype>()),
+        blob_top_score_(new Blob<Dtype>()) {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_random_seed(1701);
+    // fill the values
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_label_);
+    blob_top_vec_.push_back(blob_top_score_);
+  }
+  virtual ~SegHeadLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_label_;
+    delete blob_top_score_;
+  }
+
+  // Runs the unfused INTERP -> (SOFTMAX ->) ARGMAX pipeline and compares.
+  void TestAgainstPipeline(LayerParameter layer_param) {
+    SegHeadLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    Blob<Dtype> interp_top, softmax_top, argmax_top;
+    vector<Blob<Dtype>*> interp_top_vec(1, &interp_top);
+    vector<Blob<Dtype>*> softmax_top_vec(1, &softmax_top);
+    vector<Blob<Dtype>*> argmax_top_vec(1, &argmax_top);
+    InterpLayer<Dtype> interp_layer(layer_param);
+    interp_layer.SetUp(blob_bottom_vec_, interp_top_vec);
+    interp_layer.Forward(blob_bottom_vec_, interp_top_vec);
+    vector<Blob<Dtype>*>* argmax_bottom_vec = &interp_top_vec;
+    if (layer_param.seg_head_param().softmax()) {
+      SoftmaxLayer<Dtype> softmax_layer(layer_param);
+      softmax_layer.SetUp(interp_top_vec, softmax_top_vec);
+      softmax_layer.Forward(interp_top_vec, softmax_top_vec);
+      argmax_bottom_vec = &softmax_top_vec;
+    }
+    layer_param.mutable_argmax_param()->set_out_max_val(true);
+    ArgMaxLayer<Dtype> argmax_layer(layer_param);
+    argmax_layer.SetUp(*argmax_bottom_vec, argmax_top_vec);
+    argmax_layer.Forward(*argmax_bottom_vec, argmax_top_vec);
+    ASSERT_EQ(blob_top_label_->num(), argmax_top.num());
+    ASSERT_EQ(blob_top_label_->channels(), 1);
+    ASSERT_EQ(blob_top_label_->height(), argmax_top.height());
+    ASSERT_EQ(blob_top_label_->width(), argmax_top.width());
+    for (int n = 0; n < argmax_top.num(); ++n) {
+      for (int h = 0; h < argmax_top.height(); ++h) {
+        for (int w = 0; w < argmax_top.width(); ++w) {
+          EXPECT_EQ(blob_top_label_->data_at(n, 0, h, w),
+              argmax_top.data_at(n, 0, h, w));
+          EXPECT_NEAR(blob_top_score_->data_at(n, 0, h, w),
+              argmax_top.data_at(n, 1, h, w), 1e-5);
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_label_;
+  Blob<Dtype>* const blob_top_score_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SegHeadLayerTest, TestDtypes);
+
+TYPED_TEST(SegHeadLayerTest, TestSetup) {
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(4);
+  SegHeadLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_label_->num(), 2);
+  EXPECT_EQ(this->blob_top_label_->channels(), 1);
+  EXPECT_EQ(this->blob_top_label_->height(), 21);
+  EXPECT_EQ(this->blob_top_label_->width(), 25);
+  EXPECT_EQ(this->blob_top_score_->channels(), 1);
+  EXPECT_EQ(this->blob_top_score_->height(), 21);
+  EXPECT_EQ(this->blob_top_score_->width(), 25);
+}
+
+TYPED_TEST(SegHeadLayerTest, TestForwardSoftmax) {
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(4);
+  this->TestAgainstPipeline(layer_param);
+}
+
+TYPED_TEST(SegHeadLayerTest, TestForwardScoresCropped) {
+  LayerParameter layer_param;
+  InterpParameter* interp_param = layer_param.mutable_interp_param();
+  interp_param->set_height(13);
+  interp_param->set_width(17);
+  interp_param->set_pad_beg(-1);
+  interp_param->set_pad_end(-1);
+  layer_param.mutable_seg_head_param()->set_softmax(false);
+  this->TestAgainstPipeline(layer_param);
+}
+
+}  // namespace caffe
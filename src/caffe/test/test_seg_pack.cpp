@@ -0,0 +1,276 @@
+#ifndef OSX
+#include <opencv2/core/core.hpp>
+
+#include <stdint.h>
+
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/seg_pack.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Fills datum with a raw height x width image whose pixels are
+// (id + h * width + w + c) % 256, and a label map of id unless unlabeled.
+static void FillSegDatum(const int id, const int height, const int width,
+    const bool labeled, SegDatum* datum) {
+  const int channels = 3;
+  datum->Clear();
+  datum->set_channels(channels);
+  datum->set_height(height);
+  datum->set_width(width);
+  string* image = datum->mutable_image();
+  for (int h = 0; h < height; ++h) {
+    for (int w = 0; w < width; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        image->push_back(static_cast<char>((id + h * width + w + c) % 256));
+      }
+    }
+  }
+  if (labeled) {
+    datum->mutable_label()->assign(height * width, static_cast<char>(id));
+  }
+}
+
+class SegPackTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempFilename(&filename_);
+    SegPackWriter writer;
+    ASSERT_TRUE(writer.Open(filename_));
+    SegDatum datum;
+    for (int i = 0; i < 4; ++i) {
+      FillSegDatum(i, 3, 5, i != 2, &datum);
+      ASSERT_TRUE(writer.Add(datum));
+    }
+    EXPECT_EQ(writer.size(), 4);
+    ASSERT_TRUE(writer.Close());
+  }
+
+  string filename_;
+};
+
+TEST_F(SegPackTest, TestWriteRead) {
+  SegPackReader reader;
+  ASSERT_TRUE(reader.Open(filename_));
+  ASSERT_EQ(reader.size(), 4);
+  SegDatum expected, datum;
+  // Out of order, as a shuffled layer reads them.
+  const int order[] = {3, 0, 2, 1};
+  for (int i = 0; i < 4; ++i) {
+    FillSegDatum(order[i], 3, 5, order[i] != 2, &expected);
+    ASSERT_TRUE(reader.Read(order[i], &datum));
+    EXPECT_EQ(datum.SerializeAsString(), expected.SerializeAsString());
+  }
+}
+
+TEST_F(SegPackTest, TestReadahead) {
+  SegPackReader reader;
+  ASSERT_TRUE(reader.Open(filename_, true));
+  SegDatum expected, datum;
+  for (int i = 0; i < reader.size(); ++i) {
+    reader.WillNeed(i);
+    FillSegDatum(i, 3, 5, i != 2, &expected);
+    ASSERT_TRUE(reader.Read(i, &datum));
+    EXPECT_EQ(datum.SerializeAsString(), expected.SerializeAsString());
+  }
+}
+
+TEST_F(SegPackTest, TestReadView) {
+  SegPackReader reader;
+  ASSERT_TRUE(reader.Open(filename_));
+  SegDatum expected;
+  SegDatumView view;
+  for (int i = 0; i < reader.size(); ++i) {
+    FillSegDatum(i, 3, 5, i != 2, &expected);
+    ASSERT_TRUE(reader.Read(i, &view));
+    EXPECT_EQ(view.channels, 3);
+    EXPECT_EQ(view.height, 3);
+    EXPECT_EQ(view.width, 5);
+    EXPECT_FALSE(view.encoded);
+    EXPECT_EQ(string(view.image, view.image_size), expected.image());
+    if (i == 2) {
+      EXPECT_TRUE(view.label == NULL);
+    } else {
+      EXPECT_EQ(string(view.label, view.label_size), expected.label());
+    }
+  }
+}
+
+TEST_F(SegPackTest, TestParseViewInPlace) {
+  SegDatum datum;
+  FillSegDatum(5, 3, 5, true, &datum);
+  datum.set_encoded(true);
+  const string record = datum.SerializeAsString();
+  SegDatumView view;
+  ASSERT_TRUE(ParseSegDatumView(record.data(), record.size(), &view));
+  EXPECT_TRUE(view.encoded);
+  // The bytes are not copied.
+  EXPECT_GE(view.image, record.data());
+  EXPECT_LE(view.image + view.image_size, record.data() + record.size());
+  EXPECT_EQ(string(view.image, view.image_size), datum.image());
+  EXPECT_EQ(string(view.label, view.label_size), datum.label());
+  // A truncated record is rejected.
+  EXPECT_FALSE(ParseSegDatumView(record.data(), record.size() - 1, &view));
+  // Unknown fields are skipped: 7 (varint 300), 8 (fixed64), 9 ("ab") and
+  // 10 (fixed32).
+  const char unknown[] = "\x38\xac\x02" "\x41" "01234567" "\x4a\x02" "ab"
+      "\x55" "0123";
+  const string extended = record + string(unknown, sizeof(unknown) - 1);
+  ASSERT_TRUE(ParseSegDatumView(extended.data(), extended.size(), &view));
+  EXPECT_EQ(view.height, datum.height());
+  EXPECT_EQ(string(view.image, view.image_size), datum.image());
+  EXPECT_EQ(string(view.label, view.label_size), datum.label());
+}
+
+TEST_F(SegPackTest, TestOpenNotSegPack) {
+  string filename;
+  MakeTempFilename(&filename);
+  WriteProtoToBinaryFile(LayerParameter(), filename);
+  SegPackReader reader;
+  EXPECT_FALSE(reader.Open(filename));
+  EXPECT_EQ(reader.size(), 0);
+}
+
+TEST_F(SegPackTest, TestOpenCorruptIndex) {
+  std::ifstream in(filename_.c_str(), std::ios::in | std::ios::binary);
+  const string pack((std::istreambuf_iterator<char>(in)),
+      std::istreambuf_iterator<char>());
+  in.close();
+  uint64_t index_offset;
+  memcpy(&index_offset, pack.data() + 16, sizeof(index_offset));
+  // Record 1 ending after the index, then before its start.
+  const uint64_t bad_offsets[] = {pack.size(), 0};
+  for (int i = 0; i < 2; ++i) {
+    string corrupt = pack;
+    memcpy(&corrupt[index_offset + 2 * sizeof(uint64_t)], &bad_offsets[i],
+        sizeof(uint64_t));
+    string filename;
+    MakeTempFilename(&filename);
+    std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+    out << corrupt;
+    out.close();
+    SegPackReader reader;
+    EXPECT_FALSE(reader.Open(filename));
+    EXPECT_EQ(reader.size(), 0);
+  }
+}
+
+TEST_F(SegPackTest, TestDecodeRaw) {
+  SegDatum datum;
+  FillSegDatum(7, 3, 5, true, &datum);
+  cv::Mat cv_img, cv_seg;
+  ASSERT_TRUE(DecodeSegDatumToCVMat(datum, 0, 0, true, &cv_img, &cv_seg));
+  ASSERT_EQ(cv_img.rows, 3);
+  ASSERT_EQ(cv_img.cols, 5);
+  ASSERT_EQ(cv_img.channels(), 3);
+  ASSERT_EQ(cv_seg.rows, 3);
+  ASSERT_EQ(cv_seg.cols, 5);
+  ASSERT_EQ(cv_seg.channels(), 1);
+  // The mats own their pixels, so they outlive the datum.
+  datum.Clear();
+  for (int h = 0; h < 3; ++h) {
+    const uchar* img_row = cv_img.ptr<uchar>(h);
+    const uchar* seg_row = cv_seg.ptr<uchar>(h);
+    for (int w = 0; w < 5; ++w) {
+      for (int c = 0; c < 3; ++c) {
+        EXPECT_EQ(img_row[w * 3 + c], (7 + h * 5 + w + c) % 256);
+      }
+      EXPECT_EQ(seg_row[w], 7);
+    }
+  }
+  // An unlabeled datum gives an empty label map.
+  FillSegDatum(7, 3, 5, false, &datum);
+  ASSERT_TRUE(DecodeSegDatumToCVMat(datum, 0, 0, true, &cv_img, &cv_seg));
+  EXPECT_FALSE(cv_seg.data);
+  // A color datum is not read as grayscale.
+  EXPECT_FALSE(DecodeSegDatumToCVMat(datum, 0, 0, false, &cv_img, &cv_seg));
+}
+
+template <typename Dtype>
+class SegPackDataLayerTest : public ::testing::Test {
+ protected:
+  SegPackDataLayerTest()
+      : blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()),
+        blob_top_dim_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    MakeTempFilename(&filename_);
+    SegPackWriter writer;
+    ASSERT_TRUE(writer.Open(filename_));
+    SegDatum datum;
+    for (int i = 0; i < 3; ++i) {
+      FillSegDatum(i, 3, 5, i != 1, &datum);
+      ASSERT_TRUE(writer.Add(datum));
+    }
+    ASSERT_TRUE(writer.Close());
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    blob_top_vec_.push_back(blob_top_dim_);
+  }
+  virtual ~SegPackDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+    delete blob_top_dim_;
+  }
+
+  string filename_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  Blob<Dtype>* const blob_top_dim_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SegPackDataLayerTest, TestDtypes);
+
+TYPED_TEST(SegPackDataLayerTest, TestRead) {
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(2);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_ignore_label(255);
+  SegPackDataLayer<TypeParam> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 2);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3);
+  EXPECT_EQ(this->blob_top_data_->height(), 3);
+  EXPECT_EQ(this->blob_top_data_->width(), 5);
+  EXPECT_EQ(this->blob_top_label_->channels(), 1);
+  EXPECT_EQ(this->blob_top_label_->height(), 3);
+  EXPECT_EQ(this->blob_top_label_->width(), 5);
+  // Go through the records twice, wrapping around the end.
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int n = 0; n < 2; ++n) {
+      const int id = (iter * 2 + n) % 3;
+      EXPECT_EQ(this->blob_top_dim_->data_at(n, 0, 0, 0), 3);
+      EXPECT_EQ(this->blob_top_dim_->data_at(n, 0, 0, 1), 5);
+      for (int h = 0; h < 3; ++h) {
+        for (int w = 0; w < 5; ++w) {
+          for (int c = 0; c < 3; ++c) {
+            EXPECT_EQ(this->blob_top_data_->data_at(n, c, h, w),
+                (id + h * 5 + w + c) % 256);
+          }
+          EXPECT_EQ(this->blob_top_label_->data_at(n, 0, h, w),
+              id == 1 ? 255 : id);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace caffe
+#endif  // OSX
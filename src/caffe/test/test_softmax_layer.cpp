@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <vector>
@@ -80,6 +81,39 @@ TYPED_TEST(SoftmaxLayerTest, TestGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(SoftmaxLayerTest, TestForwardTiled) {
+  typedef typename TypeParam::Dtype Dtype;
+  // More spatial positions than one tile, with a partial last tile.
+  this->blob_bottom_->Reshape(2, 4, 23, 29);
+  FillerParameter filler_param;
+  filler_param.set_std(5);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  SoftmaxLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < this->blob_bottom_->num(); ++i) {
+    for (int k = 0; k < this->blob_bottom_->height(); ++k) {
+      for (int l = 0; l < this->blob_bottom_->width(); ++l) {
+        Dtype max_val = this->blob_bottom_->data_at(i, 0, k, l);
+        for (int j = 1; j < this->blob_bottom_->channels(); ++j) {
+          max_val = std::max(max_val, this->blob_bottom_->data_at(i, j, k, l));
+        }
+        Dtype scale = 0;
+        for (int j = 0; j < this->blob_bottom_->channels(); ++j) {
+          scale += exp(this->blob_bottom_->data_at(i, j, k, l) - max_val);
+        }
+        for (int j = 0; j < this->blob_bottom_->channels(); ++j) {
+          EXPECT_NEAR(this->blob_top_->data_at(i, j, k, l),
+              exp(this->blob_bottom_->data_at(i, j, k, l) - max_val) / scale,
+              1e-5);
+        }
+      }
+    }
+  }
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNSoftmaxLayerTest : public ::testing::Test {
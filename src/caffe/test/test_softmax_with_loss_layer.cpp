@@ -72,4 +72,85 @@ TYPED_TEST(SoftmaxWithLossLayerTest, TestGradientWeights) {
       this->blob_top_vec_, 0);
 }
 
+TYPED_TEST(SoftmaxWithLossLayerTest, TestGradientIgnoreLabel) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Labels 5 and 255 (outside the channels) are both ignored.
+  for (int i = 0; i < this->blob_bottom_label_->count(); i += 4) {
+    this->blob_bottom_label_->mutable_cpu_data()[i] = (i % 8) ? 5 : 255;
+  }
+  LayerParameter layer_param;
+  layer_param.mutable_softmaxloss_param()->add_ignore_label(5);
+  layer_param.mutable_softmaxloss_param()->add_ignore_label(255);
+  SoftmaxWithLossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(SoftmaxWithLossLayerTest, TestGradientNegativeIgnoreLabel) {
+  typedef typename TypeParam::Dtype Dtype;
+  for (int i = 0; i < this->blob_bottom_label_->count(); i += 3) {
+    this->blob_bottom_label_->mutable_cpu_data()[i] = -1;
+  }
+  LayerParameter layer_param;
+  layer_param.mutable_softmaxloss_param()->add_ignore_label(-1);
+  SoftmaxWithLossLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardKeepsDiff) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  SoftmaxWithLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_set(this->blob_bottom_data_->count(), Dtype(7),
+      this->blob_bottom_data_->mutable_cpu_diff());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < this->blob_bottom_data_->count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_data_->cpu_diff()[i], 7);
+  }
+}
+
+TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardTiled) {
+  typedef typename TypeParam::Dtype Dtype;
+  // More spatial positions than one tile, with a partial last tile.
+  this->blob_bottom_data_->Reshape(2, 3, 25, 23);
+  this->blob_bottom_label_->Reshape(2, 1, 25, 23);
+  FillerParameter filler_param;
+  filler_param.set_std(3);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_data_);
+  Dtype* label = this->blob_bottom_label_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_label_->count(); ++i) {
+    label[i] = (i % 7) ? caffe_rng_rand() % 3 : 255;
+  }
+  LayerParameter layer_param;
+  layer_param.mutable_softmaxloss_param()->add_ignore_label(255);
+  SoftmaxWithLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Dtype loss = 0;
+  int count = 0;
+  const Blob<Dtype>* data = this->blob_bottom_data_;
+  for (int n = 0; n < data->num(); ++n) {
+    for (int h = 0; h < data->height(); ++h) {
+      for (int w = 0; w < data->width(); ++w) {
+        const int gt_label = this->blob_bottom_label_->data_at(n, 0, h, w);
+        if (gt_label == 255) {
+          continue;
+        }
+        Dtype sum = 0;
+        for (int c = 0; c < data->channels(); ++c) {
+          sum += exp(data->data_at(n, c, h, w));
+        }
+        loss -= log(exp(data->data_at(n, gt_label, h, w)) / sum);
+        ++count;
+      }
+    }
+  }
+  EXPECT_NEAR(this->blob_top_loss_->cpu_data()[0], loss / count, 1e-4);
+}
+
 }  // namespace caffe
@@ -1,5 +1,9 @@
+#include <stdint.h>
+
 #include <algorithm>
+#include <fstream>
 #include <iomanip>
+#include <sstream>
 
 #include "caffe/common.hpp"
 #include "caffe/util/confusion_matrix.hpp"
@@ -8,136 +12,252 @@ std::string ConfusionMatrix::COL_SEP("\t");
 std::string ConfusionMatrix::ROW_BEGIN("\t");
 std::string ConfusionMatrix::ROW_END("");
 
-ConfusionMatrix::ConfusionMatrix() {}
+ConfusionMatrix::ConfusionMatrix() : _size(0), _shards(1),
+    _shardsDirty(false), _diagSum(0), _totalSum(0) {}
 
-ConfusionMatrix::ConfusionMatrix(const int m) {
-  _matrix.resize(m);
-  for(int i = 0; i < m; i++){
-    _matrix[i].resize(m, 0);
-  }
+ConfusionMatrix::ConfusionMatrix(const int m) : _size(0), _shards(1),
+    _shardsDirty(false), _diagSum(0), _totalSum(0) {
+  resize(m);
 }
 
 ConfusionMatrix::~ConfusionMatrix() {}
 
 int ConfusionMatrix::numRows() const { 
-  return (int) _matrix.size();
+  return _size;
 }
 
 int ConfusionMatrix::numCols() const {
-  if(_matrix.empty())
-    return 0;
-  return (int) _matrix[0].size();
+  return _size;
 }
 
 void ConfusionMatrix::resize(const int m) {
-  _matrix.resize(m);
-  for(int i = 0; i < m; i++){
-    _matrix[i].resize(m, 0);
+  CHECK_GE(m, 0);
+  mergeShards();
+  // keep the counts of the classes that remain
+  std::vector<unsigned long> matrix(m * m, 0);
+  const int n = std::min(m, _size);
+  for (int i = 0; i < n; i++) {
+    std::copy(&_matrix[i * _size], &_matrix[i * _size] + n, &matrix[i * m]);
   }
+  _matrix.swap(matrix);
+  _size = m;
+  for (size_t t = 0; t < _shards.size(); t++) {
+    _shards[t].assign(m * m, 0);
+  }
+  updateSums();
 }
 
 void ConfusionMatrix::clear() {
-  for(size_t i = 0; i < _matrix.size(); ++i){
-    std::fill(_matrix[i].begin(), _matrix[i].end(), 0);
+  std::fill(_matrix.begin(), _matrix.end(), 0);
+  for (size_t t = 0; t < _shards.size(); t++) {
+    std::fill(_shards[t].begin(), _shards[t].end(), 0);
+  }
+  _shardsDirty = false;
+  updateSums();
+}
+
+void ConfusionMatrix::resizeShards(const int n) {
+  CHECK_GE(n, 1);
+  mergeShards();
+  _shards.resize(n);
+  for (int t = 0; t < n; t++) {
+    _shards[t].assign(_size * _size, 0);
+  }
+}
+
+int ConfusionMatrix::numShards() const {
+  return (int) _shards.size();
+}
+
+unsigned long* ConfusionMatrix::shard(const int n) {
+  CHECK(n >= 0 && n < numShards()) << "no shard " << n;
+  _shardsDirty = true;
+  return _shards[n].empty() ? NULL : &_shards[n][0];
+}
+
+void ConfusionMatrix::mergeShards() {
+  if (!_shardsDirty) {
+    return;
+  }
+  for (size_t t = 0; t < _shards.size(); t++) {
+    std::vector<unsigned long>& shard = _shards[t];
+    for (size_t i = 0; i < shard.size(); i++) {
+      _matrix[i] += shard[i];
+    }
+    std::fill(shard.begin(), shard.end(), 0);
+  }
+  _shardsDirty = false;
+  updateSums();
+}
+
+void ConfusionMatrix::checkMerged() const {
+  CHECK(!_shardsDirty) << "mergeShards() must be called after counting "
+      "into the shards";
+}
+
+void ConfusionMatrix::updateSums() {
+  _rowSums.assign(_size, 0.0);
+  _colSums.assign(_size, 0.0);
+  _diagSum = 0.0;
+  _totalSum = 0.0;
+  for (int i = 0; i < _size; i++) {
+    const unsigned long* row = &_matrix[i * _size];
+    double v = 0.0;
+    for (int j = 0; j < _size; j++) {
+      v += (double)row[j];
+      _colSums[j] += (double)row[j];
+    }
+    _rowSums[i] = v;
+    _totalSum += v;
+    _diagSum += (double)row[i];
   }
 }
 
 void ConfusionMatrix::accumulate(const int actual, const int predicted) {
   CHECK_GE(actual, 0) << "gt label should not be less than zero.";
   CHECK_GE(predicted, 0) << "prediction label should not be less than zero.";
-  _matrix[actual][predicted] += 1;
+  _matrix[actual * _size + predicted] += 1;
+  _rowSums[actual] += 1.0;
+  _colSums[predicted] += 1.0;
+  _totalSum += 1.0;
+  if (actual == predicted) {
+    _diagSum += 1.0;
+  }
 }
 
 void ConfusionMatrix::accumulate(const ConfusionMatrix& confusion) {
-  CHECK(confusion._matrix.size() == _matrix.size());
-  
-  if(_matrix.empty()) return;
+  CHECK_EQ(confusion._size, _size);
+  confusion.checkMerged();
+  mergeShards();
+  for (size_t i = 0; i < _matrix.size(); ++i) {
+    _matrix[i] += confusion._matrix[i];
+  }
+  updateSums();
+}
 
-  CHECK(confusion._matrix[0].size() == _matrix[0].size());
+// Layout: int32 m, then the m * m counts as uint64 in row-major order.
+void ConfusionMatrix::write(std::ostream& os) const {
+  checkMerged();
+  const int32_t size = _size;
+  os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  std::vector<uint64_t> counts(_matrix.begin(), _matrix.end());
+  if (!counts.empty()) {
+    os.write(reinterpret_cast<const char*>(&counts[0]),
+        counts.size() * sizeof(uint64_t));
+  }
+  CHECK(os.good()) << "Failed to write the confusion matrix";
+}
 
-  for(size_t row = 0; row < _matrix.size(); ++row){
-    for(size_t col = 0; col < _matrix[row].size(); ++col){
-      _matrix[row][col] += confusion._matrix[row][col];
-    }
+void ConfusionMatrix::read(std::istream& is) {
+  int32_t size = 0;
+  is.read(reinterpret_cast<char*>(&size), sizeof(size));
+  CHECK(is.good() && size >= 0) << "Failed to read the confusion matrix";
+  std::vector<uint64_t> counts(size * size);
+  if (!counts.empty()) {
+    is.read(reinterpret_cast<char*>(&counts[0]),
+        counts.size() * sizeof(uint64_t));
   }
+  CHECK(is.good()) << "Truncated confusion matrix";
+  resize(size);
+  std::copy(counts.begin(), counts.end(), _matrix.begin());
+  updateSums();
+}
+
+void ConfusionMatrix::save(const std::string& filename) const {
+  std::ofstream os(filename.c_str(), std::ios::out | std::ios::binary);
+  CHECK(os.is_open()) << "Cannot open " << filename;
+  write(os);
+}
 
+void ConfusionMatrix::load(const std::string& filename) {
+  std::ifstream is(filename.c_str(), std::ios::in | std::ios::binary);
+  CHECK(is.is_open()) << "Cannot open " << filename;
+  read(is);
 }
 
+// Each row is logged as a single line.
 void ConfusionMatrix::printCounts(const char *header) const {
+  checkMerged();
   if (header == NULL) {
     LOG(INFO) << "--- confusion matrix: (actual, predicted) ---";
   } else {
     LOG(INFO) << header;
   }
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    LOG(INFO) << ROW_BEGIN;
-    for (size_t j = 0; j < _matrix[i].size(); j++) {
+  for (int i = 0; i < _size; i++) {
+    std::ostringstream row;
+    row << ROW_BEGIN;
+    for (int j = 0; j < _size; j++) {
       if (j > 0) {
-	LOG(INFO) << COL_SEP;
+	row << COL_SEP;
       }
-      LOG(INFO) << _matrix[i][j];
+      row << _matrix[i * _size + j];
     }
-    LOG(INFO) << ROW_END;
+    row << ROW_END;
+    LOG(INFO) << row.str();
   }
 }
 
 void ConfusionMatrix::printRowNormalized(const char *header) const {
+  checkMerged();
   if (header == NULL) {
     LOG(INFO) << "--- confusion matrix: (actual, predicted) ---";
   } else {
     LOG(INFO) << header;
   }
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    double total = rowSum(i);
-    LOG(INFO) << ROW_BEGIN;
-    for (size_t j = 0; j < _matrix[i].size(); j++) {
+  for (int i = 0; i < _size; i++) {
+    const double total = _rowSums[i];
+    std::ostringstream row;
+    row << ROW_BEGIN;
+    for (int j = 0; j < _size; j++) {
       if (j > 0) {
-	LOG(INFO) << COL_SEP;
+	row << COL_SEP;
       }
-      LOG(INFO) << ((double)_matrix[i][j] / total);
+      row << ((double)_matrix[i * _size + j] / total);
     }
-    LOG(INFO) << ROW_END;
+    row << ROW_END;
+    LOG(INFO) << row.str();
   }
 }
 
 void ConfusionMatrix::printColNormalized(const char *header) const {
-  std::vector<double> totals;
-  for (size_t i = 0; i < _matrix[0].size(); i++) {
-    totals.push_back(colSum(i));
-  }
-
+  checkMerged();
   if (header == NULL) {
     LOG(INFO) << "--- confusion matrix: (actual, predicted) ---";
   } else {
     LOG(INFO) << header;
   }
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    LOG(INFO) << ROW_BEGIN;
-    for (size_t j = 0; j < _matrix[i].size(); j++) {
+  for (int i = 0; i < _size; i++) {
+    std::ostringstream row;
+    row << ROW_BEGIN;
+    for (int j = 0; j < _size; j++) {
       if (j > 0) {
-	LOG(INFO) << COL_SEP;
+	row << COL_SEP;
       }
-      LOG(INFO) << ((double)_matrix[i][j] / totals[j]);
+      row << ((double)_matrix[i * _size + j] / _colSums[j]);
     }
-    LOG(INFO) << ROW_END;
+    row << ROW_END;
+    LOG(INFO) << row.str();
   }
 }
 
 void ConfusionMatrix::printNormalized(const char *header) const {
-  double total = totalSum();
+  checkMerged();
+  const double total = _totalSum;
   
   if (header == NULL) {
     LOG(INFO) << "--- confusion matrix: (actual, predicted) ---";
   } else {
     LOG(INFO) << header;
   }
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    LOG(INFO) << ROW_BEGIN;
-    for (size_t j = 0; j < _matrix[i].size(); j++) {
-      if (j > 0) LOG(INFO) << COL_SEP;
-      LOG(INFO) << ((double)_matrix[i][j] / total);
+  for (int i = 0; i < _size; i++) {
+    std::ostringstream row;
+    row << ROW_BEGIN;
+    for (int j = 0; j < _size; j++) {
+      if (j > 0) row << COL_SEP;
+      row << ((double)_matrix[i * _size + j] / total);
     }
-    LOG(INFO) << ROW_END;
+    row << ROW_END;
+    LOG(INFO) << row.str();
   }
 }
 
@@ -149,28 +269,28 @@ void ConfusionMatrix::printPrecisionRecall(const char *header) const {
   }
 
   // recall
-  LOG(INFO) << ROW_BEGIN;
-  for (size_t i = 0; i < _matrix.size(); i++) {
+  std::ostringstream r;
+  r << ROW_BEGIN;
+  for (int i = 0; i < _size; i++) {
     if (i > 0) {
-      LOG(INFO) << COL_SEP;
+      r << COL_SEP;
     }
-    double r = (_matrix[i].size() > i) ? 
-        (double)_matrix[i][i] / (double)rowSum(i) : 0.0;
-    LOG(INFO) <<  r;
+    r << recall(i);
   }
-  LOG(INFO) << ROW_END;
+  r << ROW_END;
+  LOG(INFO) << r.str();
 
   // precision
-  LOG(INFO) << ROW_BEGIN;
-  for (size_t i = 0; i < _matrix.size(); i++) {
+  std::ostringstream p;
+  p << ROW_BEGIN;
+  for (int i = 0; i < _size; i++) {
     if (i > 0) {
-      LOG(INFO) << COL_SEP;
+      p << COL_SEP;
     }
-    double p = (_matrix[i].size() > i) ? 
-         (double)_matrix[i][i] / (double)colSum(i) : 1.0;
-    LOG(INFO) << p;
+    p << precision(i);
   }
-  LOG(INFO) << ROW_END;
+  p << ROW_END;
+  LOG(INFO) << p.str();
 }
 
 void ConfusionMatrix::printF1Score(const char *header) const {
@@ -180,113 +300,96 @@ void ConfusionMatrix::printF1Score(const char *header) const {
     LOG(INFO) << header;
   }
 
-  LOG(INFO) << ROW_BEGIN;
-  for (size_t i = 0; i < _matrix.size(); i++) {
+  std::ostringstream row;
+  row << ROW_BEGIN;
+  for (int i = 0; i < _size; i++) {
     if (i > 0) {
-      LOG(INFO) << COL_SEP;
+      row << COL_SEP;
     }
-    // recall
-    double r = (_matrix[i].size() > i) ? 
-        (double)_matrix[i][i] / (double)rowSum(i) : 0.0;
-    // precision
-    double p = (_matrix[i].size() > i) ? 
-        (double)_matrix[i][i] / (double)colSum(i) : 1.0;
-    LOG(INFO) << ((2.0 * p * r) / (p + r));
+    const double r = recall(i);
+    const double p = precision(i);
+    row << ((2.0 * p * r) / (p + r));
   }
-  LOG(INFO) << ROW_END;
+  row << ROW_END;
+  LOG(INFO) << row.str();
 }
 
 
 void ConfusionMatrix::printJaccard(const char *header) const {
+  checkMerged();
   if (header == NULL) {
     LOG(INFO) << "--- class-specific Jaccard coefficient ---";
   } else {
     LOG(INFO) << header;
   }
 
-  LOG(INFO) << ROW_BEGIN;
-  for (size_t i = 0; i < _matrix.size(); i++) {
+  std::ostringstream row;
+  row << ROW_BEGIN;
+  for (int i = 0; i < _size; i++) {
     if (i > 0) {
-      LOG(INFO) << COL_SEP;
+      row << COL_SEP;
     }
-    double p = (_matrix[i].size() > i) ? (double)_matrix[i][i] /
-         (double)(rowSum(i) + colSum(i) - _matrix[i][i]) : 0.0;
-    LOG(INFO) << p;
+    const double d = (double)_matrix[i * (_size + 1)];
+    row << (d / (_rowSums[i] + _colSums[i] - d));
   }
-  LOG(INFO) << ROW_END;
+  row << ROW_END;
+  LOG(INFO) << row.str();
 }
 
 double ConfusionMatrix::rowSum(int n) const {
-  double v = 0.0;
-  for (size_t i = 0; i < _matrix[n].size(); i++) {
-    v += (double)_matrix[n][i];
-  }
-  return v;
+  checkMerged();
+  return _rowSums[n];
 }
 
 double ConfusionMatrix::colSum(int m) const {
-  double v = 0;
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    v += (double)_matrix[i][m];
-  }
-  return v;
+  checkMerged();
+  return _colSums[m];
 }
 
 double ConfusionMatrix::diagSum() const {
-  double v = 0;
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    if (i >= _matrix[i].size())
-      break;
-    v += (double)_matrix[i][i];
-  }
-  return v;
+  checkMerged();
+  return _diagSum;
 }
 
 double ConfusionMatrix::totalSum() const {
-  double v = 0;
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    for (size_t j = 0; j < _matrix[i].size(); j++) {
-      v += (double)_matrix[i][j];
-    }
-  }
-  return v;
+  checkMerged();
+  return _totalSum;
 }
 
 double ConfusionMatrix::accuracy() const {
-  double total_sum = totalSum();
-  double diag_sum  = diagSum();
-
-  if (total_sum == 0) {
+  checkMerged();
+  if (_totalSum == 0) {
     return 0;
   } else {
-    return diag_sum / total_sum;
+    return _diagSum / _totalSum;
   }
 }
 
 double ConfusionMatrix::avgPrecision() const {
+  checkMerged();
   double totalPrecision = 0.0;
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    totalPrecision += (_matrix[i].size() > i) ?
-      (double)_matrix[i][i] / (double)colSum(i) : 1.0;
+  for (int i = 0; i < _size; i++) {
+    totalPrecision += (double)_matrix[i * (_size + 1)] / _colSums[i];
   }
 
-  return totalPrecision /= (double)_matrix.size();
+  return totalPrecision /= (double)_size;
 }
 
+// The per-class terms below only read the diagonal and the cached sums, in
+// loops without early exits that the compiler can vectorize.
 double ConfusionMatrix::avgRecall(const bool strict) const {
+  checkMerged();
   double totalRecall = 0.0;
   int numClasses = 0;
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    if (_matrix[i].size() > i) {
-      const double classSize = (double)rowSum(i);
-      if (classSize > 0.0) {
-	totalRecall += (double)_matrix[i][i] / classSize;
-	numClasses += 1;
-      }
-    }
+  for (int i = 0; i < _size; i++) {
+    const double classSize = _rowSums[i];
+    const bool present = classSize > 0.0;
+    totalRecall += present ?
+      (double)_matrix[i * (_size + 1)] / classSize : 0.0;
+    numClasses += present;
   }
   
-  if (strict && numClasses != (int)_matrix.size()) {
+  if (strict && numClasses != _size) {
     LOG(FATAL) << "not all classes represented in avgRecall()";
   }
 
@@ -298,46 +401,41 @@ double ConfusionMatrix::avgRecall(const bool strict) const {
 }
 
 double ConfusionMatrix::avgJaccard() const {
+  checkMerged();
   double totalJaccard = 0.0;
-  for (size_t i = 0; i < _matrix.size(); i++) {
-    if (_matrix[i].size() <= i) continue;
-    const double intersectionSize = (double)_matrix[i][i];
-    const double unionSize = (double)(rowSum(i) + colSum(i) - _matrix[i][i]);
-    if (intersectionSize == unionSize) {
-      // avoid divide by zero
-      totalJaccard += 1.0;
-    } else {
-      totalJaccard += intersectionSize / unionSize;
-    }
+  for (int i = 0; i < _size; i++) {
+    const double intersectionSize = (double)_matrix[i * (_size + 1)];
+    const double unionSize = _rowSums[i] + _colSums[i] - intersectionSize;
+    // avoid divide by zero
+    totalJaccard += (intersectionSize == unionSize) ? 1.0 :
+      intersectionSize / unionSize;
   }
   
-  return totalJaccard / (double)_matrix.size();
+  return totalJaccard / (double)_size;
 }
 
 double ConfusionMatrix::precision(int n) const {
-  CHECK(_matrix.size() > (size_t)n);
-  return (_matrix[n].size() > (size_t)n) ?
-    (double)_matrix[n][n] / (double)colSum(n) : 1.0;
+  CHECK(_size > n);
+  checkMerged();
+  return (double)_matrix[n * (_size + 1)] / _colSums[n];
 }
 
 double ConfusionMatrix::recall(int n) const {
-  CHECK(_matrix.size() > (size_t)n);
-  return (_matrix[n].size() > (size_t)n) ?
-    (double)_matrix[n][n] / (double)rowSum(n) : 0.0;
+  CHECK(_size > n);
+  checkMerged();
+  return (double)_matrix[n * (_size + 1)] / _rowSums[n];
 }
 
 double ConfusionMatrix::jaccard(int n) const {
-  CHECK((_matrix.size() > (size_t)n) && (_matrix[n].size() > (size_t)n));
-  const double intersectionSize = (double)_matrix[n][n];
-  const double unionSize = (double)(rowSum(n) + colSum(n) - _matrix[n][n]);
+  CHECK(_size > n);
+  checkMerged();
+  const double intersectionSize = (double)_matrix[n * (_size + 1)];
+  const double unionSize = _rowSums[n] + _colSums[n] - intersectionSize;
   return (intersectionSize == unionSize) ? 1.0 :
     intersectionSize / unionSize;
 }
 
 const unsigned long& ConfusionMatrix::operator()(int i, int j) const {
-  return _matrix[i][j];
-}
-
-unsigned long& ConfusionMatrix::operator()(int i, int j) {
-  return _matrix[i][j];
+  checkMerged();
+  return _matrix[i * _size + j];
 }
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -50,32 +52,172 @@ template void im2col_cpu<double>(const double* data_im,
     const int stride_h, const int stride_w, const int hole_h, const int hole_w,
     double* data_col);
 
+void im2col_index(const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int hole_h, const int hole_w,
+    int* index) {
+  const int kernel_h_eff = kernel_h + (kernel_h - 1) * (hole_h - 1);
+  const int kernel_w_eff = kernel_w + (kernel_w - 1) * (hole_w - 1);
+  int height_col = (height + 2 * pad_h - kernel_h_eff) / stride_h + 1;
+  int width_col = (width + 2 * pad_w - kernel_w_eff) / stride_w + 1;
+  int channels_col = channels * kernel_h * kernel_w;
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = (c % kernel_w)  * hole_w;
+    int h_offset = ((c / kernel_w) % kernel_h) * hole_h;
+    int c_im = c / kernel_w / kernel_h;
+    for (int h = 0; h < height_col; ++h) {
+      const int h_im = h * stride_h + h_offset - pad_h;
+      for (int w = 0; w < width_col; ++w) {
+        const int w_im = w * stride_w + w_offset - pad_w;
+        *index++ = (h_im >= 0 && h_im < height && w_im >= 0 && w_im < width) ?
+            (c_im * height + h_im) * width + w_im : -1;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void im2col_gather_cpu(const Dtype* data_im, const int* index,
+    const int size, Dtype* data_col) {
+  for (int i = 0; i < size; ++i) {
+    const int idx = index[i];
+    data_col[i] = (idx >= 0) ? data_im[idx] : Dtype(0);
+  }
+}
+
+// Explicit instantiation
+template void im2col_gather_cpu<float>(const float* data_im,
+    const int* index, const int size, float* data_col);
+template void im2col_gather_cpu<double>(const double* data_im,
+    const int* index, const int size, double* data_col);
+
+template <typename Dtype>
+void im2col_channels_last_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int hole_h, const int hole_w, Dtype* data_col) {
+  const int kernel_h_eff = kernel_h + (kernel_h - 1) * (hole_h - 1);
+  const int kernel_w_eff = kernel_w + (kernel_w - 1) * (hole_w - 1);
+  const int height_col = (height + 2 * pad_h - kernel_h_eff) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - kernel_w_eff) / stride_w + 1;
+  const int row_size = kernel_h * kernel_w * channels;
+#ifdef WITH_OPENMP
+  #pragma omp parallel for
+#endif
+  for (int h = 0; h < height_col; ++h) {
+    Dtype* col = data_col + h * width_col * row_size;
+    for (int w = 0; w < width_col; ++w) {
+      for (int kh = 0; kh < kernel_h; ++kh) {
+        const int h_im = h * stride_h - pad_h + kh * hole_h;
+        for (int kw = 0; kw < kernel_w; ++kw) {
+          const int w_im = w * stride_w - pad_w + kw * hole_w;
+          if (h_im >= 0 && h_im < height && w_im >= 0 && w_im < width) {
+            const Dtype* im = data_im + (h_im * width + w_im) * channels;
+            std::copy(im, im + channels, col);
+          } else {
+            std::fill(col, col + channels, Dtype(0));
+          }
+          col += channels;
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void im2col_channels_last_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int hole_h, const int hole_w, float* data_col);
+template void im2col_channels_last_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int hole_h, const int hole_w, double* data_col);
+
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col,
     const int num, const int channels, const int height, const int width,
     const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
     const int stride_h, const int stride_w, const int hole_h, const int hole_w,
     Dtype* data_im) {
-  caffe_set(num * channels * height * width, Dtype(0), data_im);
   const int kernel_h_eff = kernel_h + (kernel_h - 1) * (hole_h - 1);
   const int kernel_w_eff = kernel_w + (kernel_w - 1) * (hole_w - 1);
   int height_col = (height + 2 * pad_h - kernel_h_eff) / stride_h + 1;
   int width_col = (width + 2 * pad_w - kernel_w_eff) / stride_w + 1;
   int channels_col = channels * kernel_h * kernel_w;
+  // A pixel gets the taps of the kernel rows covering its row and of the
+  // kernel columns covering its column, so the first tap to reach it is the
+  // first such row and column. That tap writes the pixel and the others add
+  // to it, and only the pixels no tap reaches are cleared, instead of
+  // clearing the whole image first. The taps are added row by row, with the
+  // columns in the image found up front so that the inner loop has no
+  // bounds checks.
+  vector<int> first_i(height, -1);
+  for (int i = kernel_h - 1; i >= 0; --i) {
+    for (int h = 0; h < height_col; ++h) {
+      const int h_im = h * stride_h + i * hole_h - pad_h;
+      if (h_im >= 0 && h_im < height) {
+        first_i[h_im] = i;
+      }
+    }
+  }
+  vector<int> first_j(width, -1);
+  for (int j = kernel_w - 1; j >= 0; --j) {
+    for (int w = 0; w < width_col; ++w) {
+      const int w_im = w * stride_w + j * hole_w - pad_w;
+      if (w_im >= 0 && w_im < width) {
+        first_j[w_im] = j;
+      }
+    }
+  }
   for (int n = 0; n < num; ++n) {
-    for (int c = 0; c < channels_col; ++c) {
-      int w_offset = (c % kernel_w)  * hole_w;
-      int h_offset = ((c / kernel_w) % kernel_h) * hole_h;
-      int c_im = c / kernel_w / kernel_h;
-      for (int h = 0; h < height_col; ++h) {
-	const int h_im = h * stride_h + h_offset - pad_h;
-	for (int w = 0; w < width_col; ++w) {
-	  const int w_im = w * stride_w + w_offset - pad_w;
-	  if (h_im >= 0 && h_im < height && w_im >= 0 && w_im < width) {
-	    data_im[((n * channels + c_im) * height + h_im) * width + w_im] += 
-	      data_col[((n * channels_col + c) * height_col + h) * width_col + w];
-	  }
-	}
+    for (int c_im = 0; c_im < channels; ++c_im) {
+      Dtype* im = data_im + (n * channels + c_im) * height * width;
+      for (int h_im = 0; h_im < height; ++h_im) {
+        Dtype* im_row = im + h_im * width;
+        if (first_i[h_im] < 0) {
+          caffe_set(width, Dtype(0), im_row);
+          continue;
+        }
+        for (int w_im = 0; w_im < width; ++w_im) {
+          if (first_j[w_im] < 0) {
+            im_row[w_im] = Dtype(0);
+          }
+        }
+      }
+      for (int i = 0; i < kernel_h; ++i) {
+        const int h_offset = i * hole_h - pad_h;
+        for (int j = 0; j < kernel_w; ++j) {
+          const int w_offset = j * hole_w - pad_w;
+          const int c = (c_im * kernel_h + i) * kernel_w + j;
+          const Dtype* col = data_col +
+              (n * channels_col + c) * height_col * width_col;
+          // The columns w with 0 <= w * stride_w + w_offset < width.
+          const int w_begin = w_offset >= 0 ? 0 :
+              (stride_w - 1 - w_offset) / stride_w;
+          const int w_end = width - w_offset <= 0 ? 0 :
+              std::min(width_col, (width - w_offset + stride_w - 1) / stride_w);
+          const int* first_col = &first_j[0] + w_offset;
+          for (int h = 0; h < height_col; ++h) {
+            const int h_im = h * stride_h + h_offset;
+            if (h_im < 0 || h_im >= height) {
+              continue;
+            }
+            Dtype* im_row = im + h_im * width + w_offset;
+            const Dtype* col_row = col + h * width_col;
+            if (first_i[h_im] != i) {
+              for (int w = w_begin; w < w_end; ++w) {
+                im_row[w * stride_w] += col_row[w];
+              }
+            } else {
+              for (int w = w_begin; w < w_end; ++w) {
+                const int w_im = w * stride_w;
+                im_row[w_im] = first_col[w_im] == j ?
+                    col_row[w] : im_row[w_im] + col_row[w];
+              }
+            }
+          }
+        }
       }
     }
   }
@@ -93,4 +235,73 @@ template void col2im_cpu<double>(const double* data_col,
     const int stride_h, const int stride_w, const int hole_h, const int hole_w,
     double* data_im);
 
+template <typename Dtype>
+void space_to_batch_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int hole_h, const int hole_w, const int height_sub,
+    const int width_sub, Dtype* data_sub) {
+  for (int ph = 0; ph < hole_h; ++ph) {
+    for (int pw = 0; pw < hole_w; ++pw) {
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* im = data_im + c * height * width;
+        for (int i = 0; i < height_sub; ++i) {
+          const int h_im = ph + i * hole_h - pad_h;
+          if (h_im < 0 || h_im >= height) {
+            caffe_set(width_sub, Dtype(0), data_sub);
+            data_sub += width_sub;
+            continue;
+          }
+          for (int j = 0; j < width_sub; ++j) {
+            const int w_im = pw + j * hole_w - pad_w;
+            *data_sub++ = (w_im >= 0 && w_im < width) ?
+                im[h_im * width + w_im] : Dtype(0);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void space_to_batch_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const int hole_h, const int hole_w, const int height_sub,
+    const int width_sub, float* data_sub);
+template void space_to_batch_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const int hole_h, const int hole_w, const int height_sub,
+    const int width_sub, double* data_sub);
+
+template <typename Dtype>
+void batch_to_space_cpu(const Dtype* data_sub, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int hole_h, const int hole_w, const int height_sub,
+    const int width_sub, Dtype* data_im) {
+  const int sub_dim = channels * height_sub * width_sub;
+  for (int c = 0; c < channels; ++c) {
+    for (int h = 0; h < height; ++h) {
+      const int h_pad = h + pad_h;
+      const int ph = h_pad % hole_h;
+      const int i = h_pad / hole_h;
+      CHECK_LT(i, height_sub);
+      for (int w = 0; w < width; ++w) {
+        const int w_pad = w + pad_w;
+        const int pw = w_pad % hole_w;
+        *data_im++ = data_sub[(ph * hole_w + pw) * sub_dim +
+            (c * height_sub + i) * width_sub + w_pad / hole_w];
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void batch_to_space_cpu<float>(const float* data_sub,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const int hole_h, const int hole_w, const int height_sub,
+    const int width_sub, float* data_im);
+template void batch_to_space_cpu<double>(const double* data_sub,
+    const int channels, const int height, const int width, const int pad_h,
+    const int pad_w, const int hole_h, const int hole_w, const int height_sub,
+    const int width_sub, double* data_im);
+
 }  // namespace caffe
@@ -0,0 +1,129 @@
+#ifndef OSX
+#include <boost/thread.hpp>
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "caffe/util/image_cache.hpp"
+#include "caffe/util/io.hpp"
+
+namespace caffe {
+
+class ImageCache::Sync {
+ public:
+  mutable boost::mutex mutex_;
+};
+
+static size_t CVMatBytes(const cv::Mat& cv_img) {
+  return cv_img.rows * cv_img.cols * cv_img.elemSize();
+}
+
+ImageCache::ImageCache(const size_t budget_bytes)
+    : budget_bytes_(budget_bytes), size_bytes_(0), hits_(0), misses_(0),
+      sync_(new Sync()) {
+}
+
+ImageCache::~ImageCache() {
+  delete sync_;
+}
+
+ImageCache& ImageCache::Global() {
+  static ImageCache cache;
+  return cache;
+}
+
+void ImageCache::Reserve(const size_t budget_bytes) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  budget_bytes_ = std::max(budget_bytes_, budget_bytes);
+}
+
+bool ImageCache::Lookup(const string& key, cv::Mat* cv_img) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  std::map<string, EntryList::iterator>::iterator it = index_.find(key);
+  if (it == index_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  *cv_img = it->second->second;
+  return true;
+}
+
+void ImageCache::Insert(const string& key, const cv::Mat& cv_img) {
+  const size_t bytes = CVMatBytes(cv_img);
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  if (bytes > budget_bytes_ || index_.count(key)) {
+    return;
+  }
+  EvictTo(budget_bytes_ - bytes);
+  entries_.push_front(std::make_pair(key, cv_img));
+  index_[key] = entries_.begin();
+  size_bytes_ += bytes;
+}
+
+void ImageCache::Clear() {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  EvictTo(0);
+  hits_ = 0;
+  misses_ = 0;
+}
+
+void ImageCache::EvictTo(const size_t budget_bytes) {
+  while (size_bytes_ > budget_bytes) {
+    size_bytes_ -= CVMatBytes(entries_.back().second);
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+size_t ImageCache::budget_bytes() const {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return budget_bytes_;
+}
+
+size_t ImageCache::size_bytes() const {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return size_bytes_;
+}
+
+size_t ImageCache::hits() const {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return hits_;
+}
+
+size_t ImageCache::misses() const {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return misses_;
+}
+
+cv::Mat ReadImageToCVMatCached(ImageCache* cache, const string& filename,
+    const int height, const int width, const bool is_color,
+    int* img_height, int* img_width) {
+  if (cache == NULL) {
+    return ReadImageToCVMat(filename, height, width, is_color, img_height,
+        img_width);
+  }
+  std::ostringstream key;
+  key << filename << ':' << height << 'x' << width << ':' << is_color;
+  cv::Mat cv_img;
+  if (!cache->Lookup(key.str(), &cv_img)) {
+    cv_img = ReadImageToCVMat(filename, height, width, is_color);
+    if (cv_img.data) {
+      cache->Insert(key.str(), cv_img);
+    }
+  }
+  if (cv_img.data && img_height != NULL) {
+    *img_height = cv_img.rows;
+  }
+  if (cv_img.data && img_width != NULL) {
+    *img_width = cv_img.cols;
+  }
+  return cv_img;
+}
+
+}  // namespace caffe
+#endif  // OSX
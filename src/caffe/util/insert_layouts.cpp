@@ -0,0 +1,219 @@
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/insert_layouts.hpp"
+
+namespace caffe {
+
+// Renames every occurrence of a blob as a bottom or top.
+static void RenameBlob(const string& from, const string& to,
+    NetParameter* param) {
+  for (int i = 0; i < param->layers_size(); ++i) {
+    LayerParameter* layer_param = param->mutable_layers(i);
+    for (int j = 0; j < layer_param->bottom_size(); ++j) {
+      if (layer_param->bottom(j) == from) {
+        layer_param->set_bottom(j, to);
+      }
+    }
+    for (int j = 0; j < layer_param->top_size(); ++j) {
+      if (layer_param->top(j) == from) {
+        layer_param->set_top(j, to);
+      }
+    }
+  }
+}
+
+// A name based on base that is not in used_names, which it is added to.
+static string UniqueBlobName(const string& base, set<string>* used_names) {
+  string name = base;
+  for (int k = 1; used_names->count(name); ++k) {
+    ostringstream unique_name;
+    unique_name << base << "_" << k;
+    name = unique_name.str();
+  }
+  used_names->insert(name);
+  return name;
+}
+
+void InsertLayouts(const NetParameter& param, NetParameter* param_layout) {
+  // Initialize by copying from the input NetParameter.
+  param_layout->CopyFrom(param);
+  param_layout->clear_layers();
+  // Reserve all the names of the original net, so that the blobs added here
+  // never clash with a later top.
+  set<string> used_names;
+  for (int i = 0; i < param.input_size(); ++i) {
+    used_names.insert(param.input(i));
+  }
+  for (int i = 0; i < param.layers_size(); ++i) {
+    for (int j = 0; j < param.layers(i).top_size(); ++j) {
+      used_names.insert(param.layers(i).top(j));
+    }
+  }
+  // The blob currently holding each original blob name, the layout of every
+  // blob, and the up-to-date copy of a blob in the other layout, if any.
+  map<string, string> current_name;
+  map<string, bool> channels_last;
+  map<string, string> converted;
+  for (int i = 0; i < param.input_size(); ++i) {
+    current_name[param.input(i)] = param.input(i);
+    channels_last[param.input(i)] = false;
+  }
+  for (int i = 0; i < param.layers_size(); ++i) {
+    const LayerParameter& layer_param = param.layers(i);
+    const int num_channels_last = ChannelsLastBottoms(layer_param);
+    const bool keeps_layout = LayerKeepsLayout(layer_param);
+    bool top_channels_last = num_channels_last > 0;
+    LayerParameter new_layer_param(layer_param);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      if (current_name.find(layer_param.bottom(j)) == current_name.end()) {
+        LOG(FATAL) << "Unknown blob input " << layer_param.bottom(j)
+            << " to layer " << j;
+      }
+      const string blob_name = current_name[layer_param.bottom(j)];
+      const bool blob_channels_last = channels_last[blob_name];
+      if (keeps_layout) {
+        top_channels_last = blob_channels_last;
+      }
+      const bool want_channels_last =
+          keeps_layout ? blob_channels_last : j < num_channels_last;
+      if (blob_channels_last == want_channels_last) {
+        new_layer_param.set_bottom(j, blob_name);
+        continue;
+      }
+      if (converted.find(blob_name) == converted.end()) {
+        const string layout_name = UniqueBlobName(
+            LayoutBlobName(blob_name, want_channels_last), &used_names);
+        ConfigureLayoutLayer(blob_name, layout_name, want_channels_last,
+            param_layout->add_layers());
+        channels_last[layout_name] = want_channels_last;
+        converted[blob_name] = layout_name;
+        converted[layout_name] = blob_name;
+      }
+      new_layer_param.set_bottom(j, converted[blob_name]);
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      const string& top_name = layer_param.top(j);
+      string blob_name = top_name;
+      if (j < layer_param.bottom_size() && layer_param.bottom(j) == top_name) {
+        // In-place: follow the bottom, which may have been converted, and
+        // drop the copies made of the data being overwritten.
+        blob_name = new_layer_param.bottom(j);
+        if (converted.find(blob_name) != converted.end()) {
+          converted.erase(converted[blob_name]);
+          converted.erase(blob_name);
+        }
+      }
+      new_layer_param.set_top(j, blob_name);
+      current_name[top_name] = blob_name;
+      channels_last[blob_name] = top_channels_last;
+    }
+    param_layout->add_layers()->CopyFrom(new_layer_param);
+  }
+  // The net outputs are the blobs left unconsumed, as in Net::Init. Convert
+  // the channel-last ones back, under their original names, so that the
+  // callers reading them by name get NCHW data.
+  set<string> outputs;
+  for (int i = 0; i < param.input_size(); ++i) {
+    outputs.insert(param.input(i));
+  }
+  for (int i = 0; i < param.layers_size(); ++i) {
+    for (int j = 0; j < param.layers(i).bottom_size(); ++j) {
+      outputs.erase(param.layers(i).bottom(j));
+    }
+    for (int j = 0; j < param.layers(i).top_size(); ++j) {
+      outputs.insert(param.layers(i).top(j));
+    }
+  }
+  set<string> inputs(param.input().begin(), param.input().end());
+  for (set<string>::const_iterator it = outputs.begin(); it != outputs.end();
+       ++it) {
+    const string& output_name = *it;
+    string blob_name = current_name[output_name];
+    if (!channels_last[blob_name]) {
+      continue;
+    }
+    // Free the original name for the NCHW output: rename the channel-last
+    // blob holding it, or the stale blob it was converted from in place.
+    if (inputs.count(output_name)) {
+      LOG(WARNING) << "Net output " << output_name << " is an input "
+          "overwritten in place; it stays channel-last as " << blob_name;
+      continue;
+    }
+    const string new_name = UniqueBlobName(
+        LayoutBlobName(output_name, blob_name == output_name), &used_names);
+    RenameBlob(output_name, new_name, param_layout);
+    if (blob_name == output_name) {
+      blob_name = new_name;
+    }
+    LayerParameter* layout_layer_param = param_layout->add_layers();
+    ConfigureLayoutLayer(blob_name, output_name, false, layout_layer_param);
+    layout_layer_param->set_name(
+        UniqueBlobName(LayoutBlobName(output_name, false), &used_names));
+  }
+}
+
+int ChannelsLastBottoms(const LayerParameter& layer_param) {
+  switch (layer_param.type()) {
+  case LayerParameter_LayerType_CONVOLUTION: {
+    const ConvolutionParameter& conv_param = layer_param.convolution_param();
+    if (conv_param.group() != 1 ||
+        layer_param.quantization_param().precision() ==
+        QuantizationParameter_Precision_INT8) {
+      return 0;
+    }
+    return layer_param.bottom_size();
+  }
+  case LayerParameter_LayerType_POOLING: {
+    const PoolingParameter& pool_param = layer_param.pooling_param();
+    if (pool_param.pool() == PoolingParameter_PoolMethod_STOCHASTIC ||
+        layer_param.top_size() > 1) {
+      return 0;
+    }
+    return 1;
+  }
+  case LayerParameter_LayerType_ARGMAX:
+  case LayerParameter_LayerType_DENSE_CRF:
+  case LayerParameter_LayerType_INTERP:
+  case LayerParameter_LayerType_SOFTMAX:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+bool LayerKeepsLayout(const LayerParameter& layer_param) {
+  switch (layer_param.type()) {
+  case LayerParameter_LayerType_ABSVAL:
+  case LayerParameter_LayerType_BNLL:
+  case LayerParameter_LayerType_DROPOUT:
+  case LayerParameter_LayerType_POWER:
+  case LayerParameter_LayerType_RELU:
+  case LayerParameter_LayerType_SIGMOID:
+  case LayerParameter_LayerType_SILENCE:
+  case LayerParameter_LayerType_TANH:
+  case LayerParameter_LayerType_THRESHOLD:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void ConfigureLayoutLayer(const string& bottom_name, const string& top_name,
+    const bool channels_last, LayerParameter* layout_layer_param) {
+  layout_layer_param->Clear();
+  layout_layer_param->add_bottom(bottom_name);
+  layout_layer_param->add_top(top_name);
+  layout_layer_param->set_name(top_name);
+  layout_layer_param->set_type(LayerParameter_LayerType_LAYOUT);
+  layout_layer_param->mutable_layout_param()->set_channels_last(channels_last);
+}
+
+string LayoutBlobName(const string& blob_name, const bool channels_last) {
+  return blob_name + (channels_last ? "_nhwc" : "_nchw");
+}
+
+}  // namespace caffe
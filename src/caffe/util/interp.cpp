@@ -4,9 +4,32 @@
 #include "caffe/util/interp.hpp"
 #include <algorithm>
 #include <cmath>
+#include <vector>
 
 namespace caffe {
 
+// Taps of bi-linear interpolation from size1 to size2 along one axis:
+// output i reads input idx[i] with weight lambda0[i] and input
+// idx[i] + step[i] with weight lambda1[i].
+template <typename Dtype>
+static void interp2_taps(const int size1, const int size2,
+    std::vector<int>* idx, std::vector<int>* step,
+    std::vector<Dtype>* lambda0, std::vector<Dtype>* lambda1) {
+  const float r = (size2 > 1) ? static_cast<float>(size1 - 1) / (size2 - 1) : 0.f;
+  idx->resize(size2);
+  step->resize(size2);
+  lambda0->resize(size2);
+  lambda1->resize(size2);
+  for (int i = 0; i < size2; ++i) {
+    const float i1r = r * i;
+    const int i1 = i1r;
+    (*idx)[i] = i1;
+    (*step)[i] = (i1 < size1 - 1) ? 1 : 0;
+    (*lambda1)[i] = i1r - i1;
+    (*lambda0)[i] = Dtype(1.) - (*lambda1)[i];
+  }
+}
+
 // Bi-linear interpolation
 // IN : [channels height1 width1] cropped from a bigger [Height1 Width1] image
 // OUT: [channels height2 width2] cropped from a bigger [Height2 Width2] image
@@ -17,6 +40,17 @@ void caffe_cpu_interp2(const int channels,
   CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && x2 >= 0 && y2 >= 0 && height2 > 0 && width2 > 0);
   CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1 && Width2 >= width2 + x2 && Height2 >= height2 + y2);
   // special case: just copy
+  if (height1 == height2 && width1 == width2 && !packed) {
+    // row by row within every channel
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < height2; ++h) {
+	const Dtype* pos1 = &data1[(c * Height1 + y1 + h) * Width1 + x1];
+	std::copy(pos1, pos1 + width2,
+	    &data2[(c * Height2 + y2 + h) * Width2 + x2]);
+      }
+    }
+    return;
+  }
   if (height1 == height2 && width1 == width2) {
     for (int h2 = 0; h2 < height2; ++h2) {
       const int h1 = h2;
@@ -44,40 +78,62 @@ void caffe_cpu_interp2(const int channels,
     }
     return;
   }
-  const float rheight = (height2 > 1) ? static_cast<float>(height1 - 1) / (height2 - 1) : 0.f;
-  const float rwidth = (width2 > 1) ? static_cast<float>(width1 - 1) / (width2 - 1) : 0.f;
-  for (int h2 = 0; h2 < height2; ++h2) {
-    const float h1r = rheight * h2;
-    const int h1 = h1r;
-    const int h1p = (h1 < height1 - 1) ? 1 : 0;
-    const Dtype h1lambda = h1r - h1;
-    const Dtype h0lambda = Dtype(1.) - h1lambda;
-    for (int w2 = 0; w2 < width2; ++w2) {
-      const float w1r = rwidth * w2;
-      const int w1 = w1r;
-      const int w1p = (w1 < width1 - 1) ? 1 : 0;
-      const Dtype w1lambda = w1r - w1;
-      const Dtype w0lambda = Dtype(1.) - w1lambda;
-      if (packed) {
-	const Dtype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
-	Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + (x2 + w2))];
+  // Interpolation taps of every output row and column
+  std::vector<int> h1, h1p, w1, w1p;
+  std::vector<Dtype> h0lambda, h1lambda, w0lambda, w1lambda;
+  interp2_taps(height1, height2, &h1, &h1p, &h0lambda, &h1lambda);
+  interp2_taps(width1, width2, &w1, &w1p, &w0lambda, &w1lambda);
+  if (packed) {
+    // Channels are contiguous: vectorize across them, rows in parallel.
+#ifdef WITH_OPENMP
+#pragma omp parallel for
+#endif
+    for (int h2 = 0; h2 < height2; ++h2) {
+      const Dtype* row0 = &data1[channels * ((y1 + h1[h2]) * Width1 + x1)];
+      const Dtype* row1 = row0 + channels * h1p[h2] * Width1;
+      const Dtype a = h0lambda[h2];
+      const Dtype b = h1lambda[h2];
+      Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + x2)];
+      for (int w2 = 0; w2 < width2; ++w2) {
+	const int off0 = channels * w1[w2];
+	const int off1 = off0 + channels * w1p[w2];
+	const Dtype u = w0lambda[w2];
+	const Dtype v = w1lambda[w2];
 	for (int c = 0; c < channels; ++c) {
-	  pos2[0] =
-	    h0lambda * (w0lambda * pos1[0]            + w1lambda * pos1[channels * w1p]) + 
-	    h1lambda * (w0lambda * pos1[channels * h1p * Width1] + w1lambda * pos1[channels * (h1p * Width1 + w1p)]);
-	  pos1++;
-	  pos2++;
+	  pos2[c] = a * (u * row0[off0 + c] + v * row0[off1 + c]) +
+	    b * (u * row1[off0 + c] + v * row1[off1 + c]);
 	}
+	pos2 += channels;
       }
-      else {
-	const Dtype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
-	Dtype* pos2 = &data2[(y2 + h2) * Width2 + (x2 + w2)];
-	for (int c = 0; c < channels; ++c) {
-	  pos2[0] =
-	    h0lambda * (w0lambda * pos1[0]            + w1lambda * pos1[w1p]) + 
-	    h1lambda * (w0lambda * pos1[h1p * Width1] + w1lambda * pos1[h1p * Width1 + w1p]);
-	  pos1 += Width1 * Height1;
-	  pos2 += Width2 * Height2;
+    }
+    return;
+  }
+  // Planar layout: channels in parallel. Every output row first blends its
+  // two input rows (contiguous, vectorized) and then takes the horizontal
+  // taps from the blended row, which stays in L1.
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<Dtype> row(width1);
+#ifdef WITH_OPENMP
+#pragma omp for
+#endif
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* plane1 = &data1[(c * Height1 + y1) * Width1 + x1];
+      Dtype* plane2 = &data2[(c * Height2 + y2) * Width2 + x2];
+      for (int h2 = 0; h2 < height2; ++h2) {
+	const Dtype* row0 = plane1 + h1[h2] * Width1;
+	const Dtype* row1 = row0 + h1p[h2] * Width1;
+	const Dtype a = h0lambda[h2];
+	const Dtype b = h1lambda[h2];
+	for (int w = 0; w < width1; ++w) {
+	  row[w] = a * row0[w] + b * row1[w];
+	}
+	Dtype* pos2 = plane2 + h2 * Width2;
+	for (int w2 = 0; w2 < width2; ++w2) {
+	  pos2[w2] = w0lambda[w2] * row[w1[w2]] +
+	    w1lambda[w2] * row[w1[w2] + w1p[w2]];
 	}
       }
     }
@@ -120,44 +176,201 @@ void caffe_cpu_interp2_backward(const int channels,
     }
     return;
   }
-  const float rheight = (height2 > 1) ? static_cast<float>(height1 - 1) / (height2 - 1) : 0.f;
-  const float rwidth = (width2 > 1) ? static_cast<float>(width1 - 1) / (width2 - 1) : 0.f;
-  for (int h2 = 0; h2 < height2; ++h2) {
-    const float h1r = rheight * h2;
-    const int h1 = h1r;
-    const int h1p = (h1 < height1 - 1) ? 1 : 0;
-    const Dtype h1lambda = h1r - h1;
-    const Dtype h0lambda = Dtype(1.) - h1lambda;
-    for (int w2 = 0; w2 < width2; ++w2) {
-      const float w1r = rwidth * w2;
-      const int w1 = w1r;
-      const int w1p = (w1 < width1 - 1) ? 1 : 0;
-      const Dtype w1lambda = w1r - w1;
-      const Dtype w0lambda = Dtype(1.) - w1lambda;
-      if (packed) {
-	Dtype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
-	const Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + (x2 + w2))];
+  // Interpolation taps of every output row and column
+  std::vector<int> h1, h1p, w1, w1p;
+  std::vector<Dtype> h0lambda, h1lambda, w0lambda, w1lambda;
+  interp2_taps(height1, height2, &h1, &h1p, &h0lambda, &h1lambda);
+  interp2_taps(width1, width2, &w1, &w1p, &w0lambda, &w1lambda);
+  if (packed) {
+    // Neighboring output rows update the same input rows: rows in sequence,
+    // vectorized across the contiguous channels.
+    for (int h2 = 0; h2 < height2; ++h2) {
+      Dtype* row0 = &data1[channels * ((y1 + h1[h2]) * Width1 + x1)];
+      Dtype* row1 = row0 + channels * h1p[h2] * Width1;
+      const Dtype a = h0lambda[h2];
+      const Dtype b = h1lambda[h2];
+      const Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + x2)];
+      for (int w2 = 0; w2 < width2; ++w2) {
+	const int off0 = channels * w1[w2];
+	const int off1 = off0 + channels * w1p[w2];
+	const Dtype u = w0lambda[w2];
+	const Dtype v = w1lambda[w2];
 	for (int c = 0; c < channels; ++c) {
-	  pos1[0] += h0lambda * w0lambda * pos2[0];
-	  pos1[channels * w1p] += h0lambda * w1lambda * pos2[0];
-	  pos1[channels * h1p * Width1] += h1lambda * w0lambda * pos2[0];
-	  pos1[channels * (h1p * Width1 + w1p)] += h1lambda * w1lambda * pos2[0];
-	  pos1++;
-	  pos2++;
+	  row0[off0 + c] += a * u * pos2[c];
+	  row0[off1 + c] += a * v * pos2[c];
+	  row1[off0 + c] += b * u * pos2[c];
+	  row1[off1 + c] += b * v * pos2[c];
 	}
+	pos2 += channels;
       }
-      else {
-	Dtype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
-	const Dtype* pos2 = &data2[(y2 + h2) * Width2 + (x2 + w2)];
-	for (int c = 0; c < channels; ++c) {
-	  pos1[0] += h0lambda * w0lambda * pos2[0];
-	  pos1[w1p] += h0lambda * w1lambda * pos2[0];
-	  pos1[h1p * Width1] += h1lambda * w0lambda * pos2[0];
-	  pos1[h1p * Width1 + w1p] += h1lambda * w1lambda * pos2[0];
-	  pos1 += Width1 * Height1;
-	  pos2 += Width2 * Height2;
+    }
+    return;
+  }
+  // Planar layout: channels in parallel. The horizontal adjoint of every
+  // output row is gathered into one input-wide row, which is then added to
+  // the two input rows it came from.
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<Dtype> row(width1);
+#ifdef WITH_OPENMP
+#pragma omp for
+#endif
+    for (int c = 0; c < channels; ++c) {
+      Dtype* plane1 = &data1[(c * Height1 + y1) * Width1 + x1];
+      const Dtype* plane2 = &data2[(c * Height2 + y2) * Width2 + x2];
+      for (int h2 = 0; h2 < height2; ++h2) {
+	std::fill(row.begin(), row.end(), Dtype(0));
+	const Dtype* pos2 = plane2 + h2 * Width2;
+	for (int w2 = 0; w2 < width2; ++w2) {
+	  row[w1[w2]] += w0lambda[w2] * pos2[w2];
+	  row[w1[w2] + w1p[w2]] += w1lambda[w2] * pos2[w2];
+	}
+	Dtype* row0 = plane1 + h1[h2] * Width1;
+	Dtype* row1 = row0 + h1p[h2] * Width1;
+	const Dtype a = h0lambda[h2];
+	const Dtype b = h1lambda[h2];
+	for (int w = 0; w < width1; ++w) {
+	  row0[w] += a * row[w];
+	}
+	for (int w = 0; w < width1; ++w) {
+	  row1[w] += b * row[w];
+	}
+      }
+    }
+  }
+}
+
+// Upsamples one row of width1 pixels to (width1 - 1) * zoom + 1 pixels:
+// out[w1 * zoom + k] = a[k] * in[w1] + b[k] * in[w1 + 1].
+template <typename Dtype>
+static inline void zoom_row(const Dtype* in, const int width1, const int zoom,
+    const Dtype* a, const Dtype* b, Dtype* out) {
+  for (int w1 = 0; w1 < width1 - 1; ++w1) {
+    const Dtype p = in[w1];
+    const Dtype q = in[w1 + 1];
+    for (int k = 0; k < zoom; ++k) {
+      out[k] = a[k] * p + b[k] * q;
+    }
+    out += zoom;
+  }
+  out[0] = in[width1 - 1];
+}
+
+// Adjoint of zoom_row (accumulates into in)
+template <typename Dtype>
+static inline void zoom_row_backward(Dtype* in, const int width1,
+    const int zoom, const Dtype* a, const Dtype* b, const Dtype* out) {
+  for (int w1 = 0; w1 < width1 - 1; ++w1) {
+    Dtype p = 0, q = 0;
+    for (int k = 0; k < zoom; ++k) {
+      p += a[k] * out[k];
+      q += b[k] * out[k];
+    }
+    in[w1] += p;
+    in[w1 + 1] += q;
+    out += zoom;
+  }
+  in[width1 - 1] += out[0];
+}
+
+template <typename Dtype>
+void caffe_cpu_zoom2(const int channels,
+    const Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
+    const int zoom, Dtype *data2) {
+  CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && zoom > 0);
+  CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1);
+  const int height2 = (height1 - 1) * zoom + 1;
+  const int width2 = (width1 - 1) * zoom + 1;
+  // The weights of the zoom output pixels between two input pixels
+  std::vector<Dtype> a(zoom), b(zoom);
+  for (int k = 0; k < zoom; ++k) {
+    b[k] = static_cast<Dtype>(k) / zoom;
+    a[k] = Dtype(1.) - b[k];
+  }
+  // Horizontal pass into two rolling rows, vertical pass from them straight
+  // into the output, zoom rows for every pair of input rows.
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<Dtype> rows(2 * width2);
+#ifdef WITH_OPENMP
+#pragma omp for
+#endif
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* plane1 = &data1[(c * Height1 + y1) * Width1 + x1];
+      Dtype* pos2 = &data2[c * height2 * width2];
+      Dtype* row0 = &rows[0];
+      Dtype* row1 = &rows[width2];
+      zoom_row(plane1, width1, zoom, &a[0], &b[0], row0);
+      for (int h1 = 0; h1 < height1 - 1; ++h1) {
+	zoom_row(plane1 + (h1 + 1) * Width1, width1, zoom, &a[0], &b[0], row1);
+	for (int k = 0; k < zoom; ++k) {
+	  const Dtype u = a[k];
+	  const Dtype v = b[k];
+	  for (int w2 = 0; w2 < width2; ++w2) {
+	    pos2[w2] = u * row0[w2] + v * row1[w2];
+	  }
+	  pos2 += width2;
 	}
+	std::swap(row0, row1);
       }
+      std::copy(row0, row0 + width2, pos2);
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_zoom2_backward(const int channels,
+    Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
+    const int zoom, const Dtype *data2) {
+  CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && zoom > 0);
+  CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1);
+  const int height2 = (height1 - 1) * zoom + 1;
+  const int width2 = (width1 - 1) * zoom + 1;
+  std::vector<Dtype> a(zoom), b(zoom);
+  for (int k = 0; k < zoom; ++k) {
+    b[k] = static_cast<Dtype>(k) / zoom;
+    a[k] = Dtype(1.) - b[k];
+  }
+  // Vertical adjoint into two rolling rows; every completed row goes
+  // through the horizontal adjoint into its input row.
+#ifdef WITH_OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<Dtype> rows(2 * width2);
+#ifdef WITH_OPENMP
+#pragma omp for
+#endif
+    for (int c = 0; c < channels; ++c) {
+      Dtype* plane1 = &data1[(c * Height1 + y1) * Width1 + x1];
+      const Dtype* pos2 = &data2[c * height2 * width2];
+      Dtype* row0 = &rows[0];
+      Dtype* row1 = &rows[width2];
+      std::fill(row0, row0 + width2, Dtype(0));
+      for (int h1 = 0; h1 < height1 - 1; ++h1) {
+	std::fill(row1, row1 + width2, Dtype(0));
+	for (int k = 0; k < zoom; ++k) {
+	  const Dtype u = a[k];
+	  const Dtype v = b[k];
+	  for (int w2 = 0; w2 < width2; ++w2) {
+	    row0[w2] += u * pos2[w2];
+	    row1[w2] += v * pos2[w2];
+	  }
+	  pos2 += width2;
+	}
+	zoom_row_backward(plane1 + h1 * Width1, width1, zoom, &a[0], &b[0],
+	    row0);
+	std::swap(row0, row1);
+      }
+      for (int w2 = 0; w2 < width2; ++w2) {
+	row0[w2] += pos2[w2];
+      }
+      zoom_row_backward(plane1 + (height1 - 1) * Width1, width1, zoom,
+	  &a[0], &b[0], row0);
     }
   }
 }
@@ -290,7 +503,15 @@ template void caffe_cpu_interp2<double,false>(const int, const double *, const i
 template void caffe_cpu_interp2<double,true>(const int, const double *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int);
 
 template void caffe_cpu_interp2_backward<float,false>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<float,true>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int);
 template void caffe_cpu_interp2_backward<double,false>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<double,true>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int);
+
+template void caffe_cpu_zoom2<float>(const int, const float *, const int, const int, const int, const int, const int, const int, const int, float *);
+template void caffe_cpu_zoom2<double>(const int, const double *, const int, const int, const int, const int, const int, const int, const int, double *);
+
+template void caffe_cpu_zoom2_backward<float>(const int, float *, const int, const int, const int, const int, const int, const int, const int, const float *);
+template void caffe_cpu_zoom2_backward<double>(const int, double *, const int, const int, const int, const int, const int, const int, const int, const double *);
 
 template void caffe_cpu_pyramid2<float,false>(const int, const float *, const int, const int, float *, const int);
 template void caffe_cpu_pyramid2<float,true>(const int, const float *, const int, const int, float *, const int);
@@ -9,6 +9,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <cstring>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -93,6 +94,65 @@ cv::Mat ReadImageToCVMat(const string& filename,
   return cv_img;
 }
 
+bool ReadImageSize(const string& filename, int* height, int* width) {
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  unsigned char header[24];
+  if (!file.read(reinterpret_cast<char*>(header), 2)) {
+    return false;
+  }
+  if (header[0] == 0x89 && header[1] == 'P') {
+    // PNG: the signature, then the IHDR chunk, which starts with the width
+    // and the height.
+    if (!file.read(reinterpret_cast<char*>(header + 2), 22) ||
+        memcmp(header + 12, "IHDR", 4) != 0) {
+      return false;
+    }
+    *width = header[16] << 24 | header[17] << 16 | header[18] << 8 |
+        header[19];
+    *height = header[20] << 24 | header[21] << 16 | header[22] << 8 |
+        header[23];
+    return *height > 0 && *width > 0;
+  }
+  if (header[0] == 0xFF && header[1] == 0xD8) {
+    // JPEG: skip the segments up to the start of frame, which holds the
+    // precision, the height and the width.
+    while (true) {
+      if (file.get() != 0xFF) {
+        return false;
+      }
+      int marker;
+      do {
+        marker = file.get();
+      } while (marker == 0xFF);
+      if (marker == EOF) {
+        return false;
+      }
+      if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+        // Markers without a segment.
+        continue;
+      }
+      if (!file.read(reinterpret_cast<char*>(header), 2)) {
+        return false;
+      }
+      const int length = header[0] << 8 | header[1];
+      if (length < 2) {
+        return false;
+      }
+      if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+          marker != 0xC8 && marker != 0xCC) {
+        if (!file.read(reinterpret_cast<char*>(header), 5)) {
+          return false;
+        }
+        *height = header[1] << 8 | header[2];
+        *width = header[3] << 8 | header[4];
+        return *height > 0 && *width > 0;
+      }
+      file.seekg(length - 2, std::ios::cur);
+    }
+  }
+  return false;
+}
+
 bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, const bool is_color, Datum* datum) {
   cv::Mat cv_img = ReadImageToCVMat(filename, height, width, is_color);
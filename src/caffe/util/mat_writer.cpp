@@ -0,0 +1,184 @@
+#include <boost/thread.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/mat_writer.hpp"
+
+#include "matio.h"
+
+namespace caffe {
+
+size_t MatWriteJob::elem_size(const ElemType type) {
+  switch (type) {
+  case SINGLE:
+    return sizeof(float);
+  case DOUBLE:
+    return sizeof(double);
+  case HALF:
+    return sizeof(unsigned short);
+  case UINT8:
+    return sizeof(unsigned char);
+  default:
+    LOG(FATAL) << "Unknown element type " << type;
+  }
+  return 0;
+}
+
+void MatWriteJob::Reshape(const ElemType type, const int num,
+    const int channels, const int height, const int width) {
+  this->type = type;
+  this->num = num;
+  this->channels = channels;
+  this->height = height;
+  this->width = width;
+  // The buffer keeps its capacity from file to file.
+  buffer.resize(count() * elem_size(type));
+}
+
+class MatWriter::Workers {
+ public:
+  boost::thread_group threads_;
+};
+
+MatWriter::MatWriter(const int threads, const int max_pending)
+    : workers_(new Workers()) {
+  CHECK_GE(threads, 0);
+  CHECK_GT(max_pending, 0);
+  for (int i = 0; i < max_pending; ++i) {
+    jobs_.push_back(shared_ptr<MatWriteJob>(new MatWriteJob()));
+    free_.push(jobs_.back().get());
+  }
+  for (int i = 0; i < threads; ++i) {
+    workers_->threads_.add_thread(
+        new boost::thread(&MatWriter::WorkerEntry, this));
+  }
+}
+
+MatWriter::~MatWriter() {
+  // A NULL job stops a worker once the jobs queued before it are saved.
+  for (int i = 0; i < workers_->threads_.size(); ++i) {
+    full_.push(NULL);
+  }
+  workers_->threads_.join_all();
+}
+
+MatWriteJob* MatWriter::Get() {
+  return free_.pop("Waiting for MAT files to be saved");
+}
+
+void MatWriter::Write(MatWriteJob* job) {
+  if (workers_->threads_.size() == 0) {
+    Save(*job);
+    free_.push(job);
+  } else {
+    full_.push(job);
+  }
+}
+
+void MatWriter::WorkerEntry() {
+  while (true) {
+    MatWriteJob* job = full_.pop();
+    if (job == NULL) {
+      return;
+    }
+    Save(*job);
+    free_.push(job);
+  }
+}
+
+void MatWriter::Save(const MatWriteJob& job) {
+  matio_classes class_type;
+  matio_types data_type;
+  switch (job.type) {
+  case MatWriteJob::SINGLE:
+    class_type = MAT_C_SINGLE;
+    data_type = MAT_T_SINGLE;
+    break;
+  case MatWriteJob::DOUBLE:
+    class_type = MAT_C_DOUBLE;
+    data_type = MAT_T_DOUBLE;
+    break;
+  case MatWriteJob::HALF:
+    class_type = MAT_C_UINT16;
+    data_type = MAT_T_UINT16;
+    break;
+  case MatWriteJob::UINT8:
+    class_type = MAT_C_UINT8;
+    data_type = MAT_T_UINT8;
+    break;
+  default:
+    LOG(FATAL) << "Unknown element type " << job.type;
+  }
+  CHECK_EQ(job.buffer.size(), job.count() * MatWriteJob::elem_size(job.type));
+  // The file is saved aside and renamed once complete, so that a reader
+  // (e.g. a MAT_READ layer waiting for it) never sees it half written.
+  const string part_filename = job.filename + ".part";
+  mat_t *matfp = Mat_Create(part_filename.c_str(), 0);
+  CHECK(matfp) << "Error creating MAT file " << part_filename;
+  size_t dims[4];
+  dims[0] = job.width; dims[1] = job.height;
+  dims[2] = job.channels; dims[3] = job.num;
+  // The variable points into the buffer rather than copying it.
+  matvar_t *matvar = Mat_VarCreate("data", class_type, data_type, 4, dims,
+      const_cast<char*>(job.buffer.data()), MAT_F_DONT_COPY_DATA);
+  CHECK(matvar) << "Error creating 'data' variable";
+  CHECK_EQ(Mat_VarWrite(matfp, matvar, MAT_COMPRESSION_NONE), 0)
+      << "Error saving array 'data' into MAT file " << job.filename;
+  Mat_VarFree(matvar);
+  Mat_Close(matfp);
+  CHECK_EQ(std::rename(part_filename.c_str(), job.filename.c_str()), 0)
+      << "Error renaming " << part_filename << " to " << job.filename;
+}
+
+unsigned short FloatToHalf(const float value) {
+  unsigned int bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const unsigned short sign = (bits >> 16) & 0x8000;
+  const unsigned int magnitude = bits & 0x7fffffff;
+  if (magnitude >= 0x7f800000) {
+    // Inf, or a quiet NaN.
+    return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+  }
+  if (magnitude >= 0x477ff000) {
+    // Rounds beyond the largest half, 65504.
+    return sign | 0x7c00;
+  }
+  if (magnitude < 0x38800000) {
+    // A subnormal half, in units of 2^-24. The scaling is exact, and
+    // nearbyint rounds to nearest even.
+    float abs_value;
+    memcpy(&abs_value, &magnitude, sizeof(abs_value));
+    return sign | static_cast<unsigned short>(
+        nearbyintf(abs_value * 16777216.f));
+  }
+  // Round the mantissa to nearest even, then rebias the exponent from 127
+  // to 15. A carry out of the mantissa correctly bumps the exponent.
+  const unsigned int rounded = magnitude + 0xfff + ((magnitude >> 13) & 1);
+  return sign | static_cast<unsigned short>((rounded - 0x38000000) >> 13);
+}
+
+float HalfToFloat(const unsigned short half) {
+  const unsigned int sign = (half & 0x8000) << 16;
+  const unsigned int exponent = (half >> 10) & 0x1f;
+  const unsigned int mantissa = half & 0x3ff;
+  if (exponent == 0) {
+    const float value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -value : value;
+  }
+  unsigned int bits;
+  if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+}  // namespace caffe
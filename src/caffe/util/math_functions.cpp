@@ -1,6 +1,7 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
 #include <limits>
 
 #include "caffe/common.hpp"
@@ -310,6 +311,82 @@ void caffe_exp<double>(const int n, const double* a, double* y) {
   vdExp(n, a, y);
 }
 
+template <typename Dtype>
+void caffe_cpu_channel_softmax(const int channels, const int spatial_dim,
+    const int size, const Dtype* x, Dtype* y) {
+  // Positions are handled in chunks whose channels all stay in cache through
+  // the max, exp-sum and normalization passes.
+  const int kChunk = 512;
+  Dtype max_data[kChunk];
+  Dtype sum_data[kChunk];
+  for (int k0 = 0; k0 < size; k0 += kChunk) {
+    const int n = std::min(kChunk, size - k0);
+    const Dtype* x0 = x + k0;
+    Dtype* y0 = y + k0;
+    std::copy(x0, x0 + n, max_data);
+    for (int c = 1; c < channels; ++c) {
+      const Dtype* xc = x0 + c * spatial_dim;
+      for (int k = 0; k < n; ++k) {
+        max_data[k] = std::max(max_data[k], xc[k]);
+      }
+    }
+    std::fill(sum_data, sum_data + n, Dtype(0));
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* xc = x0 + c * spatial_dim;
+      Dtype* yc = y0 + c * spatial_dim;
+      for (int k = 0; k < n; ++k) {
+        yc[k] = xc[k] - max_data[k];
+      }
+      caffe_exp<Dtype>(n, yc, yc);
+      for (int k = 0; k < n; ++k) {
+        sum_data[k] += yc[k];
+      }
+    }
+    for (int k = 0; k < n; ++k) {
+      sum_data[k] = Dtype(1) / sum_data[k];
+    }
+    for (int c = 0; c < channels; ++c) {
+      Dtype* yc = y0 + c * spatial_dim;
+      for (int k = 0; k < n; ++k) {
+        yc[k] *= sum_data[k];
+      }
+    }
+  }
+}
+
+template
+void caffe_cpu_channel_softmax<float>(const int channels,
+    const int spatial_dim, const int size, const float* x, float* y);
+template
+void caffe_cpu_channel_softmax<double>(const int channels,
+    const int spatial_dim, const int size, const double* x, double* y);
+
+template <typename Dtype>
+void caffe_cpu_channel_argmax(const int channels, const int spatial_dim,
+    const int size, const Dtype* x, int* argmax, Dtype* max_val) {
+  // Running maximum over contiguous channel planes; the compare and selects
+  // of the inner loop vectorize.
+  std::copy(x, x + size, max_val);
+  std::fill(argmax, argmax + size, 0);
+  for (int c = 1; c < channels; ++c) {
+    const Dtype* xc = x + c * spatial_dim;
+    for (int k = 0; k < size; ++k) {
+      const bool greater = xc[k] >= max_val[k];
+      max_val[k] = greater ? xc[k] : max_val[k];
+      argmax[k] = greater ? c : argmax[k];
+    }
+  }
+}
+
+template
+void caffe_cpu_channel_argmax<float>(const int channels,
+    const int spatial_dim, const int size, const float* x, int* argmax,
+    float* max_val);
+template
+void caffe_cpu_channel_argmax<double>(const int channels,
+    const int spatial_dim, const int size, const double* x, int* argmax,
+    double* max_val);
+
 template <>
 void caffe_abs<float>(const int n, const float* a, float* y) {
     vsAbs(n, a, y);
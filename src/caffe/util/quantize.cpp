@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/util/quantize.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void caffe_cpu_quantize_weights(const int rows, const int cols,
+    const Dtype* w, int8_t* q, Dtype* scale, int* row_sum) {
+  for (int r = 0; r < rows; ++r) {
+    const Dtype* w_row = w + r * cols;
+    int8_t* q_row = q + r * cols;
+    Dtype max_abs = 0;
+    for (int c = 0; c < cols; ++c) {
+      max_abs = std::max(max_abs, Dtype(std::fabs(w_row[c])));
+    }
+    scale[r] = (max_abs > 0) ? max_abs / Dtype(127) : Dtype(1);
+    int sum = 0;
+    for (int c = 0; c < cols; ++c) {
+      int v = static_cast<int>(std::floor(w_row[c] / scale[r] + Dtype(0.5)));
+      v = std::min(127, std::max(-127, v));
+      q_row[c] = static_cast<int8_t>(v);
+      sum += v;
+    }
+    if (row_sum) {
+      row_sum[r] = sum;
+    }
+  }
+}
+
+template void caffe_cpu_quantize_weights<float>(const int rows,
+    const int cols, const float* w, int8_t* q, float* scale, int* row_sum);
+template void caffe_cpu_quantize_weights<double>(const int rows,
+    const int cols, const double* w, int8_t* q, double* scale, int* row_sum);
+
+template <typename Dtype>
+void caffe_cpu_quantize_range(const int n, const Dtype* x,
+    Dtype* scale, int* zero_point) {
+  Dtype min_val = 0, max_val = 0;
+  for (int i = 0; i < n; ++i) {
+    min_val = std::min(min_val, x[i]);
+    max_val = std::max(max_val, x[i]);
+  }
+  *scale = (max_val > min_val) ? (max_val - min_val) / Dtype(255) : Dtype(1);
+  *zero_point = std::min(255, std::max(0,
+      static_cast<int>(std::floor(-min_val / *scale + Dtype(0.5)))));
+}
+
+template void caffe_cpu_quantize_range<float>(const int n, const float* x,
+    float* scale, int* zero_point);
+template void caffe_cpu_quantize_range<double>(const int n, const double* x,
+    double* scale, int* zero_point);
+
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    const int zero_point, uint8_t* q) {
+  const Dtype inv_scale = Dtype(1) / scale;
+  const Dtype offset = Dtype(zero_point) + Dtype(0.5);
+  for (int i = 0; i < n; ++i) {
+    const Dtype v = std::min(Dtype(255),
+        std::max(Dtype(0), x[i] * inv_scale + offset));
+    q[i] = static_cast<uint8_t>(v);
+  }
+}
+
+template void caffe_cpu_quantize<float>(const int n, const float* x,
+    const float scale, const int zero_point, uint8_t* q);
+template void caffe_cpu_quantize<double>(const int n, const double* x,
+    const double scale, const int zero_point, uint8_t* q);
+
+void caffe_cpu_gemm_s8u8s32(const CBLAS_TRANSPOSE TransB,
+    const int M, const int N, const int K,
+    const int8_t* A, const uint8_t* B, int32_t* C) {
+  if (TransB == CblasTrans) {
+    // B is N x K: every output is a dot product of two contiguous rows.
+    for (int m = 0; m < M; ++m) {
+      const int8_t* a = A + m * K;
+      for (int n = 0; n < N; ++n) {
+        const uint8_t* b = B + n * K;
+        int32_t acc = 0;
+        for (int k = 0; k < K; ++k) {
+          acc += static_cast<int32_t>(a[k]) * static_cast<int32_t>(b[k]);
+        }
+        C[m * N + n] = acc;
+      }
+    }
+    return;
+  }
+  // B is K x N: accumulate rank-1 updates along contiguous rows of B and C,
+  // in column blocks so that the block of C stays in cache over all of K.
+  const int kBlockN = 256;
+  for (int n0 = 0; n0 < N; n0 += kBlockN) {
+    const int block_n = std::min(kBlockN, N - n0);
+    for (int m = 0; m < M; ++m) {
+      int32_t* c = C + m * N + n0;
+      std::fill(c, c + block_n, 0);
+      const int8_t* a = A + m * K;
+      for (int k = 0; k < K; ++k) {
+        const int32_t a_mk = a[k];
+        if (a_mk == 0) {
+          continue;
+        }
+        const uint8_t* b = B + k * N + n0;
+        for (int n = 0; n < block_n; ++n) {
+          c[n] += a_mk * static_cast<int32_t>(b[n]);
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void QuantizeBlobToProto(const Blob<Dtype>& blob, const int rows,
+    BlobProto* proto) {
+  CHECK_GT(rows, 0);
+  CHECK_EQ(blob.count() % rows, 0)
+      << "Blob cannot be split into " << rows << " rows.";
+  const int cols = blob.count() / rows;
+  std::vector<int8_t> q(blob.count());
+  std::vector<Dtype> scale(rows);
+  caffe_cpu_quantize_weights(rows, cols, blob.cpu_data(), &q[0], &scale[0],
+      static_cast<int*>(NULL));
+  proto->set_num(blob.num());
+  proto->set_channels(blob.channels());
+  proto->set_height(blob.height());
+  proto->set_width(blob.width());
+  proto->clear_data();
+  proto->clear_diff();
+  proto->set_int8_data(reinterpret_cast<const char*>(&q[0]), q.size());
+  proto->clear_int8_scale();
+  for (int r = 0; r < rows; ++r) {
+    proto->add_int8_scale(scale[r]);
+  }
+}
+
+template void QuantizeBlobToProto<float>(const Blob<float>& blob,
+    const int rows, BlobProto* proto);
+template void QuantizeBlobToProto<double>(const Blob<double>& blob,
+    const int rows, BlobProto* proto);
+
+template <typename Dtype>
+Int8Gemm<Dtype>::Int8Gemm(const QuantizationParameter& param)
+    : has_input_scale_(param.has_input_scale()),
+      input_scale_(param.input_scale()),
+      input_zero_point_(param.input_zero_point()),
+      rows_(0), cols_(0), weight_version_(0) {
+  CHECK(!has_input_scale_ || input_scale_ > 0)
+      << "input_scale must be positive.";
+  CHECK_LE(input_zero_point_, 255) << "input_zero_point must fit in uint8.";
+}
+
+template <typename Dtype>
+void Int8Gemm<Dtype>::SetWeights(const int rows, const int cols,
+    const Dtype* weight) {
+  rows_ = rows;
+  cols_ = cols;
+  weight_.resize(rows * cols);
+  weight_scale_.resize(rows);
+  weight_sum_.resize(rows);
+  caffe_cpu_quantize_weights(rows, cols, weight, &weight_[0],
+      &weight_scale_[0], &weight_sum_[0]);
+  weight_memory_.reset();
+}
+
+template <typename Dtype>
+void Int8Gemm<Dtype>::UpdateWeights(const int rows, const int cols,
+    const Blob<Dtype>& weights) {
+  CHECK_EQ(rows * cols, weights.count());
+  const shared_ptr<SyncedMemory>& memory = weights.data();
+  if (initialized() && rows == rows_ && cols == cols_ &&
+      memory == weight_memory_ && memory->version() == weight_version_) {
+    return;
+  }
+  SetWeights(rows, cols, weights.cpu_data());
+  // Read after cpu_data(), which may sync but does not count as a change.
+  weight_memory_ = memory;
+  weight_version_ = memory->version();
+}
+
+template <typename Dtype>
+void Int8Gemm<Dtype>::Forward(const int row_begin, const int M, const int N,
+    const Dtype* in, const bool trans_in, const Dtype* bias,
+    Dtype* out, const bool trans_out) {
+  CHECK(initialized()) << "SetWeights must be called before Forward.";
+  CHECK_LE(row_begin + M, rows_);
+  const int K = cols_;
+  Dtype in_scale = input_scale_;
+  int zero_point = input_zero_point_;
+  if (!has_input_scale_) {
+    caffe_cpu_quantize_range(K * N, in, &in_scale, &zero_point);
+  }
+  input_.resize(K * N);
+  output_.resize(M * N);
+  caffe_cpu_quantize(K * N, in, in_scale, zero_point, &input_[0]);
+  caffe_cpu_gemm_s8u8s32(trans_in ? CblasTrans : CblasNoTrans, M, N, K,
+      &weight_[row_begin * K], &input_[0], &output_[0]);
+  // Requantize: sum_k w_q (x_q - zp) = acc - zp * sum_k w_q.
+  for (int m = 0; m < M; ++m) {
+    const Dtype scale = weight_scale_[row_begin + m] * in_scale;
+    const int32_t offset = zero_point * weight_sum_[row_begin + m];
+    const Dtype b = bias ? bias[m] : Dtype(0);
+    const int32_t* acc = &output_[m * N];
+    if (trans_out) {
+      for (int n = 0; n < N; ++n) {
+        out[n * M + m] = scale * (acc[n] - offset) + b;
+      }
+    } else {
+      Dtype* out_row = out + m * N;
+      for (int n = 0; n < N; ++n) {
+        out_row[n] = scale * (acc[n] - offset) + b;
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(Int8Gemm);
+
+}  // namespace caffe
@@ -0,0 +1,385 @@
+#include <fcntl.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/seg_pack.hpp"
+
+namespace caffe {
+
+static const char kSegPackMagic[8] = {'S', 'E', 'G', 'P', 'A', 'C', 'K', '1'};
+static const size_t kSegPackHeaderSize = 8 + 2 * sizeof(uint64_t);
+
+bool SegPackWriter::Open(const string& filename) {
+  Close();
+  offsets_.clear();
+  file_ = fopen(filename.c_str(), "wb");
+  if (file_ == NULL) {
+    LOG(ERROR) << "Could not open " << filename;
+    return false;
+  }
+  // The header is written by Close, once the index offset is known.
+  char header[kSegPackHeaderSize];
+  memset(header, 0, kSegPackHeaderSize);
+  pos_ = kSegPackHeaderSize;
+  return fwrite(header, 1, kSegPackHeaderSize, file_) == kSegPackHeaderSize;
+}
+
+bool SegPackWriter::Add(const SegDatum& datum) {
+  CHECK(file_) << "SegPackWriter is not open";
+  string buffer;
+  datum.SerializeToString(&buffer);
+  offsets_.push_back(pos_);
+  pos_ += buffer.size();
+  return fwrite(buffer.data(), 1, buffer.size(), file_) == buffer.size();
+}
+
+bool SegPackWriter::Close() {
+  if (file_ == NULL) {
+    return true;
+  }
+  const uint64_t num_records = offsets_.size();
+  // The index is aligned so that the reader can use it in place.
+  const char padding[sizeof(uint64_t)] = {0};
+  const size_t padding_size = (sizeof(uint64_t) - pos_ % sizeof(uint64_t)) %
+      sizeof(uint64_t);
+  bool ok = fwrite(padding, 1, padding_size, file_) == padding_size;
+  const uint64_t index_offset = pos_ + padding_size;
+  offsets_.push_back(pos_);
+  ok = ok && fwrite(&offsets_[0], sizeof(uint64_t), offsets_.size(), file_)
+      == offsets_.size();
+  offsets_.pop_back();
+  ok = ok && fseek(file_, 0, SEEK_SET) == 0;
+  ok = ok && fwrite(kSegPackMagic, 1, 8, file_) == 8;
+  ok = ok && fwrite(&num_records, sizeof(uint64_t), 1, file_) == 1;
+  ok = ok && fwrite(&index_offset, sizeof(uint64_t), 1, file_) == 1;
+  ok = (fclose(file_) == 0) && ok;
+  file_ = NULL;
+  return ok;
+}
+
+bool SegPackReader::Open(const string& filename, const bool readahead) {
+  Close();
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Could not open " << filename;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < kSegPackHeaderSize) {
+    LOG(ERROR) << filename << " is not a seg pack";
+    close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(ERROR) << "Could not map " << filename;
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  size_ = st.st_size;
+  uint64_t num_records, index_offset;
+  memcpy(&num_records, data_ + 8, sizeof(uint64_t));
+  memcpy(&index_offset, data_ + 8 + sizeof(uint64_t), sizeof(uint64_t));
+  // The index fills the end of the file, written as is by SegPackWriter.
+  if (memcmp(data_, kSegPackMagic, 8) != 0 ||
+      index_offset < kSegPackHeaderSize || index_offset > size_ ||
+      index_offset % sizeof(uint64_t) != 0 ||
+      (size_ - index_offset) / sizeof(uint64_t) != num_records + 1 ||
+      (size_ - index_offset) % sizeof(uint64_t) != 0 ||
+      num_records > INT_MAX) {
+    LOG(ERROR) << filename << " is not a seg pack";
+    Close();
+    return false;
+  }
+  // The records must lie in order between the header and the index, so that
+  // Read never looks outside the mapping.
+  const uint64_t* index =
+      reinterpret_cast<const uint64_t*>(data_ + index_offset);
+  for (uint64_t i = 0; i <= num_records; ++i) {
+    if (index[i] < (i == 0 ? kSegPackHeaderSize : index[i - 1]) ||
+        index[i] > index_offset) {
+      LOG(ERROR) << filename << " has a corrupt index at record " << i;
+      Close();
+      return false;
+    }
+  }
+  num_records_ = num_records;
+  index_ = index;
+  readahead_ = readahead;
+  if (!readahead_) {
+    madvise(const_cast<char*>(data_), size_, MADV_RANDOM);
+  }
+  return true;
+}
+
+void SegPackReader::Close() {
+  if (data_ != NULL) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  num_records_ = 0;
+  index_ = NULL;
+}
+
+void SegPackReader::WillNeed(const int i) const {
+  if (!readahead_) {
+    return;
+  }
+  CHECK_GE(i, 0);
+  CHECK_LT(i, num_records_);
+  // madvise wants a page-aligned address.
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t begin = index_[i] / page_size * page_size;
+  madvise(const_cast<char*>(data_) + begin, index_[i + 1] - begin,
+      MADV_WILLNEED);
+}
+
+bool SegPackReader::Read(const int i, SegDatum* datum) const {
+  CHECK_GE(i, 0);
+  CHECK_LT(i, num_records_);
+  return datum->ParseFromArray(data_ + index_[i], index_[i + 1] - index_[i]);
+}
+
+bool SegPackReader::Read(const int i, SegDatumView* view) const {
+  CHECK_GE(i, 0);
+  CHECK_LT(i, num_records_);
+  return ParseSegDatumView(data_ + index_[i], index_[i + 1] - index_[i],
+      view);
+}
+
+// Reads a base 128 varint at *pos, not past end.
+static bool ReadVarint(const uint8_t** pos, const uint8_t* end,
+    uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+    const uint8_t byte = *(*pos)++;
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ParseSegDatumView(const char* data, const size_t size,
+    SegDatumView* view) {
+  *view = SegDatumView();
+  const uint8_t* pos = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* const end = pos + size;
+  while (pos < end) {
+    uint64_t tag;
+    if (!ReadVarint(&pos, end, &tag) || (tag >> 3) == 0) {
+      return false;
+    }
+    const uint64_t field = tag >> 3;
+    uint64_t value;
+    switch (tag & 7) {
+    case 0:  // varint
+      if (!ReadVarint(&pos, end, &value)) {
+        return false;
+      }
+      if (field == SegDatum::kChannelsFieldNumber) {
+        view->channels = static_cast<int>(value);
+      } else if (field == SegDatum::kHeightFieldNumber) {
+        view->height = static_cast<int>(value);
+      } else if (field == SegDatum::kWidthFieldNumber) {
+        view->width = static_cast<int>(value);
+      } else if (field == SegDatum::kEncodedFieldNumber) {
+        view->encoded = value != 0;
+      }
+      break;
+    case 1:  // 64-bit
+      if (end - pos < 8) {
+        return false;
+      }
+      pos += 8;
+      break;
+    case 2:  // length-delimited
+      if (!ReadVarint(&pos, end, &value) ||
+          value > static_cast<uint64_t>(end - pos)) {
+        return false;
+      }
+      // The bytes are left where they are, only pointed at.
+      if (field == SegDatum::kImageFieldNumber) {
+        view->image = reinterpret_cast<const char*>(pos);
+        view->image_size = value;
+      } else if (field == SegDatum::kLabelFieldNumber && value > 0) {
+        view->label = reinterpret_cast<const char*>(pos);
+        view->label_size = value;
+      }
+      pos += value;
+      break;
+    case 5:  // 32-bit
+      if (end - pos < 4) {
+        return false;
+      }
+      pos += 4;
+      break;
+    default:  // groups, which SegDatum does not have, or garbage
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ReadFileToString(const string& filename, string* buffer) {
+  std::ifstream file(filename.c_str(),
+      std::ios::in | std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  const std::streampos size = file.tellg();
+  buffer->resize(size);
+  file.seekg(0, std::ios::beg);
+  file.read(&(*buffer)[0], size);
+  return file.good();
+}
+
+// Appends the pixels of cv_img to buffer, row by row.
+static void CVMatToString(const cv::Mat& cv_img, string* buffer) {
+  CHECK(cv_img.depth() == CV_8U) << "Image data type must be unsigned byte";
+  const size_t row_size = cv_img.cols * cv_img.channels();
+  buffer->resize(cv_img.rows * row_size);
+  for (int h = 0; h < cv_img.rows; ++h) {
+    memcpy(&(*buffer)[h * row_size], cv_img.ptr<uchar>(h), row_size);
+  }
+}
+
+bool ReadImgAndSegToSegDatum(const string& img_filename,
+    const string& seg_filename, const int height, const int width,
+    const bool is_color, const bool encoded, SegDatum* datum) {
+  datum->Clear();
+  // The image is decoded even when encoded, to record its size.
+  cv::Mat cv_img = ReadImageToCVMat(img_filename, height, width, is_color);
+  if (!cv_img.data) {
+    return false;
+  }
+  datum->set_channels(cv_img.channels());
+  datum->set_height(cv_img.rows);
+  datum->set_width(cv_img.cols);
+  datum->set_encoded(encoded);
+  if (encoded) {
+    if (!ReadFileToString(img_filename, datum->mutable_image())) {
+      return false;
+    }
+    if (!seg_filename.empty() &&
+        !ReadFileToString(seg_filename, datum->mutable_label())) {
+      LOG(ERROR) << "Could not open or find file " << seg_filename;
+      return false;
+    }
+    return true;
+  }
+  CVMatToString(cv_img, datum->mutable_image());
+  if (!seg_filename.empty()) {
+    cv::Mat cv_seg = ReadImageToCVMat(seg_filename, false);
+    if (!cv_seg.data) {
+      return false;
+    }
+    if (cv_seg.rows != cv_img.rows || cv_seg.cols != cv_img.cols) {
+      cv::resize(cv_seg, cv_seg, cv::Size(cv_img.cols, cv_img.rows), 0, 0,
+          cv::INTER_NEAREST);
+    }
+    CVMatToString(cv_seg, datum->mutable_label());
+  }
+  return true;
+}
+
+// Decodes or wraps one image of a SegDatum, without copying raw pixels.
+static cv::Mat SegDatumImageToCVMat(const SegDatumView& view,
+    const char* data, const size_t size, const int channels,
+    const int cv_read_flag) {
+  if (view.encoded) {
+    return cv::imdecode(cv::Mat(1, size, CV_8UC1, const_cast<char*>(data)),
+        cv_read_flag);
+  }
+  CHECK_EQ(size, view.height * view.width * channels)
+      << "Incorrect data field size " << size;
+  return cv::Mat(view.height, view.width, CV_MAKETYPE(CV_8U, channels),
+      const_cast<char*>(data));
+}
+
+bool DecodeSegDatumToCVMat(const SegDatumView& view, const int height,
+    const int width, const bool is_color, cv::Mat* cv_img, cv::Mat* cv_seg) {
+  const bool resize = height > 0 && width > 0;
+  cv::Mat cv_img_origin = SegDatumImageToCVMat(view, view.image,
+      view.image_size, view.channels, is_color ? CV_LOAD_IMAGE_COLOR :
+      CV_LOAD_IMAGE_GRAYSCALE);
+  if (!cv_img_origin.data) {
+    LOG(ERROR) << "Could not decode seg datum";
+    return false;
+  }
+  if (!view.encoded && (cv_img_origin.channels() == 3) != is_color) {
+    LOG(ERROR) << "Seg datum has " << cv_img_origin.channels()
+        << " channels, is_color is " << is_color;
+    return false;
+  }
+  if (resize) {
+    cv::resize(cv_img_origin, *cv_img, cv::Size(width, height));
+  } else {
+    *cv_img = cv_img_origin;
+  }
+  *cv_seg = cv::Mat();
+  if (view.label == NULL) {
+    return true;
+  }
+  cv::Mat cv_seg_origin = SegDatumImageToCVMat(view, view.label,
+      view.label_size, 1, CV_LOAD_IMAGE_GRAYSCALE);
+  if (!cv_seg_origin.data) {
+    LOG(ERROR) << "Could not decode seg datum label";
+    return false;
+  }
+  if (cv_seg_origin.rows != cv_img->rows ||
+      cv_seg_origin.cols != cv_img->cols) {
+    cv::resize(cv_seg_origin, *cv_seg, cv::Size(cv_img->cols, cv_img->rows),
+        0, 0, cv::INTER_NEAREST);
+  } else {
+    *cv_seg = cv_seg_origin;
+  }
+  return true;
+}
+
+bool DecodeSegDatumToCVMat(const SegDatum& datum, const int height,
+    const int width, const bool is_color, cv::Mat* cv_img, cv::Mat* cv_seg) {
+  SegDatumView view;
+  view.channels = datum.channels();
+  view.height = datum.height();
+  view.width = datum.width();
+  view.encoded = datum.encoded();
+  view.image = datum.image().data();
+  view.image_size = datum.image().size();
+  if (!datum.label().empty()) {
+    view.label = datum.label().data();
+    view.label_size = datum.label().size();
+  }
+  if (!DecodeSegDatumToCVMat(view, height, width, is_color, cv_img, cv_seg)) {
+    return false;
+  }
+  // Raw pixels that were not resized still point into datum.
+  if (cv_img->data == reinterpret_cast<const uchar*>(view.image)) {
+    *cv_img = cv_img->clone();
+  }
+  if (cv_seg->data &&
+      cv_seg->data == reinterpret_cast<const uchar*>(view.label)) {
+    *cv_seg = cv_seg->clone();
+  }
+  return true;
+}
+
+}  // namespace caffe
@@ -0,0 +1,96 @@
+#include <boost/thread.hpp>
+
+#include "caffe/common.hpp"
+#include "caffe/util/worker_pool.hpp"
+
+namespace caffe {
+
+class WorkerPool::Workers {
+ public:
+  Workers() : task_(NULL), count_(0), next_(0), running_(0), loop_(0),
+      stop_(false) {}
+
+  // Runs the iterations left in the current loop, unlocking around each.
+  void RunIterations(boost::mutex::scoped_lock* lock) {
+    while (next_ < count_) {
+      const int i = next_++;
+      lock->unlock();
+      (*task_)(i);
+      lock->lock();
+    }
+  }
+
+  boost::thread_group threads_;
+  boost::mutex mutex_;
+  // Signaled on a new loop and on stop.
+  boost::condition_variable start_;
+  // Signaled when the last background thread leaves a loop.
+  boost::condition_variable done_;
+  const boost::function<void(int)>* task_;
+  int count_;
+  // The next iteration to run.
+  int next_;
+  // The background threads inside the current loop.
+  int running_;
+  // Counts the loops, so that a thread runs each of them once.
+  unsigned int loop_;
+  bool stop_;
+};
+
+WorkerPool::WorkerPool(const int threads)
+    : threads_(threads), workers_(new Workers()) {
+  CHECK_GT(threads, 0);
+  for (int i = 1; i < threads; ++i) {
+    workers_->threads_.add_thread(
+        new boost::thread(&WorkerPool::WorkerEntry, this));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    boost::mutex::scoped_lock lock(workers_->mutex_);
+    workers_->stop_ = true;
+  }
+  workers_->start_.notify_all();
+  workers_->threads_.join_all();
+}
+
+void WorkerPool::Run(const int count,
+    const boost::function<void(int)>& task) {
+  // The tasks may use the stack of the caller, which must not unwind while
+  // a background thread still runs one.
+  boost::this_thread::disable_interruption no_interruption;
+  boost::mutex::scoped_lock lock(workers_->mutex_);
+  workers_->task_ = &task;
+  workers_->count_ = count;
+  workers_->next_ = 0;
+  ++workers_->loop_;
+  workers_->start_.notify_all();
+  workers_->RunIterations(&lock);
+  while (workers_->running_ > 0) {
+    workers_->done_.wait(lock);
+  }
+  workers_->task_ = NULL;
+}
+
+void WorkerPool::WorkerEntry() {
+  boost::mutex::scoped_lock lock(workers_->mutex_);
+  // A loop started before this thread got here is joined late.
+  unsigned int loop = 0;
+  while (true) {
+    while (!workers_->stop_ && loop == workers_->loop_) {
+      workers_->start_.wait(lock);
+    }
+    if (workers_->stop_) {
+      return;
+    }
+    loop = workers_->loop_;
+    ++workers_->running_;
+    workers_->RunIterations(&lock);
+    if (--workers_->running_ == 0) {
+      workers_->done_.notify_all();
+    }
+  }
+}
+
+}  // namespace caffe
@@ -1,11 +1,14 @@
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <map>
 #include <string>
 #include <vector>
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
@@ -30,6 +33,8 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_string(out_weights, "",
     "Optional; the file where to dump weights.");
+DEFINE_string(out_model, "",
+    "Optional; the file where to dump the model definition.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
 
@@ -302,6 +307,98 @@ int save() {
 }
 RegisterBrewFunction(save);
 
+// Quantize: calibrate int8 inference for the convolution and inner product
+// layers by running the model over its (calibration) data, and save the
+// weights in int8 together with the calibrated input ranges.
+int quantize() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to calibrate.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to quantize.";
+  CHECK_GT(FLAGS_out_weights.size(), 0)
+      << "Give filename where to save the quantized weights.";
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  Caffe::set_phase(Caffe::TEST);
+  Net<float> caffe_net(FLAGS_model);
+  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+
+  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
+  vector<vector<Blob<float>*> >& bottom_vecs = caffe_net.bottom_vecs();
+  vector<bool> quantized(layers.size(), false);
+  for (int i = 0; i < layers.size(); ++i) {
+    const caffe::LayerParameter_LayerType type = layers[i]->type();
+    quantized[i] = (type == caffe::LayerParameter_LayerType_CONVOLUTION ||
+        type == caffe::LayerParameter_LayerType_INNER_PRODUCT);
+  }
+  // Track the range of the input of every quantized layer. The layers run
+  // one at a time so that in-place layers cannot alter a recorded input.
+  vector<float> min_val(layers.size(), 0), max_val(layers.size(), 0);
+  LOG(INFO) << "Calibrating for " << FLAGS_iterations << " iterations.";
+  for (int iter = 0; iter < FLAGS_iterations; ++iter) {
+    for (int i = 0; i < layers.size(); ++i) {
+      if (quantized[i]) {
+        const Blob<float>* bottom = bottom_vecs[i][0];
+        const float* data = bottom->cpu_data();
+        for (int k = 0; k < bottom->count(); ++k) {
+          min_val[i] = std::min(min_val[i], data[k]);
+          max_val[i] = std::max(max_val[i], data[k]);
+        }
+      }
+      caffe_net.ForwardFromTo(i, i);
+    }
+  }
+  NetParameter net_param;
+  caffe_net.ToProto(&net_param);
+  NetParameter model_param;
+  if (FLAGS_out_model.size()) {
+    caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &model_param);
+  }
+  for (int i = 0; i < layers.size(); ++i) {
+    if (!quantized[i]) {
+      continue;
+    }
+    caffe::QuantizationParameter quant_param;
+    quant_param.set_precision(caffe::QuantizationParameter_Precision_INT8);
+    const float range = max_val[i] - min_val[i];
+    const float scale = (range > 0) ? range / 255 : 1;
+    quant_param.set_input_scale(scale);
+    quant_param.set_input_zero_point(std::min(255, std::max(0,
+        static_cast<int>(std::floor(-min_val[i] / scale + 0.5)))));
+    const caffe::string& layer_name = caffe_net.layer_names()[i];
+    LOG(INFO) << layer_name << ": input range [" << min_val[i] << ", "
+        << max_val[i] << "], scale " << quant_param.input_scale()
+        << ", zero point " << quant_param.input_zero_point();
+    caffe::LayerParameter* layer_param = net_param.mutable_layers(i);
+    layer_param->mutable_quantization_param()->CopyFrom(quant_param);
+    // One weight scale per output channel.
+    const int num_output =
+        (layers[i]->type() == caffe::LayerParameter_LayerType_CONVOLUTION) ?
+        layer_param->convolution_param().num_output() :
+        layer_param->inner_product_param().num_output();
+    caffe::QuantizeBlobToProto(*layers[i]->blobs()[0], num_output,
+        layer_param->mutable_blobs(0));
+    for (int j = 0; j < model_param.layers_size(); ++j) {
+      if (model_param.layers(j).name() == layer_name) {
+        model_param.mutable_layers(j)->mutable_quantization_param()->CopyFrom(
+            quant_param);
+      }
+    }
+  }
+  LOG(INFO) << "Saving quantized weights to " << FLAGS_out_weights;
+  WriteProtoToBinaryFile(net_param, FLAGS_out_weights.c_str());
+  if (FLAGS_out_model.size()) {
+    LOG(INFO) << "Saving quantized model definition to " << FLAGS_out_model;
+    WriteProtoToTextFile(model_param, FLAGS_out_model.c_str());
+  }
+  return 0;
+}
+RegisterBrewFunction(quantize);
+
 int main(int argc, char** argv) {
   // Print output to stderr (while still logging).
   FLAGS_alsologtostderr = 1;
@@ -313,7 +410,8 @@ int main(int argc, char** argv) {
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
       "  time            benchmark model execution time\n"
-      "  save            load and save model");
+      "  save            load and save model\n"
+      "  quantize        calibrate and save an int8 model");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
   if (argc == 2) {
@@ -0,0 +1,147 @@
+// This program converts a segmentation dataset to SegDatum records, in a
+// single seg pack file as read by the SEG_PACK_DATA layer, or in an lmdb or
+// leveldb as read by the SEG_DATA layer.
+// Usage:
+//   convert_segset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME
+//
+// where ROOTFOLDER is the root folder that holds all the images and label
+// maps, and LISTFILE should be a list of images and their label maps, in the
+// format of ImageSegDataLayer
+//   subfolder1/file1.jpg subfolder2/file1.png
+//   ....
+// A line without a label map gives an unlabeled record.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/dataset_factory.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/seg_pack.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_bool(gray, false,
+    "When this option is on, treat images as grayscale ones");
+DEFINE_bool(shuffle, false,
+    "Randomly shuffle the order of the samples");
+DEFINE_string(backend, "pack",
+    "The backend for storing the result: pack, lmdb or leveldb");
+DEFINE_int32(resize_width, 0, "Width images are resized to");
+DEFINE_int32(resize_height, 0, "Height images are resized to");
+DEFINE_bool(encoded, false,
+    "When this option is on, the image and label files are stored as they "
+    "are, instead of their pixels");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Convert a segmentation dataset to a seg pack\n"
+        "file (SEG_PACK_DATA layer) or to an lmdb or leveldb (SEG_DATA).\n"
+        "Usage:\n"
+        "    convert_segset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 4) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_segset");
+    return 1;
+  }
+
+  const bool is_color = !FLAGS_gray;
+  const bool encoded = FLAGS_encoded;
+
+  std::ifstream infile(argv[2]);
+  std::vector<std::pair<std::string, std::string> > lines;
+  std::string linestr;
+  while (std::getline(infile, linestr)) {
+    std::istringstream iss(linestr);
+    std::string imgfn, segfn;
+    if (!(iss >> imgfn)) {
+      continue;
+    }
+    iss >> segfn;
+    lines.push_back(std::make_pair(imgfn, segfn));
+  }
+  if (FLAGS_shuffle) {
+    // randomly shuffle data
+    LOG(INFO) << "Shuffling data";
+    shuffle(lines.begin(), lines.end());
+  }
+  LOG(INFO) << "A total of " << lines.size() << " images.";
+
+  if (encoded) {
+    CHECK_EQ(FLAGS_resize_height, 0) << "With encoded don't resize images";
+    CHECK_EQ(FLAGS_resize_width, 0) << "With encoded don't resize images";
+  }
+
+  int resize_height = std::max<int>(0, FLAGS_resize_height);
+  int resize_width = std::max<int>(0, FLAGS_resize_width);
+
+  const std::string& db_backend = FLAGS_backend;
+  const char* db_path = argv[3];
+  const bool pack = db_backend == "pack";
+
+  // Open new db
+  SegPackWriter writer;
+  shared_ptr<Dataset<string, string> > dataset;
+  if (pack) {
+    CHECK(writer.Open(db_path)) << "Could not create " << db_path;
+  } else {
+    dataset = DatasetFactory<string, string>(db_backend);
+    CHECK(dataset->open(db_path, Dataset<string, string>::New));
+  }
+
+  // Storing to db
+  std::string root_folder(argv[1]);
+  SegDatum datum;
+  int count = 0;
+  const int kMaxKeyLength = 256;
+  char key_cstr[kMaxKeyLength];
+
+  for (int line_id = 0; line_id < lines.size(); ++line_id) {
+    const std::string seg_filename = lines[line_id].second.empty() ?
+        std::string() : root_folder + lines[line_id].second;
+    if (!ReadImgAndSegToSegDatum(root_folder + lines[line_id].first,
+        seg_filename, resize_height, resize_width, is_color, encoded,
+        &datum)) {
+      LOG(ERROR) << "Skipping " << lines[line_id].first;
+      continue;
+    }
+    if (pack) {
+      CHECK(writer.Add(datum)) << "Could not write to " << db_path;
+    } else {
+      // sequential
+      int length = snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
+          lines[line_id].first.c_str());
+      CHECK(dataset->put(string(key_cstr, length), datum.SerializeAsString()));
+    }
+    if (++count % 1000 == 0) {
+      // Commit txn
+      if (!pack) {
+        CHECK(dataset->commit());
+      }
+      LOG(ERROR) << "Processed " << count << " files.";
+    }
+  }
+  // write the last batch
+  if (pack) {
+    CHECK(writer.Close()) << "Could not write to " << db_path;
+  } else {
+    CHECK(dataset->commit());
+    dataset->close();
+  }
+  LOG(ERROR) << "Processed " << count << " files.";
+  return 0;
+}
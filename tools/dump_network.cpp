@@ -41,6 +41,8 @@ int main(int argc, char** argv) {
     caffe_net.reset(new Net<float>(argv[1]));
   }
   caffe_net->CopyTrainedLayersFrom(argv[2]);
+  // Every blob is dumped, so none may share memory.
+  caffe_net->UnplanMemory();
 
   std::vector<Blob<float>* > input_vec;
   shared_ptr<Blob<float> > input_blob(new Blob<float>());
@@ -117,6 +117,9 @@ int feature_extraction_pipeline(int argc, char** argv) {
     CHECK(feature_extraction_net->has_blob(blob_names[i]))
         << "Unknown feature blob name " << blob_names[i]
         << " in the network " << feature_extraction_proto;
+    // Request the blobs before the forward passes, so that a net planning
+    // its memory keeps them.
+    feature_extraction_net->blob_by_name(blob_names[i]);
   }
 
   int num_mini_batches = atoi(argv[++arg_pos]);